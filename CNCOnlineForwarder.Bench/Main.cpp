@@ -0,0 +1,520 @@
+#include <precompiled.hpp>
+#include <benchmark/benchmark.h>
+#include <Admin/AdminServer.hpp>
+#include <Logging/Logging.hpp>
+#include <NatNeg/NatNegPacket.hpp>
+#include <TCPProxy/TCPProxy.hpp>
+#include <Utility/Defer.hpp>
+#include <Utility/HTTPClient.hpp>
+#include <Utility/PendingActions.hpp>
+#include <Utility/ProxyAddressTranslator.hpp>
+#include <Utility/WeakRefHandler.hpp>
+
+// Microbenchmarks of the primitives on the hot path of the forwarder.
+// Results can be saved in a machine readable format, to be compared across versions:
+//      CNCOnlineForwarder.Bench --benchmark_out=results.json --benchmark_out_format=json
+// and then compared with tools/compare.py from Google Benchmark.
+// Logging benchmarks write into the log file of the current directory.
+
+namespace NatNeg = CNCOnlineForwarder::NatNeg;
+namespace Utility = CNCOnlineForwarder::Utility;
+namespace Logging = CNCOnlineForwarder::Logging;
+
+namespace
+{
+    std::string makeNatNegPacket(NatNeg::NatNegStep const step, std::size_t const size)
+    {
+        auto packet = std::string{ NatNeg::natNegMagic };
+        packet.push_back(3); // version
+        packet.push_back(static_cast<char>(step));
+        auto const natNegID = NatNeg::NatNegID{ 0x12345678 };
+        packet.append(reinterpret_cast<char const*>(&natNegID), sizeof(natNegID));
+        packet.resize(size, '\0');
+        return packet;
+    }
+
+    struct BenchmarkTarget : std::enable_shared_from_this<BenchmarkTarget>
+    {
+        static constexpr auto description = "BenchmarkTarget";
+
+        std::uint64_t calls = 0;
+    };
+
+    class PromisedValue
+    {
+    public:
+        using ActionType = std::function<void(std::uint64_t)>;
+
+    private:
+        std::optional<std::uint64_t> m_value;
+
+    public:
+        static constexpr auto description = "Bench.promisedValue";
+
+        void setValue(std::uint64_t const value) { m_value = value; }
+
+        template<typename Action>
+        void apply(Action&& action) { action(m_value.value()); }
+
+        bool isReady() const noexcept { return m_value.has_value(); }
+    };
+
+    struct StrandHandler
+    {
+        static constexpr auto description = "Bench.strand";
+    };
+
+    // Sends back everything it receives, on its own thread
+    class EchoServer
+    {
+    private:
+        using TCP = boost::asio::ip::tcp;
+
+        struct Connection
+        {
+            TCP::socket socket;
+            std::array<char, 64 * 1024> buffer{};
+        };
+
+        boost::asio::io_context m_context;
+        TCP::acceptor m_acceptor;
+        std::thread m_thread;
+
+    public:
+        EchoServer() :
+            m_context{},
+            m_acceptor{ m_context, { boost::asio::ip::address_v4::loopback(), 0 } },
+            m_thread{}
+        {
+            accept();
+            m_thread = std::thread{ [this] { m_context.run(); } };
+        }
+
+        ~EchoServer()
+        {
+            m_context.stop();
+            m_thread.join();
+        }
+
+        std::uint16_t getPort() const
+        {
+            return m_acceptor.local_endpoint().port();
+        }
+
+    private:
+        void accept()
+        {
+            m_acceptor.async_accept([this](boost::system::error_code const& code, TCP::socket socket)
+            {
+                if (code.failed())
+                {
+                    return;
+                }
+                socket.set_option(TCP::no_delay{ true });
+                echo(std::make_shared<Connection>(Connection{ std::move(socket) }));
+                accept();
+            });
+        }
+
+        static void echo(std::shared_ptr<Connection> const& connection)
+        {
+            connection->socket.async_read_some
+            (
+                boost::asio::buffer(connection->buffer),
+                [connection](boost::system::error_code const& code, std::size_t const bytesReceived)
+                {
+                    if (code.failed())
+                    {
+                        return;
+                    }
+                    boost::asio::async_write
+                    (
+                        connection->socket,
+                        boost::asio::buffer(connection->buffer.data(), bytesReceived),
+                        [connection](boost::system::error_code const& code, std::size_t const)
+                        {
+                            if (!code.failed())
+                            {
+                                echo(connection);
+                            }
+                        }
+                    );
+                }
+            );
+        }
+    };
+
+    // TCPProxy relays with splice(), which needs the process to ignore SIGPIPE like CNCOnlineForwarder.Exe does
+    void ignoreSigPipe()
+    {
+#ifdef __linux__
+        ::signal(SIGPIPE, SIG_IGN);
+#endif
+    }
+}
+
+static void natNegIsNatNeg(benchmark::State& state)
+{
+    // Game packets are checked too, and they are far more frequent than NatNeg packets
+    auto const packet = (state.range(0) != 0)
+        ? makeNatNegPacket(NatNeg::NatNegStep::init, 21)
+        : std::string(64, 'x');
+    for (auto _ : state)
+    {
+        auto const view = NatNeg::NatNegPacketView{ packet };
+        benchmark::DoNotOptimize(view.isNatNeg());
+    }
+}
+BENCHMARK(natNegIsNatNeg)->ArgName("natNeg")->Arg(1)->Arg(0);
+
+static void natNegGetNatNegPlayerID(benchmark::State& state)
+{
+    auto const packet = makeNatNegPacket(NatNeg::NatNegStep::init, 21);
+    for (auto _ : state)
+    {
+        auto const view = NatNeg::NatNegPacketView{ packet };
+        benchmark::DoNotOptimize(view.getNatNegPlayerID());
+    }
+}
+BENCHMARK(natNegGetNatNegPlayerID);
+
+static void natNegParseAddress(benchmark::State& state)
+{
+    auto const packet = makeNatNegPacket(NatNeg::NatNegStep::connect, 20);
+    for (auto _ : state)
+    {
+        auto const view = NatNeg::NatNegPacketView{ packet };
+        auto const offset = NatNeg::NatNegPacketView::getAddressOffset(view.getStep());
+        benchmark::DoNotOptimize(NatNeg::parseAddress(view.getView(), offset.value()));
+    }
+}
+BENCHMARK(natNegParseAddress);
+
+static void natNegRewriteAddress(benchmark::State& state)
+{
+    auto packet = makeNatNegPacket(NatNeg::NatNegStep::connect, 20);
+    auto const offset = NatNeg::NatNegPacketView::getAddressOffset(NatNeg::NatNegStep::connect).value();
+    auto const ip = std::array<std::uint8_t, 4>{ 192, 168, 1, 2 };
+    auto port = std::uint16_t{ 0 };
+    for (auto _ : state)
+    {
+        NatNeg::rewriteAddress(packet, offset, ip, ++port);
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(natNegRewriteAddress);
+
+static void natNegPlayerIDHash(benchmark::State& state)
+{
+    auto id = NatNeg::NatNegPlayerID{ 0x12345678, 0 };
+    auto const hash = NatNeg::NatNegPlayerID::Hash{};
+    for (auto _ : state)
+    {
+        ++id.natNegID;
+        benchmark::DoNotOptimize(hash(id));
+    }
+}
+BENCHMARK(natNegPlayerIDHash);
+
+static void weakRefHandlerDispatch(benchmark::State& state)
+{
+    auto const target = std::make_shared<BenchmarkTarget>();
+    auto handler = Utility::makeWeakHandler(target.get(), [](BenchmarkTarget& self, std::size_t const bytes)
+    {
+        self.calls += bytes;
+    });
+    for (auto _ : state)
+    {
+        handler(std::size_t{ 1 });
+    }
+    benchmark::DoNotOptimize(target->calls);
+}
+BENCHMARK(weakRefHandlerDispatch);
+
+static void pendingActionsAsyncDoReady(benchmark::State& state)
+{
+    auto sum = std::uint64_t{ 0 };
+    auto actions = Utility::PendingActions<PromisedValue>{ PromisedValue{} };
+    actions->setValue(1);
+    actions.trySetReady();
+    for (auto _ : state)
+    {
+        actions.asyncDo([&sum](std::uint64_t const value) { sum += value; });
+    }
+    benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(pendingActionsAsyncDoReady);
+
+// Actions queued while the data is not ready yet, then applied all at once
+static void pendingActionsAsyncDoQueued(benchmark::State& state)
+{
+    auto const batch = state.range(0);
+    auto sum = std::uint64_t{ 0 };
+    for (auto _ : state)
+    {
+        auto actions = Utility::PendingActions<PromisedValue>{ PromisedValue{} };
+        for (auto i = std::int64_t{ 0 }; i < batch; ++i)
+        {
+            actions.asyncDo([&sum](std::uint64_t const value) { sum += value; });
+        }
+        actions->setValue(1);
+        actions.trySetReady();
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(pendingActionsAsyncDoQueued)->ArgName("batch")->Arg(1)->Arg(16);
+
+// The default filter level is info
+static void logLineFiltered(benchmark::State& state)
+{
+    auto const natNegID = NatNeg::NatNegID{ 0x12345678 };
+    for (auto _ : state)
+    {
+        Logging::logLine<BenchmarkTarget>(Logging::Level::debug, "Filtered line, natNegID ", natNegID);
+    }
+}
+BENCHMARK(logLineFiltered);
+
+static void logLineEnabled(benchmark::State& state)
+{
+    auto const natNegID = NatNeg::NatNegID{ 0x12345678 };
+    for (auto _ : state)
+    {
+        Logging::logLine<BenchmarkTarget>(Logging::Level::info, "Benchmark line, natNegID ", natNegID);
+    }
+}
+BENCHMARK(logLineEnabled);
+
+// Handler deferred to a strand run by another thread, until it has been executed
+static void strandDeferRoundTrip(benchmark::State& state)
+{
+    auto context = boost::asio::io_context{};
+    auto work = boost::asio::make_work_guard(context);
+    auto const strand = boost::asio::make_strand(context);
+    auto worker = std::thread{ [&context] { context.run(); } };
+
+    auto executed = std::atomic<std::uint64_t>{ 0 };
+    auto expected = std::uint64_t{ 0 };
+    for (auto _ : state)
+    {
+        Utility::defer<StrandHandler>(strand, [&executed] { executed.fetch_add(1, std::memory_order_release); });
+        ++expected;
+        while (executed.load(std::memory_order_acquire) != expected)
+        {
+        }
+    }
+
+    work.reset();
+    worker.join();
+}
+BENCHMARK(strandDeferRoundTrip)->UseRealTime();
+
+// Same, but the strand is run by the benchmark thread, so it's only the cost of queueing and dispatching
+static void strandDeferPoll(benchmark::State& state)
+{
+    auto context = boost::asio::io_context{};
+    auto const strand = boost::asio::make_strand(context);
+    auto executed = std::uint64_t{ 0 };
+    for (auto _ : state)
+    {
+        Utility::defer<StrandHandler>(strand, [&executed] { ++executed; });
+        context.poll();
+        context.restart();
+    }
+    benchmark::DoNotOptimize(executed);
+}
+BENCHMARK(strandDeferPoll);
+
+// Every connect relayed to a client is translated, by whichever thread handles it
+static void proxyAddressTranslatorLocalToPublic(benchmark::State& state)
+{
+    static auto const ioManager = CNCOnlineForwarder::IOManager::create();
+    static auto const translator = Utility::ProxyAddressTranslator::create
+    (
+        CNCOnlineForwarder::IOManager::ObjectMaker{ ioManager },
+        boost::asio::ip::make_address_v4("203.0.113.1")
+    );
+    auto endPoint = boost::asio::ip::udp::endpoint{ boost::asio::ip::address_v4::loopback(), 0 };
+    for (auto _ : state)
+    {
+        endPoint.port(static_cast<std::uint16_t>(endPoint.port() + 1));
+        benchmark::DoNotOptimize(translator->localToPublic(endPoint));
+    }
+}
+BENCHMARK(proxyAddressTranslatorLocalToPublic)->ThreadRange(1, 8)->UseRealTime();
+
+// GETs to a local server through the pooled client, a batch of concurrent requests at a time.
+// With distinct targets they are spread on the connections and pipelined, otherwise they are coalesced.
+static void httpClientGet(benchmark::State& state)
+{
+    using CNCOnlineForwarder::IOManager;
+    using CNCOnlineForwarder::Admin::AdminServer;
+    using CNCOnlineForwarder::Admin::AdminResponse;
+
+    auto const batch = static_cast<std::size_t>(state.range(0));
+    auto const distinct = state.range(1) != 0;
+
+    auto const ioManager = IOManager::create();
+    auto const objectMaker = IOManager::ObjectMaker{ ioManager };
+    auto port = std::uint16_t{};
+    {
+        auto probe = boost::asio::ip::tcp::acceptor{ boost::asio::system_executor{}, { boost::asio::ip::address_v4::loopback(), 0 } };
+        port = probe.local_endpoint().port();
+    }
+    auto const server = AdminServer::create(objectMaker, { boost::asio::ip::address_v4::loopback(), port });
+    server->addRoute("/value", [](auto const&, auto respond) { respond(AdminResponse{ 200, "text/plain", "203.0.113.1" }); });
+    auto const client = Utility::HTTPClient::create(objectMaker, Utility::HTTPClient::Options{});
+    auto worker = std::thread{ [&ioManager] { ioManager->run(); } };
+
+    auto completed = std::atomic<std::uint64_t>{ 0 };
+    auto expected = std::uint64_t{ 0 };
+    auto failed = std::atomic<std::uint64_t>{ 0 };
+    for (auto _ : state)
+    {
+        for (auto i = std::size_t{ 0 }; i < batch; ++i)
+        {
+            auto get = Utility::HTTPClient::Get{ "127.0.0.1", port, "/value?i=" + std::to_string(distinct ? i : 0), {} };
+            client->asyncGet(std::move(get), [&completed, &failed](auto const& code, auto const&)
+            {
+                if (code.failed())
+                {
+                    failed.fetch_add(1, std::memory_order_relaxed);
+                }
+                completed.fetch_add(1, std::memory_order_release);
+            });
+        }
+        expected += batch;
+        while (completed.load(std::memory_order_acquire) != expected)
+        {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(expected));
+    state.counters["failed"] = static_cast<double>(failed.load());
+    // Process-wide, so it includes the previous runs
+    state.counters["connections"] = static_cast<double>(CNCOnlineForwarder::Diagnostics::MetricsRegistry::get().counter("http.connections").get());
+
+    ioManager->stop();
+    worker.join();
+}
+BENCHMARK(httpClientGet)->ArgNames({ "batch", "distinct" })->Args({ 1, 1 })->Args({ 16, 1 })->Args({ 16, 0 })->UseRealTime();
+
+// Round trips of a message to a local echo server: directly (relay 0), through TCPProxy with splice() (relay 1),
+// or through TCPProxy copying (relay 2). Small messages measure the latency added by the relay,
+// large ones its throughput (both directions are counted).
+static void tcpProxyEcho(benchmark::State& state)
+{
+    using CNCOnlineForwarder::IOManager;
+    using CNCOnlineForwarder::TCPProxy::RelayMode;
+    using CNCOnlineForwarder::TCPProxy::TCPProxy;
+    using TCP = boost::asio::ip::tcp;
+
+    ignoreSigPipe();
+    auto const relay = state.range(0);
+    auto const size = static_cast<std::size_t>(state.range(1));
+
+    auto const echoServer = std::make_unique<EchoServer>();
+    auto const ioManager = IOManager::create();
+    auto const objectMaker = IOManager::ObjectMaker{ ioManager };
+    auto options = TCPProxy::Options{};
+    options.localEndPoint = { boost::asio::ip::address_v4::loopback(), 0 };
+    options.serverHost = "127.0.0.1";
+    options.serverPort = echoServer->getPort();
+    options.mode = (relay == 1) ? RelayMode::automatic : RelayMode::copy;
+    auto const proxy = (relay == 0) ? nullptr : TCPProxy::create(objectMaker, options);
+    auto const port = proxy ? proxy->getLocalPort() : echoServer->getPort();
+    auto worker = std::thread{ [&ioManager] { ioManager->run(); } };
+
+    auto context = boost::asio::io_context{};
+    auto client = TCP::socket{ context };
+    client.connect({ boost::asio::ip::address_v4::loopback(), port });
+    client.set_option(TCP::no_delay{ true });
+    auto const message = std::string(size, 'x');
+    auto echoed = std::string(size, '\0');
+    for (auto _ : state)
+    {
+        boost::asio::write(client, boost::asio::buffer(message));
+        boost::asio::read(client, boost::asio::buffer(echoed));
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * size * 2));
+    // Process-wide, so it includes the previous runs
+    auto& metrics = CNCOnlineForwarder::Diagnostics::MetricsRegistry::get();
+    state.counters["splicedBytes"] = static_cast<double>(metrics.counter("tcpProxy.splicedBytes").get());
+    state.counters["copiedBytes"] = static_cast<double>(metrics.counter("tcpProxy.copiedBytes").get());
+
+    client.close();
+    ioManager->stop();
+    worker.join();
+}
+BENCHMARK(tcpProxyEcho)->ArgNames({ "relay", "bytes" })->ArgsProduct({ { 0, 1, 2 }, { 64, 64 * 1024 } })->UseRealTime();
+
+// Reconnect storm: 8 clients each open 32 connections to TCPProxy at once, then check each one with a round trip
+// and reset it. Measures connections set up per second with 1 or 4 acceptors (SO_REUSEPORT), 4 threads running the proxy.
+static void tcpProxyReconnectStorm(benchmark::State& state)
+{
+    using CNCOnlineForwarder::IOManager;
+    using CNCOnlineForwarder::TCPProxy::TCPProxy;
+    using TCP = boost::asio::ip::tcp;
+
+    constexpr auto clients = 8;
+    constexpr auto connectionsPerClient = 32;
+
+    ignoreSigPipe();
+    auto const echoServer = std::make_unique<EchoServer>();
+    auto const ioManager = IOManager::create();
+    auto const objectMaker = IOManager::ObjectMaker{ ioManager };
+    auto options = TCPProxy::Options{};
+    options.localEndPoint = { boost::asio::ip::address_v4::loopback(), 0 };
+    options.serverHost = "127.0.0.1";
+    options.serverPort = echoServer->getPort();
+    options.acceptors = static_cast<std::size_t>(state.range(0));
+    auto const proxy = TCPProxy::create(objectMaker, options);
+    auto const proxyEndPoint = TCP::endpoint{ boost::asio::ip::address_v4::loopback(), proxy->getLocalPort() };
+    auto workers = std::vector<std::thread>{};
+    for (auto i = 0; i < 4; ++i)
+    {
+        workers.emplace_back([&ioManager] { ioManager->run(); });
+    }
+
+    auto const reconnect = [&proxyEndPoint]
+    {
+        auto context = boost::asio::io_context{};
+        auto sockets = std::vector<TCP::socket>{};
+        for (auto i = 0; i < connectionsPerClient; ++i)
+        {
+            auto& socket = sockets.emplace_back(context);
+            socket.connect(proxyEndPoint);
+            // Closed with a reset, so the ports are not kept in TIME_WAIT
+            socket.set_option(boost::asio::socket_base::linger{ true, 0 });
+        }
+        auto byte = char{ 'x' };
+        for (auto& socket : sockets)
+        {
+            boost::asio::write(socket, boost::asio::buffer(&byte, 1));
+            boost::asio::read(socket, boost::asio::buffer(&byte, 1));
+        }
+    };
+    for (auto _ : state)
+    {
+        auto storm = std::vector<std::future<void>>{};
+        for (auto i = 0; i < clients; ++i)
+        {
+            storm.push_back(std::async(std::launch::async, reconnect));
+        }
+        for (auto& client : storm)
+        {
+            client.get();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * clients * connectionsPerClient);
+
+    ioManager->stop();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+BENCHMARK(tcpProxyReconnectStorm)->ArgName("acceptors")->Arg(1)->Arg(4)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -1,17 +1,345 @@
 #include <IOManager.hpp>
+#include <Admin/AdminServer.hpp>
+#include <Admin/DiagnosticsRoutes.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
+#include <Diagnostics/EventLoopMonitor.hpp>
+#include <Diagnostics/MetricsHistory.hpp>
+#include <Diagnostics/MetricsReporter.hpp>
+#include <Diagnostics/PacketCapture.hpp>
+#include <Diagnostics/SessionEventStream.hpp>
+#include <Diagnostics/SharedStatsPublisher.hpp>
+#include <Diagnostics/Tracing.hpp>
+#include <HTTPProxy/HTTPProxy.hpp>
 #include <NatNeg/NatNegProxy.hpp>
 #include <Logging/Logging.hpp>
+#include <TCPProxy/TCPProxy.hpp>
+#include <Utility/NetworkImpairment.hpp>
+#include <Utility/ParseNumber.hpp>
 #include <Utility/WeakRefHandler.hpp>
+#include <iostream>
 
 using CNCOnlineForwarder::IOManager;
+using CNCOnlineForwarder::Admin::AdminServer;
+using CNCOnlineForwarder::Admin::addDiagnosticsRoutes;
+using CNCOnlineForwarder::Admin::addHistoryRoute;
+using CNCOnlineForwarder::Diagnostics::AllocationTracker;
+using CNCOnlineForwarder::Diagnostics::EventLoopMonitor;
+using CNCOnlineForwarder::Diagnostics::MetricsHistory;
+using CNCOnlineForwarder::Diagnostics::MetricsReporter;
+using CNCOnlineForwarder::Diagnostics::PacketCapture;
+using CNCOnlineForwarder::Diagnostics::SessionEventStream;
+using CNCOnlineForwarder::Diagnostics::SharedStatsPublisher;
+using CNCOnlineForwarder::Diagnostics::Tracer;
+using CNCOnlineForwarder::HTTPProxy::HTTPProxy;
 using CNCOnlineForwarder::Logging::logLine;
 using CNCOnlineForwarder::Logging::Level;
 using CNCOnlineForwarder::NatNeg::NatNegProxy;
+using CNCOnlineForwarder::Peerchat::PeerchatConnection;
+using CNCOnlineForwarder::TCPProxy::RelayMode;
+using CNCOnlineForwarder::TCPProxy::TCPProxy;
 using CNCOnlineForwarder::Utility::makeWeakHandler;
+using CNCOnlineForwarder::Utility::NetworkImpairment;
+using CNCOnlineForwarder::Utility::parseNumber;
+using CNCOnlineForwarder::Utility::parsePort;
 using CNCOnlineForwarder::Utility::ProxyAddressTranslator;
+using CNCOnlineForwarder::Utility::PublicAddressDiscovery;
 
 using ErrorCode = boost::system::error_code;
 using SignalSet = boost::asio::signal_set;
+using AddressV4 = boost::asio::ip::address_v4;
+
+struct Options
+{
+    std::string natNegServer{ "natneg.server.cnc-online.net" };
+    std::uint16_t natNegServerPort = 27901;
+    // Port on which players send their NatNeg packets
+    std::uint16_t natNegPort = 27901;
+    // If not set, it will be discovered periodically with publicAddressSources
+    std::optional<AddressV4> publicAddress;
+    // The defaults of PublicAddressDiscovery if empty
+    std::vector<PublicAddressDiscovery::Source> publicAddressSources;
+    // For benchmarks only, degrades the datagrams sent by the forwarder
+    std::vector<NetworkImpairment::Rule> impairments;
+    // Datagrams of NatNegProxy and GameConnection are written to a pcapng file if set
+    std::optional<PacketCapture::Options> capture;
+    // Reverse proxy of the HTTP server of C&C:Online, enabled by --http-proxy-port
+    std::optional<HTTPProxy::Options> httpProxy;
+    // Relay of the peerchat (IRC) server of C&C:Online, enabled by --peerchat-port
+    std::optional<std::uint16_t> peerchatPort;
+    std::string peerchatServer{ "peerchat.server.cnc-online.net" };
+    std::uint16_t peerchatServerPort = 6667;
+    // Decrypts the peerchat connections to answer the lobby queries from a cache
+    bool peerchatLobbyCache = false;
+    PeerchatConnection::Options peerchat;
+    // Listening sockets sharing the peerchat port, one per thread running the IOManager
+    std::size_t peerchatAcceptors = 2;
+    // Metrics are published to this shared memory segment if set, see CNCOnlineForwarder.StatsReader
+    std::optional<std::string> sharedStatsSegment;
+    SharedStatsPublisher::Interval sharedStatsInterval{ 100'000 };
+    // Session lifecycle events are sent to this Unix datagram socket if set, see SessionEventStream
+    std::optional<std::string> sessionEventsSocket;
+    // Diagnostics HTTP server on the loopback address, enabled by --admin-port
+    std::optional<std::uint16_t> adminPort;
+    // Handlers running longer are counted and logged as slow, see EventLoopMonitor
+    std::chrono::microseconds slowHandlerBudget = EventLoopMonitor::defaultSlowHandlerBudget;
+    // One NatNeg negotiation out of this many is traced, see /trace on the admin server; 0 disables tracing
+    std::uint32_t traceSampleRate = 0;
+};
+
+void printUsage(char const* program)
+{
+    std::cerr << "Usage: " << program
+        << " [--natneg-server HOST] [--natneg-server-port PORT] [--natneg-port PORT] [--public-address IPV4]"
+        << " [--public-address-source static:IPV4|interface|stun[:HOST[:PORT]]|http[:HOST[:PORT][/TARGET]]]..."
+        << " [--impairment to=IPV4[:PORT],latency=MS,jitter=MS,loss=P,reorder=P,duplicate=P]..."
+        << " [--capture FILE.pcapng] [--capture-sample NEGOTIATIONS] [--capture-address IPV4]"
+        << " [--http-proxy-port PORT] [--http-proxy-upstream HOST[:PORT]] [--http-proxy-prefetch TARGET]..."
+        << " [--peerchat-port PORT] [--peerchat-server HOST[:PORT]] [--peerchat-lobby-cache 0|1] [--peerchat-secret-key GAME=KEY]... [--peerchat-acceptors COUNT]"
+        << " [--shared-stats SEGMENT_NAME] [--shared-stats-interval-us MICROSECONDS]"
+        << " [--session-events SOCKET_PATH] [--admin-port PORT] [--slow-handler-budget-us MICROSECONDS]"
+        << " [--trace-sample NEGOTIATIONS]\n";
+}
+
+// HOST[:PORT], `port` is left unchanged if not specified
+bool parseHostAndPort(std::string_view const text, std::string& host, std::uint16_t& port)
+{
+    auto const colon = text.find(':');
+    host = text.substr(0, colon);
+    if (colon != text.npos)
+    {
+        auto const parsed = parsePort(text.substr(colon + 1));
+        if (!parsed.has_value())
+        {
+            return false;
+        }
+        port = parsed.value();
+    }
+    return !host.empty();
+}
+
+std::optional<Options> parseOptions(int const argc, char** const argv)
+{
+    auto options = Options{};
+    for (auto i = 1; i < argc; ++i)
+    {
+        auto const argument = std::string_view{ argv[i] };
+        if ((i + 1) >= argc)
+        {
+            return std::nullopt;
+        }
+        auto const value = argv[++i];
+        auto const invalidValue = [argument, value]
+        {
+            std::cerr << "Invalid value for " << argument << ": " << value << '\n';
+            return std::nullopt;
+        };
+        if (argument == "--natneg-server")
+        {
+            options.natNegServer = value;
+        }
+        else if (argument == "--natneg-server-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.natNegServerPort = port.value();
+        }
+        else if (argument == "--natneg-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.natNegPort = port.value();
+        }
+        else if (argument == "--public-address")
+        {
+            auto code = ErrorCode{};
+            options.publicAddress = boost::asio::ip::make_address_v4(value, code);
+            if (code.failed())
+            {
+                return std::nullopt;
+            }
+        }
+        else if (argument == "--public-address-source")
+        {
+            try
+            {
+                options.publicAddressSources.push_back(PublicAddressDiscovery::parseSource(value));
+            }
+            catch (std::invalid_argument const& error)
+            {
+                std::cerr << error.what() << '\n';
+                return std::nullopt;
+            }
+        }
+        else if (argument == "--impairment")
+        {
+            try
+            {
+                options.impairments.push_back(NetworkImpairment::parseRule(value));
+            }
+            catch (std::invalid_argument const& error)
+            {
+                std::cerr << error.what() << '\n';
+                return std::nullopt;
+            }
+        }
+        else if (argument == "--capture")
+        {
+            options.capture = options.capture.value_or(PacketCapture::Options{});
+            options.capture->path = value;
+        }
+        else if (argument == "--capture-sample")
+        {
+            auto const sampleRate = parseNumber<std::uint32_t>(value, 1);
+            if (!sampleRate.has_value())
+            {
+                return invalidValue();
+            }
+            options.capture = options.capture.value_or(PacketCapture::Options{});
+            options.capture->sampleRate = sampleRate.value();
+        }
+        else if (argument == "--capture-address")
+        {
+            auto code = ErrorCode{};
+            options.capture = options.capture.value_or(PacketCapture::Options{});
+            options.capture->address = boost::asio::ip::make_address_v4(value, code);
+            if (code.failed())
+            {
+                return std::nullopt;
+            }
+        }
+        else if (argument == "--http-proxy-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.httpProxy = options.httpProxy.value_or(HTTPProxy::Options{});
+            options.httpProxy->localEndPoint = { boost::asio::ip::tcp::v4(), port.value() };
+        }
+        else if (argument == "--http-proxy-upstream")
+        {
+            options.httpProxy = options.httpProxy.value_or(HTTPProxy::Options{});
+            if (!parseHostAndPort(value, options.httpProxy->upstreamHost, options.httpProxy->upstreamPort))
+            {
+                return invalidValue();
+            }
+        }
+        else if (argument == "--http-proxy-prefetch")
+        {
+            options.httpProxy = options.httpProxy.value_or(HTTPProxy::Options{});
+            options.httpProxy->prefetchTargets.emplace_back(value);
+        }
+        else if (argument == "--peerchat-port")
+        {
+            options.peerchatPort = parsePort(value);
+            if (!options.peerchatPort.has_value())
+            {
+                return invalidValue();
+            }
+        }
+        else if (argument == "--peerchat-server")
+        {
+            if (!parseHostAndPort(value, options.peerchatServer, options.peerchatServerPort))
+            {
+                return invalidValue();
+            }
+        }
+        else if (argument == "--peerchat-lobby-cache")
+        {
+            options.peerchatLobbyCache = (std::string_view{ value } != "0");
+        }
+        else if (argument == "--peerchat-secret-key")
+        {
+            auto const gameKey = std::string_view{ value };
+            auto const equals = gameKey.find('=');
+            if ((equals == gameKey.npos) || (equals == 0) || ((equals + 1) == gameKey.size()))
+            {
+                return std::nullopt;
+            }
+            options.peerchat.secretKeys[std::string{ gameKey.substr(0, equals) }] = gameKey.substr(equals + 1);
+        }
+        else if (argument == "--peerchat-acceptors")
+        {
+            // Each one is a listening socket, a sanity bound
+            auto const acceptors = parseNumber<std::size_t>(value, 1, 1024);
+            if (!acceptors.has_value())
+            {
+                return invalidValue();
+            }
+            options.peerchatAcceptors = acceptors.value();
+        }
+        else if (argument == "--shared-stats")
+        {
+            // shm_open names are a single path component starting with '/'
+            auto const name = std::string_view{ value };
+            if (name.empty() || (name.find('/', 1) != name.npos))
+            {
+                return std::nullopt;
+            }
+            options.sharedStatsSegment = (name.front() == '/') ? std::string{ name } : "/" + std::string{ name };
+        }
+        else if (argument == "--shared-stats-interval-us")
+        {
+            auto const interval = parseNumber<SharedStatsPublisher::Interval::rep>(value, 100);
+            if (!interval.has_value())
+            {
+                return invalidValue();
+            }
+            options.sharedStatsInterval = SharedStatsPublisher::Interval{ interval.value() };
+        }
+        else if (argument == "--session-events")
+        {
+            options.sessionEventsSocket = value;
+        }
+        else if (argument == "--admin-port")
+        {
+            options.adminPort = parsePort(value);
+            if (!options.adminPort.has_value())
+            {
+                return invalidValue();
+            }
+        }
+        else if (argument == "--slow-handler-budget-us")
+        {
+            auto const budget = parseNumber<std::chrono::microseconds::rep>(value, 1);
+            if (!budget.has_value())
+            {
+                return invalidValue();
+            }
+            options.slowHandlerBudget = std::chrono::microseconds{ budget.value() };
+        }
+        else if (argument == "--trace-sample")
+        {
+            auto const sampleRate = parseNumber<std::uint32_t>(value, 0);
+            if (!sampleRate.has_value())
+            {
+                return invalidValue();
+            }
+            options.traceSampleRate = sampleRate.value();
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    if (options.capture.has_value() && options.capture->path.empty())
+    {
+        return std::nullopt;
+    }
+    if (options.httpProxy.has_value() && (options.httpProxy->localEndPoint.port() == 0))
+    {
+        return std::nullopt;
+    }
+    return options;
+}
 
 void signalHandler(IOManager& manager, ErrorCode const& errorCode, int const signal)
 {
@@ -38,27 +366,95 @@ struct Main
         return ::logLine<Main>(level, std::forward<Arguments>(arguments)...);
     }
 
-    static void run()
+    static void run(Options const& options)
     {
         logLine(Level::info, "Begin!");
         try
         {
+            EventLoopMonitor::setSlowHandlerBudget(options.slowHandlerBudget);
             auto const ioManager = IOManager::create();
             auto objectMaker = IOManager::ObjectMaker{ ioManager };
 
             auto signals = objectMaker.make<SignalSet>(SIGINT, SIGTERM);
             signals.async_wait(makeWeakHandler(ioManager.get(), &signalHandler));
+#ifdef __linux__
+            // The peerchat relay writes with splice(), which has no MSG_NOSIGNAL
+            if (::signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+            {
+                logLine(Level::error, "Cannot ignore SIGPIPE: ", std::strerror(errno));
+            }
+#endif
+
+            auto const metricsReporter = MetricsReporter::create(objectMaker, std::chrono::minutes{ 1 });
+            auto const metricsHistory = MetricsHistory::create(objectMaker);
+            AllocationTracker::registerMetrics();
+            if constexpr (AllocationTracker::enabled)
+            {
+                logLine(Level::info, "Allocation tracking enabled, see the memory.* metrics");
+            }
+            // External tools can sample the metrics through /dev/shm (see CNCOnlineForwarder.StatsReader)
+            auto const sharedStatsPublisher = options.sharedStatsSegment.has_value()
+                ? SharedStatsPublisher::create(options.sharedStatsSegment.value(), options.sharedStatsInterval)
+                : nullptr;
+            // Local analytics agents can receive session lifecycle events by binding this socket
+            auto const sessionEventStream = options.sessionEventsSocket.has_value()
+                ? SessionEventStream::create(options.sessionEventsSocket.value())
+                : nullptr;
+            // Replayable with CNCOnlineForwarder.Replay
+            auto const packetCapture = options.capture.has_value() ? PacketCapture::create(options.capture.value()) : nullptr;
+            Tracer::get().setSampleRate(options.traceSampleRate);
+
+            // Only reachable from the local machine, the forwarder still runs without it
+            auto adminServer = std::shared_ptr<AdminServer>{};
+            if (options.adminPort.has_value())
+            {
+                try
+                {
+                    adminServer = AdminServer::create
+                    (
+                        objectMaker,
+                        { boost::asio::ip::address_v4::loopback(), options.adminPort.value() }
+                    );
+                    addDiagnosticsRoutes(*adminServer, objectMaker);
+                    addHistoryRoute(*adminServer, metricsHistory);
+                }
+                catch (boost::system::system_error const& error)
+                {
+                    logLine(Level::error, "Admin server on port ", options.adminPort.value(), " not started: ", error.what());
+                }
+            }
 
-            auto const addressTranslator = ProxyAddressTranslator::create(objectMaker);
+            // NatNegProxy does not accept new sessions until the public address is known
+            auto const addressTranslator = (options.publicAddress.has_value() || options.publicAddressSources.empty())
+                ? ProxyAddressTranslator::create(objectMaker, options.publicAddress)
+                : ProxyAddressTranslator::create(objectMaker, options.publicAddressSources);
 
+            if (!options.impairments.empty())
+            {
+                logLine(Level::warning, "Impairing outgoing datagrams with ", options.impairments.size(), " rules, see the impairment.* metrics");
+                NetworkImpairment::get().setRules(options.impairments);
+            }
+
+            logLine(Level::info, "NatNeg server: ", options.natNegServer, ":", options.natNegServerPort);
             auto const natNegProxy = NatNegProxy::create
             (
                 objectMaker,
-                "natneg.server.cnc-online.net",
-                27901,
+                options.natNegServer,
+                options.natNegServerPort,
+                options.natNegPort,
                 addressTranslator
             );
 
+            auto const httpProxy = options.httpProxy.has_value() ? HTTPProxy::create(objectMaker, options.httpProxy.value()) : nullptr;
+            auto peerchatOptions = TCPProxy::Options{};
+            peerchatOptions.localEndPoint = { boost::asio::ip::tcp::v4(), options.peerchatPort.value_or(0) };
+            peerchatOptions.serverHost = options.peerchatServer;
+            peerchatOptions.serverPort = options.peerchatServerPort;
+            peerchatOptions.mode = options.peerchatLobbyCache ? RelayMode::peerchat : RelayMode::automatic;
+            peerchatOptions.peerchat = options.peerchat;
+            peerchatOptions.acceptors = options.peerchatAcceptors;
+            auto const peerchatProxy = options.peerchatPort.has_value() ? TCPProxy::create(objectMaker, peerchatOptions) : nullptr;
+
             {
                 auto const runner = [ioManager] 
                 { 
@@ -78,6 +474,8 @@ struct Main
                 f1.get();
                 f2.get();
             }
+
+            metricsReporter->report();
         }
         catch (std::exception const& error)
         {
@@ -89,11 +487,18 @@ struct Main
 
 
 
-int main()
+int main(int argc, char** argv)
 {
+    auto const options = parseOptions(argc, argv);
+    if (!options.has_value())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
     try
     {
-        Main::run();
+        Main::run(options.value());
     }
     catch (...)
     {
@@ -0,0 +1,521 @@
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <NatNeg/NatNegProxy.hpp>
+#include <Utility/JsonWriter.hpp>
+#include <Utility/ParseNumber.hpp>
+#include <Utility/ProxyAddressTranslator.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <iostream>
+#include <fstream>
+// Only built where mallinfo2 exists, see CMakeLists.txt
+#include <malloc.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/sock_diag.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Memory footprint of a forwarder session: one InitialPhase plus one GameConnection,
+// with their strands, three sockets, pending handlers and map entries.
+// The forwarder runs in this process, while CNCOnlineForwarder.LoadGenerator is spawned
+// to set up sessions through it, so nothing else of the clients is measured here.
+// First N idle sessions are set up (negotiated, no game traffic), then N more active ones
+// relaying game traffic on top of them; each phase is charged the growth it caused.
+//      CNCOnlineForwarder.Footprint --sessions 1000 --baseline CNCOnlineForwarder.Footprint/baseline.json
+// Updating the baseline:
+//      CNCOnlineForwarder.Footprint --sessions 1000 --json 1 > CNCOnlineForwarder.Footprint/baseline.json
+
+using CNCOnlineForwarder::IOManager;
+using CNCOnlineForwarder::Diagnostics::MetricsRegistry;
+using CNCOnlineForwarder::NatNeg::NatNegProxy;
+using CNCOnlineForwarder::Utility::JsonWriter;
+using CNCOnlineForwarder::Utility::parseNumber;
+using CNCOnlineForwarder::Utility::parsePort;
+using CNCOnlineForwarder::Utility::ProxyAddressTranslator;
+
+using AddressV4 = boost::asio::ip::address_v4;
+using Clock = std::chrono::steady_clock;
+
+extern char** environ;
+
+struct Options
+{
+    // Players, each one owning an InitialPhase and a GameConnection
+    std::size_t sessions = 1000;
+    // New sessions per second. All of them must be set up well within
+    // the one minute timeout of the forwarder, or idle sessions would expire during the active phase.
+    double rate = 200;
+    // Low enough not to saturate the forwarder, which would make handshakes fail
+    unsigned packetsPerSecond = 5;
+    std::uint16_t forwarderPort = 27911;
+    std::uint16_t serverPort = 27912;
+    std::string loadGenerator;
+    std::optional<std::string> baseline;
+    // Relative growth of heap bytes per session tolerated before reporting a regression
+    double tolerance = 0.10;
+    bool json = false;
+};
+
+struct Sample
+{
+    std::int64_t gameConnections = 0;
+    std::int64_t initialPhases = 0;
+    std::int64_t heapBytes = 0;
+    std::int64_t residentBytes = 0;
+    std::int64_t sockets = 0;
+    // Buffers and queues charged to the sockets, from SO_MEMINFO
+    std::int64_t socketBufferBytes = 0;
+};
+
+// Per session cost of a phase
+struct Footprint
+{
+    double heapBytes = 0;
+    double residentBytes = 0;
+    double sockets = 0;
+    double socketBufferBytes = 0;
+    // Estimated from the size of the kernel's UDP socket objects
+    double kernelSocketObjectBytes = 0;
+};
+
+struct Results
+{
+    std::size_t sessions = 0;
+    std::int64_t kernelSocketObjectSize = 0;
+    Footprint idle;
+    Footprint active;
+};
+
+void printUsage(char const* program)
+{
+    std::cerr << "Usage: " << program
+        << " [--sessions COUNT] [--rate SESSIONS_PER_SECOND] [--pps PACKETS_PER_SECOND]"
+        << " [--forwarder-port PORT] [--server-port PORT] [--load-generator PATH]"
+        << " [--baseline FILE] [--tolerance FRACTION] [--json 0|1]\n";
+}
+
+std::string getDefaultLoadGenerator()
+{
+    auto path = std::array<char, 4096>{};
+    auto const size = ::readlink("/proc/self/exe", path.data(), path.size() - 1);
+    auto directory = std::string{ path.data(), static_cast<std::size_t>(std::max<ssize_t>(size, 0)) };
+    directory.erase(directory.find_last_of('/') + 1);
+    return directory + "../CNCOnlineForwarder.LoadGenerator/CNCOnlineForwarder.LoadGenerator";
+}
+
+std::optional<Options> parseOptions(int const argc, char** const argv)
+{
+    auto options = Options{};
+    options.loadGenerator = getDefaultLoadGenerator();
+    for (auto i = 1; i < argc; ++i)
+    {
+        auto const argument = std::string_view{ argv[i] };
+        if ((i + 1) >= argc)
+        {
+            return std::nullopt;
+        }
+        auto const value = argv[++i];
+        auto const invalidValue = [argument, value]
+        {
+            std::cerr << "Invalid value for " << argument << ": " << value << '\n';
+            return std::nullopt;
+        };
+        if (argument == "--sessions")
+        {
+            auto const sessions = parseNumber<std::size_t>(value, 2);
+            if (!sessions.has_value())
+            {
+                return invalidValue();
+            }
+            options.sessions = sessions.value();
+        }
+        else if (argument == "--rate")
+        {
+            auto const rate = parseNumber<double>(value, 0);
+            if (!rate.has_value())
+            {
+                return invalidValue();
+            }
+            options.rate = rate.value();
+        }
+        else if (argument == "--pps")
+        {
+            auto const packetsPerSecond = parseNumber<unsigned>(value, 1);
+            if (!packetsPerSecond.has_value())
+            {
+                return invalidValue();
+            }
+            options.packetsPerSecond = packetsPerSecond.value();
+        }
+        else if (argument == "--forwarder-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.forwarderPort = port.value();
+        }
+        else if (argument == "--server-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.serverPort = port.value();
+        }
+        else if (argument == "--load-generator")
+        {
+            options.loadGenerator = value;
+        }
+        else if (argument == "--baseline")
+        {
+            options.baseline = value;
+        }
+        else if (argument == "--tolerance")
+        {
+            auto const tolerance = parseNumber<double>(value, 0);
+            if (!tolerance.has_value())
+            {
+                return invalidValue();
+            }
+            options.tolerance = tolerance.value();
+        }
+        else if (argument == "--json")
+        {
+            options.json = std::string_view{ value } != "0";
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    // Sessions come in pairs
+    options.sessions -= options.sessions % 2;
+    if ((options.sessions == 0) || (options.rate <= 0) || ((options.sessions / options.rate) > 20))
+    {
+        return std::nullopt;
+    }
+    return options;
+}
+
+std::int64_t getHeapBytes() noexcept
+{
+    return static_cast<std::int64_t>(::mallinfo2().uordblks);
+}
+
+std::int64_t getResidentBytes()
+{
+    auto statm = std::ifstream{ "/proc/self/statm" };
+    auto size = std::int64_t{ 0 };
+    auto resident = std::int64_t{ 0 };
+    statm >> size >> resident;
+    return resident * ::sysconf(_SC_PAGESIZE);
+}
+
+// Returns: the size of the kernel object of an IPv4 UDP socket, 0 if /proc/slabinfo is not readable
+std::int64_t getKernelSocketObjectSize()
+{
+    auto slabInfo = std::ifstream{ "/proc/slabinfo" };
+    auto line = std::string{};
+    while (std::getline(slabInfo, line))
+    {
+        auto fields = std::istringstream{ line };
+        auto name = std::string{};
+        auto active = std::int64_t{ 0 };
+        auto total = std::int64_t{ 0 };
+        auto objectSize = std::int64_t{ 0 };
+        if ((fields >> name >> active >> total >> objectSize) && (name == "UDP"))
+        {
+            return objectSize;
+        }
+    }
+    return 0;
+}
+
+// Counts the sockets of this process, and the memory charged to their buffers
+void sampleSockets(Sample& sample)
+{
+    auto const directory = ::opendir("/proc/self/fd");
+    if (directory == nullptr)
+    {
+        return;
+    }
+
+    while (auto const entry = ::readdir(directory))
+    {
+        auto const fd = std::atoi(entry->d_name);
+        auto target = std::array<char, 64>{};
+        auto const path = std::string{ "/proc/self/fd/" } + entry->d_name;
+        auto const size = ::readlink(path.c_str(), target.data(), target.size() - 1);
+        if ((size <= 0) || (std::string_view{ target.data(), static_cast<std::size_t>(size) }.substr(0, 7) != "socket:"))
+        {
+            continue;
+        }
+
+        ++sample.sockets;
+        auto memory = std::array<std::uint32_t, SK_MEMINFO_VARS>{};
+        auto length = static_cast<::socklen_t>(sizeof(memory));
+        if (::getsockopt(fd, SOL_SOCKET, SO_MEMINFO, memory.data(), &length) == 0)
+        {
+            for (auto const index : { SK_MEMINFO_RMEM_ALLOC, SK_MEMINFO_WMEM_ALLOC, SK_MEMINFO_FWD_ALLOC, SK_MEMINFO_WMEM_QUEUED, SK_MEMINFO_OPTMEM, SK_MEMINFO_BACKLOG })
+            {
+                sample.socketBufferBytes += memory[index];
+            }
+        }
+    }
+    ::closedir(directory);
+}
+
+Sample takeSample()
+{
+    auto& metrics = MetricsRegistry::get();
+    auto sample = Sample{};
+    sample.gameConnections = metrics.gauge("sessions.GameConnection.live").get();
+    sample.initialPhases = metrics.gauge("sessions.InitialPhase.live").get();
+    sample.heapBytes = getHeapBytes();
+    sample.residentBytes = getResidentBytes();
+    sampleSockets(sample);
+    return sample;
+}
+
+Footprint getFootprint(Sample const& before, Sample const& after, std::size_t const sessions, std::int64_t const kernelSocketObjectSize)
+{
+    auto const perSession = [sessions](std::int64_t const growth)
+    {
+        return static_cast<double>(growth) / static_cast<double>(sessions);
+    };
+    auto footprint = Footprint{};
+    footprint.heapBytes = perSession(after.heapBytes - before.heapBytes);
+    footprint.residentBytes = perSession(after.residentBytes - before.residentBytes);
+    footprint.sockets = perSession(after.sockets - before.sockets);
+    footprint.socketBufferBytes = perSession(after.socketBufferBytes - before.socketBufferBytes);
+    footprint.kernelSocketObjectBytes = footprint.sockets * static_cast<double>(kernelSocketObjectSize);
+    return footprint;
+}
+
+class LoadGeneratorProcess
+{
+private:
+    ::pid_t m_pid;
+
+public:
+    LoadGeneratorProcess(Options const& options, unsigned const packetsPerSecond, std::chrono::seconds const duration)
+    {
+        auto const arguments = std::vector<std::string>
+        {
+            options.loadGenerator,
+            "--forwarder-port", std::to_string(options.forwarderPort),
+            "--server-port", std::to_string(options.serverPort),
+            "--pairs", std::to_string(options.sessions / 2),
+            "--rate", std::to_string(options.rate / 2),
+            "--pps", std::to_string(packetsPerSecond),
+            "--duration", std::to_string(duration.count()),
+        };
+        auto argv = std::vector<char*>{};
+        for (auto const& argument : arguments)
+        {
+            argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        // Its report would be mixed with ours
+        auto actions = ::posix_spawn_file_actions_t{};
+        ::posix_spawn_file_actions_init(&actions);
+        ::posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        auto const result = ::posix_spawn(&m_pid, argv.front(), &actions, nullptr, argv.data(), environ);
+        ::posix_spawn_file_actions_destroy(&actions);
+        if (result != 0)
+        {
+            throw std::system_error{ result, std::generic_category(), "Cannot start " + options.loadGenerator };
+        }
+    }
+
+    LoadGeneratorProcess(LoadGeneratorProcess const&) = delete;
+    LoadGeneratorProcess& operator=(LoadGeneratorProcess const&) = delete;
+
+    ~LoadGeneratorProcess()
+    {
+        if (m_pid != 0)
+        {
+            ::kill(m_pid, SIGTERM);
+            wait();
+        }
+    }
+
+    bool isRunning()
+    {
+        return (m_pid != 0) && (::waitpid(m_pid, nullptr, WNOHANG) == 0);
+    }
+
+    void wait()
+    {
+        ::waitpid(m_pid, nullptr, 0);
+        m_pid = 0;
+    }
+};
+
+// Waits until the forwarder holds the given number of sessions
+void waitForSessions(std::int64_t const target, LoadGeneratorProcess& loadGenerator, std::chrono::seconds const timeout)
+{
+    auto const deadline = Clock::now() + timeout;
+    auto& gameConnections = MetricsRegistry::get().gauge("sessions.GameConnection.live");
+    while (gameConnections.get() < target)
+    {
+        if ((Clock::now() > deadline) || !loadGenerator.isRunning())
+        {
+            throw std::runtime_error{ "Only " + std::to_string(gameConnections.get()) + " of " + std::to_string(target) + " sessions were set up" };
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 100 });
+    }
+}
+
+Results run(Options const& options)
+{
+    auto results = Results{};
+    results.sessions = options.sessions;
+    results.kernelSocketObjectSize = getKernelSocketObjectSize();
+
+    auto const ioManager = IOManager::create();
+    auto const objectMaker = IOManager::ObjectMaker{ ioManager };
+    auto const addressTranslator = ProxyAddressTranslator::create(objectMaker, AddressV4::loopback());
+    auto const natNegProxy = NatNegProxy::create(objectMaker, "127.0.0.1", options.serverPort, options.forwarderPort, addressTranslator);
+    auto workers = std::vector<std::future<std::size_t>>{};
+    for (auto i = 0; i < 2; ++i)
+    {
+        workers.push_back(std::async(std::launch::async, [ioManager] { return ioManager->run(); }));
+    }
+
+    auto const setupDuration = std::chrono::seconds{ static_cast<std::int64_t>(std::ceil(static_cast<double>(options.sessions) / options.rate)) };
+    auto const timeout = setupDuration + std::chrono::seconds{ 15 };
+    auto const settle = std::chrono::seconds{ 2 };
+    auto const sessions = static_cast<std::int64_t>(options.sessions);
+    try
+    {
+        // Let the forwarder resolve the server and settle
+        std::this_thread::sleep_for(std::chrono::seconds{ 1 });
+        auto const baseline = takeSample();
+
+        {
+            auto idle = LoadGeneratorProcess{ options, 0, std::chrono::seconds{ 1 } };
+            waitForSessions(sessions, idle, timeout);
+            std::this_thread::sleep_for(settle);
+        }
+        auto const idle = takeSample();
+        results.idle = getFootprint(baseline, idle, options.sessions, results.kernelSocketObjectSize);
+
+        {
+            auto active = LoadGeneratorProcess{ options, options.packetsPerSecond, setupDuration + settle * 4 };
+            waitForSessions(sessions * 2, active, timeout);
+            std::this_thread::sleep_for(settle);
+            auto const busy = takeSample();
+            results.active = getFootprint(idle, busy, options.sessions, results.kernelSocketObjectSize);
+        }
+    }
+    catch (...)
+    {
+        ioManager->stop();
+        throw;
+    }
+
+    ioManager->stop();
+    for (auto& worker : workers)
+    {
+        worker.get();
+    }
+    return results;
+}
+
+void writeFootprint(JsonWriter& json, Footprint const& footprint)
+{
+    json.beginObject();
+    json.member("heapBytes", footprint.heapBytes);
+    json.member("residentBytes", footprint.residentBytes);
+    json.member("sockets", footprint.sockets);
+    json.member("socketBufferBytes", footprint.socketBufferBytes);
+    json.member("kernelSocketObjectBytes", footprint.kernelSocketObjectBytes);
+    json.endObject();
+}
+
+void writeJson(std::ostream& out, Results const& results)
+{
+    auto json = JsonWriter{ out };
+    json.beginObject();
+    json.member("sessions", results.sessions);
+    json.member("kernelSocketObjectSize", results.kernelSocketObjectSize);
+    json.key("idle");
+    writeFootprint(json, results.idle);
+    json.key("active");
+    writeFootprint(json, results.active);
+    json.endObject();
+    out << '\n';
+}
+
+void writeText(std::ostream& out, Results const& results)
+{
+    out << "Per session (" << results.sessions << " sessions, one InitialPhase and one GameConnection each):\n";
+    for (auto const& [name, footprint] : { std::pair{ "idle", &results.idle }, { "active", &results.active } })
+    {
+        out << "  " << name << ": " << footprint->heapBytes << " heap bytes, " << footprint->residentBytes << " resident bytes, "
+            << footprint->sockets << " sockets, " << footprint->socketBufferBytes << " socket buffer bytes, "
+            << footprint->kernelSocketObjectBytes << " kernel socket object bytes\n";
+    }
+}
+
+// Returns: false if the heap used per session grew beyond the tolerance
+bool checkBaseline(std::ostream& out, Results const& results, std::string const& path, double const tolerance)
+{
+    auto baseline = boost::property_tree::ptree{};
+    boost::property_tree::read_json(path, baseline);
+    auto passed = true;
+    for (auto const& [name, footprint] : { std::pair{ "idle", &results.idle }, { "active", &results.active } })
+    {
+        auto const expected = baseline.get<double>(std::string{ name } + ".heapBytes");
+        auto const limit = expected * (1 + tolerance);
+        auto const regressed = footprint->heapBytes > limit;
+        out << (regressed ? "REGRESSION " : "OK ") << name << ": " << footprint->heapBytes
+            << " heap bytes per session, baseline " << expected << ", limit " << limit << '\n';
+        passed = passed && !regressed;
+    }
+    return passed;
+}
+
+int main(int argc, char** argv)
+{
+    auto const options = parseOptions(argc, argv);
+    if (!options.has_value())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        auto const results = run(options.value());
+        if (options->json)
+        {
+            writeJson(std::cout, results);
+        }
+        else
+        {
+            writeText(std::cout, results);
+        }
+
+        if (options->baseline.has_value())
+        {
+            return checkBaseline(options->json ? std::cerr : std::cout, results, options->baseline.value(), options->tolerance) ? 0 : 1;
+        }
+        return 0;
+    }
+    catch (std::exception const& error)
+    {
+        std::cerr << "Footprint measurement failed: " << error.what() << '\n';
+        return 1;
+    }
+}
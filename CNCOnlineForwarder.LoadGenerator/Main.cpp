@@ -0,0 +1,637 @@
+#include <precompiled.hpp>
+#include "NatNegServerEmulator.hpp"
+#include "PeerchatServerEmulator.hpp"
+#include "PublicAddressEmulator.hpp"
+#include "SimulatedLobbyClient.hpp"
+#include "SimulatedSession.hpp"
+#include <IOManager.hpp>
+#include <Utility/JsonWriter.hpp>
+#include <Utility/ParseNumber.hpp>
+#include <iostream>
+#include <random>
+
+// End to end load test of the forwarder on the local machine.
+// Hosts a NatNeg server emulator, then simulates pairs of RA3 clients negotiating
+// through the forwarder and exchanging game traffic through its relays.
+// The forwarder must be started with the emulator as its NatNeg server, and without public address lookup:
+//      CNCOnlineForwarder.Exe --natneg-server 127.0.0.1 --natneg-server-port 27902 --public-address 127.0.0.1
+//      CNCOnlineForwarder.LoadGenerator --pairs 1000 --rate 200 --pps 30 --duration 30
+// Sessions are set up at the given rate, then the relay is measured for `duration` seconds
+// while all the established sessions keep sending game packets.
+// With --discovery-port, it also stands in for the public address sources of the forwarder,
+// which can then be started with, instead of --public-address:
+//      --public-address-source stun:127.0.0.1:27903 --public-address-source http:127.0.0.1:27903
+// With --peerchat-joins, it tests the peerchat relay instead: it hosts a peerchat server emulator,
+// then players join its lobbies through the forwarder, `threads` at a time:
+//      CNCOnlineForwarder.Exe --peerchat-port 6667 --peerchat-server 127.0.0.1:6668 --peerchat-lobby-cache 1
+//      CNCOnlineForwarder.LoadGenerator --peerchat-joins 2000 --threads 16 --peerchat-server-delay 50
+// where the delay stands in for the round trip to the real server.
+
+using CNCOnlineForwarder::IOManager;
+using CNCOnlineForwarder::LoadGenerator::LoadStatistics;
+using CNCOnlineForwarder::LoadGenerator::NatNegServerEmulator;
+using CNCOnlineForwarder::LoadGenerator::PeerchatServerEmulator;
+using CNCOnlineForwarder::LoadGenerator::PublicAddressEmulator;
+using CNCOnlineForwarder::LoadGenerator::SimulatedLobbyClient;
+using CNCOnlineForwarder::LoadGenerator::SimulatedSession;
+using CNCOnlineForwarder::Utility::JsonWriter;
+using CNCOnlineForwarder::Utility::parseNumber;
+using CNCOnlineForwarder::Utility::parsePort;
+
+using Clock = std::chrono::steady_clock;
+using EndPoint = boost::asio::ip::udp::endpoint;
+
+struct Options
+{
+    EndPoint forwarder{ boost::asio::ip::address_v4::loopback(), 27901 };
+    EndPoint server{ boost::asio::ip::address_v4::loopback(), 27902 };
+    // STUN and HTTP stand-ins are not started if the port is 0
+    EndPoint discovery{ boost::asio::ip::address_v4::loopback(), 0 };
+    // What the stand-ins report as the public address of the forwarder
+    boost::asio::ip::address_v4 discoveryAddress = boost::asio::ip::address_v4::loopback();
+    std::size_t pairs = 100;
+    // New sessions per second
+    double rate = 50;
+    unsigned packetsPerSecond = 30;
+    std::size_t packetSize = 64;
+    std::chrono::seconds duration{ 10 };
+    std::chrono::seconds handshakeTimeout{ 10 };
+    unsigned threads = 2;
+    bool json = false;
+    // Lobby joins through the peerchat relay, instead of NatNeg sessions
+    std::size_t peerchatJoins = 0;
+    boost::asio::ip::tcp::endpoint peerchatForwarder{ boost::asio::ip::address_v4::loopback(), 6667 };
+    boost::asio::ip::tcp::endpoint peerchatServer{ boost::asio::ip::address_v4::loopback(), 6668 };
+    std::size_t peerchatChannels = 8;
+    std::size_t peerchatMembers = 50;
+    std::chrono::milliseconds peerchatServerDelay{ 0 };
+};
+
+struct Results
+{
+    std::size_t pairs;
+    std::uint64_t established;
+    std::uint64_t failed;
+    double setupSeconds;
+    std::vector<std::chrono::microseconds> handshakeDurations;
+    double measuredSeconds;
+    std::uint64_t packetsSent;
+    std::uint64_t packetsReceived;
+    std::uint64_t sendErrors;
+    std::vector<std::uint32_t> relayLatencies;
+    NatNegServerEmulator::Statistics server;
+    std::optional<PublicAddressEmulator::Statistics> discovery;
+};
+
+struct PeerchatResults
+{
+    std::size_t joins;
+    std::uint64_t failed;
+    double seconds;
+    std::vector<std::chrono::microseconds> joinDurations;
+    PeerchatServerEmulator::Statistics server;
+};
+
+void printUsage(char const* program)
+{
+    std::cerr << "Usage: " << program
+        << " [--forwarder IPV4] [--forwarder-port PORT] [--server-port PORT] [--discovery-port PORT] [--discovery-address IPV4]"
+        << " [--pairs COUNT] [--rate SESSIONS_PER_SECOND] [--pps PACKETS_PER_SECOND] [--packet-size BYTES]"
+        << " [--duration SECONDS] [--handshake-timeout SECONDS] [--threads COUNT] [--json 0|1]"
+        << " [--peerchat-joins COUNT] [--peerchat-port PORT] [--peerchat-server-port PORT]"
+        << " [--peerchat-channels COUNT] [--peerchat-members COUNT] [--peerchat-server-delay MILLISECONDS]\n";
+}
+
+std::optional<Options> parseOptions(int const argc, char** const argv)
+{
+    auto options = Options{};
+    for (auto i = 1; i < argc; ++i)
+    {
+        auto const argument = std::string_view{ argv[i] };
+        if ((i + 1) >= argc)
+        {
+            return std::nullopt;
+        }
+        auto const value = argv[++i];
+        auto const invalidValue = [argument, value]
+        {
+            std::cerr << "Invalid value for " << argument << ": " << value << '\n';
+            return std::nullopt;
+        };
+        if (argument == "--forwarder")
+        {
+            auto code = boost::system::error_code{};
+            options.forwarder.address(boost::asio::ip::make_address_v4(value, code));
+            if (code.failed())
+            {
+                return std::nullopt;
+            }
+        }
+        else if (argument == "--forwarder-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.forwarder.port(port.value());
+        }
+        else if (argument == "--server-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.server.port(port.value());
+        }
+        else if (argument == "--discovery-port")
+        {
+            auto const port = parseNumber<std::uint16_t>(value, 0);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.discovery.port(port.value());
+        }
+        else if (argument == "--discovery-address")
+        {
+            auto code = boost::system::error_code{};
+            options.discoveryAddress = boost::asio::ip::make_address_v4(value, code);
+            if (code.failed())
+            {
+                return std::nullopt;
+            }
+        }
+        else if (argument == "--pairs")
+        {
+            auto const pairs = parseNumber<std::size_t>(value, 0);
+            if (!pairs.has_value())
+            {
+                return invalidValue();
+            }
+            options.pairs = pairs.value();
+        }
+        else if (argument == "--rate")
+        {
+            auto const rate = parseNumber<double>(value, 0);
+            if (!rate.has_value())
+            {
+                return invalidValue();
+            }
+            options.rate = rate.value();
+        }
+        else if (argument == "--pps")
+        {
+            auto const packetsPerSecond = parseNumber<unsigned>(value, 0);
+            if (!packetsPerSecond.has_value())
+            {
+                return invalidValue();
+            }
+            options.packetsPerSecond = packetsPerSecond.value();
+        }
+        else if (argument == "--packet-size")
+        {
+            auto const packetSize = parseNumber<std::size_t>(value, 0, SimulatedSession::maxPacketSize);
+            if (!packetSize.has_value())
+            {
+                return invalidValue();
+            }
+            options.packetSize = packetSize.value();
+        }
+        else if (argument == "--duration")
+        {
+            auto const seconds = parseNumber<std::chrono::seconds::rep>(value, 0);
+            if (!seconds.has_value())
+            {
+                return invalidValue();
+            }
+            options.duration = std::chrono::seconds{ seconds.value() };
+        }
+        else if (argument == "--handshake-timeout")
+        {
+            auto const seconds = parseNumber<std::chrono::seconds::rep>(value, 1);
+            if (!seconds.has_value())
+            {
+                return invalidValue();
+            }
+            options.handshakeTimeout = std::chrono::seconds{ seconds.value() };
+        }
+        else if (argument == "--threads")
+        {
+            auto const threads = parseNumber<unsigned>(value, 1);
+            if (!threads.has_value())
+            {
+                return invalidValue();
+            }
+            options.threads = threads.value();
+        }
+        else if (argument == "--json")
+        {
+            options.json = std::string_view{ value } != "0";
+        }
+        else if (argument == "--peerchat-joins")
+        {
+            auto const joins = parseNumber<std::size_t>(value, 0);
+            if (!joins.has_value())
+            {
+                return invalidValue();
+            }
+            options.peerchatJoins = joins.value();
+        }
+        else if (argument == "--peerchat-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.peerchatForwarder.port(port.value());
+        }
+        else if (argument == "--peerchat-server-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.peerchatServer.port(port.value());
+        }
+        else if (argument == "--peerchat-channels")
+        {
+            auto const channels = parseNumber<std::size_t>(value, 1);
+            if (!channels.has_value())
+            {
+                return invalidValue();
+            }
+            options.peerchatChannels = channels.value();
+        }
+        else if (argument == "--peerchat-members")
+        {
+            auto const members = parseNumber<std::size_t>(value, 0);
+            if (!members.has_value())
+            {
+                return invalidValue();
+            }
+            options.peerchatMembers = members.value();
+        }
+        else if (argument == "--peerchat-server-delay")
+        {
+            auto const milliseconds = parseNumber<std::chrono::milliseconds::rep>(value, 0);
+            if (!milliseconds.has_value())
+            {
+                return invalidValue();
+            }
+            options.peerchatServerDelay = std::chrono::milliseconds{ milliseconds.value() };
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    if (options.rate <= 0)
+    {
+        return std::nullopt;
+    }
+    return options;
+}
+
+template<typename Value>
+Value getPercentile(std::vector<Value> const& sorted, double const percentile)
+{
+    if (sorted.empty())
+    {
+        return Value{};
+    }
+    auto const index = static_cast<std::size_t>(percentile * static_cast<double>(sorted.size() - 1));
+    return sorted[index];
+}
+
+Results run(Options const& options)
+{
+    auto const ioManager = IOManager::create();
+    auto const objectMaker = IOManager::ObjectMaker{ ioManager };
+    auto const server = NatNegServerEmulator::create(objectMaker, options.server);
+    auto const discovery = (options.discovery.port() != 0)
+        ? PublicAddressEmulator::create(objectMaker, options.discovery, options.discoveryAddress)
+        : nullptr;
+    auto statistics = LoadStatistics{};
+    auto const sessionOptions = SimulatedSession::Options
+    {
+        options.forwarder,
+        options.packetsPerSecond,
+        options.packetSize,
+        options.handshakeTimeout,
+    };
+
+    auto workers = std::vector<std::future<std::size_t>>{};
+    for (auto i = 0u; i < options.threads; ++i)
+    {
+        workers.push_back(std::async(std::launch::async, [ioManager] { return ioManager->run(); }));
+    }
+
+    // NatNegIDs of previous runs might still be known by the forwarder
+    auto const firstNatNegID = static_cast<CNCOnlineForwarder::NatNeg::NatNegID>(std::random_device{}());
+    auto sessions = std::vector<std::shared_ptr<SimulatedSession>>{};
+    sessions.reserve(options.pairs);
+    auto const startedAt = Clock::now();
+    auto const interval = std::chrono::duration<double>{ 1.0 / options.rate };
+    for (auto i = std::size_t{ 0 }; i < options.pairs; ++i)
+    {
+        std::this_thread::sleep_until(startedAt + std::chrono::duration_cast<Clock::duration>(interval * static_cast<double>(i)));
+        auto const natNegID = static_cast<CNCOnlineForwarder::NatNeg::NatNegID>(firstNatNegID + i);
+        sessions.push_back(SimulatedSession::create(objectMaker, natNegID, sessionOptions, statistics));
+    }
+
+    auto const setUpBefore = Clock::now() + options.handshakeTimeout + SimulatedSession::retryInterval;
+    while (((statistics.established + statistics.failed) < options.pairs) && (Clock::now() < setUpBefore))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 10 });
+    }
+
+    auto results = Results{};
+    results.pairs = options.pairs;
+    results.established = statistics.established;
+    results.failed = options.pairs - results.established;
+    auto const lastEstablishedAt = statistics.getLastEstablishedAt();
+    results.setupSeconds = std::chrono::duration<double>{ std::max(lastEstablishedAt, startedAt) - startedAt }.count();
+    results.handshakeDurations = statistics.getHandshakeDurations();
+
+    auto const sentBefore = statistics.packetsSent.load();
+    auto const receivedBefore = statistics.packetsReceived.load();
+    auto const sendErrorsBefore = statistics.sendErrors.load();
+    auto const measureStartedAt = Clock::now();
+    statistics.measuring = true;
+    std::this_thread::sleep_for(options.duration);
+    statistics.measuring = false;
+    results.measuredSeconds = std::chrono::duration<double>{ Clock::now() - measureStartedAt }.count();
+    results.packetsSent = statistics.packetsSent - sentBefore;
+    results.packetsReceived = statistics.packetsReceived - receivedBefore;
+    results.sendErrors = statistics.sendErrors - sendErrorsBefore;
+    results.server = server->getStatistics();
+    if (discovery)
+    {
+        results.discovery = discovery->getStatistics();
+    }
+
+    ioManager->stop();
+    for (auto& worker : workers)
+    {
+        worker.get();
+    }
+
+    for (auto const& session : sessions)
+    {
+        auto const& latencies = session->getRelayLatencyMicroseconds();
+        results.relayLatencies.insert(results.relayLatencies.end(), latencies.begin(), latencies.end());
+    }
+    std::sort(results.handshakeDurations.begin(), results.handshakeDurations.end());
+    std::sort(results.relayLatencies.begin(), results.relayLatencies.end());
+    return results;
+}
+
+PeerchatResults runPeerchat(Options const& options)
+{
+    // The default secret key of the forwarder
+    static auto const gameName = std::string{ "redalert3pc" };
+    static auto const secretKey = std::string{ "uBZwpf" };
+
+    auto const ioManager = IOManager::create();
+    auto const objectMaker = IOManager::ObjectMaker{ ioManager };
+    auto const server = PeerchatServerEmulator::create
+    (
+        objectMaker,
+        PeerchatServerEmulator::Options
+        {
+            options.peerchatServer,
+            secretKey,
+            options.peerchatChannels,
+            options.peerchatMembers,
+            options.peerchatServerDelay,
+        }
+    );
+    auto const serverWorker = std::async(std::launch::async, [ioManager] { return ioManager->run(); });
+
+    auto const clientOptions = SimulatedLobbyClient::Options
+    {
+        options.peerchatForwarder,
+        gameName,
+        secretKey,
+        options.handshakeTimeout,
+    };
+    auto next = std::atomic<std::size_t>{ 0 };
+    auto failed = std::atomic<std::uint64_t>{ 0 };
+    auto const join = [&options, &clientOptions, &next, &failed]
+    {
+        auto durations = std::vector<std::chrono::microseconds>{};
+        for (auto i = next++; i < options.peerchatJoins; i = next++)
+        {
+            try
+            {
+                auto client = SimulatedLobbyClient{ clientOptions };
+                auto const channel = "#GPG!" + std::to_string(i % options.peerchatChannels + 1);
+                auto const duration = client.joinLobby("lobbyPlayer" + std::to_string(i), channel);
+                durations.push_back(std::chrono::duration_cast<std::chrono::microseconds>(duration));
+            }
+            catch (std::exception const& error)
+            {
+                if (failed++ == 0)
+                {
+                    std::cerr << "Lobby join failed: " << error.what() << '\n';
+                }
+            }
+        }
+        return durations;
+    };
+
+    auto const startedAt = Clock::now();
+    auto workers = std::vector<std::future<std::vector<std::chrono::microseconds>>>{};
+    for (auto i = 0u; i < options.threads; ++i)
+    {
+        workers.push_back(std::async(std::launch::async, join));
+    }
+
+    auto results = PeerchatResults{};
+    for (auto& worker : workers)
+    {
+        auto const durations = worker.get();
+        results.joinDurations.insert(results.joinDurations.end(), durations.begin(), durations.end());
+    }
+    results.seconds = std::chrono::duration<double>{ Clock::now() - startedAt }.count();
+    results.joins = options.peerchatJoins;
+    results.failed = failed;
+    results.server = server->getStatistics();
+
+    ioManager->stop();
+    serverWorker.wait();
+    std::sort(results.joinDurations.begin(), results.joinDurations.end());
+    return results;
+}
+
+void writeText(std::ostream& out, Results const& results)
+{
+    auto const handshake = [&results](double const percentile)
+    {
+        return getPercentile(results.handshakeDurations, percentile).count() / 1000.0;
+    };
+    auto const relay = [&results](double const percentile)
+    {
+        return getPercentile(results.relayLatencies, percentile);
+    };
+
+    out << "Sessions: " << results.established << '/' << results.pairs << " established, "
+        << results.failed << " failed\n";
+    out << "Setup rate: " << (results.established / std::max(results.setupSeconds, 1e-9)) << " sessions/s\n";
+    out << "Handshake (ms): p50 " << handshake(0.5) << ", p90 " << handshake(0.9)
+        << ", p99 " << handshake(0.99) << ", max " << handshake(1) << '\n';
+    out << "Relay: " << (results.packetsReceived / results.measuredSeconds) << " packets/s received, "
+        << (results.packetsSent / results.measuredSeconds) << " packets/s sent, "
+        << results.sendErrors << " send errors\n";
+    out << "Relay latency (us): p50 " << relay(0.5) << ", p90 " << relay(0.9)
+        << ", p99 " << relay(0.99) << ", p99.9 " << relay(0.999) << ", max " << relay(1) << '\n';
+    out << "Server: " << results.server.inits << " inits, " << results.server.connects << " connects, "
+        << results.server.connectAcks << " connect acks, " << results.server.discarded << " discarded\n";
+    if (results.discovery.has_value())
+    {
+        out << "Discovery: " << results.discovery->stunRequests << " STUN requests, "
+            << results.discovery->httpRequests << " HTTP requests\n";
+    }
+}
+
+void writeJson(std::ostream& out, Results const& results)
+{
+    auto json = JsonWriter{ out };
+    json.beginObject();
+    json.key("sessions").beginObject();
+    json.member("pairs", results.pairs);
+    json.member("established", results.established);
+    json.member("failed", results.failed);
+    json.member("perSecond", results.established / std::max(results.setupSeconds, 1e-9));
+    json.key("handshakeMicroseconds").beginObject();
+    for (auto const& [name, percentile] : { std::pair{ "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "max", 1.0 } })
+    {
+        json.member(name, getPercentile(results.handshakeDurations, percentile).count());
+    }
+    json.endObject();
+    json.endObject();
+
+    json.key("relay").beginObject();
+    json.member("seconds", results.measuredSeconds);
+    json.member("packetsSent", results.packetsSent);
+    json.member("packetsReceived", results.packetsReceived);
+    json.member("sendErrors", results.sendErrors);
+    json.member("packetsPerSecond", results.packetsReceived / results.measuredSeconds);
+    json.key("latencyMicroseconds").beginObject();
+    for (auto const& [name, percentile] : { std::pair{ "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "p99.9", 0.999 }, { "max", 1.0 } })
+    {
+        json.member(name, getPercentile(results.relayLatencies, percentile));
+    }
+    json.endObject();
+    json.endObject();
+
+    json.key("server").beginObject();
+    json.member("inits", results.server.inits);
+    json.member("connects", results.server.connects);
+    json.member("connectAcks", results.server.connectAcks);
+    json.member("discarded", results.server.discarded);
+    json.endObject();
+
+    if (results.discovery.has_value())
+    {
+        json.key("discovery").beginObject();
+        json.member("stunRequests", results.discovery->stunRequests);
+        json.member("httpRequests", results.discovery->httpRequests);
+        json.endObject();
+    }
+    json.endObject();
+    out << '\n';
+}
+
+void writeText(std::ostream& out, PeerchatResults const& results)
+{
+    auto const join = [&results](double const percentile)
+    {
+        return getPercentile(results.joinDurations, percentile).count() / 1000.0;
+    };
+
+    out << "Lobby joins: " << results.joinDurations.size() << '/' << results.joins << " completed, "
+        << results.failed << " failed, " << (results.joinDurations.size() / results.seconds) << " joins/s\n";
+    out << "Join (ms): p50 " << join(0.5) << ", p90 " << join(0.9)
+        << ", p99 " << join(0.99) << ", max " << join(1) << '\n';
+    out << "Server: " << results.server.connections << " connections, " << results.server.lines << " lines, "
+        << results.server.lists << " LIST, " << results.server.joins << " JOIN, "
+        << results.server.topics << " TOPIC, " << results.server.names << " NAMES\n";
+}
+
+void writeJson(std::ostream& out, PeerchatResults const& results)
+{
+    auto json = JsonWriter{ out };
+    json.beginObject();
+    json.key("joins").beginObject();
+    json.member("count", results.joins);
+    json.member("completed", results.joinDurations.size());
+    json.member("failed", results.failed);
+    json.member("perSecond", results.joinDurations.size() / results.seconds);
+    json.key("durationMicroseconds").beginObject();
+    for (auto const& [name, percentile] : { std::pair{ "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "max", 1.0 } })
+    {
+        json.member(name, getPercentile(results.joinDurations, percentile).count());
+    }
+    json.endObject();
+    json.endObject();
+
+    json.key("server").beginObject();
+    json.member("connections", results.server.connections);
+    json.member("lines", results.server.lines);
+    json.member("lists", results.server.lists);
+    json.member("joins", results.server.joins);
+    json.member("topics", results.server.topics);
+    json.member("names", results.server.names);
+    json.endObject();
+    json.endObject();
+    out << '\n';
+}
+
+int main(int argc, char** argv)
+{
+    auto const options = parseOptions(argc, argv);
+    if (!options.has_value())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        if (options->peerchatJoins != 0)
+        {
+            auto const results = runPeerchat(options.value());
+            if (options->json)
+            {
+                writeJson(std::cout, results);
+            }
+            else
+            {
+                writeText(std::cout, results);
+            }
+            return (results.failed == 0) ? 0 : 1;
+        }
+
+        auto const results = run(options.value());
+        if (options->json)
+        {
+            writeJson(std::cout, results);
+        }
+        else
+        {
+            writeText(std::cout, results);
+        }
+        return (results.established == results.pairs) ? 0 : 1;
+    }
+    catch (std::exception const& error)
+    {
+        std::cerr << "Load test failed: " << error.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <precompiled.hpp>
+#include <NatNeg/NatNegPacket.hpp>
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    // Builders of the NatNeg packets exchanged by RA3 clients and the NatNeg server,
+    // laid out the way NatNegPacketView parses them:
+    //      magic (6), version (1), step (1), NatNegID (4), then
+    //      init, initAck, connectAck: port type (1), player ID (1)
+    //      connect: IPv4 address (4), port in network byte order (2)
+    namespace NatNegPackets
+    {
+        using EndPoint = boost::asio::ip::udp::endpoint;
+
+        // Port type of the init sent from the game socket.
+        // The forwarder relies on it to find the public address of the client.
+        inline constexpr auto gamePortType = std::uint8_t{ 0 };
+        inline constexpr auto communicationPortType = std::uint8_t{ 1 };
+
+        inline constexpr auto portTypeOffset = std::size_t{ 12 };
+        inline constexpr auto playerIDOffset = std::size_t{ 13 };
+
+        inline std::string makeHeader(NatNeg::NatNegStep const step, NatNeg::NatNegID const natNegID, std::size_t const size)
+        {
+            auto packet = std::string{ NatNeg::natNegMagic };
+            packet.push_back(3);
+            packet.push_back(static_cast<char>(step));
+            packet.append(reinterpret_cast<char const*>(&natNegID), sizeof(natNegID));
+            packet.resize(size, '\0');
+            return packet;
+        }
+
+        inline std::string makeInit
+        (
+            NatNeg::NatNegStep const step,
+            NatNeg::NatNegID const natNegID,
+            std::uint8_t const portType,
+            std::int8_t const playerID
+        )
+        {
+            auto packet = makeHeader(step, natNegID, 21);
+            packet[portTypeOffset] = static_cast<char>(portType);
+            packet[playerIDOffset] = static_cast<char>(playerID);
+            if (step == NatNeg::NatNegStep::init)
+            {
+                packet.append(NatNeg::gameName);
+                packet.push_back('\0');
+            }
+            return packet;
+        }
+
+        inline std::string makeConnect(NatNeg::NatNegID const natNegID, EndPoint const& remotePlayer)
+        {
+            auto packet = makeHeader(NatNeg::NatNegStep::connect, natNegID, 20);
+            auto const offset = NatNeg::NatNegPacketView::getAddressOffset(NatNeg::NatNegStep::connect).value();
+            auto const ip = remotePlayer.address().to_v4().to_bytes();
+            NatNeg::rewriteAddress(packet, offset, ip, boost::endian::native_to_big(remotePlayer.port()));
+            return packet;
+        }
+
+        inline EndPoint parseConnect(NatNeg::NatNegPacketView const packet)
+        {
+            auto const offset = NatNeg::NatNegPacketView::getAddressOffset(NatNeg::NatNegStep::connect).value();
+            auto const [ip, port] = NatNeg::parseAddress(packet.getView(), offset);
+            return EndPoint{ boost::asio::ip::address_v4{ ip }, boost::endian::big_to_native(port) };
+        }
+    }
+}
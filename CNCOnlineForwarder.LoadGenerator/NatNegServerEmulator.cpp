@@ -0,0 +1,171 @@
+#include "NatNegServerEmulator.hpp"
+#include <precompiled.hpp>
+#include "NatNegPackets.hpp"
+#include <Logging/Logging.hpp>
+
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<NatNegServerEmulator>(level, std::forward<Arguments>(arguments)...);
+        }
+    }
+
+    std::shared_ptr<NatNegServerEmulator> NatNegServerEmulator::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        EndPoint const& endPoint
+    )
+    {
+        auto const self = std::make_shared<NatNegServerEmulator>(PrivateConstructor{}, objectMaker, endPoint);
+        logLine(LogLevel::info, "Listening on ", self->m_socket.local_endpoint());
+        boost::asio::dispatch(self->m_strand, [self] { self->prepareForNextPacket(); });
+        return self;
+    }
+
+    NatNegServerEmulator::NatNegServerEmulator
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        EndPoint const& endPoint
+    ) :
+        m_strand{ objectMaker.makeStrand() },
+        m_socket{ m_strand, endPoint },
+        m_buffer{},
+        m_from{},
+        m_negotiations{},
+        m_inits{ 0 },
+        m_connects{ 0 },
+        m_connectAcks{ 0 },
+        m_discarded{ 0 }
+    {}
+
+    NatNegServerEmulator::Statistics NatNegServerEmulator::getStatistics() const noexcept
+    {
+        return Statistics
+        {
+            m_inits.load(),
+            m_connects.load(),
+            m_connectAcks.load(),
+            m_discarded.load(),
+        };
+    }
+
+    void NatNegServerEmulator::prepareForNextPacket()
+    {
+        m_socket.async_receive_from
+        (
+            boost::asio::buffer(m_buffer),
+            m_from,
+            [self = shared_from_this()](ErrorCode const& code, std::size_t const bytesReceived)
+            {
+                if (code == boost::asio::error::operation_aborted)
+                {
+                    return;
+                }
+
+                if (code.failed())
+                {
+                    logLine(LogLevel::error, "Async receive failed: ", code);
+                }
+                else
+                {
+                    self->handlePacket({ { self->m_buffer.data(), bytesReceived } }, self->m_from);
+                }
+                self->prepareForNextPacket();
+            }
+        );
+    }
+
+    void NatNegServerEmulator::handlePacket(NatNeg::NatNegPacketView const packet, EndPoint const& from)
+    {
+        auto const playerID = packet.isNatNeg() ? packet.getNatNegPlayerID() : std::nullopt;
+        if (!playerID.has_value() || (playerID->playerID < 0) || (playerID->playerID > 1))
+        {
+            ++m_discarded;
+            return;
+        }
+
+        auto const step = packet.getStep();
+        if (step == NatNeg::NatNegStep::connectAck)
+        {
+            ++m_connectAcks;
+            return;
+        }
+
+        if (step != NatNeg::NatNegStep::init)
+        {
+            ++m_discarded;
+            return;
+        }
+
+        ++m_inits;
+        auto const portType = static_cast<std::uint8_t>(packet.getView().at(NatNegPackets::portTypeOffset));
+        auto acknowledgement = packet.copyBuffer();
+        acknowledgement[7] = static_cast<char>(NatNeg::NatNegStep::initAck);
+        send(std::move(acknowledgement), from);
+
+        auto& negotiation = m_negotiations[playerID->natNegID];
+        auto const playerIndex = static_cast<std::size_t>(playerID->playerID);
+        auto& player = negotiation.players[playerIndex];
+        (portType == NatNegPackets::gamePortType ? player.game : player.communication) = from;
+
+        if (negotiation.connected)
+        {
+            sendConnect(playerID->natNegID, negotiation, playerIndex);
+            return;
+        }
+
+        auto const isComplete = std::all_of(negotiation.players.begin(), negotiation.players.end(), [](Player const& candidate)
+        {
+            return candidate.game.has_value() && candidate.communication.has_value();
+        });
+        if (isComplete)
+        {
+            negotiation.connected = true;
+            sendConnect(playerID->natNegID, negotiation, 0);
+            sendConnect(playerID->natNegID, negotiation, 1);
+        }
+    }
+
+    void NatNegServerEmulator::sendConnect
+    (
+        NatNeg::NatNegID const natNegID,
+        Negotiation const& negotiation,
+        std::size_t const playerIndex
+    )
+    {
+        auto const& player = negotiation.players[playerIndex];
+        auto const& remotePlayer = negotiation.players[1 - playerIndex];
+        if (!player.communication.has_value() || !remotePlayer.game.has_value())
+        {
+            return;
+        }
+
+        ++m_connects;
+        send(NatNegPackets::makeConnect(natNegID, remotePlayer.game.value()), player.communication.value());
+    }
+
+    void NatNegServerEmulator::send(std::string data, EndPoint const& to)
+    {
+        auto const buffer = std::make_shared<std::string>(std::move(data));
+        m_socket.async_send_to
+        (
+            boost::asio::buffer(*buffer),
+            to,
+            [buffer](ErrorCode const& code, std::size_t)
+            {
+                if (code.failed() && (code != boost::asio::error::operation_aborted))
+                {
+                    logLine(LogLevel::error, "Async send failed: ", code);
+                }
+            }
+        );
+    }
+}
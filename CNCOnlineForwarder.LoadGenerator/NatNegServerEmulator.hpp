@@ -0,0 +1,79 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <NatNeg/NatNegPacket.hpp>
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    // Local stand-in of natneg.server.cnc-online.net, so the forwarder can be exercised without the live service.
+    // Acknowledges every init, and once both players of a NatNegID sent the inits of
+    // both their game and communication ports, sends each player's communication port
+    // a connect containing the other player's game address.
+    // Inits received after that are answered with the connect again, in case it was lost.
+    class NatNegServerEmulator : public std::enable_shared_from_this<NatNegServerEmulator>
+    {
+    public:
+        using EndPoint = boost::asio::ip::udp::endpoint;
+        using Socket = boost::asio::ip::udp::socket;
+
+        struct Statistics
+        {
+            std::uint64_t inits;
+            std::uint64_t connects;
+            std::uint64_t connectAcks;
+            std::uint64_t discarded;
+        };
+
+    private:
+        struct PrivateConstructor {};
+
+        struct Player
+        {
+            std::optional<EndPoint> game;
+            std::optional<EndPoint> communication;
+        };
+
+        struct Negotiation
+        {
+            std::array<Player, 2> players;
+            bool connected = false;
+        };
+
+        IOManager::StrandType m_strand;
+        Socket m_socket;
+        std::array<char, 1024> m_buffer;
+        EndPoint m_from;
+        std::unordered_map<NatNeg::NatNegID, Negotiation> m_negotiations;
+        std::atomic<std::uint64_t> m_inits;
+        std::atomic<std::uint64_t> m_connects;
+        std::atomic<std::uint64_t> m_connectAcks;
+        std::atomic<std::uint64_t> m_discarded;
+
+    public:
+        static constexpr auto description = "NatNegServerEmulator";
+
+        static std::shared_ptr<NatNegServerEmulator> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            EndPoint const& endPoint
+        );
+
+        NatNegServerEmulator
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            EndPoint const& endPoint
+        );
+
+        Statistics getStatistics() const noexcept;
+
+    private:
+        void prepareForNextPacket();
+
+        void handlePacket(NatNeg::NatNegPacketView const packet, EndPoint const& from);
+
+        void sendConnect(NatNeg::NatNegID const natNegID, Negotiation const& negotiation, std::size_t const playerIndex);
+
+        void send(std::string data, EndPoint const& to);
+    };
+}
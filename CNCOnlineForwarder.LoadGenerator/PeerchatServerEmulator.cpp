@@ -0,0 +1,419 @@
+#include "PeerchatServerEmulator.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+#include <Peerchat/IRCMessage.hpp>
+#include <Peerchat/PeerchatCipher.hpp>
+#include <random>
+
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+using TCP = boost::asio::ip::tcp;
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<PeerchatServerEmulator>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        std::string makeChallenge(std::minstd_rand& random)
+        {
+            constexpr auto characters = std::string_view{ "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789" };
+            auto challenge = std::string(Peerchat::PeerchatCipher::challengeSize, '\0');
+            for (auto& c : challenge)
+            {
+                c = characters[random() % characters.size()];
+            }
+            return challenge;
+        }
+    }
+
+    class PeerchatServerEmulator::Session : public std::enable_shared_from_this<PeerchatServerEmulator::Session>
+    {
+    private:
+        std::weak_ptr<PeerchatServerEmulator> m_server;
+        TCP::socket m_socket;
+        boost::asio::steady_timer m_timer;
+        std::array<char, 4096> m_buffer;
+        std::string m_received;
+        std::optional<Peerchat::PeerchatCipher> m_decrypt;
+        std::optional<Peerchat::PeerchatCipher> m_encrypt;
+        std::string m_sendBuffer;
+        std::string m_writingBuffer;
+        std::string m_nick;
+        bool m_isRegistered;
+        bool m_isClosed;
+
+    public:
+        Session(std::weak_ptr<PeerchatServerEmulator> server, TCP::socket&& socket) :
+            m_server{ std::move(server) },
+            m_socket{ std::move(socket) },
+            m_timer{ m_socket.get_executor() },
+            m_buffer{},
+            m_received{},
+            m_decrypt{},
+            m_encrypt{},
+            m_sendBuffer{},
+            m_writingBuffer{},
+            m_nick{ "*" },
+            m_isRegistered{ false },
+            m_isClosed{ false }
+        {}
+
+        std::string const& getNick() const noexcept { return m_nick; }
+
+        void read()
+        {
+            m_socket.async_read_some
+            (
+                boost::asio::buffer(m_buffer),
+                [self = shared_from_this()](ErrorCode const& code, std::size_t const bytesReceived)
+                {
+                    if (code.failed())
+                    {
+                        return self->close();
+                    }
+                    self->onReceived(bytesReceived, self->m_server.lock());
+                }
+            );
+        }
+
+        // Line without "\r\n"
+        void send(std::string_view const line)
+        {
+            if (m_isClosed)
+            {
+                return;
+            }
+
+            auto const start = m_sendBuffer.size();
+            m_sendBuffer.append(line).append("\r\n");
+            if (m_encrypt.has_value())
+            {
+                m_encrypt->apply(m_sendBuffer.data() + start, m_sendBuffer.size() - start);
+            }
+            write();
+        }
+
+        void close()
+        {
+            if (m_isClosed)
+            {
+                return;
+            }
+            m_isClosed = true;
+
+            auto ignored = ErrorCode{};
+            m_socket.close(ignored);
+            if (auto const server = m_server.lock())
+            {
+                server->leaveAll(shared_from_this(), ":" + getSource() + " QUIT :Quit");
+            }
+        }
+
+    private:
+        std::string getSource() const
+        {
+            return m_nick + "!user@127.0.0.1";
+        }
+
+        void onReceived(std::size_t const size, std::shared_ptr<PeerchatServerEmulator> const& server)
+        {
+            if (m_decrypt.has_value())
+            {
+                m_decrypt->apply(m_buffer.data(), size);
+            }
+            m_received.append(m_buffer.data(), size);
+
+            if (!server || (server->m_replyDelay.count() == 0))
+            {
+                return handleLines();
+            }
+            m_timer.expires_after(server->m_replyDelay);
+            m_timer.async_wait([self = shared_from_this()](ErrorCode const&)
+            {
+                self->handleLines();
+            });
+        }
+
+        void handleLines()
+        {
+            auto position = std::size_t{ 0 };
+            for (auto end = m_received.find('\n'); end != m_received.npos; end = m_received.find('\n', position))
+            {
+                auto const line = m_received.substr(position, end + 1 - position);
+                position = end + 1;
+                handle(line);
+                if (m_isClosed)
+                {
+                    return;
+                }
+            }
+            m_received.erase(0, position);
+            read();
+        }
+
+        void handle(std::string_view const line)
+        {
+            auto const server = m_server.lock();
+            auto const message = Peerchat::IRCMessage::parse(line);
+            if (!server || !message.has_value())
+            {
+                return;
+            }
+
+            ++server->m_lines;
+            auto const& command = message->command;
+            auto const& target = message->getParameter(0);
+            if (command == "CRYPT")
+            {
+                // The client encrypts with the first key, the server with the second
+                auto random = std::minstd_rand{ static_cast<std::minstd_rand::result_type>(server->m_connections.load()) };
+                auto const clientKey = makeChallenge(random);
+                auto const serverKey = makeChallenge(random);
+                send(":s 705 * " + clientKey + " " + serverKey);
+                m_decrypt.emplace(clientKey, server->m_secretKey);
+                m_encrypt.emplace(serverKey, server->m_secretKey);
+            }
+            else if (command == "NICK")
+            {
+                m_nick = target;
+            }
+            else if (command == "USER")
+            {
+                m_isRegistered = true;
+                send(":s 001 " + m_nick + " :Welcome to the Matrix " + m_nick);
+            }
+            else if (command == "PING")
+            {
+                send(":s PONG s :" + target);
+            }
+            else if (command == "QUIT")
+            {
+                close();
+            }
+            else if (!m_isRegistered)
+            {
+                send(":s 451 " + m_nick + " :You have not registered");
+            }
+            else if (command == "LIST")
+            {
+                ++server->m_lists;
+                send(":s 321 " + m_nick + " Channel :Users  Name");
+                for (auto const& channel : server->m_channels)
+                {
+                    auto const count = channel.members.size() + channel.sessions.size();
+                    send(":s 322 " + m_nick + " " + channel.name + " " + std::to_string(count) + " :" + channel.topic);
+                }
+                send(":s 323 " + m_nick + " :End of /LIST");
+            }
+            else if (auto const channel = server->findChannel(target); channel == nullptr)
+            {
+                send(":s 403 " + m_nick + " " + target + " :No such channel");
+            }
+            else if (command == "JOIN")
+            {
+                ++server->m_joins;
+                channel->sessions.insert(shared_from_this());
+                auto const join = ":" + getSource() + " JOIN :" + channel->name;
+                for (auto const& session : channel->sessions)
+                {
+                    session->send(join);
+                }
+                sendTopic(*channel);
+                sendNames(*channel);
+            }
+            else if (command == "PART")
+            {
+                auto const part = ":" + getSource() + " PART " + channel->name + " :Leaving";
+                for (auto const& session : channel->sessions)
+                {
+                    session->send(part);
+                }
+                channel->sessions.erase(shared_from_this());
+            }
+            else if (command == "NAMES")
+            {
+                ++server->m_names;
+                sendNames(*channel);
+            }
+            else if (command == "TOPIC")
+            {
+                ++server->m_topics;
+                sendTopic(*channel);
+            }
+        }
+
+        void sendTopic(Channel const& channel)
+        {
+            send(":s 332 " + m_nick + " " + channel.name + " :" + channel.topic);
+            send(":s 333 " + m_nick + " " + channel.name + " SERVER 1700000000");
+        }
+
+        void sendNames(Channel const& channel)
+        {
+            auto names = std::string{};
+            auto const flush = [this, &channel, &names]
+            {
+                send(":s 353 " + m_nick + " = " + channel.name + " :" + names);
+                names.clear();
+            };
+            auto const add = [&names, &flush](std::string const& nick)
+            {
+                if (names.size() + nick.size() > 400)
+                {
+                    flush();
+                }
+                names.append(names.empty() ? 0 : 1, ' ').append(nick);
+            };
+            for (auto const& member : channel.members)
+            {
+                add(member);
+            }
+            for (auto const& session : channel.sessions)
+            {
+                add(session->getNick());
+            }
+            if (!names.empty())
+            {
+                flush();
+            }
+            send(":s 366 " + m_nick + " " + channel.name + " :End of /NAMES list.");
+        }
+
+        void write()
+        {
+            if (!m_writingBuffer.empty() || m_sendBuffer.empty())
+            {
+                return;
+            }
+
+            std::swap(m_writingBuffer, m_sendBuffer);
+            boost::asio::async_write
+            (
+                m_socket,
+                boost::asio::buffer(m_writingBuffer),
+                [self = shared_from_this()](ErrorCode const& code, std::size_t const /* bytesSent */)
+                {
+                    self->m_writingBuffer.clear();
+                    if (code.failed())
+                    {
+                        return self->close();
+                    }
+                    self->write();
+                }
+            );
+        }
+    };
+
+    std::shared_ptr<PeerchatServerEmulator> PeerchatServerEmulator::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        Options const& options
+    )
+    {
+        auto const self = std::make_shared<PeerchatServerEmulator>(PrivateConstructor{}, objectMaker, options);
+        logLine(LogLevel::info, "Listening on ", self->m_acceptor.local_endpoint());
+        boost::asio::dispatch(self->m_strand, [self] { self->prepareForNextConnection(); });
+        return self;
+    }
+
+    PeerchatServerEmulator::PeerchatServerEmulator
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        Options const& options
+    ) :
+        m_strand{ objectMaker.makeStrand() },
+        m_acceptor{ m_strand, options.endPoint },
+        m_secretKey{ options.secretKey },
+        m_replyDelay{ options.replyDelay },
+        m_channels{},
+        m_connections{ 0 },
+        m_lines{ 0 },
+        m_lists{ 0 },
+        m_names{ 0 },
+        m_topics{ 0 },
+        m_joins{ 0 }
+    {
+        for (auto i = std::size_t{ 0 }; i < options.channelCount; ++i)
+        {
+            auto channel = Channel{ "#GPG!" + std::to_string(i + 1), "Lobby " + std::to_string(i + 1), {}, {} };
+            for (auto j = std::size_t{ 0 }; j < options.membersPerChannel; ++j)
+            {
+                channel.members.push_back("player" + std::to_string(i + 1) + "_" + std::to_string(j + 1));
+            }
+            m_channels.push_back(std::move(channel));
+        }
+    }
+
+    PeerchatServerEmulator::Statistics PeerchatServerEmulator::getStatistics() const noexcept
+    {
+        return Statistics
+        {
+            m_connections.load(),
+            m_lines.load(),
+            m_lists.load(),
+            m_names.load(),
+            m_topics.load(),
+            m_joins.load(),
+        };
+    }
+
+    void PeerchatServerEmulator::prepareForNextConnection()
+    {
+        m_acceptor.async_accept
+        (
+            m_strand,
+            [self = shared_from_this()](ErrorCode const& code, TCP::socket socket)
+            {
+                if (code == boost::asio::error::operation_aborted)
+                {
+                    return;
+                }
+
+                self->prepareForNextConnection();
+                if (code.failed())
+                {
+                    logLine(LogLevel::error, "Accept failed: ", code);
+                    return;
+                }
+
+                ++self->m_connections;
+                auto ignored = ErrorCode{};
+                socket.set_option(TCP::no_delay{ true }, ignored);
+                std::make_shared<Session>(self, std::move(socket))->read();
+            }
+        );
+    }
+
+    PeerchatServerEmulator::Channel* PeerchatServerEmulator::findChannel(std::string_view const name)
+    {
+        auto const lowerCase = Peerchat::toLowerCase(name);
+        for (auto& channel : m_channels)
+        {
+            if (Peerchat::toLowerCase(channel.name) == lowerCase)
+            {
+                return &channel;
+            }
+        }
+        return nullptr;
+    }
+
+    void PeerchatServerEmulator::leaveAll(std::shared_ptr<Session> const& session, std::string const& line)
+    {
+        for (auto& channel : m_channels)
+        {
+            if (channel.sessions.erase(session) != 0)
+            {
+                for (auto const& other : channel.sessions)
+                {
+                    other->send(line);
+                }
+            }
+        }
+    }
+}
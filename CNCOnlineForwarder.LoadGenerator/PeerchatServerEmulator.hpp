@@ -0,0 +1,88 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    // Local stand-in of peerchat.server.cnc-online.net, so the peerchat relay of the forwarder
+    // can be exercised without the live service:
+    //      CNCOnlineForwarder.Exe --peerchat-port 6667 --peerchat-server 127.0.0.1:6668 --peerchat-lobby-cache 1
+    // Speaks the GameSpy flavour of IRC: CRYPT then encrypted NICK, USER, LIST, JOIN, NAMES, TOPIC, PART, PING and QUIT.
+    // Hosts `channelCount` lobbies, each with `membersPerChannel` players who never leave.
+    class PeerchatServerEmulator : public std::enable_shared_from_this<PeerchatServerEmulator>
+    {
+    public:
+        using EndPoint = boost::asio::ip::tcp::endpoint;
+        using Acceptor = boost::asio::ip::tcp::acceptor;
+
+        struct Options
+        {
+            EndPoint endPoint;
+            std::string secretKey;
+            std::size_t channelCount = 8;
+            std::size_t membersPerChannel = 50;
+            // Before handling what a client sent, like the round trip to the real server
+            std::chrono::milliseconds replyDelay{ 0 };
+        };
+
+        struct Statistics
+        {
+            std::uint64_t connections;
+            std::uint64_t lines;
+            std::uint64_t lists;
+            std::uint64_t names;
+            std::uint64_t topics;
+            std::uint64_t joins;
+        };
+
+    private:
+        struct PrivateConstructor {};
+        class Session;
+
+        struct Channel
+        {
+            std::string name;
+            std::string topic;
+            std::vector<std::string> members;
+            std::unordered_set<std::shared_ptr<Session>> sessions;
+        };
+
+        IOManager::StrandType m_strand;
+        Acceptor m_acceptor;
+        std::string m_secretKey;
+        std::chrono::milliseconds m_replyDelay;
+        // All the sessions share the strand of the emulator
+        std::vector<Channel> m_channels;
+        std::atomic<std::uint64_t> m_connections;
+        std::atomic<std::uint64_t> m_lines;
+        std::atomic<std::uint64_t> m_lists;
+        std::atomic<std::uint64_t> m_names;
+        std::atomic<std::uint64_t> m_topics;
+        std::atomic<std::uint64_t> m_joins;
+
+    public:
+        static constexpr auto description = "PeerchatServerEmulator";
+
+        static std::shared_ptr<PeerchatServerEmulator> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            Options const& options
+        );
+
+        PeerchatServerEmulator
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            Options const& options
+        );
+
+        Statistics getStatistics() const noexcept;
+
+    private:
+        void prepareForNextConnection();
+
+        Channel* findChannel(std::string_view const name);
+
+        void leaveAll(std::shared_ptr<Session> const& session, std::string const& line);
+    };
+}
@@ -0,0 +1,95 @@
+#include "PublicAddressEmulator.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+#include <Utility/StunMessage.hpp>
+
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<PublicAddressEmulator>(level, std::forward<Arguments>(arguments)...);
+        }
+    }
+
+    std::shared_ptr<PublicAddressEmulator> PublicAddressEmulator::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        EndPoint const& endPoint,
+        AddressV4 const& reportedAddress
+    )
+    {
+        auto const self = std::make_shared<PublicAddressEmulator>(PrivateConstructor{}, objectMaker, endPoint, reportedAddress);
+        logLine(LogLevel::info, "Reporting ", reportedAddress, " on ", self->m_socket.local_endpoint());
+        boost::asio::dispatch(self->m_strand, [self] { self->prepareForNextPacket(); });
+        return self;
+    }
+
+    PublicAddressEmulator::PublicAddressEmulator
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        EndPoint const& endPoint,
+        AddressV4 const& reportedAddress
+    ) :
+        m_strand{ objectMaker.makeStrand() },
+        m_socket{ m_strand, endPoint },
+        m_httpServer{ Admin::AdminServer::create(objectMaker, { endPoint.address(), endPoint.port() }) },
+        m_reportedAddress{ reportedAddress },
+        m_buffer{},
+        m_from{},
+        m_stunRequests{ 0 },
+        m_httpRequests{ std::make_shared<std::atomic<std::uint64_t>>(0) }
+    {
+        // Like api.ipify.org, the address alone
+        m_httpServer->addRoute("/", [reportedAddress, requests = m_httpRequests](Admin::AdminRequest const&, Admin::AdminResponder respond)
+        {
+            ++*requests;
+            respond(Admin::AdminResponse{ 200, "text/plain", reportedAddress.to_string() });
+        });
+    }
+
+    PublicAddressEmulator::Statistics PublicAddressEmulator::getStatistics() const noexcept
+    {
+        return Statistics{ m_stunRequests.load(), m_httpRequests->load() };
+    }
+
+    void PublicAddressEmulator::prepareForNextPacket()
+    {
+        m_socket.async_receive_from
+        (
+            boost::asio::buffer(m_buffer),
+            m_from,
+            [self = shared_from_this()](ErrorCode const& code, std::size_t const bytesReceived)
+            {
+                if (code == boost::asio::error::operation_aborted)
+                {
+                    return;
+                }
+
+                if (code.failed())
+                {
+                    logLine(LogLevel::error, "Async receive failed: ", code);
+                }
+                else if (auto const id = Utility::Stun::parseBindingRequest({ self->m_buffer.data(), bytesReceived }); id.has_value())
+                {
+                    ++self->m_stunRequests;
+                    auto const mapped = EndPoint{ self->m_reportedAddress, self->m_from.port() };
+                    auto const response = Utility::Stun::makeBindingResponse(id.value(), mapped);
+                    auto sendCode = ErrorCode{};
+                    self->m_socket.send_to(boost::asio::buffer(response), self->m_from, 0, sendCode);
+                    if (sendCode.failed())
+                    {
+                        logLine(LogLevel::error, "Send failed: ", sendCode);
+                    }
+                }
+                self->prepareForNextPacket();
+            }
+        );
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <Admin/AdminServer.hpp>
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    // Local stand-in of the public address sources of the forwarder (a STUN server and api.ipify.org),
+    // so its discovery can be exercised without the internet:
+    //      CNCOnlineForwarder.Exe --public-address-source stun:127.0.0.1:27903 --public-address-source http:127.0.0.1:27903
+    // Answers STUN binding requests on the UDP port and HTTP GETs on the TCP port of `endPoint`,
+    // both with `reportedAddress`.
+    class PublicAddressEmulator : public std::enable_shared_from_this<PublicAddressEmulator>
+    {
+    public:
+        using AddressV4 = boost::asio::ip::address_v4;
+        using EndPoint = boost::asio::ip::udp::endpoint;
+        using Socket = boost::asio::ip::udp::socket;
+
+        struct Statistics
+        {
+            std::uint64_t stunRequests;
+            std::uint64_t httpRequests;
+        };
+
+    private:
+        struct PrivateConstructor {};
+
+        IOManager::StrandType m_strand;
+        Socket m_socket;
+        std::shared_ptr<Admin::AdminServer> m_httpServer;
+        AddressV4 m_reportedAddress;
+        std::array<char, 512> m_buffer;
+        EndPoint m_from;
+        std::atomic<std::uint64_t> m_stunRequests;
+        std::shared_ptr<std::atomic<std::uint64_t>> m_httpRequests;
+
+    public:
+        static constexpr auto description = "PublicAddressEmulator";
+
+        static std::shared_ptr<PublicAddressEmulator> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            EndPoint const& endPoint,
+            AddressV4 const& reportedAddress
+        );
+
+        PublicAddressEmulator
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            EndPoint const& endPoint,
+            AddressV4 const& reportedAddress
+        );
+
+        Statistics getStatistics() const noexcept;
+
+    private:
+        void prepareForNextPacket();
+    };
+}
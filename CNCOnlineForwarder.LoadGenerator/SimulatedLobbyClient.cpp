@@ -0,0 +1,129 @@
+#include "SimulatedLobbyClient.hpp"
+#include <precompiled.hpp>
+
+using ErrorCode = boost::system::error_code;
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    SimulatedLobbyClient::SimulatedLobbyClient(Options const& options) :
+        m_options{ options },
+        m_context{},
+        m_socket{ m_context },
+        m_buffer{},
+        m_received{},
+        m_encrypt{},
+        m_decrypt{},
+        m_deadline{}
+    {}
+
+    SimulatedLobbyClient::Clock::duration SimulatedLobbyClient::joinLobby
+    (
+        std::string const& nick,
+        std::string const& channel
+    )
+    {
+        m_deadline = Clock::now() + m_options.timeout;
+        m_socket.connect(m_options.forwarder);
+        m_socket.set_option(boost::asio::ip::tcp::no_delay{ true });
+
+        send("CRYPT des 1 " + m_options.gameName);
+        auto const keys = receiveUntil({ "705" });
+        m_encrypt.emplace(keys.getParameter(1), m_options.secretKey);
+        m_decrypt.emplace(keys.getParameter(2), m_options.secretKey);
+        // What followed the keys was already encrypted
+        m_decrypt->apply(m_received.data(), m_received.size());
+
+        send("NICK " + nick);
+        send("USER X14saFv19X|1 127.0.0.1 peerchat.gamespy.com :" + nick);
+        receiveUntil({ "001" });
+
+        auto const startedAt = Clock::now();
+        send("LIST");
+        receiveUntil({ "323" });
+        send("JOIN " + channel);
+        receiveUntil({ "366" });
+        send("TOPIC " + channel);
+        receiveUntil({ "333", "331" });
+        send("NAMES " + channel);
+        receiveUntil({ "366" });
+        auto const duration = Clock::now() - startedAt;
+
+        send("PART " + channel + " :Leaving");
+        send("QUIT :Later!");
+        auto ignored = ErrorCode{};
+        m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ignored);
+        m_socket.close(ignored);
+        return duration;
+    }
+
+    void SimulatedLobbyClient::send(std::string const& line)
+    {
+        auto data = line + "\r\n";
+        if (m_encrypt.has_value())
+        {
+            m_encrypt->apply(data.data(), data.size());
+        }
+        boost::asio::write(m_socket, boost::asio::buffer(data));
+    }
+
+    Peerchat::IRCMessage SimulatedLobbyClient::receiveUntil(std::initializer_list<std::string_view> const commands)
+    {
+        while (true)
+        {
+            for (auto end = m_received.find('\n'); end != m_received.npos; end = m_received.find('\n'))
+            {
+                auto message = Peerchat::IRCMessage::parse(std::string_view{ m_received }.substr(0, end + 1));
+                m_received.erase(0, end + 1);
+                if (!message.has_value())
+                {
+                    continue;
+                }
+                if (std::find(commands.begin(), commands.end(), message->command) != commands.end())
+                {
+                    return std::move(message.value());
+                }
+                if (message->command == "PING")
+                {
+                    send("PONG :" + message->getParameter(0));
+                }
+            }
+            receive();
+        }
+    }
+
+    void SimulatedLobbyClient::receive()
+    {
+        auto code = ErrorCode{};
+        auto received = std::optional<std::size_t>{};
+        m_socket.async_read_some
+        (
+            boost::asio::buffer(m_buffer),
+            [&code, &received](ErrorCode const& result, std::size_t const size)
+            {
+                code = result;
+                received = size;
+            }
+        );
+        m_context.restart();
+        m_context.run_until(m_deadline);
+        if (!received.has_value())
+        {
+            // Wait for the cancelled operation, it refers to this stack frame
+            m_socket.cancel();
+            m_context.restart();
+            m_context.run();
+            throw std::runtime_error{ "Timed out" };
+        }
+        if (code.failed())
+        {
+            throw boost::system::system_error{ code };
+        }
+
+        auto const start = m_received.size();
+        m_received.append(m_buffer.data(), received.value());
+        if (m_decrypt.has_value())
+        {
+            m_decrypt->apply(m_received.data() + start, received.value());
+        }
+    }
+}
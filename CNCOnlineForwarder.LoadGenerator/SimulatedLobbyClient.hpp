@@ -0,0 +1,52 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Peerchat/IRCMessage.hpp>
+#include <Peerchat/PeerchatCipher.hpp>
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    // A player joining a lobby through the peerchat relay of the forwarder:
+    // CRYPT, NICK and USER, then the queries of the lobby screen (LIST, JOIN, TOPIC and NAMES),
+    // each one waiting for the end of the previous reply, then PART and QUIT.
+    // Blocking, meant to be run on its own thread; throws if the forwarder fails or is too slow.
+    class SimulatedLobbyClient
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using EndPoint = boost::asio::ip::tcp::endpoint;
+
+        struct Options
+        {
+            EndPoint forwarder;
+            std::string gameName;
+            std::string secretKey;
+            Clock::duration timeout;
+        };
+
+    private:
+        Options const& m_options;
+        boost::asio::io_context m_context;
+        boost::asio::ip::tcp::socket m_socket;
+        std::array<char, 4096> m_buffer;
+        // Decrypted, not a complete line yet
+        std::string m_received;
+        std::optional<Peerchat::PeerchatCipher> m_encrypt;
+        std::optional<Peerchat::PeerchatCipher> m_decrypt;
+        Clock::time_point m_deadline;
+
+    public:
+        explicit SimulatedLobbyClient(Options const& options);
+
+        // Returns: how long the lobby queries took, from LIST to the end of NAMES.
+        Clock::duration joinLobby(std::string const& nick, std::string const& channel);
+
+    private:
+        // Line without "\r\n"
+        void send(std::string const& line);
+
+        // Skips the other messages, like the JOIN of other players
+        Peerchat::IRCMessage receiveUntil(std::initializer_list<std::string_view> const commands);
+
+        void receive();
+    };
+}
@@ -0,0 +1,308 @@
+#include "SimulatedSession.hpp"
+#include <precompiled.hpp>
+#include "NatNegPackets.hpp"
+#include <Logging/Logging.hpp>
+
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+using UDP = boost::asio::ip::udp;
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<SimulatedSession>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        std::int64_t getTimestamp() noexcept
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(SimulatedSession::Clock::now().time_since_epoch()).count();
+        }
+    }
+
+    void LoadStatistics::recordEstablished(Clock::duration const handshakeDuration)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        m_handshakeDurations.push_back(std::chrono::duration_cast<std::chrono::microseconds>(handshakeDuration));
+        m_lastEstablishedAt = Clock::now();
+        ++established;
+    }
+
+    std::vector<std::chrono::microseconds> LoadStatistics::getHandshakeDurations() const
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        return m_handshakeDurations;
+    }
+
+    LoadStatistics::Clock::time_point LoadStatistics::getLastEstablishedAt() const
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        return m_lastEstablishedAt;
+    }
+
+    SimulatedSession::Player::Player(IOManager::StrandType const& strand) :
+        game{ strand, EndPoint{ UDP::v4(), 0 } },
+        communication{ strand, EndPoint{ UDP::v4(), 0 } },
+        remote{},
+        gameBuffer{},
+        communicationBuffer{},
+        gameFrom{},
+        communicationFrom{}
+    {
+        // A full send buffer is counted as a send error instead of stalling the other sessions
+        game.non_blocking(true);
+        communication.non_blocking(true);
+    }
+
+    std::shared_ptr<SimulatedSession> SimulatedSession::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        NatNeg::NatNegID const natNegID,
+        Options const& options,
+        LoadStatistics& statistics
+    )
+    {
+        auto const self = std::make_shared<SimulatedSession>
+        (
+            PrivateConstructor{},
+            objectMaker,
+            natNegID,
+            options,
+            statistics
+        );
+        boost::asio::dispatch(self->m_strand, [self] { self->start(); });
+        return self;
+    }
+
+    SimulatedSession::SimulatedSession
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        NatNeg::NatNegID const natNegID,
+        Options const& options,
+        LoadStatistics& statistics
+    ) :
+        m_strand{ objectMaker.makeStrand() },
+        m_options{ options },
+        m_statistics{ statistics },
+        m_natNegID{ natNegID },
+        m_players{},
+        m_timer{ m_strand },
+        m_state{ State::handshaking },
+        m_startedAt{},
+        m_nextSendAt{},
+        m_gamePacket(std::max(options.packetSize, minPacketSize), 'x'),
+        m_relayLatencies{}
+    {
+        // The first byte is never the first byte of the NatNeg magic
+        m_gamePacket.front() = '\0';
+        m_players.reserve(2);
+        m_players.emplace_back(m_strand);
+        m_players.emplace_back(m_strand);
+    }
+
+    std::vector<std::uint32_t> const& SimulatedSession::getRelayLatencyMicroseconds() const noexcept
+    {
+        return m_relayLatencies;
+    }
+
+    void SimulatedSession::start()
+    {
+        m_startedAt = Clock::now();
+        for (auto i = std::size_t{ 0 }; i < m_players.size(); ++i)
+        {
+            prepareForNextGamePacket(i);
+            prepareForNextCommunicationPacket(i);
+            sendInits(i);
+        }
+        waitForNextTick(m_startedAt + retryInterval);
+    }
+
+    void SimulatedSession::sendInits(std::size_t const playerIndex)
+    {
+        auto& player = m_players[playerIndex];
+        auto const playerID = static_cast<std::int8_t>(playerIndex);
+        // Like the game, the game port first: it tells the forwarder the public address of the client
+        auto const gameInit = NatNegPackets::makeInit(NatNeg::NatNegStep::init, m_natNegID, NatNegPackets::gamePortType, playerID);
+        sendTo(player.game, gameInit, m_options.forwarder);
+        auto const communicationInit = NatNegPackets::makeInit(NatNeg::NatNegStep::init, m_natNegID, NatNegPackets::communicationPortType, playerID);
+        sendTo(player.communication, communicationInit, m_options.forwarder);
+    }
+
+    void SimulatedSession::prepareForNextGamePacket(std::size_t const playerIndex)
+    {
+        auto& player = m_players[playerIndex];
+        player.game.async_receive_from
+        (
+            boost::asio::buffer(player.gameBuffer),
+            player.gameFrom,
+            [self = shared_from_this(), playerIndex](ErrorCode const& code, std::size_t const bytesReceived)
+            {
+                if (code == boost::asio::error::operation_aborted)
+                {
+                    return;
+                }
+
+                if (!code.failed())
+                {
+                    self->handleGamePacket(playerIndex, bytesReceived);
+                }
+                self->prepareForNextGamePacket(playerIndex);
+            }
+        );
+    }
+
+    void SimulatedSession::prepareForNextCommunicationPacket(std::size_t const playerIndex)
+    {
+        auto& player = m_players[playerIndex];
+        player.communication.async_receive_from
+        (
+            boost::asio::buffer(player.communicationBuffer),
+            player.communicationFrom,
+            [self = shared_from_this(), playerIndex](ErrorCode const& code, std::size_t const bytesReceived)
+            {
+                if (code == boost::asio::error::operation_aborted)
+                {
+                    return;
+                }
+
+                if (!code.failed())
+                {
+                    self->handleCommunicationPacket(playerIndex, bytesReceived);
+                }
+                self->prepareForNextCommunicationPacket(playerIndex);
+            }
+        );
+    }
+
+    void SimulatedSession::handleCommunicationPacket(std::size_t const playerIndex, std::size_t const size)
+    {
+        auto& player = m_players[playerIndex];
+        auto const packet = NatNeg::NatNegPacketView{ { player.communicationBuffer.data(), size } };
+        if (!packet.isNatNeg() || (packet.getStep() != NatNeg::NatNegStep::connect))
+        {
+            return;
+        }
+
+        player.remote = NatNegPackets::parseConnect(packet);
+        auto const acknowledgement = NatNegPackets::makeInit
+        (
+            NatNeg::NatNegStep::connectAck,
+            m_natNegID,
+            NatNegPackets::communicationPortType,
+            static_cast<std::int8_t>(playerIndex)
+        );
+        sendTo(player.communication, acknowledgement, m_options.forwarder);
+
+        auto const connected = std::all_of(m_players.begin(), m_players.end(), [](Player const& candidate)
+        {
+            return candidate.remote.has_value();
+        });
+        if ((m_state == State::handshaking) && connected)
+        {
+            m_state = State::established;
+            m_statistics.recordEstablished(Clock::now() - m_startedAt);
+            m_timer.cancel();
+            m_nextSendAt = Clock::now();
+            waitForNextTick(m_nextSendAt);
+        }
+    }
+
+    void SimulatedSession::handleGamePacket(std::size_t const playerIndex, std::size_t const size)
+    {
+        auto const& player = m_players[playerIndex];
+        if ((size < minPacketSize) || (player.gameBuffer.front() != '\0'))
+        {
+            // Most likely, the init acknowledgement
+            return;
+        }
+
+        ++m_statistics.packetsReceived;
+        if (m_statistics.measuring.load(std::memory_order_relaxed))
+        {
+            auto sentAt = std::int64_t{};
+            std::memcpy(&sentAt, player.gameBuffer.data() + 1, sizeof(sentAt));
+            auto const latency = (getTimestamp() - sentAt) / 1000;
+            m_relayLatencies.push_back(static_cast<std::uint32_t>(std::clamp<std::int64_t>(latency, 0, std::numeric_limits<std::uint32_t>::max())));
+        }
+    }
+
+    void SimulatedSession::waitForNextTick(Clock::time_point const at)
+    {
+        m_timer.expires_at(at);
+        m_timer.async_wait([self = shared_from_this()](ErrorCode const& code)
+        {
+            if (code == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+
+            if (code.failed())
+            {
+                logLine(LogLevel::error, "Async wait failed: ", code);
+                return;
+            }
+            self->onTick();
+        });
+    }
+
+    void SimulatedSession::onTick()
+    {
+        if (m_state == State::established)
+        {
+            sendGamePackets();
+            auto const period = std::chrono::duration_cast<Clock::duration>(std::chrono::seconds{ 1 }) / std::max(m_options.packetsPerSecond, 1u);
+            // If we fell behind, skip the missed packets instead of sending them in a burst
+            m_nextSendAt = std::max(m_nextSendAt + period, Clock::now());
+            waitForNextTick(m_nextSendAt);
+            return;
+        }
+
+        if ((Clock::now() - m_startedAt) >= m_options.handshakeTimeout)
+        {
+            logLine(LogLevel::warning, "Handshake of ", m_natNegID, " timed out");
+            m_state = State::failed;
+            ++m_statistics.failed;
+            return;
+        }
+
+        // Like the game, retry until the connect is received
+        for (auto i = std::size_t{ 0 }; i < m_players.size(); ++i)
+        {
+            if (!m_players[i].remote.has_value())
+            {
+                sendInits(i);
+            }
+        }
+        waitForNextTick(Clock::now() + retryInterval);
+    }
+
+    void SimulatedSession::sendGamePackets()
+    {
+        if (m_options.packetsPerSecond == 0)
+        {
+            return;
+        }
+
+        for (auto& player : m_players)
+        {
+            auto const now = getTimestamp();
+            std::memcpy(m_gamePacket.data() + 1, &now, sizeof(now));
+            sendTo(player.game, m_gamePacket, player.remote.value());
+            ++m_statistics.packetsSent;
+        }
+    }
+
+    void SimulatedSession::sendTo(Socket& socket, std::string_view const data, EndPoint const& to)
+    {
+        auto code = ErrorCode{};
+        socket.send_to(boost::asio::buffer(data), to, 0, code);
+        if (code.failed())
+        {
+            ++m_statistics.sendErrors;
+        }
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <NatNeg/NatNegPacket.hpp>
+
+namespace CNCOnlineForwarder::LoadGenerator
+{
+    // Shared by all the simulated sessions
+    class LoadStatistics
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        std::atomic<std::uint64_t> established{ 0 };
+        std::atomic<std::uint64_t> failed{ 0 };
+        std::atomic<std::uint64_t> packetsSent{ 0 };
+        std::atomic<std::uint64_t> packetsReceived{ 0 };
+        std::atomic<std::uint64_t> sendErrors{ 0 };
+        // Relay latencies are only recorded while measuring
+        std::atomic<bool> measuring{ false };
+
+    private:
+        std::mutex mutable m_mutex;
+        std::vector<std::chrono::microseconds> m_handshakeDurations;
+        Clock::time_point m_lastEstablishedAt;
+
+    public:
+        void recordEstablished(Clock::duration const handshakeDuration);
+
+        std::vector<std::chrono::microseconds> getHandshakeDurations() const;
+
+        Clock::time_point getLastEstablishedAt() const;
+    };
+
+    // A pair of simulated RA3 clients, each one with a game socket and a communication socket.
+    // They negotiate through the forwarder like the game does:
+    // both ports send an init, the communication port receives the connect containing
+    // the (rewritten) address of the remote player and acknowledges it.
+    // Once both players are connected, each one sends game packets to the other one
+    // from its game socket, timestamped so the relay latency can be measured.
+    class SimulatedSession : public std::enable_shared_from_this<SimulatedSession>
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using EndPoint = boost::asio::ip::udp::endpoint;
+        using Socket = boost::asio::ip::udp::socket;
+
+        struct Options
+        {
+            EndPoint forwarder;
+            // Of each player
+            unsigned packetsPerSecond;
+            std::size_t packetSize;
+            Clock::duration handshakeTimeout;
+        };
+
+        static constexpr auto retryInterval = std::chrono::seconds{ 1 };
+        static constexpr auto minPacketSize = std::size_t{ 1 + sizeof(std::int64_t) };
+        // Larger game packets would be truncated by the receive buffer
+        static constexpr auto maxPacketSize = std::size_t{ 1024 };
+
+    private:
+        struct PrivateConstructor {};
+
+        enum class State
+        {
+            handshaking,
+            established,
+            failed,
+        };
+
+        struct Player
+        {
+            Socket game;
+            Socket communication;
+            // Where the forwarder told this player to send its game packets
+            std::optional<EndPoint> remote;
+            std::array<char, maxPacketSize> gameBuffer;
+            std::array<char, 1024> communicationBuffer;
+            EndPoint gameFrom;
+            EndPoint communicationFrom;
+
+            explicit Player(IOManager::StrandType const& strand);
+        };
+
+        IOManager::StrandType m_strand;
+        Options const& m_options;
+        LoadStatistics& m_statistics;
+        NatNeg::NatNegID m_natNegID;
+        std::vector<Player> m_players;
+        boost::asio::steady_timer m_timer;
+        State m_state;
+        Clock::time_point m_startedAt;
+        Clock::time_point m_nextSendAt;
+        std::string m_gamePacket;
+        std::vector<std::uint32_t> m_relayLatencies;
+
+    public:
+        static constexpr auto description = "SimulatedSession";
+
+        // The session starts negotiating immediately
+        static std::shared_ptr<SimulatedSession> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            NatNeg::NatNegID const natNegID,
+            Options const& options,
+            LoadStatistics& statistics
+        );
+
+        SimulatedSession
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            NatNeg::NatNegID const natNegID,
+            Options const& options,
+            LoadStatistics& statistics
+        );
+
+        // Must not be called while the session is running
+        std::vector<std::uint32_t> const& getRelayLatencyMicroseconds() const noexcept;
+
+    private:
+        void start();
+
+        void sendInits(std::size_t const playerIndex);
+
+        void prepareForNextGamePacket(std::size_t const playerIndex);
+
+        void prepareForNextCommunicationPacket(std::size_t const playerIndex);
+
+        void handleCommunicationPacket(std::size_t const playerIndex, std::size_t const size);
+
+        void handleGamePacket(std::size_t const playerIndex, std::size_t const size);
+
+        void waitForNextTick(Clock::time_point const at);
+
+        void onTick();
+
+        void sendGamePackets();
+
+        void sendTo(Socket& socket, std::string_view const data, EndPoint const& to);
+    };
+}
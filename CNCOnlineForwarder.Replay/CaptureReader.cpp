@@ -0,0 +1,249 @@
+#include "CaptureReader.hpp"
+#include <precompiled.hpp>
+#include <fstream>
+
+namespace CNCOnlineForwarder::Replay
+{
+    namespace
+    {
+        using Diagnostics::CaptureDirection;
+        using Diagnostics::CaptureInterface;
+        using Diagnostics::PacketCapture;
+
+        constexpr auto sectionHeaderBlock = std::uint32_t{ 0x0A0D0D0A };
+        constexpr auto interfaceDescriptionBlock = std::uint32_t{ 1 };
+        constexpr auto enhancedPacketBlock = std::uint32_t{ 6 };
+        constexpr auto byteOrderMagic = std::uint32_t{ 0x1A2B3C4D };
+        constexpr auto linkTypeIPv4 = std::uint16_t{ 228 };
+        constexpr auto optionEnd = std::uint16_t{ 0 };
+        constexpr auto optionInterfaceName = std::uint16_t{ 2 };
+        constexpr auto optionTimestampResolution = std::uint16_t{ 9 };
+        constexpr auto optionPacketFlags = std::uint16_t{ 2 };
+        constexpr auto udpProtocol = std::uint8_t{ 17 };
+        constexpr auto udpHeaderSize = std::size_t{ 8 };
+
+        struct Interface
+        {
+            std::optional<CaptureInterface> kind;
+            std::uint16_t linkType;
+            // pcapng default: microseconds
+            std::uint8_t timestampResolution = 6;
+        };
+
+        [[noreturn]] void fail(std::string const& reason)
+        {
+            throw std::runtime_error{ "Malformed capture: " + reason };
+        }
+
+        template<typename Integer>
+        Integer read(std::string_view const data, std::size_t const offset)
+        {
+            if ((offset + sizeof(Integer)) > data.size())
+            {
+                fail("truncated block");
+            }
+            auto value = Integer{};
+            std::memcpy(&value, data.data() + offset, sizeof(value));
+            return value;
+        }
+
+        std::uint16_t readBigEndian(std::string_view const data, std::size_t const offset)
+        {
+            return boost::endian::big_to_native(read<std::uint16_t>(data, offset));
+        }
+
+        // Calls visitor(code, value) for each option
+        template<typename Visitor>
+        void readOptions(std::string_view options, Visitor&& visitor)
+        {
+            while (options.size() >= 4)
+            {
+                auto const code = read<std::uint16_t>(options, 0);
+                auto const length = std::size_t{ read<std::uint16_t>(options, 2) };
+                if (code == optionEnd)
+                {
+                    return;
+                }
+                if ((4 + length) > options.size())
+                {
+                    fail("truncated option");
+                }
+                visitor(code, options.substr(4, length));
+                options.remove_prefix(std::min(options.size(), 4 + ((length + 3) & ~std::size_t{ 3 })));
+            }
+        }
+
+        std::optional<CaptureInterface> findInterface(std::string_view const name)
+        {
+            for (auto const kind : { CaptureInterface::natNegProxy, CaptureInterface::publicSocketForClient, CaptureInterface::fakeRemotePlayerSocket })
+            {
+                if (PacketCapture::getInterfaceName(kind) == name)
+                {
+                    return kind;
+                }
+            }
+            return std::nullopt;
+        }
+
+        std::chrono::nanoseconds toNanoseconds(std::uint64_t const ticks, std::uint8_t const resolution)
+        {
+            auto const exponent = resolution & 0x7F;
+            if ((resolution & 0x80) != 0)
+            {
+                // Negative power of 2
+                auto const seconds = static_cast<long double>(ticks) / std::ldexp(1.0L, exponent);
+                return std::chrono::nanoseconds{ static_cast<std::int64_t>(seconds * 1e9L) };
+            }
+
+            auto value = static_cast<std::int64_t>(ticks);
+            for (auto i = exponent; i < 9; ++i)
+            {
+                value *= 10;
+            }
+            for (auto i = 9; i < exponent; ++i)
+            {
+                value /= 10;
+            }
+            return std::chrono::nanoseconds{ value };
+        }
+
+        std::optional<CapturedDatagram> readPacket(std::string_view const body, std::vector<Interface> const& interfaces)
+        {
+            auto const interfaceID = read<std::uint32_t>(body, 0);
+            if (interfaceID >= interfaces.size())
+            {
+                fail("packet of an undescribed interface");
+            }
+            auto const& interface = interfaces[interfaceID];
+            if (!interface.kind.has_value() || (interface.linkType != linkTypeIPv4))
+            {
+                return std::nullopt;
+            }
+
+            auto const ticks = (std::uint64_t{ read<std::uint32_t>(body, 4) } << 32) | read<std::uint32_t>(body, 8);
+            auto const capturedLength = std::size_t{ read<std::uint32_t>(body, 12) };
+            if ((20 + capturedLength) > body.size())
+            {
+                fail("truncated packet");
+            }
+            auto const packet = body.substr(20, capturedLength);
+
+            auto direction = std::optional<CaptureDirection>{};
+            readOptions(body.substr(20 + ((capturedLength + 3) & ~std::size_t{ 3 })), [&direction](std::uint16_t const code, std::string_view const value)
+            {
+                if ((code == optionPacketFlags) && (value.size() == sizeof(std::uint32_t)))
+                {
+                    auto const flags = read<std::uint32_t>(value, 0) & 3;
+                    if ((flags == 1) || (flags == 2))
+                    {
+                        direction = static_cast<CaptureDirection>(flags);
+                    }
+                }
+            });
+            if (!direction.has_value())
+            {
+                return std::nullopt;
+            }
+
+            auto const headerSize = std::size_t{ (read<std::uint8_t>(packet, 0) & 0x0Fu) * 4u };
+            if ((read<std::uint8_t>(packet, 9) != udpProtocol) || ((headerSize + udpHeaderSize) > packet.size()))
+            {
+                return std::nullopt;
+            }
+            auto const source = boost::asio::ip::address_v4{ boost::endian::big_to_native(read<std::uint32_t>(packet, 12)) };
+            auto const destination = boost::asio::ip::address_v4{ boost::endian::big_to_native(read<std::uint32_t>(packet, 16)) };
+            auto const sourcePort = readBigEndian(packet, headerSize);
+            auto const destinationPort = readBigEndian(packet, headerSize + 2);
+
+            auto const inbound = (direction == CaptureDirection::inbound);
+            return CapturedDatagram
+            {
+                toNanoseconds(ticks, interface.timestampResolution),
+                interface.kind.value(),
+                direction.value(),
+                inbound ? destinationPort : sourcePort,
+                inbound ? CapturedDatagram::EndPoint{ source, sourcePort } : CapturedDatagram::EndPoint{ destination, destinationPort },
+                std::string{ packet.substr(headerSize + udpHeaderSize) },
+            };
+        }
+    }
+
+    std::vector<CapturedDatagram> readCapture(std::string const& path)
+    {
+        auto file = std::ifstream{ path, std::ios::binary };
+        if (!file)
+        {
+            throw std::runtime_error{ "Cannot open capture " + path };
+        }
+        auto const content = std::string{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+        auto const data = std::string_view{ content };
+
+        auto datagrams = std::vector<CapturedDatagram>{};
+        auto interfaces = std::vector<Interface>{};
+        auto inSection = false;
+        auto offset = std::size_t{ 0 };
+        // Blocks still being written when the forwarder was stopped are ignored
+        while ((offset + 12) <= data.size())
+        {
+            auto const type = read<std::uint32_t>(data, offset);
+            auto const length = std::size_t{ read<std::uint32_t>(data, offset + 4) };
+            if ((length < 12) || ((length % 4) != 0))
+            {
+                fail("invalid block length");
+            }
+            if ((offset + length) > data.size())
+            {
+                break;
+            }
+            auto const body = data.substr(offset + 8, length - 12);
+            offset += length;
+
+            if (type == sectionHeaderBlock)
+            {
+                if (read<std::uint32_t>(body, 0) != byteOrderMagic)
+                {
+                    throw std::runtime_error{ "Captures written in another byte order are not supported" };
+                }
+                interfaces.clear();
+                inSection = true;
+                continue;
+            }
+
+            if (!inSection)
+            {
+                fail("missing section header");
+            }
+
+            if (type == interfaceDescriptionBlock)
+            {
+                auto interface = Interface{};
+                interface.linkType = read<std::uint16_t>(body, 0);
+                readOptions(body.substr(std::min<std::size_t>(8, body.size())), [&interface](std::uint16_t const code, std::string_view const value)
+                {
+                    if (code == optionInterfaceName)
+                    {
+                        interface.kind = findInterface(value);
+                    }
+                    else if ((code == optionTimestampResolution) && (value.size() == 1))
+                    {
+                        interface.timestampResolution = static_cast<std::uint8_t>(value.front());
+                    }
+                });
+                interfaces.push_back(interface);
+            }
+            else if (type == enhancedPacketBlock)
+            {
+                if (auto datagram = readPacket(body, interfaces); datagram.has_value())
+                {
+                    datagrams.push_back(std::move(datagram.value()));
+                }
+            }
+        }
+
+        std::stable_sort(datagrams.begin(), datagrams.end(), [](CapturedDatagram const& a, CapturedDatagram const& b)
+        {
+            return a.timestamp < b.timestamp;
+        });
+        return datagrams;
+    }
+}
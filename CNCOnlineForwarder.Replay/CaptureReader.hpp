@@ -0,0 +1,30 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/PacketCapture.hpp>
+
+namespace CNCOnlineForwarder::Replay
+{
+    struct CapturedDatagram
+    {
+        using EndPoint = boost::asio::ip::udp::endpoint;
+
+        // Since the Unix epoch
+        std::chrono::nanoseconds timestamp;
+        Diagnostics::CaptureInterface interface;
+        Diagnostics::CaptureDirection direction;
+        // Port of the forwarder's socket
+        std::uint16_t localPort;
+        // The other side: client, remote player or NatNeg server
+        EndPoint remote;
+        // Truncated to the snap length of the capture
+        std::string data;
+    };
+
+    // Reads the pcapng files written by Diagnostics::PacketCapture.
+    // Only understands what PacketCapture writes: sections in the byte order of this machine,
+    // raw IPv4 interfaces named after the CaptureInterface values, and enhanced packet blocks.
+    // Other blocks are skipped.
+    // Throws: std::runtime_error if the file cannot be read or is malformed.
+    // Returns: the datagrams, sorted by timestamp.
+    std::vector<CapturedDatagram> readCapture(std::string const& path);
+}
@@ -0,0 +1,282 @@
+#include <precompiled.hpp>
+#include "CaptureReader.hpp"
+#include "NatNegServerEmulator.hpp"
+#include "Replayer.hpp"
+#include <IOManager.hpp>
+#include <Utility/JsonWriter.hpp>
+#include <Utility/ParseNumber.hpp>
+#include <iostream>
+#include <random>
+
+// Replays a capture of the forwarder (CNCOnlineForwarder.Exe --capture) on the local machine.
+// Hosts a NatNeg server emulator, like the load generator, then sends what the clients
+// of the capture sent, with the original timing (--speed 1), faster or slower,
+// or as fast as possible (--speed 0). The forwarder must be started with the emulator
+// as its NatNeg server, and without public address lookup:
+//      CNCOnlineForwarder.Exe --natneg-server 127.0.0.1 --natneg-server-port 27902 --public-address 127.0.0.1
+//      CNCOnlineForwarder.Replay --capture incident.pcapng --speed 0
+
+using CNCOnlineForwarder::IOManager;
+using CNCOnlineForwarder::LoadGenerator::NatNegServerEmulator;
+using CNCOnlineForwarder::Replay::readCapture;
+using CNCOnlineForwarder::Replay::Replayer;
+using CNCOnlineForwarder::Utility::JsonWriter;
+using CNCOnlineForwarder::Utility::parseNumber;
+using CNCOnlineForwarder::Utility::parsePort;
+
+using EndPoint = boost::asio::ip::udp::endpoint;
+
+struct Options
+{
+    std::string capture;
+    EndPoint forwarder{ boost::asio::ip::address_v4::loopback(), 27901 };
+    EndPoint server{ boost::asio::ip::address_v4::loopback(), 27902 };
+    double speed = 1;
+    std::chrono::seconds settleTimeout{ 10 };
+    unsigned threads = 2;
+    bool json = false;
+};
+
+struct Results
+{
+    Replayer::Results replay;
+    NatNegServerEmulator::Statistics server;
+};
+
+void printUsage(char const* program)
+{
+    std::cerr << "Usage: " << program
+        << " --capture FILE.pcapng [--forwarder IPV4] [--forwarder-port PORT] [--server-port PORT]"
+        << " [--speed FACTOR, 0 for as fast as possible] [--settle-timeout SECONDS] [--threads COUNT] [--json 0|1]\n";
+}
+
+std::optional<Options> parseOptions(int const argc, char** const argv)
+{
+    auto options = Options{};
+    for (auto i = 1; i < argc; ++i)
+    {
+        auto const argument = std::string_view{ argv[i] };
+        if ((i + 1) >= argc)
+        {
+            return std::nullopt;
+        }
+        auto const value = argv[++i];
+        auto const invalidValue = [argument, value]
+        {
+            std::cerr << "Invalid value for " << argument << ": " << value << '\n';
+            return std::nullopt;
+        };
+        if (argument == "--capture")
+        {
+            options.capture = value;
+        }
+        else if (argument == "--forwarder")
+        {
+            auto code = boost::system::error_code{};
+            options.forwarder.address(boost::asio::ip::make_address_v4(value, code));
+            if (code.failed())
+            {
+                return std::nullopt;
+            }
+        }
+        else if (argument == "--forwarder-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.forwarder.port(port.value());
+        }
+        else if (argument == "--server-port")
+        {
+            auto const port = parsePort(value);
+            if (!port.has_value())
+            {
+                return invalidValue();
+            }
+            options.server.port(port.value());
+        }
+        else if (argument == "--speed")
+        {
+            auto const speed = parseNumber<double>(value, 0);
+            if (!speed.has_value())
+            {
+                return invalidValue();
+            }
+            options.speed = speed.value();
+        }
+        else if (argument == "--settle-timeout")
+        {
+            auto const seconds = parseNumber<std::chrono::seconds::rep>(value, 0);
+            if (!seconds.has_value())
+            {
+                return invalidValue();
+            }
+            options.settleTimeout = std::chrono::seconds{ seconds.value() };
+        }
+        else if (argument == "--threads")
+        {
+            auto const threads = parseNumber<unsigned>(value, 1);
+            if (!threads.has_value())
+            {
+                return invalidValue();
+            }
+            options.threads = threads.value();
+        }
+        else if (argument == "--json")
+        {
+            options.json = std::string_view{ value } != "0";
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    if (options.capture.empty())
+    {
+        return std::nullopt;
+    }
+    return options;
+}
+
+std::chrono::microseconds getPercentile(std::vector<std::chrono::microseconds> const& sorted, double const percentile)
+{
+    if (sorted.empty())
+    {
+        return {};
+    }
+    auto const index = static_cast<std::size_t>(percentile * static_cast<double>(sorted.size() - 1));
+    return sorted[index];
+}
+
+double toSeconds(std::chrono::nanoseconds const duration)
+{
+    return std::chrono::duration<double>{ duration }.count();
+}
+
+Results run(Options const& options)
+{
+    auto const capture = readCapture(options.capture);
+    auto const ioManager = IOManager::create();
+    auto const objectMaker = IOManager::ObjectMaker{ ioManager };
+    auto const server = NatNegServerEmulator::create(objectMaker, options.server);
+    // NatNegIDs of previous runs might still be known by the forwarder
+    auto const natNegIDOffset = static_cast<CNCOnlineForwarder::NatNeg::NatNegID>(std::random_device{}());
+    auto const replayer = Replayer::create
+    (
+        objectMaker,
+        capture,
+        natNegIDOffset,
+        Replayer::Options{ options.forwarder, options.speed, options.settleTimeout }
+    );
+
+    auto workers = std::vector<std::future<std::size_t>>{};
+    for (auto i = 0u; i < options.threads; ++i)
+    {
+        workers.push_back(std::async(std::launch::async, [ioManager] { return ioManager->run(); }));
+    }
+
+    auto results = Results{};
+    results.replay = replayer->start().get();
+    results.server = server->getStatistics();
+
+    ioManager->stop();
+    for (auto& worker : workers)
+    {
+        worker.get();
+    }
+    return results;
+}
+
+void writeText(std::ostream& out, Options const& options, Results const& results)
+{
+    auto const& replay = results.replay;
+    auto const lateness = [&replay](double const percentile)
+    {
+        return getPercentile(replay.lateness, percentile).count() / 1000.0;
+    };
+    auto const replaySeconds = toSeconds(replay.replayDuration);
+
+    out << "Capture: " << replay.datagrams << " datagrams of " << replay.clients << " clients over "
+        << toSeconds(replay.captureDuration) << " s\n";
+    out << "Replay: " << replay.sent << " sent in " << replaySeconds << " s ("
+        << (replay.sent / std::max(replaySeconds, 1e-9)) << " datagrams/s), "
+        << replay.heldBack << " held back, " << replay.unsent << " not sent, "
+        << replay.sendErrors << " send errors, " << replay.received << " received\n";
+    if (options.speed > 0)
+    {
+        out << "Lateness (ms): p50 " << lateness(0.5) << ", p99 " << lateness(0.99) << ", max " << lateness(1) << '\n';
+    }
+    out << "Server: " << results.server.inits << " inits, " << results.server.connects << " connects, "
+        << results.server.connectAcks << " connect acks, " << results.server.discarded << " discarded\n";
+}
+
+void writeJson(std::ostream& out, Options const& options, Results const& results)
+{
+    auto const& replay = results.replay;
+    auto const replaySeconds = toSeconds(replay.replayDuration);
+    auto json = JsonWriter{ out };
+    json.beginObject();
+    json.key("capture").beginObject();
+    json.member("datagrams", replay.datagrams);
+    json.member("clients", replay.clients);
+    json.member("seconds", toSeconds(replay.captureDuration));
+    json.endObject();
+
+    json.key("replay").beginObject();
+    json.member("speed", options.speed);
+    json.member("seconds", replaySeconds);
+    json.member("sent", replay.sent);
+    json.member("perSecond", replay.sent / std::max(replaySeconds, 1e-9));
+    json.member("heldBack", replay.heldBack);
+    json.member("unsent", replay.unsent);
+    json.member("sendErrors", replay.sendErrors);
+    json.member("received", replay.received);
+    json.key("latenessMicroseconds").beginObject();
+    for (auto const& [name, percentile] : { std::pair{ "p50", 0.5 }, { "p99", 0.99 }, { "max", 1.0 } })
+    {
+        json.member(name, getPercentile(replay.lateness, percentile).count());
+    }
+    json.endObject();
+    json.endObject();
+
+    json.key("server").beginObject();
+    json.member("inits", results.server.inits);
+    json.member("connects", results.server.connects);
+    json.member("connectAcks", results.server.connectAcks);
+    json.member("discarded", results.server.discarded);
+    json.endObject();
+    json.endObject();
+    out << '\n';
+}
+
+int main(int argc, char** argv)
+{
+    auto const options = parseOptions(argc, argv);
+    if (!options.has_value())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        auto const results = run(options.value());
+        if (options->json)
+        {
+            writeJson(std::cout, options.value(), results);
+        }
+        else
+        {
+            writeText(std::cout, options.value(), results);
+        }
+        return ((results.replay.unsent == 0) && (results.replay.sendErrors == 0)) ? 0 : 1;
+    }
+    catch (std::exception const& error)
+    {
+        std::cerr << "Replay failed: " << error.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,341 @@
+#include "Replayer.hpp"
+#include <precompiled.hpp>
+#include <NatNegPackets.hpp>
+#include <Logging/Logging.hpp>
+
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Replay
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<Replayer>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        constexpr auto natNegIDPosition = std::size_t{ 8 };
+
+        std::optional<NatNeg::NatNegID> getNatNegID(NatNeg::NatNegPacketView const packet) noexcept
+        {
+            try
+            {
+                return packet.isNatNeg() ? packet.getNatNegID() : std::nullopt;
+            }
+            catch (std::invalid_argument const&)
+            {
+                return std::nullopt;
+            }
+        }
+
+        // Returns: the port of the address contained in the connect, if the packet is one
+        std::optional<std::uint16_t> getConnectPort(NatNeg::NatNegPacketView const packet) noexcept
+        {
+            auto const offset = NatNeg::NatNegPacketView::getAddressOffset(NatNeg::NatNegStep::connect).value();
+            if (!packet.isNatNeg() || (packet.getView().size() < (offset + 6)) || (packet.getStep() != NatNeg::NatNegStep::connect))
+            {
+                return std::nullopt;
+            }
+            return LoadGenerator::NatNegPackets::parseConnect(packet).port();
+        }
+    }
+
+    Replayer::Client::Client(IOManager::StrandType& strand) :
+        socket{ strand, EndPoint{ boost::asio::ip::address_v4::loopback(), 0 } },
+        buffer{},
+        from{},
+        capturedPorts{},
+        learnedPorts{}
+    {}
+
+    std::shared_ptr<Replayer> Replayer::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        std::vector<CapturedDatagram> const& capture,
+        NatNeg::NatNegID const natNegIDOffset,
+        Options const& options
+    )
+    {
+        return std::make_shared<Replayer>(PrivateConstructor{}, objectMaker, capture, natNegIDOffset, options);
+    }
+
+    Replayer::Replayer
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        std::vector<CapturedDatagram> const& capture,
+        NatNeg::NatNegID const natNegIDOffset,
+        Options const& options
+    ) :
+        m_strand{ objectMaker.makeStrand() },
+        m_options{ options },
+        m_steps{},
+        m_clients{},
+        m_ports{},
+        m_pending{},
+        m_nextStep{ 0 },
+        m_startedAt{},
+        m_lastSentAt{},
+        m_timer{ m_strand },
+        m_results{},
+        m_isFinished{ false },
+        m_finished{}
+    {
+        using Diagnostics::CaptureDirection;
+        using Diagnostics::CaptureInterface;
+
+        auto clientIndexes = std::map<EndPoint, std::size_t>{};
+        auto const firstTimestamp = capture.empty() ? std::chrono::nanoseconds{} : capture.front().timestamp;
+        for (auto const& datagram : capture)
+        {
+            auto const packet = NatNeg::NatNegPacketView{ datagram.data };
+            if (datagram.direction == CaptureDirection::outbound)
+            {
+                // Connects sent by NatNegProxy tell the clients where to send their game packets
+                auto const client = clientIndexes.find(datagram.remote);
+                auto const port = getConnectPort(packet);
+                if ((datagram.interface != CaptureInterface::natNegProxy) || (client == clientIndexes.end()) || !port.has_value())
+                {
+                    continue;
+                }
+
+                auto& capturedPorts = m_clients[client->second]->capturedPorts;
+                if (std::find(capturedPorts.begin(), capturedPorts.end(), port.value()) == capturedPorts.end())
+                {
+                    capturedPorts.push_back(port.value());
+                }
+                continue;
+            }
+
+            // Inbound datagrams of publicSocketForClient come from the NatNeg server
+            // and from the forwarder itself, both are replaced during the replay
+            if (datagram.interface == CaptureInterface::publicSocketForClient)
+            {
+                continue;
+            }
+
+            auto [client, isNew] = clientIndexes.try_emplace(datagram.remote, m_clients.size());
+            if (isNew)
+            {
+                m_clients.push_back(std::make_unique<Client>(m_strand));
+            }
+
+            auto data = datagram.data;
+            if (auto const natNegID = getNatNegID(packet); natNegID.has_value())
+            {
+                auto const shifted = static_cast<NatNeg::NatNegID>(natNegID.value() + natNegIDOffset);
+                std::memcpy(data.data() + natNegIDPosition, &shifted, sizeof(shifted));
+            }
+
+            auto const target = (datagram.interface == CaptureInterface::natNegProxy) ? Target::natNegProxy : Target::fakeRemotePlayerSocket;
+            m_steps.push_back(Step{ datagram.timestamp - firstTimestamp, client->second, target, datagram.localPort, std::move(data) });
+        }
+
+        m_results.clients = m_clients.size();
+        m_results.datagrams = m_steps.size();
+        m_results.captureDuration = m_steps.empty() ? std::chrono::nanoseconds{} : m_steps.back().at;
+        m_results.lateness.reserve(m_steps.size());
+    }
+
+    std::future<Replayer::Results> Replayer::start()
+    {
+        auto future = m_finished.get_future();
+        boost::asio::dispatch(m_strand, [self = shared_from_this()]
+        {
+            logLine(LogLevel::info, "Replaying ", self->m_steps.size(), " datagrams of ", self->m_clients.size(), " clients");
+            for (auto i = std::size_t{ 0 }; i < self->m_clients.size(); ++i)
+            {
+                self->prepareForNextPacket(i);
+            }
+            self->m_startedAt = Clock::now();
+            self->m_lastSentAt = self->m_startedAt;
+            self->sendDue();
+        });
+        return future;
+    }
+
+    void Replayer::prepareForNextPacket(std::size_t const clientIndex)
+    {
+        auto& client = *m_clients[clientIndex];
+        client.socket.async_receive_from
+        (
+            boost::asio::buffer(client.buffer),
+            client.from,
+            [self = shared_from_this(), clientIndex](ErrorCode const& code, std::size_t const bytesReceived)
+            {
+                if ((code == boost::asio::error::operation_aborted) || self->m_isFinished)
+                {
+                    return;
+                }
+
+                if (code.failed())
+                {
+                    logLine(LogLevel::error, "Async receive failed: ", code);
+                }
+                else
+                {
+                    auto const& client = *self->m_clients[clientIndex];
+                    self->handlePacket(clientIndex, { client.buffer.data(), bytesReceived });
+                }
+                self->prepareForNextPacket(clientIndex);
+            }
+        );
+    }
+
+    void Replayer::handlePacket(std::size_t const clientIndex, std::string_view const data)
+    {
+        ++m_results.received;
+        auto const port = getConnectPort(NatNeg::NatNegPacketView{ data });
+        if (!port.has_value())
+        {
+            return;
+        }
+
+        // Connects are resent until acknowledged, only new ports are matched with the capture
+        auto& client = *m_clients[clientIndex];
+        if ((std::find(client.learnedPorts.begin(), client.learnedPorts.end(), port.value()) != client.learnedPorts.end())
+            || client.capturedPorts.empty())
+        {
+            return;
+        }
+        client.learnedPorts.push_back(port.value());
+        auto const capturedPort = client.capturedPorts.front();
+        client.capturedPorts.pop_front();
+        m_ports[capturedPort] = port.value();
+        logLine(LogLevel::info, "Fake remote player port ", capturedPort, " is now ", port.value());
+
+        auto const pending = m_pending.find(capturedPort);
+        if (pending == m_pending.end())
+        {
+            return;
+        }
+        auto const steps = std::move(pending->second);
+        m_pending.erase(pending);
+        for (auto const& [stepIndex, due] : steps)
+        {
+            ++m_results.heldBack;
+            send(stepIndex, due);
+        }
+        if ((m_nextStep == m_steps.size()) && m_pending.empty())
+        {
+            finish();
+        }
+    }
+
+    void Replayer::sendDue()
+    {
+        auto sent = std::size_t{ 0 };
+        while (m_nextStep < m_steps.size())
+        {
+            auto const due = getDueTime(m_steps[m_nextStep]);
+            if (due > Clock::now())
+            {
+                m_timer.expires_at(due);
+                m_timer.async_wait([self = shared_from_this()](ErrorCode const& code)
+                {
+                    if (!code.failed())
+                    {
+                        self->sendDue();
+                    }
+                });
+                return;
+            }
+
+            if (sent == sendBatch)
+            {
+                boost::asio::post(m_strand, [self = shared_from_this()] { self->sendDue(); });
+                return;
+            }
+
+            auto const& step = m_steps[m_nextStep];
+            if ((step.target == Target::fakeRemotePlayerSocket) && !m_ports.contains(step.capturedPort))
+            {
+                m_pending[step.capturedPort].emplace_back(m_nextStep, due);
+            }
+            else
+            {
+                send(m_nextStep, due);
+                ++sent;
+            }
+            ++m_nextStep;
+        }
+
+        if (m_pending.empty())
+        {
+            finish();
+            return;
+        }
+        waitForPending();
+    }
+
+    Replayer::Clock::time_point Replayer::getDueTime(Step const& step) const
+    {
+        if (m_options.speed <= 0)
+        {
+            return m_startedAt;
+        }
+        auto const scaled = std::chrono::duration<double, std::nano>{ static_cast<double>(step.at.count()) / m_options.speed };
+        return m_startedAt + std::chrono::duration_cast<Clock::duration>(scaled);
+    }
+
+    void Replayer::send(std::size_t const stepIndex, Clock::time_point const due)
+    {
+        auto const& step = m_steps[stepIndex];
+        auto to = m_options.forwarder;
+        if (step.target == Target::fakeRemotePlayerSocket)
+        {
+            to.port(m_ports.at(step.capturedPort));
+        }
+
+        auto code = ErrorCode{};
+        m_clients[step.client]->socket.send_to(boost::asio::buffer(step.data), to, 0, code);
+        m_lastSentAt = Clock::now();
+        if (code.failed())
+        {
+            ++m_results.sendErrors;
+            return;
+        }
+        ++m_results.sent;
+        m_results.lateness.push_back(std::chrono::duration_cast<std::chrono::microseconds>(m_lastSentAt - due));
+    }
+
+    void Replayer::waitForPending()
+    {
+        m_timer.expires_after(m_options.settleTimeout);
+        m_timer.async_wait([self = shared_from_this()](ErrorCode const& code)
+        {
+            if (code.failed() || self->m_isFinished)
+            {
+                return;
+            }
+
+            for (auto const& [port, steps] : self->m_pending)
+            {
+                logLine(LogLevel::warning, steps.size(), " datagrams sent to fake remote player port ", port, " were not replayed");
+                self->m_results.unsent += steps.size();
+            }
+            self->m_pending.clear();
+            self->finish();
+        });
+    }
+
+    void Replayer::finish()
+    {
+        if (m_isFinished)
+        {
+            return;
+        }
+        m_isFinished = true;
+        m_timer.cancel();
+        for (auto const& client : m_clients)
+        {
+            auto code = ErrorCode{};
+            client->socket.cancel(code);
+        }
+        m_results.replayDuration = m_lastSentAt - m_startedAt;
+        std::sort(m_results.lateness.begin(), m_results.lateness.end());
+        m_finished.set_value(std::move(m_results));
+    }
+}
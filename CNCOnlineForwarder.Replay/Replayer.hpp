@@ -0,0 +1,143 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <NatNeg/NatNegPacket.hpp>
+#include "CaptureReader.hpp"
+
+namespace CNCOnlineForwarder::Replay
+{
+    // Plays the client side of a capture against a forwarder on the local machine.
+    // Every client endpoint of the capture (whatever sent datagrams to NatNegProxy
+    // or to a fake remote player socket) gets its own local socket, which sends
+    // what the client sent, with the original timing divided by `speed`, or as fast as possible.
+    // The forwarder itself relays them and talks to the NatNeg server, so the datagrams it sent
+    // are not replayed: they are only used to find out which fake remote player socket
+    // each connect told the clients about. Since the forwarder of the replay opens other ports,
+    // datagrams sent to a fake remote player socket wait until the client received the connect
+    // naming its replacement.
+    class Replayer : public std::enable_shared_from_this<Replayer>
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using EndPoint = boost::asio::ip::udp::endpoint;
+        using Socket = boost::asio::ip::udp::socket;
+        using Timer = boost::asio::steady_timer;
+
+        struct Options
+        {
+            EndPoint forwarder;
+            // 1 for the original timing, 0 for as fast as possible
+            double speed;
+            // How long datagrams may wait for their destination once everything else was sent
+            Clock::duration settleTimeout;
+        };
+
+        struct Results
+        {
+            std::size_t clients;
+            std::size_t datagrams;
+            std::uint64_t sent;
+            // Sent after waiting for the connect naming their destination
+            std::uint64_t heldBack;
+            // Never sent, because their destination was never learned
+            std::uint64_t unsent;
+            std::uint64_t sendErrors;
+            std::uint64_t received;
+            std::chrono::nanoseconds captureDuration;
+            Clock::duration replayDuration;
+            // How late datagrams were sent compared to the scaled timing of the capture
+            std::vector<std::chrono::microseconds> lateness;
+        };
+
+        // Consecutive sends before letting the received datagrams be handled
+        static constexpr auto sendBatch = std::size_t{ 64 };
+
+    private:
+        struct PrivateConstructor {};
+
+        enum class Target
+        {
+            natNegProxy,
+            fakeRemotePlayerSocket,
+        };
+
+        struct Step
+        {
+            // Since the first datagram of the capture
+            std::chrono::nanoseconds at;
+            std::size_t client;
+            Target target;
+            // Of the fake remote player socket, in the capture
+            std::uint16_t capturedPort;
+            std::string data;
+        };
+
+        struct Client
+        {
+            explicit Client(IOManager::StrandType& strand);
+
+            Socket socket;
+            std::array<char, 1024> buffer;
+            EndPoint from;
+            // Fake remote player ports named by the connects this client received in the capture
+            std::deque<std::uint16_t> capturedPorts;
+            // The replacements named by the connects received during the replay
+            std::vector<std::uint16_t> learnedPorts;
+        };
+
+        IOManager::StrandType m_strand;
+        Options m_options;
+        std::vector<Step> m_steps;
+        std::vector<std::unique_ptr<Client>> m_clients;
+        std::unordered_map<std::uint16_t, std::uint16_t> m_ports;
+        // Steps waiting for the replacement of a fake remote player port, and when they were due
+        std::unordered_map<std::uint16_t, std::vector<std::pair<std::size_t, Clock::time_point>>> m_pending;
+        std::size_t m_nextStep;
+        Clock::time_point m_startedAt;
+        Clock::time_point m_lastSentAt;
+        Timer m_timer;
+        Results m_results;
+        bool m_isFinished;
+        std::promise<Results> m_finished;
+
+    public:
+        static constexpr auto description = "Replayer";
+
+        // NatNegIDs are shifted by natNegIDOffset, so a capture can be replayed
+        // again while the forwarder still remembers the previous negotiations.
+        static std::shared_ptr<Replayer> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            std::vector<CapturedDatagram> const& capture,
+            NatNeg::NatNegID const natNegIDOffset,
+            Options const& options
+        );
+
+        Replayer
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            std::vector<CapturedDatagram> const& capture,
+            NatNeg::NatNegID const natNegIDOffset,
+            Options const& options
+        );
+
+        // Starts the replay
+        std::future<Results> start();
+
+    private:
+        void prepareForNextPacket(std::size_t const clientIndex);
+
+        void handlePacket(std::size_t const clientIndex, std::string_view const data);
+
+        void sendDue();
+
+        Clock::time_point getDueTime(Step const& step) const;
+
+        void send(std::size_t const stepIndex, Clock::time_point const due);
+
+        void waitForPending();
+
+        void finish();
+    };
+}
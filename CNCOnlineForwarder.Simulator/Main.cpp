@@ -0,0 +1,549 @@
+#include <precompiled.hpp>
+#include "SimulatedPair.hpp"
+#include "SimulatedServer.hpp"
+#include <IOManager.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Logging/Logging.hpp>
+#include <NatNeg/NatNegProxy.hpp>
+#include <Simulation/VirtualNetwork.hpp>
+#include <Utility/JsonWriter.hpp>
+#include <Utility/NetworkImpairment.hpp>
+#include <Utility/ParseNumber.hpp>
+#include <Utility/ProxyAddressTranslator.hpp>
+#include <iostream>
+#ifdef CNCONLINEFORWARDER_HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+#include <fstream>
+#include <iomanip>
+#include <time.h>
+#include <unistd.h>
+
+// Deterministic capacity simulation of the forwarder.
+// The forwarder runs unmodified, except that its sockets, timers and resolvers are in-memory fakes
+// on a virtual clock (see Simulation/VirtualNetwork.hpp), so the whole run happens on one thread,
+// as fast as the CPU allows, and always produces the same packets at the same virtual times.
+// Players arrive in pairs at the given rate, negotiate through NatNegProxy, InitialPhase and GameConnection,
+// play for a while, then go quiet until the forwarder times out their sessions.
+// Once a second of virtual time, the live sessions, the heap and the bound ports are sampled,
+// to estimate the memory cost of a session and the number of sessions a host can hold.
+//      CNCOnlineForwarder.Simulator --players 100000 --rate 100 --pps 10 --game-seconds 10
+
+using CNCOnlineForwarder::IOManager;
+using CNCOnlineForwarder::Diagnostics::MetricsRegistry;
+using CNCOnlineForwarder::NatNeg::NatNegID;
+using CNCOnlineForwarder::NatNeg::NatNegProxy;
+using CNCOnlineForwarder::Simulation::VirtualNetwork;
+using CNCOnlineForwarder::Simulator::PairStatistics;
+using CNCOnlineForwarder::Simulator::SimulatedPair;
+using CNCOnlineForwarder::Simulator::SimulatedServer;
+using CNCOnlineForwarder::Utility::JsonWriter;
+using CNCOnlineForwarder::Utility::NetworkImpairment;
+using CNCOnlineForwarder::Utility::parseNumber;
+using CNCOnlineForwarder::Utility::ProxyAddressTranslator;
+
+using AddressV4 = boost::asio::ip::address_v4;
+using EndPoint = boost::asio::ip::udp::endpoint;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace
+{
+    auto const forwarderAddress = AddressV4{ { 10, 0, 0, 1 } };
+    auto const serverAddress = AddressV4{ { 10, 0, 0, 2 } };
+    // Players get consecutive addresses from here
+    auto const firstPlayerAddress = AddressV4{ { 10, 1, 0, 0 } };
+    constexpr auto serverHostName = "natneg.server.cnc-online.net";
+    constexpr auto natNegPort = std::uint16_t{ 27901 };
+    // Sessions of the forwarder time out after one minute, wait a bit longer than that before tearing down
+    constexpr auto drainDuration = std::chrono::minutes{ 3 };
+    // Largest UDP payload
+    constexpr auto maxPacketSize = std::size_t{ 65'507 };
+    // Sanity bound, handshakes would time out long before
+    constexpr auto maxLatencyMilliseconds = 60'000.0;
+}
+
+struct Options
+{
+    std::size_t players = 100'000;
+    // New players per second, in pairs
+    double rate = 100;
+    unsigned packetsPerSecond = 10;
+    std::size_t packetSize = 64;
+    std::chrono::seconds gameDuration{ 10 };
+    std::chrono::seconds handshakeTimeout{ 10 };
+    // One way, between any two hosts
+    std::chrono::microseconds latency{ 20'000 };
+    // Sessions log errors when they time out, which would dominate the run
+    LogLevel logLevel = LogLevel::fatal;
+    // Applied to the datagrams sent by the forwarder
+    std::vector<NetworkImpairment::Rule> impairments;
+    bool json = false;
+};
+
+struct Sample
+{
+    std::chrono::seconds at{ 0 };
+    std::int64_t initialPhases = 0;
+    std::int64_t gameConnections = 0;
+    std::size_t boundEndPoints = 0;
+    std::int64_t heapBytes = 0;
+    std::int64_t residentBytes = 0;
+};
+
+struct ImpairmentCounts
+{
+    std::uint64_t impaired = 0;
+    std::uint64_t dropped = 0;
+    std::uint64_t duplicated = 0;
+    std::uint64_t reordered = 0;
+};
+
+struct Results
+{
+    std::size_t players = 0;
+    PairStatistics pairs;
+    SimulatedServer::Statistics server{};
+    VirtualNetwork::Statistics network{};
+    ImpairmentCounts impairment;
+    std::chrono::seconds virtualDuration{ 0 };
+    double cpuSeconds = 0;
+    Sample baseline;
+    // When the heap was the largest
+    Sample peak;
+    Sample teardown;
+    // Virtual time at which the forwarder ran out of ephemeral ports
+    std::optional<std::chrono::seconds> portsExhaustedAt;
+};
+
+void printUsage(char const* program)
+{
+    std::cerr << "Usage: " << program
+        << " [--players COUNT] [--rate PLAYERS_PER_SECOND] [--pps PACKETS_PER_SECOND] [--packet-size BYTES]"
+        << " [--game-seconds SECONDS] [--handshake-timeout SECONDS] [--latency-ms MILLISECONDS]"
+        << " [--log-level trace|debug|info|warning|error|fatal] [--json 0|1]"
+        << " [--impairment to=IPV4[:PORT],latency=MS,jitter=MS,loss=P,reorder=P,duplicate=P]...\n";
+}
+
+std::optional<Options> parseOptions(int const argc, char** const argv)
+{
+    auto options = Options{};
+    for (auto i = 1; i < argc; ++i)
+    {
+        auto const argument = std::string_view{ argv[i] };
+        if ((i + 1) >= argc)
+        {
+            return std::nullopt;
+        }
+        auto const value = argv[++i];
+        auto const invalidValue = [argument, value]
+        {
+            std::cerr << "Invalid value for " << argument << ": " << value << '\n';
+            return std::nullopt;
+        };
+        if (argument == "--players")
+        {
+            auto const players = parseNumber<std::size_t>(value, 2);
+            if (!players.has_value())
+            {
+                return invalidValue();
+            }
+            options.players = players.value();
+        }
+        else if (argument == "--rate")
+        {
+            auto const rate = parseNumber<double>(value, 0);
+            if (!rate.has_value())
+            {
+                return invalidValue();
+            }
+            options.rate = rate.value();
+        }
+        else if (argument == "--pps")
+        {
+            auto const packetsPerSecond = parseNumber<unsigned>(value, 0);
+            if (!packetsPerSecond.has_value())
+            {
+                return invalidValue();
+            }
+            options.packetsPerSecond = packetsPerSecond.value();
+        }
+        else if (argument == "--packet-size")
+        {
+            auto const packetSize = parseNumber<std::size_t>(value, 0, maxPacketSize);
+            if (!packetSize.has_value())
+            {
+                return invalidValue();
+            }
+            options.packetSize = packetSize.value();
+        }
+        else if (argument == "--game-seconds")
+        {
+            auto const seconds = parseNumber<std::chrono::seconds::rep>(value, 0);
+            if (!seconds.has_value())
+            {
+                return invalidValue();
+            }
+            options.gameDuration = std::chrono::seconds{ seconds.value() };
+        }
+        else if (argument == "--handshake-timeout")
+        {
+            auto const seconds = parseNumber<std::chrono::seconds::rep>(value, 1);
+            if (!seconds.has_value())
+            {
+                return invalidValue();
+            }
+            options.handshakeTimeout = std::chrono::seconds{ seconds.value() };
+        }
+        else if (argument == "--latency-ms")
+        {
+            auto const milliseconds = parseNumber<double>(value, 0, maxLatencyMilliseconds);
+            if (!milliseconds.has_value())
+            {
+                return invalidValue();
+            }
+            options.latency = std::chrono::microseconds{ static_cast<std::int64_t>(milliseconds.value() * 1000) };
+        }
+        else if (argument == "--log-level")
+        {
+            if (!boost::log::trivial::from_string(value, std::strlen(value), options.logLevel))
+            {
+                return std::nullopt;
+            }
+        }
+        else if (argument == "--json")
+        {
+            options.json = std::string_view{ value } != "0";
+        }
+        else if (argument == "--impairment")
+        {
+            try
+            {
+                options.impairments.push_back(NetworkImpairment::parseRule(value));
+            }
+            catch (std::invalid_argument const& error)
+            {
+                std::cerr << error.what() << '\n';
+                return std::nullopt;
+            }
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    if (options.rate <= 0)
+    {
+        return std::nullopt;
+    }
+    return options;
+}
+
+double getProcessCPUSeconds() noexcept
+{
+    auto time = ::timespec{};
+    ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return static_cast<double>(time.tv_sec) + (static_cast<double>(time.tv_nsec) / 1e9);
+}
+
+std::int64_t getHeapBytes() noexcept
+{
+#ifdef CNCONLINEFORWARDER_HAVE_MALLINFO2
+    return static_cast<std::int64_t>(::mallinfo2().uordblks);
+#else
+    return 0;
+#endif
+}
+
+std::int64_t getResidentBytes()
+{
+    auto statm = std::ifstream{ "/proc/self/statm" };
+    auto size = std::int64_t{ 0 };
+    auto resident = std::int64_t{ 0 };
+    statm >> size >> resident;
+    return resident * ::sysconf(_SC_PAGESIZE);
+}
+
+Sample takeSample(VirtualNetwork const& network)
+{
+    auto& metrics = MetricsRegistry::get();
+    auto sample = Sample{};
+    sample.at = std::chrono::duration_cast<std::chrono::seconds>(network.now());
+    sample.initialPhases = metrics.gauge("sessions.InitialPhase.live").get();
+    sample.gameConnections = metrics.gauge("sessions.GameConnection.live").get();
+    sample.boundEndPoints = network.getStatistics().boundEndPoints;
+    sample.heapBytes = getHeapBytes();
+    sample.residentBytes = getResidentBytes();
+    return sample;
+}
+
+AddressV4 getPlayerAddress(std::size_t const index)
+{
+    return AddressV4{ static_cast<AddressV4::uint_type>(firstPlayerAddress.to_uint() + index) };
+}
+
+Results run(Options const& options)
+{
+    auto& network = VirtualNetwork::get();
+    network.setLocalAddress(forwarderAddress);
+    network.setLatency(options.latency);
+    network.setResolveLatency(options.latency * 2);
+    network.addHost(serverHostName, serverAddress);
+    NetworkImpairment::get().setRules(options.impairments);
+
+    auto results = Results{};
+    results.players = options.players - (options.players % 2);
+    auto const pairOptions = SimulatedPair::Options
+    {
+        { forwarderAddress, natNegPort },
+        options.packetsPerSecond,
+        options.packetSize,
+        options.gameDuration,
+        options.handshakeTimeout,
+    };
+    auto pairs = std::vector<std::shared_ptr<SimulatedPair>>{};
+    auto nextPair = std::size_t{ 0 };
+    auto const pairCount = results.players / 2;
+    auto const pairInterval = std::chrono::duration<double>{ 2.0 / options.rate };
+
+    auto const cpuBefore = getProcessCPUSeconds();
+    {
+        auto const ioManager = IOManager::create();
+        auto const objectMaker = IOManager::ObjectMaker{ ioManager };
+        auto const server = SimulatedServer{ { serverAddress, natNegPort } };
+        auto const addressTranslator = ProxyAddressTranslator::create(objectMaker, forwarderAddress);
+        auto const natNegProxy = NatNegProxy::create(objectMaker, serverHostName, natNegPort, natNegPort, addressTranslator);
+
+        // Let the forwarder settle, so the baseline doesn't include its start up
+        network.runUntil(*ioManager, std::chrono::seconds{ 1 });
+        results.baseline = takeSample(network);
+        results.peak = results.baseline;
+
+        auto second = std::chrono::seconds{ 1 };
+        auto drainUntil = std::optional<std::chrono::seconds>{};
+        try
+        {
+            while (!drainUntil.has_value() || (second < drainUntil.value()))
+            {
+                // Arrivals of the next second
+                auto const until = second + std::chrono::seconds{ 1 };
+                for (; nextPair < pairCount; ++nextPair)
+                {
+                    auto const at = std::chrono::seconds{ 1 } + std::chrono::duration_cast<VirtualNetwork::Duration>(pairInterval * static_cast<double>(nextPair));
+                    if (at >= until)
+                    {
+                        break;
+                    }
+                    network.schedule(at, [&pairs, &pairOptions, &results, index = nextPair]
+                    {
+                        auto const natNegID = static_cast<NatNegID>(index + 1);
+                        auto const addresses = std::array{ getPlayerAddress(index * 2), getPlayerAddress((index * 2) + 1) };
+                        pairs.push_back(SimulatedPair::create(natNegID, addresses, pairOptions, results.pairs));
+                    });
+                }
+
+                network.runUntil(*ioManager, until);
+                second = until;
+                pairs.erase(std::remove_if(pairs.begin(), pairs.end(), [](auto const& pair)
+                {
+                    return pair->isFinished();
+                }), pairs.end());
+
+                auto const sample = takeSample(network);
+                if (sample.heapBytes > results.peak.heapBytes)
+                {
+                    results.peak = sample;
+                }
+
+                if (!drainUntil.has_value() && (nextPair == pairCount) && pairs.empty())
+                {
+                    drainUntil = second + drainDuration;
+                }
+            }
+        }
+        catch (std::system_error const& error)
+        {
+            if (error.code() != std::errc::address_in_use)
+            {
+                throw;
+            }
+            results.portsExhaustedAt = std::chrono::duration_cast<std::chrono::seconds>(network.now());
+        }
+
+        results.virtualDuration = std::chrono::duration_cast<std::chrono::seconds>(network.now());
+        results.server = server.getStatistics();
+        pairs.clear();
+        results.teardown = takeSample(network);
+    }
+    results.cpuSeconds = getProcessCPUSeconds() - cpuBefore;
+    results.network = network.getStatistics();
+    auto& metrics = MetricsRegistry::get();
+    results.impairment = ImpairmentCounts
+    {
+        metrics.counter("impairment.impaired").get(),
+        metrics.counter("impairment.dropped").get(),
+        metrics.counter("impairment.duplicated").get(),
+        metrics.counter("impairment.reordered").get(),
+    };
+    std::sort(results.pairs.handshakeDurations.begin(), results.pairs.handshakeDurations.end());
+    return results;
+}
+
+double getBytesPerSession(Results const& results)
+{
+    auto const sessions = std::max<std::int64_t>(results.peak.gameConnections, 1);
+    return static_cast<double>(results.peak.heapBytes - results.baseline.heapBytes) / static_cast<double>(sessions);
+}
+
+double getHandshakeMilliseconds(Results const& results, double const percentile)
+{
+    auto const& durations = results.pairs.handshakeDurations;
+    if (durations.empty())
+    {
+        return 0;
+    }
+    auto const index = static_cast<std::size_t>(percentile * static_cast<double>(durations.size() - 1));
+    return std::chrono::duration<double, std::milli>{ durations[index] }.count();
+}
+
+// Two runs with the same options must print the same digest
+std::string getDigestText(std::uint64_t const digest)
+{
+    auto text = std::ostringstream{};
+    text << std::hex << std::setw(16) << std::setfill('0') << digest;
+    return text.str();
+}
+
+void writeText(std::ostream& out, Results const& results)
+{
+    auto const& peak = results.peak;
+    out << "Players: " << results.players << ", " << results.pairs.established << " pairs established, "
+        << results.pairs.failed << " failed, in " << results.virtualDuration.count() << " virtual seconds\n";
+    if (results.portsExhaustedAt.has_value())
+    {
+        out << "Ran out of ephemeral ports at " << results.portsExhaustedAt->count() << " s, results are partial\n";
+    }
+    out << "Handshake (ms): p50 " << getHandshakeMilliseconds(results, 0.5) << ", p99 " << getHandshakeMilliseconds(results, 0.99)
+        << ", max " << getHandshakeMilliseconds(results, 1) << '\n';
+    out << "Relay: " << results.pairs.packetsReceived << '/' << results.pairs.packetsSent << " game packets delivered\n";
+    out << "Peak at " << peak.at.count() << " s: " << peak.gameConnections << " GameConnections, "
+        << peak.initialPhases << " InitialPhases, " << peak.boundEndPoints << " bound endpoints\n";
+    out << "Memory: " << getBytesPerSession(results) << " heap bytes per live GameConnection, "
+        << (peak.residentBytes - results.baseline.residentBytes) << " bytes of resident set growth at peak\n";
+    out << "After teardown: " << (results.teardown.heapBytes - results.baseline.heapBytes) << " heap bytes retained, "
+        << results.teardown.gameConnections << " GameConnections, " << results.teardown.initialPhases << " InitialPhases\n";
+    out << "CPU: " << results.cpuSeconds << " s, " << (results.cpuSeconds * 1e6 / static_cast<double>(results.players))
+        << " us per player, " << (results.cpuSeconds * 1e9 / static_cast<double>(std::max<std::uint64_t>(results.network.delivered, 1)))
+        << " ns per delivered datagram\n";
+    out << "Server: " << results.server.inits << " inits, " << results.server.connects << " connects, "
+        << results.server.connectAcks << " connect acks, " << results.server.discarded << " discarded\n";
+    if (results.impairment.impaired > 0)
+    {
+        out << "Impairment: " << results.impairment.impaired << " datagrams impaired, " << results.impairment.dropped << " dropped, "
+            << results.impairment.duplicated << " duplicated, " << results.impairment.reordered << " reordered\n";
+    }
+    out << "Network: " << results.network.delivered << " datagrams delivered, " << results.network.unreachable
+        << " unreachable, " << results.network.events << " events, digest " << getDigestText(results.network.digest) << '\n';
+}
+
+void writeSample(JsonWriter& json, Sample const& sample)
+{
+    json.beginObject();
+    json.member("second", sample.at.count());
+    json.member("gameConnections", sample.gameConnections);
+    json.member("initialPhases", sample.initialPhases);
+    json.member("boundEndPoints", sample.boundEndPoints);
+    json.member("heapBytes", sample.heapBytes);
+    json.member("residentBytes", sample.residentBytes);
+    json.endObject();
+}
+
+void writeJson(std::ostream& out, Results const& results)
+{
+    auto json = JsonWriter{ out };
+    json.beginObject();
+    json.member("players", results.players);
+    json.member("established", results.pairs.established);
+    json.member("failed", results.pairs.failed);
+    json.member("virtualSeconds", results.virtualDuration.count());
+    json.key("portsExhaustedAt");
+    if (results.portsExhaustedAt.has_value())
+    {
+        json.value(results.portsExhaustedAt->count());
+    }
+    else
+    {
+        json.null();
+    }
+    json.key("handshakeMilliseconds").beginObject();
+    for (auto const& [name, percentile] : { std::pair{ "p50", 0.5 }, { "p99", 0.99 }, { "max", 1.0 } })
+    {
+        json.member(name, getHandshakeMilliseconds(results, percentile));
+    }
+    json.endObject();
+    json.member("packetsSent", results.pairs.packetsSent);
+    json.member("packetsReceived", results.pairs.packetsReceived);
+
+    json.key("memory").beginObject();
+    json.member("heapBytesPerGameConnection", getBytesPerSession(results));
+    json.member("retainedHeapBytes", results.teardown.heapBytes - results.baseline.heapBytes);
+    json.key("baseline");
+    writeSample(json, results.baseline);
+    json.key("peak");
+    writeSample(json, results.peak);
+    json.key("teardown");
+    writeSample(json, results.teardown);
+    json.endObject();
+
+    json.key("cpu").beginObject();
+    json.member("seconds", results.cpuSeconds);
+    json.member("microsecondsPerPlayer", results.cpuSeconds * 1e6 / static_cast<double>(results.players));
+    json.member("nanosecondsPerDatagram", results.cpuSeconds * 1e9 / static_cast<double>(std::max<std::uint64_t>(results.network.delivered, 1)));
+    json.endObject();
+
+    json.key("impairment").beginObject();
+    json.member("impaired", results.impairment.impaired);
+    json.member("dropped", results.impairment.dropped);
+    json.member("duplicated", results.impairment.duplicated);
+    json.member("reordered", results.impairment.reordered);
+    json.endObject();
+
+    json.key("network").beginObject();
+    json.member("delivered", results.network.delivered);
+    json.member("unreachable", results.network.unreachable);
+    json.member("events", results.network.events);
+    json.member("digest", getDigestText(results.network.digest));
+    json.endObject();
+    json.endObject();
+    out << '\n';
+}
+
+int main(int argc, char** argv)
+{
+    auto const options = parseOptions(argc, argv);
+    if (!options.has_value())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        CNCOnlineForwarder::Logging::setFilterLevel(options->logLevel);
+        auto const results = run(options.value());
+        if (options->json)
+        {
+            writeJson(std::cout, results);
+        }
+        else
+        {
+            writeText(std::cout, results);
+        }
+        return results.portsExhaustedAt.has_value() ? 1 : 0;
+    }
+    catch (std::exception const& error)
+    {
+        std::cerr << "Simulation failed: " << error.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,216 @@
+#include "SimulatedPair.hpp"
+#include <precompiled.hpp>
+#include <NatNegPackets.hpp>
+
+namespace CNCOnlineForwarder::Simulator
+{
+    namespace NatNegPackets = LoadGenerator::NatNegPackets;
+
+    namespace
+    {
+        // Ports used by RA3 clients
+        constexpr auto gamePort = std::uint16_t{ 6500 };
+        constexpr auto communicationPort = std::uint16_t{ 6501 };
+    }
+
+    SimulatedPair::Port::Port(SimulatedPair& pair, std::size_t const playerIndex, EndPoint const& endPoint) :
+        m_pair{ pair },
+        m_playerIndex{ playerIndex },
+        m_endPoint{}
+    {
+        m_endPoint = Network::get().bind(*this, endPoint);
+    }
+
+    SimulatedPair::Port::~Port()
+    {
+        Network::get().unbind(m_endPoint);
+    }
+
+    void SimulatedPair::Port::deliver(EndPoint const&, std::string_view const data)
+    {
+        if (m_endPoint.port() == gamePort)
+        {
+            m_pair.handleGamePacket(data);
+        }
+        else
+        {
+            m_pair.handleCommunicationPacket(m_playerIndex, data);
+        }
+    }
+
+    SimulatedPair::Player::Player(SimulatedPair& pair, std::size_t const playerIndex, Address const& address) :
+        game{ pair, playerIndex, { address, gamePort } },
+        communication{ pair, playerIndex, { address, communicationPort } },
+        remote{}
+    {}
+
+    std::shared_ptr<SimulatedPair> SimulatedPair::create
+    (
+        NatNeg::NatNegID const natNegID,
+        std::array<Address, 2> const& addresses,
+        Options const& options,
+        PairStatistics& statistics
+    )
+    {
+        auto const self = std::make_shared<SimulatedPair>(PrivateConstructor{}, natNegID, addresses, options, statistics);
+        self->start();
+        return self;
+    }
+
+    SimulatedPair::SimulatedPair
+    (
+        PrivateConstructor,
+        NatNeg::NatNegID const natNegID,
+        std::array<Address, 2> const& addresses,
+        Options const& options,
+        PairStatistics& statistics
+    ) :
+        m_options{ options },
+        m_statistics{ statistics },
+        m_natNegID{ natNegID },
+        m_players{},
+        m_state{ State::handshaking },
+        m_startedAt{},
+        m_playingUntil{},
+        m_nextTickAt{},
+        m_gamePacket(std::max(options.packetSize, std::size_t{ 1 }), 'x')
+    {
+        // The first byte is never the first byte of the NatNeg magic
+        m_gamePacket.front() = '\0';
+        for (auto i = std::size_t{ 0 }; i < addresses.size(); ++i)
+        {
+            m_players.emplace_back(*this, i, addresses[i]);
+        }
+    }
+
+    bool SimulatedPair::isFinished() const noexcept
+    {
+        return m_state == State::finished;
+    }
+
+    void SimulatedPair::start()
+    {
+        m_startedAt = Network::get().now();
+        for (auto i = std::size_t{ 0 }; i < m_players.size(); ++i)
+        {
+            sendInits(i);
+        }
+        scheduleTick(m_startedAt + retryInterval);
+    }
+
+    void SimulatedPair::sendInits(std::size_t const playerIndex)
+    {
+        auto const& player = m_players[playerIndex];
+        auto const playerID = static_cast<std::int8_t>(playerIndex);
+        // Like the game, the game port first: it tells the forwarder the public address of the client
+        auto const gameInit = NatNegPackets::makeInit(NatNeg::NatNegStep::init, m_natNegID, NatNegPackets::gamePortType, playerID);
+        send(player.game, gameInit, m_options.forwarder);
+        auto const communicationInit = NatNegPackets::makeInit(NatNeg::NatNegStep::init, m_natNegID, NatNegPackets::communicationPortType, playerID);
+        send(player.communication, communicationInit, m_options.forwarder);
+    }
+
+    void SimulatedPair::handleCommunicationPacket(std::size_t const playerIndex, std::string_view const data)
+    {
+        auto const packet = NatNeg::NatNegPacketView{ data };
+        if (!packet.isNatNeg() || (packet.getStep() != NatNeg::NatNegStep::connect))
+        {
+            return;
+        }
+
+        auto& player = m_players[playerIndex];
+        player.remote = NatNegPackets::parseConnect(packet);
+        auto const acknowledgement = NatNegPackets::makeInit
+        (
+            NatNeg::NatNegStep::connectAck,
+            m_natNegID,
+            NatNegPackets::communicationPortType,
+            static_cast<std::int8_t>(playerIndex)
+        );
+        send(player.communication, acknowledgement, m_options.forwarder);
+
+        auto const connected = std::all_of(m_players.begin(), m_players.end(), [](Player const& candidate)
+        {
+            return candidate.remote.has_value();
+        });
+        if ((m_state == State::handshaking) && connected)
+        {
+            auto const now = Network::get().now();
+            m_state = State::playing;
+            ++m_statistics.established;
+            m_statistics.handshakeDurations.push_back(now - m_startedAt);
+            m_playingUntil = now + m_options.gameDuration;
+            scheduleTick(now);
+        }
+    }
+
+    void SimulatedPair::handleGamePacket(std::string_view const data)
+    {
+        if (data.empty() || (data.front() != '\0'))
+        {
+            // Most likely, the init acknowledgement
+            return;
+        }
+        ++m_statistics.packetsReceived;
+    }
+
+    void SimulatedPair::scheduleTick(Network::TimePoint const at)
+    {
+        // Replaces the tick already scheduled, if any
+        m_nextTickAt = at;
+        Network::get().schedule(at, [weak = weak_from_this(), at]
+        {
+            if (auto const self = weak.lock(); self && (self->m_nextTickAt == at))
+            {
+                self->onTick();
+            }
+        });
+    }
+
+    void SimulatedPair::onTick()
+    {
+        auto const now = Network::get().now();
+        if (m_state == State::playing)
+        {
+            if ((now >= m_playingUntil) || (m_options.packetsPerSecond == 0))
+            {
+                m_state = State::finished;
+                return;
+            }
+
+            for (auto const& player : m_players)
+            {
+                send(player.game, m_gamePacket, player.remote.value());
+                ++m_statistics.packetsSent;
+            }
+            scheduleTick(now + std::chrono::nanoseconds{ std::chrono::seconds{ 1 } } / m_options.packetsPerSecond);
+            return;
+        }
+
+        if (m_state != State::handshaking)
+        {
+            return;
+        }
+
+        if ((now - m_startedAt) >= m_options.handshakeTimeout)
+        {
+            m_state = State::finished;
+            ++m_statistics.failed;
+            return;
+        }
+
+        // Like the game, retry until the connect is received
+        for (auto i = std::size_t{ 0 }; i < m_players.size(); ++i)
+        {
+            if (!m_players[i].remote.has_value())
+            {
+                sendInits(i);
+            }
+        }
+        scheduleTick(now + retryInterval);
+    }
+
+    void SimulatedPair::send(Port const& port, std::string_view const data, EndPoint const& to)
+    {
+        Network::get().send(port.getEndPoint(), to, data);
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <precompiled.hpp>
+#include <NatNeg/NatNegPacket.hpp>
+#include <Simulation/VirtualNetwork.hpp>
+
+namespace CNCOnlineForwarder::Simulator
+{
+    struct PairStatistics
+    {
+        std::uint64_t established = 0;
+        std::uint64_t failed = 0;
+        std::uint64_t packetsSent = 0;
+        std::uint64_t packetsReceived = 0;
+        std::vector<Simulation::VirtualNetwork::Duration> handshakeDurations;
+    };
+
+    // Two RA3 clients on the virtual network, each with its own address.
+    // Like SimulatedSession of the load generator, they negotiate through the forwarder,
+    // retrying every second, then exchange game packets through its relays for a while.
+    // Afterwards, the clients go quiet, leaving the forwarder to time out its sessions.
+    class SimulatedPair : public std::enable_shared_from_this<SimulatedPair>
+    {
+    public:
+        using Network = Simulation::VirtualNetwork;
+        using EndPoint = Network::EndPoint;
+        using Address = Network::Address;
+
+        struct Options
+        {
+            EndPoint forwarder;
+            unsigned packetsPerSecond;
+            std::size_t packetSize;
+            std::chrono::seconds gameDuration;
+            std::chrono::seconds handshakeTimeout;
+        };
+
+        static constexpr auto retryInterval = std::chrono::seconds{ 1 };
+
+    private:
+        struct PrivateConstructor {};
+
+        enum class State
+        {
+            handshaking,
+            playing,
+            finished,
+        };
+
+        class Port : private Network::Receiver
+        {
+        private:
+            SimulatedPair& m_pair;
+            std::size_t m_playerIndex;
+            EndPoint m_endPoint;
+
+        public:
+            Port(SimulatedPair& pair, std::size_t const playerIndex, EndPoint const& endPoint);
+            Port(Port const&) = delete;
+            Port& operator=(Port const&) = delete;
+            ~Port();
+
+            EndPoint const& getEndPoint() const noexcept { return m_endPoint; }
+
+        private:
+            void deliver(EndPoint const& from, std::string_view const data) override;
+        };
+
+        struct Player
+        {
+            Port game;
+            Port communication;
+            std::optional<EndPoint> remote;
+
+            Player(SimulatedPair& pair, std::size_t const playerIndex, Address const& address);
+        };
+
+        Options const& m_options;
+        PairStatistics& m_statistics;
+        NatNeg::NatNegID m_natNegID;
+        // Ports are bound to the pair, which is never moved
+        std::deque<Player> m_players;
+        State m_state;
+        Network::TimePoint m_startedAt;
+        Network::TimePoint m_playingUntil;
+        Network::TimePoint m_nextTickAt;
+        std::string m_gamePacket;
+
+    public:
+        static constexpr auto description = "SimulatedPair";
+
+        static std::shared_ptr<SimulatedPair> create
+        (
+            NatNeg::NatNegID const natNegID,
+            std::array<Address, 2> const& addresses,
+            Options const& options,
+            PairStatistics& statistics
+        );
+
+        SimulatedPair
+        (
+            PrivateConstructor,
+            NatNeg::NatNegID const natNegID,
+            std::array<Address, 2> const& addresses,
+            Options const& options,
+            PairStatistics& statistics
+        );
+
+        bool isFinished() const noexcept;
+
+    private:
+        void start();
+
+        void sendInits(std::size_t const playerIndex);
+
+        void handleCommunicationPacket(std::size_t const playerIndex, std::string_view const data);
+
+        void handleGamePacket(std::string_view const data);
+
+        void scheduleTick(Network::TimePoint const at);
+
+        void onTick();
+
+        void send(Port const& port, std::string_view const data, EndPoint const& to);
+    };
+}
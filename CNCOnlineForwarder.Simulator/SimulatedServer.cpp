@@ -0,0 +1,111 @@
+#include "SimulatedServer.hpp"
+#include <precompiled.hpp>
+#include <NatNegPackets.hpp>
+
+using CNCOnlineForwarder::Simulation::VirtualNetwork;
+
+namespace CNCOnlineForwarder::Simulator
+{
+    namespace NatNegPackets = LoadGenerator::NatNegPackets;
+
+    SimulatedServer::SimulatedServer(EndPoint const& endPoint) :
+        m_endPoint{},
+        m_negotiations{},
+        m_statistics{ 0, 0, 0, 0 }
+    {
+        m_endPoint = VirtualNetwork::get().bind(*this, endPoint);
+    }
+
+    SimulatedServer::~SimulatedServer()
+    {
+        VirtualNetwork::get().unbind(m_endPoint);
+    }
+
+    SimulatedServer::Statistics SimulatedServer::getStatistics() const noexcept
+    {
+        return m_statistics;
+    }
+
+    void SimulatedServer::deliver(EndPoint const& from, std::string_view const data)
+    {
+        auto const packet = NatNeg::NatNegPacketView{ data };
+        auto const playerID = packet.isNatNeg() ? packet.getNatNegPlayerID() : std::nullopt;
+        if (!playerID.has_value() || (playerID->playerID < 0) || (playerID->playerID > 1))
+        {
+            ++m_statistics.discarded;
+            return;
+        }
+
+        auto const step = packet.getStep();
+        auto const playerIndex = static_cast<std::size_t>(playerID->playerID);
+        if (step == NatNeg::NatNegStep::connectAck)
+        {
+            ++m_statistics.connectAcks;
+            auto const negotiation = m_negotiations.find(playerID->natNegID);
+            if (negotiation == m_negotiations.end())
+            {
+                return;
+            }
+
+            auto& players = negotiation->second.players;
+            players[playerIndex].acknowledged = true;
+            if (players[0].acknowledged && players[1].acknowledged)
+            {
+                m_negotiations.erase(negotiation);
+            }
+            return;
+        }
+
+        if (step != NatNeg::NatNegStep::init)
+        {
+            ++m_statistics.discarded;
+            return;
+        }
+
+        ++m_statistics.inits;
+        auto const portType = static_cast<std::uint8_t>(packet.getView().at(NatNegPackets::portTypeOffset));
+        auto acknowledgement = packet.copyBuffer();
+        acknowledgement[7] = static_cast<char>(NatNeg::NatNegStep::initAck);
+        VirtualNetwork::get().send(m_endPoint, from, acknowledgement);
+
+        auto& negotiation = m_negotiations[playerID->natNegID];
+        auto& player = negotiation.players[playerIndex];
+        (portType == NatNegPackets::gamePortType ? player.game : player.communication) = from;
+
+        if (negotiation.connected)
+        {
+            sendConnect(playerID->natNegID, negotiation, playerIndex);
+            return;
+        }
+
+        auto const isComplete = std::all_of(negotiation.players.begin(), negotiation.players.end(), [](Player const& candidate)
+        {
+            return candidate.game.has_value() && candidate.communication.has_value();
+        });
+        if (isComplete)
+        {
+            negotiation.connected = true;
+            sendConnect(playerID->natNegID, negotiation, 0);
+            sendConnect(playerID->natNegID, negotiation, 1);
+        }
+    }
+
+    void SimulatedServer::sendConnect
+    (
+        NatNeg::NatNegID const natNegID,
+        Negotiation const& negotiation,
+        std::size_t const playerIndex
+    )
+    {
+        auto const& player = negotiation.players[playerIndex];
+        auto const& remotePlayer = negotiation.players[1 - playerIndex];
+        if (!player.communication.has_value() || !remotePlayer.game.has_value())
+        {
+            return;
+        }
+
+        ++m_statistics.connects;
+        auto const connect = NatNegPackets::makeConnect(natNegID, remotePlayer.game.value());
+        VirtualNetwork::get().send(m_endPoint, player.communication.value(), connect);
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <precompiled.hpp>
+#include <NatNeg/NatNegPacket.hpp>
+#include <Simulation/VirtualNetwork.hpp>
+
+namespace CNCOnlineForwarder::Simulator
+{
+    // NatNeg server on the virtual network, behaving like the NatNegServerEmulator of the load generator:
+    // acknowledges every init, and once both players of a NatNegID sent the inits of both their ports,
+    // sends each player's communication port a connect containing the other player's game address.
+    // A negotiation is forgotten once both players acknowledged their connect.
+    class SimulatedServer : private Simulation::VirtualNetwork::Receiver
+    {
+    public:
+        using EndPoint = Simulation::VirtualNetwork::EndPoint;
+
+        struct Statistics
+        {
+            std::uint64_t inits;
+            std::uint64_t connects;
+            std::uint64_t connectAcks;
+            std::uint64_t discarded;
+        };
+
+    private:
+        struct Player
+        {
+            std::optional<EndPoint> game;
+            std::optional<EndPoint> communication;
+            bool acknowledged = false;
+        };
+
+        struct Negotiation
+        {
+            std::array<Player, 2> players;
+            bool connected = false;
+        };
+
+        EndPoint m_endPoint;
+        std::unordered_map<NatNeg::NatNegID, Negotiation> m_negotiations;
+        Statistics m_statistics;
+
+    public:
+        static constexpr auto description = "SimulatedServer";
+
+        explicit SimulatedServer(EndPoint const& endPoint);
+        SimulatedServer(SimulatedServer const&) = delete;
+        SimulatedServer& operator=(SimulatedServer const&) = delete;
+        ~SimulatedServer();
+
+        Statistics getStatistics() const noexcept;
+
+    private:
+        void deliver(EndPoint const& from, std::string_view const data) override;
+
+        void sendConnect(NatNeg::NatNegID const natNegID, Negotiation const& negotiation, std::size_t const playerIndex);
+    };
+}
@@ -0,0 +1,199 @@
+#include <Diagnostics/SharedStatsLayout.hpp>
+#include <Utility/ParseNumber.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Layout = CNCOnlineForwarder::Diagnostics::SharedStatsLayout;
+using CNCOnlineForwarder::Utility::parseNumber;
+
+// Samples the shared memory segment published by CNCOnlineForwarder
+// and prints one CSV line for each matching metric of each new sample:
+// publishedAt (ns since epoch),name,kind,value[,sum,max,p50,p90,p99]
+// Exits with an error if the publisher seems to have stopped in the middle of a write.
+struct Options
+{
+    std::string segmentName{ Layout::defaultSegmentName };
+    std::chrono::microseconds interval{ 1000 };
+    // Same minimum as --shared-stats-interval-us of the forwarder, shorter would be a busy loop
+    static constexpr auto minInterval = std::chrono::microseconds{ 100 };
+    // 0 means forever
+    std::uint64_t samples = 0;
+    std::string prefix;
+    // A write takes microseconds: if the segment stays unreadable that long, the publisher is gone
+    std::chrono::milliseconds staleAfter{ 1000 };
+};
+
+void printUsage(char const* program)
+{
+    std::cerr << "Usage: " << program
+        << " [--segment NAME] [--interval-us MICROSECONDS] [--samples COUNT] [--prefix METRIC_PREFIX]\n";
+}
+
+std::optional<Options> parseOptions(int const argc, char** const argv)
+{
+    auto options = Options{};
+    for (auto i = 1; i < argc; ++i)
+    {
+        auto const argument = std::string_view{ argv[i] };
+        if ((i + 1) >= argc)
+        {
+            return std::nullopt;
+        }
+        auto const value = argv[++i];
+        auto const invalidValue = [argument, value]
+        {
+            std::cerr << "Invalid value for " << argument << ": " << value << '\n';
+            return std::nullopt;
+        };
+        if (argument == "--segment")
+        {
+            options.segmentName = value;
+        }
+        else if (argument == "--interval-us")
+        {
+            auto const interval = parseNumber<std::chrono::microseconds::rep>(value, Options::minInterval.count());
+            if (!interval.has_value())
+            {
+                return invalidValue();
+            }
+            options.interval = std::chrono::microseconds{ interval.value() };
+        }
+        else if (argument == "--samples")
+        {
+            auto const samples = parseNumber<std::uint64_t>(value, 0);
+            if (!samples.has_value())
+            {
+                return invalidValue();
+            }
+            options.samples = samples.value();
+        }
+        else if (argument == "--prefix")
+        {
+            options.prefix = value;
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+    return options;
+}
+
+std::string_view getKindName(Layout::Kind const kind)
+{
+    switch (kind)
+    {
+    case Layout::Kind::counter:
+        return "counter";
+    case Layout::Kind::gauge:
+        return "gauge";
+    case Layout::Kind::histogram:
+        return "histogram";
+    }
+    return "unknown";
+}
+
+int main(int argc, char** argv)
+{
+    auto const options = parseOptions(argc, argv);
+    if (!options.has_value())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+#ifdef __linux__
+    auto const descriptor = ::shm_open(options->segmentName.c_str(), O_RDONLY, 0);
+    if (descriptor == -1)
+    {
+        std::cerr << "Cannot open " << options->segmentName << ", is the forwarder running with --shared-stats?\n";
+        return 1;
+    }
+
+    struct stat status{};
+    auto memory = MAP_FAILED;
+    if ((::fstat(descriptor, &status) == 0) && (static_cast<std::size_t>(status.st_size) >= sizeof(Layout::Header)))
+    {
+        memory = ::mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_SHARED, descriptor, 0);
+    }
+    ::close(descriptor);
+    if (memory == MAP_FAILED)
+    {
+        std::cerr << "Cannot map " << options->segmentName << '\n';
+        return 1;
+    }
+
+    auto const& header = *static_cast<Layout::Header const*>(memory);
+    if (!Layout::isCompatible(header) || (static_cast<std::size_t>(status.st_size) < Layout::getSegmentSize()))
+    {
+        std::cerr << "Incompatible segment: version " << header.version
+            << ", expected " << Layout::version << '\n';
+        return 1;
+    }
+
+    auto copy = std::make_unique<Layout::Header>();
+    auto const entries = std::make_unique<Layout::Entry[]>(Layout::capacity);
+    auto lastSequence = std::uint64_t{ 0 };
+    auto printed = std::uint64_t{ 0 };
+    auto next = std::chrono::steady_clock::now();
+    while ((options->samples == 0) || (printed < options->samples))
+    {
+        auto const giveUpAt = std::chrono::steady_clock::now() + options->staleAfter;
+        while (!Layout::tryRead(header, *copy, entries.get()))
+        {
+            if (std::chrono::steady_clock::now() > giveUpAt)
+            {
+                std::cerr << "Segment unreadable for " << options->staleAfter.count()
+                    << "ms, has process " << header.processID << " stopped while publishing?\n";
+                return 1;
+            }
+            std::this_thread::yield();
+        }
+
+        auto const sequence = copy->sequence.load(std::memory_order_relaxed);
+        if (sequence != lastSequence)
+        {
+            lastSequence = sequence;
+            ++printed;
+            for (auto i = std::uint32_t{ 0 }; i < copy->entryCount; ++i)
+            {
+                auto const& entry = entries[i];
+                auto const name = std::string_view{ entry.name };
+                if (name.substr(0, options->prefix.size()) != options->prefix)
+                {
+                    continue;
+                }
+
+                std::cout << copy->publishedAt << ',' << name << ',' << getKindName(entry.kind) << ',' << entry.value;
+                if (entry.kind == Layout::Kind::histogram)
+                {
+                    std::cout << ',' << entry.sum << ',' << entry.max
+                        << ',' << entry.p50 << ',' << entry.p90 << ',' << entry.p99;
+                }
+                std::cout << '\n';
+            }
+            std::cout.flush();
+        }
+
+        next += options->interval;
+        std::this_thread::sleep_until(next);
+    }
+    return 0;
+#else
+    std::cerr << "Shared memory statistics are not supported on this platform\n";
+    return 1;
+#endif
+}
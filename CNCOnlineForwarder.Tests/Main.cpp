@@ -0,0 +1,113 @@
+#include <precompiled.hpp>
+#include <Peerchat/IRCMessage.hpp>
+#include <Peerchat/PeerchatCipher.hpp>
+#include <iostream>
+
+// Known answer checks of the code which has to match other implementations byte for byte,
+// run by ctest. Prints each failed check, and exits with an error if there was any.
+
+using CNCOnlineForwarder::Peerchat::IRCMessage;
+using CNCOnlineForwarder::Peerchat::PeerchatCipher;
+
+namespace
+{
+    auto failures = 0;
+
+    void check(bool const passed, std::string_view const what)
+    {
+        if (!passed)
+        {
+            std::cerr << "FAILED: " << what << '\n';
+            ++failures;
+        }
+    }
+
+    // Secret key of Red Alert 3
+    constexpr auto secretKey = std::string_view{ "uBZwpf" };
+
+    std::vector<std::uint8_t> apply(PeerchatCipher& cipher, std::string data)
+    {
+        cipher.apply(data.data(), data.size());
+        return { data.begin(), data.end() };
+    }
+
+    // Expected values come from gs_peerchat.c by Luigi Auriemma, the reference used by the other
+    // reimplementations of the peerchat servers: the keystream is what encrypting zeros gives.
+    void testPeerchatCipher()
+    {
+        auto first = PeerchatCipher{ "0123456789abcdef", secretKey };
+        check(apply(first, std::string(16, '\0')) == std::vector<std::uint8_t>
+        {
+            0xB7, 0x2A, 0x8F, 0xF7, 0xB0, 0x64, 0xBF, 0xB8, 0x08, 0x7D, 0xD0, 0x50, 0xC2, 0x91, 0x21, 0x7B
+        }, "PeerchatCipher keystream of 0123456789abcdef");
+
+        auto second = PeerchatCipher{ "Gs1KZ3uVqN8p0XfH", secretKey };
+        check(apply(second, std::string(16, '\0')) == std::vector<std::uint8_t>
+        {
+            0x32, 0x96, 0x6C, 0xCC, 0xBD, 0x92, 0x26, 0x8F, 0xCE, 0x21, 0x4D, 0x22, 0x60, 0xC3, 0x8F, 0xB9
+        }, "PeerchatCipher keystream of Gs1KZ3uVqN8p0XfH");
+
+        // The stream goes on across calls, as lines are encrypted one after the other
+        auto encrypt = PeerchatCipher{ "0123456789abcdef", secretKey };
+        auto encrypted = apply(encrypt, "NICK ");
+        auto const rest = apply(encrypt, "player\r\n");
+        encrypted.insert(encrypted.end(), rest.begin(), rest.end());
+        check(encrypted == std::vector<std::uint8_t>
+        {
+            0xF9, 0x63, 0xCC, 0xBC, 0x90, 0x14, 0xD3, 0xD9, 0x71, 0x18, 0xA2, 0x5D, 0xC8
+        }, "PeerchatCipher encryption of NICK player in two calls");
+
+        auto decrypt = PeerchatCipher{ "0123456789abcdef", secretKey };
+        auto decrypted = std::string{ encrypted.begin(), encrypted.end() };
+        decrypt.apply(decrypted.data(), decrypted.size());
+        check(decrypted == "NICK player\r\n", "PeerchatCipher decryption of NICK player");
+    }
+
+    void testIRCMessage()
+    {
+        auto const privmsg = IRCMessage::parse(":nick!user@127.0.0.1 PRIVMSG #GPG!1 :hello  there\r\n");
+        check(privmsg.has_value(), "IRCMessage parses PRIVMSG");
+        if (privmsg.has_value())
+        {
+            check(privmsg->prefix == "nick!user@127.0.0.1", "IRCMessage prefix");
+            check(privmsg->getSourceNick() == "nick", "IRCMessage source nick");
+            check(privmsg->command == "PRIVMSG", "IRCMessage command");
+            check(privmsg->parameters == std::vector<std::string>{ "#GPG!1", "hello  there" }, "IRCMessage trailing parameter keeps its spaces");
+            check(privmsg->hasTrailing, "IRCMessage hasTrailing");
+        }
+
+        auto const join = IRCMessage::parse("join   #GPG!2\n");
+        check(join.has_value() && (join->command == "JOIN"), "IRCMessage command is upper case");
+        check(join.has_value() && (join->parameters == std::vector<std::string>{ "#GPG!2" }), "IRCMessage skips repeated spaces");
+        check(join.has_value() && !join->hasTrailing && join->prefix.empty(), "IRCMessage without prefix nor trailing");
+
+        auto const keys = IRCMessage::parse(":s 705 * 0123456789abcdef Gs1KZ3uVqN8p0XfH\r\n");
+        check(keys.has_value() && keys->isNumeric(), "IRCMessage numeric reply");
+        check(keys.has_value() && (keys->getParameter(2) == "Gs1KZ3uVqN8p0XfH") && keys->getParameter(3).empty(), "IRCMessage getParameter");
+
+        auto const emptyTopic = IRCMessage::parse("TOPIC #GPG!1 :");
+        check(emptyTopic.has_value() && (emptyTopic->parameters == std::vector<std::string>{ "#GPG!1", "" }), "IRCMessage empty trailing parameter");
+
+        check(!IRCMessage::parse("\r\n").has_value(), "IRCMessage rejects an empty line");
+        check(!IRCMessage::parse(":prefix.only").has_value(), "IRCMessage rejects a line without command");
+
+        for (auto const line : { ":s 332 nick #GPG!1 :Lobby 1\r\n", "NAMES #GPG!1\r\n", ":s 353 nick = #GPG!1 :a b c\r\n" })
+        {
+            auto const message = IRCMessage::parse(line);
+            check(message.has_value() && (message->toLine() == line), "IRCMessage toLine of " + std::string{ line });
+        }
+    }
+}
+
+int main()
+{
+    testPeerchatCipher();
+    testIRCMessage();
+    if (failures != 0)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+}
@@ -0,0 +1,325 @@
+#include "AdminServer.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+#include <Utility/Defer.hpp>
+#include <Utility/WeakRefHandler.hpp>
+
+using TCP = boost::asio::ip::tcp;
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+using CNCOnlineForwarder::Utility::makeWeakHandler;
+
+namespace CNCOnlineForwarder::Admin
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<AdminServer>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        std::string decodeURLComponent(std::string_view const text)
+        {
+            auto const fromHex = [](char const character) -> std::optional<int>
+            {
+                if (character >= '0' && character <= '9') return character - '0';
+                if (character >= 'a' && character <= 'f') return character - 'a' + 10;
+                if (character >= 'A' && character <= 'F') return character - 'A' + 10;
+                return std::nullopt;
+            };
+
+            auto result = std::string{};
+            result.reserve(text.size());
+            for (auto i = std::size_t{ 0 }; i < text.size(); ++i)
+            {
+                if (text[i] == '+')
+                {
+                    result.push_back(' ');
+                    continue;
+                }
+
+                if (text[i] == '%' && (i + 2) < text.size())
+                {
+                    auto const high = fromHex(text[i + 1]);
+                    auto const low = fromHex(text[i + 2]);
+                    if (high.has_value() && low.has_value())
+                    {
+                        result.push_back(static_cast<char>((high.value() << 4) | low.value()));
+                        i += 2;
+                        continue;
+                    }
+                }
+
+                result.push_back(text[i]);
+            }
+            return result;
+        }
+    }
+
+    AdminRequest AdminRequest::parse(std::string_view const target)
+    {
+        auto request = AdminRequest{};
+        auto const queryStart = target.find('?');
+        request.path = decodeURLComponent(target.substr(0, queryStart));
+        if (queryStart == target.npos)
+        {
+            return request;
+        }
+
+        auto query = target.substr(queryStart + 1);
+        while (!query.empty())
+        {
+            auto const parameterEnd = query.find('&');
+            auto const parameter = query.substr(0, parameterEnd);
+            auto const separator = parameter.find('=');
+            auto name = decodeURLComponent(parameter.substr(0, separator));
+            auto value = separator == parameter.npos
+                ? std::string{}
+                : decodeURLComponent(parameter.substr(separator + 1));
+            if (!name.empty())
+            {
+                request.query.insert_or_assign(std::move(name), std::move(value));
+            }
+
+            if (parameterEnd == query.npos)
+            {
+                break;
+            }
+            query.remove_prefix(parameterEnd + 1);
+        }
+        return request;
+    }
+
+    std::optional<std::string_view> AdminRequest::getParameter(std::string_view const name) const
+    {
+        auto const iterator = query.find(name);
+        if (iterator == query.end())
+        {
+            return std::nullopt;
+        }
+        return iterator->second;
+    }
+
+    class AdminServer::Session : public std::enable_shared_from_this<AdminServer::Session>
+    {
+    private:
+        using TCPStream = boost::beast::tcp_stream;
+        using FlatBuffer = boost::beast::flat_buffer;
+        using HTTPRequest = boost::beast::http::request<boost::beast::http::string_body>;
+        using HTTPResponse = boost::beast::http::response<boost::beast::http::string_body>;
+
+    private:
+        std::weak_ptr<AdminServer const> m_server;
+        TCPStream m_stream;
+        FlatBuffer m_buffer; // (Must persist between reads)
+        HTTPRequest m_request;
+        HTTPResponse m_response;
+
+    public:
+        Session(std::weak_ptr<AdminServer const> server, TCP::socket&& socket) :
+            m_server{ std::move(server) },
+            m_stream{ std::move(socket) },
+            m_buffer{},
+            m_request{},
+            m_response{}
+        {}
+
+        void read()
+        {
+            m_request = {};
+            m_stream.expires_after(std::chrono::seconds(30));
+            boost::beast::http::async_read
+            (
+                m_stream,
+                m_buffer,
+                m_request,
+                boost::beast::bind_front_handler(&Session::onRead, shared_from_this())
+            );
+        }
+
+    private:
+        void onRead(ErrorCode const& code, std::size_t const /* bytesTransferred */)
+        {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::http };
+
+            if (code == boost::beast::http::error::end_of_stream)
+            {
+                return close();
+            }
+
+            if (code.failed())
+            {
+                logLine(LogLevel::debug, "Read failed: ", code);
+                return;
+            }
+
+            auto const server = m_server.lock();
+            if (!server)
+            {
+                logLine(LogLevel::warning, "AdminServer already died when handling request");
+                return close();
+            }
+
+            if (m_request.method() != boost::beast::http::verb::get)
+            {
+                return respond(AdminResponse{ 405, "text/plain", "Only GET is supported\n" });
+            }
+
+            auto responder = [self = shared_from_this()](AdminResponse response)
+            {
+                auto action = [self, response = std::move(response)]() mutable
+                {
+                    self->respond(std::move(response));
+                };
+                boost::asio::dispatch(self->m_stream.get_executor(), std::move(action));
+            };
+            auto const target = m_request.target();
+            server->dispatch(AdminRequest::parse({ target.data(), target.size() }), std::move(responder));
+        }
+
+        void respond(AdminResponse&& response)
+        {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::http };
+
+            namespace Http = boost::beast::http;
+            m_response = HTTPResponse{ static_cast<Http::status>(response.status), m_request.version() };
+            m_response.set(Http::field::server, BOOST_BEAST_VERSION_STRING);
+            m_response.set(Http::field::content_type, response.contentType);
+            m_response.set(Http::field::cache_control, "no-store");
+            m_response.keep_alive(m_request.keep_alive());
+            m_response.body() = std::move(response.body);
+            m_response.prepare_payload();
+
+            Http::async_write
+            (
+                m_stream,
+                m_response,
+                boost::beast::bind_front_handler(&Session::onWrite, shared_from_this())
+            );
+        }
+
+        void onWrite(ErrorCode const& code, std::size_t const /* bytesTransferred */)
+        {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::http };
+
+            if (code.failed())
+            {
+                logLine(LogLevel::debug, "Write failed: ", code);
+                return;
+            }
+
+            if (!m_response.keep_alive())
+            {
+                return close();
+            }
+
+            read();
+        }
+
+        void close()
+        {
+            auto code = ErrorCode{};
+            m_stream.socket().shutdown(TCP::socket::shutdown_send, code);
+        }
+    };
+
+    std::shared_ptr<AdminServer> AdminServer::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        EndPoint const& localEndPoint
+    )
+    {
+        auto const self = std::make_shared<AdminServer>
+        (
+            PrivateConstructor{},
+            objectMaker,
+            localEndPoint
+        );
+
+        auto const action = [](AdminServer& self)
+        {
+            logLine(LogLevel::info, "AdminServer listening on ", self.m_acceptor->local_endpoint());
+            self.prepareForNextConnection();
+        };
+        Utility::defer(self->m_strand, makeWeakHandler(self, action));
+
+        return self;
+    }
+
+    AdminServer::AdminServer
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        EndPoint const& localEndPoint
+    ) :
+        m_objectMaker{ objectMaker },
+        m_strand{ objectMaker.makeStrand() },
+        m_acceptor{ m_strand, localEndPoint },
+        m_routesMutex{},
+        m_routes{}
+    {}
+
+    void AdminServer::addRoute(std::string_view const path, AdminRoute route)
+    {
+        auto const lock = std::scoped_lock{ m_routesMutex };
+        m_routes.insert_or_assign(std::string{ path }, std::move(route));
+    }
+
+    void AdminServer::prepareForNextConnection()
+    {
+        auto const handler = [](AdminServer& self, ErrorCode const& code, TCP::socket socket)
+        {
+            self.prepareForNextConnection();
+            if (code.failed())
+            {
+                logLine(LogLevel::error, "Accept failed: ", code);
+                return;
+            }
+
+            std::make_shared<Session>(self.weak_from_this(), std::move(socket))->read();
+        };
+        m_acceptor->async_accept
+        (
+            m_objectMaker.makeStrand(),
+            boost::asio::bind_executor(m_strand, makeWeakHandler(this, handler))
+        );
+    }
+
+    void AdminServer::dispatch(AdminRequest const& request, AdminResponder responder) const
+    {
+        auto route = AdminRoute{};
+        {
+            auto const lock = std::scoped_lock{ m_routesMutex };
+            if (auto const iterator = m_routes.find(request.path); iterator != m_routes.end())
+            {
+                route = iterator->second;
+            }
+        }
+
+        if (!route)
+        {
+            auto paths = std::ostringstream{};
+            paths << "Not found. Available paths:\n";
+            {
+                auto const lock = std::scoped_lock{ m_routesMutex };
+                for (auto const& entry : m_routes)
+                {
+                    paths << entry.first << '\n';
+                }
+            }
+            return responder(AdminResponse{ 404, "text/plain", paths.str() });
+        }
+
+        try
+        {
+            route(request, responder);
+        }
+        catch (std::exception const& error)
+        {
+            logLine(LogLevel::error, "Route ", request.path, " failed: ", error.what());
+            responder(AdminResponse{ 500, "text/plain", std::string{ error.what() } + '\n' });
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
+#include <Utility/WithStrand.hpp>
+
+namespace CNCOnlineForwarder::Admin
+{
+    struct AdminRequest
+    {
+        std::string path;
+        std::map<std::string, std::string, std::less<>> query;
+
+        static AdminRequest parse(std::string_view const target);
+
+        std::optional<std::string_view> getParameter(std::string_view const name) const;
+    };
+
+    struct AdminResponse
+    {
+        unsigned status = 200;
+        std::string contentType = "application/json";
+        std::string body;
+    };
+
+    // Sends the response, can be called from any thread
+    using AdminResponder = std::function<void(AdminResponse)>;
+    using AdminRoute = std::function<void(AdminRequest const&, AdminResponder)>;
+
+    // Local HTTP server used for inspecting the forwarder at runtime.
+    // It should only be bound to a loopback address.
+    class AdminServer : public std::enable_shared_from_this<AdminServer>
+    {
+    public:
+        using Strand = IOManager::StrandType;
+        using EndPoint = boost::asio::ip::tcp::endpoint;
+        using Acceptor = Utility::WithStrand<boost::asio::ip::tcp::acceptor>;
+    private:
+        struct PrivateConstructor {};
+        class Session;
+    private:
+        IOManager::ObjectMaker m_objectMaker;
+        Strand m_strand;
+        Acceptor m_acceptor;
+        std::mutex mutable m_routesMutex;
+        std::map<std::string, AdminRoute, std::less<>> m_routes;
+
+    public:
+        static constexpr auto description = "AdminServer";
+        static constexpr auto allocationTag = Diagnostics::AllocationTag::http;
+
+        static std::shared_ptr<AdminServer> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            EndPoint const& localEndPoint
+        );
+
+        AdminServer
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            EndPoint const& localEndPoint
+        );
+
+        void addRoute(std::string_view const path, AdminRoute route);
+
+    private:
+        void prepareForNextConnection();
+
+        void dispatch(AdminRequest const& request, AdminResponder responder) const;
+    };
+}
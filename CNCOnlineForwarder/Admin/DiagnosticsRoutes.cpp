@@ -0,0 +1,157 @@
+#include "DiagnosticsRoutes.hpp"
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Diagnostics/SamplingProfiler.hpp>
+#include <Diagnostics/SessionRegistry.hpp>
+#include <Diagnostics/Tracing.hpp>
+#include <Utility/ParseNumber.hpp>
+
+namespace CNCOnlineForwarder::Admin
+{
+    namespace
+    {
+        void getMetrics(AdminRequest const& request, AdminResponder const& respond)
+        {
+            auto const entries = Diagnostics::MetricsRegistry::get().snapshot();
+            auto body = std::ostringstream{};
+            if (request.getParameter("format") == "text")
+            {
+                for (auto const& entry : entries)
+                {
+                    body << entry << '\n';
+                }
+                return respond(AdminResponse{ 200, "text/plain", body.str() });
+            }
+
+            Diagnostics::writeMetricsJson(body, entries);
+            respond(AdminResponse{ 200, "application/json", body.str() });
+        }
+
+        void getSessions(AdminRequest const& request, AdminResponder const& respond)
+        {
+            auto filter = Diagnostics::SessionRegistry::Filter{};
+            if (auto const natNegID = request.getParameter("natNegID"); natNegID.has_value())
+            {
+                filter.natNegID = Utility::parseNumber<std::uint32_t>(natNegID.value());
+                if (!filter.natNegID.has_value())
+                {
+                    return respond(AdminResponse{ 400, "text/plain", "Invalid natNegID\n" });
+                }
+            }
+            if (auto const ip = request.getParameter("ip"); ip.has_value())
+            {
+                auto code = boost::system::error_code{};
+                filter.address = boost::asio::ip::make_address(ip.value(), code);
+                if (code.failed())
+                {
+                    return respond(AdminResponse{ 400, "text/plain", "Invalid ip\n" });
+                }
+            }
+
+            auto body = std::ostringstream{};
+            Diagnostics::writeSessionsJson(body, Diagnostics::SessionRegistry::get().snapshot(filter));
+            respond(AdminResponse{ 200, "application/json", body.str() });
+        }
+
+        // Chrome trace event JSON, can be opened in chrome://tracing or ui.perfetto.dev
+        void getTrace(AdminRequest const& request, AdminResponder const& respond)
+        {
+            auto natNegID = std::optional<std::uint32_t>{};
+            if (auto const parameter = request.getParameter("natNegID"); parameter.has_value())
+            {
+                natNegID = Utility::parseNumber<std::uint32_t>(parameter.value());
+                if (!natNegID.has_value())
+                {
+                    return respond(AdminResponse{ 400, "text/plain", "Invalid natNegID\n" });
+                }
+            }
+
+            auto& tracer = Diagnostics::Tracer::get();
+            auto body = std::ostringstream{};
+            tracer.writeChromeTrace(body, tracer.snapshot(natNegID));
+            respond(AdminResponse{ 200, "application/json", body.str() });
+        }
+
+        // Profiles the whole process for the given number of seconds, then responds with folded stacks
+        void getProfile
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            AdminRequest const& request,
+            AdminResponder const& respond
+        )
+        {
+            auto const readParameter = [&request](std::string_view const name, unsigned const defaultValue)
+            {
+                auto const parameter = request.getParameter(name);
+                return parameter.has_value() ? Utility::parseNumber<unsigned>(parameter.value()) : defaultValue;
+            };
+            auto const seconds = readParameter("seconds", 10);
+            // Not a multiple of common timer frequencies, to avoid sampling in lockstep with them
+            auto const frequency = readParameter("frequency", 99);
+            if (!seconds.has_value() || !frequency.has_value())
+            {
+                return respond(AdminResponse{ 400, "text/plain", "Invalid seconds or frequency\n" });
+            }
+
+            auto& profiler = Diagnostics::SamplingProfiler::get();
+            if (!profiler.start(frequency.value()))
+            {
+                return respond(AdminResponse{ 409, "text/plain", "Profiler is busy or not supported\n" });
+            }
+
+            using Timer = boost::asio::steady_timer;
+            auto const timer = std::make_shared<Timer>(objectMaker.make<Timer>());
+            timer->expires_after(std::chrono::seconds{ std::clamp(seconds.value(), 1u, 300u) });
+            timer->async_wait([timer, respond](boost::system::error_code const&)
+            {
+                auto const profile = Diagnostics::SamplingProfiler::get().stop();
+                if (!profile.has_value())
+                {
+                    return respond(AdminResponse{ 500, "text/plain", "Profile has been lost\n" });
+                }
+
+                auto body = std::ostringstream{};
+                Diagnostics::SamplingProfiler::writeFoldedStacks(body, profile.value());
+                respond(AdminResponse{ 200, "text/plain", body.str() });
+            });
+        }
+    }
+
+    void addDiagnosticsRoutes(AdminServer& server, IOManager::ObjectMaker const& objectMaker)
+    {
+        server.addRoute("/metrics", &getMetrics);
+        server.addRoute("/sessions", &getSessions);
+        server.addRoute("/trace", &getTrace);
+        server.addRoute("/profile", [objectMaker](AdminRequest const& request, AdminResponder respond)
+        {
+            getProfile(objectMaker, request, respond);
+        });
+    }
+
+    void addHistoryRoute(AdminServer& server, std::weak_ptr<Diagnostics::MetricsHistory const> const& history)
+    {
+        server.addRoute("/history", [history](AdminRequest const& request, AdminResponder respond)
+        {
+            auto const self = history.lock();
+            if (!self)
+            {
+                return respond(AdminResponse{ 503, "text/plain", "History is not available\n" });
+            }
+
+            auto window = std::chrono::seconds{ 3600 };
+            if (auto const parameter = request.getParameter("seconds"); parameter.has_value())
+            {
+                auto const seconds = Utility::parseNumber<std::chrono::seconds::rep>(parameter.value());
+                if (!seconds.has_value() || (seconds.value() <= 0))
+                {
+                    return respond(AdminResponse{ 400, "text/plain", "Invalid seconds\n" });
+                }
+                window = std::min(std::chrono::seconds{ seconds.value() }, Diagnostics::MetricsHistory::maximumWindow);
+            }
+
+            auto body = std::ostringstream{};
+            Diagnostics::writeHistoryJson(body, self->getView(window));
+            respond(AdminResponse{ 200, "application/json", body.str() });
+        });
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Admin/AdminServer.hpp>
+#include <Diagnostics/MetricsHistory.hpp>
+
+namespace CNCOnlineForwarder::Admin
+{
+    // Registers the routes exposing runtime statistics:
+    // /metrics[?format=text], /sessions[?natNegID=...][&ip=...], /trace[?natNegID=...]
+    // and /profile[?seconds=...][&frequency=...]
+    void addDiagnosticsRoutes(AdminServer& server, IOManager::ObjectMaker const& objectMaker);
+
+    // Registers /history[?seconds=...], the recent history of key metrics
+    void addHistoryRoute(AdminServer& server, std::weak_ptr<Diagnostics::MetricsHistory const> const& history);
+}
@@ -0,0 +1,322 @@
+#include "AllocationTracker.hpp"
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        struct alignas(64) TagCounters
+        {
+            std::atomic<std::int64_t> liveBytes{ 0 };
+            std::atomic<std::int64_t> peakBytes{ 0 };
+            std::atomic<std::uint64_t> allocations{ 0 };
+            std::atomic<std::uint64_t> allocatedBytes{ 0 };
+        };
+
+        // Constant initialized, so allocations made before main are accounted too
+        constinit auto counters = std::array<TagCounters, allocationTagCount>{};
+
+#ifdef CNCONLINEFORWARDER_ALLOCATION_TRACKING
+        constinit thread_local auto currentTag = AllocationTag::untagged;
+
+        // Stored right before every block returned by operator new
+        struct BlockHeader
+        {
+            std::uint64_t size;
+            // Distance from the block returned by malloc
+            std::uint32_t offset;
+            AllocationTag tag;
+        };
+        static_assert(sizeof(BlockHeader) == 16);
+
+        constexpr auto minimumAlignment = std::max(sizeof(BlockHeader), alignof(std::max_align_t));
+
+        void charge(AllocationTag const tag, std::size_t const size) noexcept
+        {
+            auto& tagCounters = counters[static_cast<std::size_t>(tag)];
+            auto const signedSize = static_cast<std::int64_t>(size);
+            tagCounters.allocations.fetch_add(1, std::memory_order_relaxed);
+            tagCounters.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+            auto const live = tagCounters.liveBytes.fetch_add(signedSize, std::memory_order_relaxed) + signedSize;
+            auto peak = tagCounters.peakBytes.load(std::memory_order_relaxed);
+            while ((live > peak) && !tagCounters.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        void* allocate(std::size_t const size, std::size_t const requestedAlignment) noexcept
+        {
+            auto const alignment = std::max(requestedAlignment, minimumAlignment);
+            auto const raw = static_cast<std::byte*>(std::malloc(size + alignment + sizeof(BlockHeader)));
+            if (raw == nullptr)
+            {
+                return nullptr;
+            }
+
+            auto const address = reinterpret_cast<std::uintptr_t>(raw + sizeof(BlockHeader));
+            auto const block = reinterpret_cast<std::byte*>((address + alignment - 1) & ~(alignment - 1));
+            auto const tag = currentTag;
+            new (block - sizeof(BlockHeader)) BlockHeader
+            {
+                size,
+                static_cast<std::uint32_t>(block - raw),
+                tag
+            };
+            charge(tag, size);
+            return block;
+        }
+
+        void* allocateOrThrow(std::size_t const size, std::size_t const alignment)
+        {
+            while (true)
+            {
+                if (auto const block = allocate(size, alignment); block != nullptr)
+                {
+                    return block;
+                }
+
+                auto const handler = std::get_new_handler();
+                if (handler == nullptr)
+                {
+                    throw std::bad_alloc{};
+                }
+                handler();
+            }
+        }
+
+        void deallocate(void* const pointer) noexcept
+        {
+            if (pointer == nullptr)
+            {
+                return;
+            }
+
+            auto const block = static_cast<std::byte*>(pointer);
+            auto const header = *reinterpret_cast<BlockHeader const*>(block - sizeof(BlockHeader));
+            auto& tagCounters = counters[static_cast<std::size_t>(header.tag)];
+            tagCounters.liveBytes.fetch_sub(static_cast<std::int64_t>(header.size), std::memory_order_relaxed);
+            std::free(block - header.offset);
+        }
+#endif
+    }
+
+    std::string_view AllocationTracker::getTagName(AllocationTag const tag) noexcept
+    {
+        switch (tag)
+        {
+        case AllocationTag::untagged:
+            return "untagged";
+        case AllocationTag::natNegSession:
+            return "natNegSession";
+        case AllocationTag::handlerState:
+            return "handlerState";
+        case AllocationTag::logging:
+            return "logging";
+        case AllocationTag::http:
+            return "http";
+        }
+        return "unknown";
+    }
+
+    AllocationTracker::Statistics AllocationTracker::getStatistics(AllocationTag const tag) noexcept
+    {
+        auto const& tagCounters = counters[static_cast<std::size_t>(tag)];
+        return Statistics
+        {
+            tagCounters.liveBytes.load(std::memory_order_relaxed),
+            tagCounters.peakBytes.load(std::memory_order_relaxed),
+            tagCounters.allocations.load(std::memory_order_relaxed),
+            tagCounters.allocatedBytes.load(std::memory_order_relaxed)
+        };
+    }
+
+    void AllocationTracker::registerMetrics()
+    {
+        if constexpr (enabled)
+        {
+            using Clock = std::chrono::steady_clock;
+
+            struct Published
+            {
+                Gauge& liveBytes;
+                Gauge& peakBytes;
+                Counter& allocations;
+                Gauge& allocationsPerSecond;
+                Gauge& allocatedBytesPerSecond;
+                Statistics rateBase;
+            };
+
+            struct State
+            {
+                std::mutex mutex;
+                std::vector<Published> published;
+                Clock::time_point rateBaseTime;
+            };
+
+            auto& registry = MetricsRegistry::get();
+            auto const state = std::make_shared<State>();
+            state->rateBaseTime = Clock::now();
+            for (auto i = std::size_t{ 0 }; i < allocationTagCount; ++i)
+            {
+                auto const tag = static_cast<AllocationTag>(i);
+                auto const prefix = "memory." + std::string{ getTagName(tag) } + ".";
+                state->published.push_back
+                ({
+                    registry.gauge(prefix + "liveBytes"),
+                    registry.gauge(prefix + "peakBytes"),
+                    registry.counter(prefix + "allocations"),
+                    registry.gauge(prefix + "allocationsPerSecond"),
+                    registry.gauge(prefix + "allocatedBytesPerSecond"),
+                    getStatistics(tag)
+                });
+            }
+
+            registry.addCollector([state]
+            {
+                auto const lock = std::scoped_lock{ state->mutex };
+                auto const now = Clock::now();
+                // Rates are averaged over at least one second, however often the registry is read
+                auto const elapsed = std::chrono::duration<double>{ now - state->rateBaseTime }.count();
+                auto const updateRates = elapsed >= 1;
+                for (auto i = std::size_t{ 0 }; i < allocationTagCount; ++i)
+                {
+                    auto& published = state->published[i];
+                    auto const current = getStatistics(static_cast<AllocationTag>(i));
+                    published.liveBytes.set(current.liveBytes);
+                    published.peakBytes.set(current.peakBytes);
+                    published.allocations.add(current.allocations - published.allocations.get());
+                    if (updateRates)
+                    {
+                        auto const allocations = current.allocations - published.rateBase.allocations;
+                        auto const bytes = current.allocatedBytes - published.rateBase.allocatedBytes;
+                        published.allocationsPerSecond.set(static_cast<std::int64_t>(allocations / elapsed));
+                        published.allocatedBytesPerSecond.set(static_cast<std::int64_t>(bytes / elapsed));
+                        published.rateBase = current;
+                    }
+                }
+                if (updateRates)
+                {
+                    state->rateBaseTime = now;
+                }
+            });
+        }
+    }
+
+#ifdef CNCONLINEFORWARDER_ALLOCATION_TRACKING
+    AllocationScope::AllocationScope(AllocationTag const tag) noexcept :
+        m_previous{ currentTag }
+    {
+        currentTag = tag;
+    }
+
+    AllocationScope::~AllocationScope()
+    {
+        currentTag = m_previous;
+    }
+#endif
+}
+
+#ifdef CNCONLINEFORWARDER_ALLOCATION_TRACKING
+namespace Tracking = CNCOnlineForwarder::Diagnostics;
+
+void* operator new(std::size_t const size)
+{
+    return Tracking::allocateOrThrow(size, 0);
+}
+
+void* operator new[](std::size_t const size)
+{
+    return Tracking::allocateOrThrow(size, 0);
+}
+
+void* operator new(std::size_t const size, std::align_val_t const alignment)
+{
+    return Tracking::allocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t const size, std::align_val_t const alignment)
+{
+    return Tracking::allocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new(std::size_t const size, std::nothrow_t const&) noexcept
+{
+    return Tracking::allocate(size, 0);
+}
+
+void* operator new[](std::size_t const size, std::nothrow_t const&) noexcept
+{
+    return Tracking::allocate(size, 0);
+}
+
+void* operator new(std::size_t const size, std::align_val_t const alignment, std::nothrow_t const&) noexcept
+{
+    return Tracking::allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t const size, std::align_val_t const alignment, std::nothrow_t const&) noexcept
+{
+    return Tracking::allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* const pointer) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete[](void* const pointer) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete(void* const pointer, std::size_t) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete[](void* const pointer, std::size_t) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete(void* const pointer, std::align_val_t) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete[](void* const pointer, std::align_val_t) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete(void* const pointer, std::size_t, std::align_val_t) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete[](void* const pointer, std::size_t, std::align_val_t) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete(void* const pointer, std::nothrow_t const&) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete[](void* const pointer, std::nothrow_t const&) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete(void* const pointer, std::align_val_t, std::nothrow_t const&) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+
+void operator delete[](void* const pointer, std::align_val_t, std::nothrow_t const&) noexcept
+{
+    Tracking::deallocate(pointer);
+}
+#endif
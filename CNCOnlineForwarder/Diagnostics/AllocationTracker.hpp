@@ -0,0 +1,88 @@
+#pragma once
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Subsystem charged for heap allocations made on the current thread
+    enum class AllocationTag : std::uint8_t
+    {
+        untagged,
+        // Session objects of NatNegProxy, InitialPhase and GameConnection,
+        // and whatever their handlers allocate
+        natNegSession,
+        // Asynchronous operations and deferred handlers waiting in the event loop
+        handlerState,
+        logging,
+        http,
+    };
+    inline constexpr auto allocationTagCount = std::size_t{ 5 };
+
+    // Accounts live bytes, peak and allocation counts per AllocationTag,
+    // by replacing the global operator new / delete.
+    // Only compiled in with the CNCONLINEFORWARDER_ALLOCATION_TRACKING CMake option:
+    // otherwise the allocation functions are untouched and AllocationScope is empty.
+    class AllocationTracker
+    {
+    public:
+        struct Statistics
+        {
+            std::int64_t liveBytes;
+            std::int64_t peakBytes;
+            std::uint64_t allocations;
+            std::uint64_t allocatedBytes;
+        };
+
+#ifdef CNCONLINEFORWARDER_ALLOCATION_TRACKING
+        static constexpr auto enabled = true;
+#else
+        static constexpr auto enabled = false;
+#endif
+
+        static constexpr auto description = "AllocationTracker";
+
+        static std::string_view getTagName(AllocationTag const tag) noexcept;
+
+        static Statistics getStatistics(AllocationTag const tag) noexcept;
+
+        // Publishes memory.<tag>.* metrics, refreshed every time the registry is read.
+        // Does nothing if tracking is not compiled in.
+        static void registerMetrics();
+    };
+
+    // Returns: Type::allocationTag if Type declares one, for example
+    // `static constexpr auto allocationTag = AllocationTag::natNegSession;`
+    template<typename Type>
+    constexpr AllocationTag getAllocationTag() noexcept
+    {
+        if constexpr (requires { Type::allocationTag; })
+        {
+            return Type::allocationTag;
+        }
+        else
+        {
+            return AllocationTag::untagged;
+        }
+    }
+
+    // Charges the allocations made on this thread during the scope to `tag`.
+    // Scopes nest, the innermost one wins. Memory is always credited back
+    // to the tag it was charged to, whichever thread frees it.
+    class AllocationScope
+    {
+#ifdef CNCONLINEFORWARDER_ALLOCATION_TRACKING
+    private:
+        AllocationTag m_previous;
+
+    public:
+        explicit AllocationScope(AllocationTag const tag) noexcept;
+        ~AllocationScope();
+#else
+    public:
+        explicit AllocationScope(AllocationTag) noexcept {}
+        // User provided, so scopes are not reported as unused variables
+        ~AllocationScope() {}
+#endif
+        AllocationScope(AllocationScope const&) = delete;
+        AllocationScope& operator=(AllocationScope const&) = delete;
+    };
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Bounded buffer of records filled by any thread and emptied in batches by a dedicated thread,
+    // for the outputs which must never make the relay wait (SessionEventStream, PacketCapture).
+    // The mutex belongs to the owner, which usually also protects its own lifetime with it:
+    // producers hold it to append one record, the thread only holds it to swap the whole buffer out,
+    // and processes the batch without it.
+    template<typename Record>
+    class BackgroundQueue
+    {
+    public:
+        using Batch = std::vector<Record>;
+
+    private:
+        std::mutex& m_mutex;
+        std::size_t m_capacity;
+        std::condition_variable m_wakeUp;
+        // Swapped with the batch of the thread, both are reserved up front so they never reallocate
+        Batch m_pending;
+        bool m_stopping;
+        std::thread m_thread;
+
+    public:
+        BackgroundQueue(std::mutex& mutex, std::size_t const capacity) :
+            m_mutex{ mutex },
+            m_capacity{ capacity },
+            m_wakeUp{},
+            m_pending{},
+            m_stopping{ false },
+            m_thread{}
+        {
+            m_pending.reserve(capacity);
+        }
+
+        BackgroundQueue(BackgroundQueue const&) = delete;
+        BackgroundQueue& operator=(BackgroundQueue const&) = delete;
+
+        ~BackgroundQueue()
+        {
+            stop();
+        }
+
+        // Starts the thread, which calls process(Batch const&) for each batch
+        template<typename Process>
+        void start(Process process)
+        {
+            m_thread = std::thread{ [this, process = std::move(process)]() mutable { run(process); } };
+        }
+
+        // Requires: the mutex is held.
+        // Calls fill(Record&) on a new record at the end of the buffer.
+        // Returns: false if the buffer is full, in which case `fill` isn't called.
+        template<typename Fill>
+        bool push(Fill&& fill)
+        {
+            if (m_pending.size() == m_capacity)
+            {
+                return false;
+            }
+
+            fill(m_pending.emplace_back());
+            if (m_pending.size() == 1)
+            {
+                m_wakeUp.notify_one();
+            }
+            return true;
+        }
+
+        // Requires: the mutex is not held.
+        // Processes the records still in the buffer, then stops the thread.
+        void stop()
+        {
+            if (!m_thread.joinable())
+            {
+                return;
+            }
+
+            {
+                auto const lock = std::scoped_lock{ m_mutex };
+                m_stopping = true;
+            }
+            m_wakeUp.notify_one();
+            m_thread.join();
+        }
+
+    private:
+        template<typename Process>
+        void run(Process& process)
+        {
+            auto batch = Batch{};
+            batch.reserve(m_capacity);
+            auto lock = std::unique_lock{ m_mutex };
+            while (true)
+            {
+                m_wakeUp.wait(lock, [this] { return m_stopping || !m_pending.empty(); });
+                if (m_pending.empty())
+                {
+                    return;
+                }
+
+                std::swap(m_pending, batch);
+                lock.unlock();
+                process(std::as_const(batch));
+                batch.clear();
+                lock.lock();
+            }
+        }
+    };
+}
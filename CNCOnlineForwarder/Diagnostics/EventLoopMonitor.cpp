@@ -0,0 +1,151 @@
+#include "EventLoopMonitor.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<EventLoopMonitor>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        std::string makeName(std::string_view const description, std::string_view const metric)
+        {
+            auto name = std::string{ "eventLoop.handler." };
+            name.append(description).append(".").append(metric);
+            return name;
+        }
+
+        std::atomic<std::int64_t> slowHandlerBudget{ EventLoopMonitor::defaultSlowHandlerBudget.count() };
+
+        thread_local EventLoopMonitor::WorkerScope* currentWorker = nullptr;
+        thread_local auto handlerDepth = 0;
+    }
+
+    HandlerStatistics::HandlerStatistics(std::string_view const description) :
+        description{ description },
+        duration{ MetricsRegistry::get().histogram(makeName(description, "durationMicroseconds")) },
+        lag{ MetricsRegistry::get().histogram(makeName(description, "lagMicroseconds")) },
+        pending{ MetricsRegistry::get().gauge(makeName(description, "pending")) },
+        slow{ MetricsRegistry::get().counter(makeName(description, "slow")) }
+    {}
+
+    void EventLoopMonitor::setSlowHandlerBudget(std::chrono::microseconds const budget) noexcept
+    {
+        slowHandlerBudget.store(budget.count(), std::memory_order_relaxed);
+    }
+
+    std::chrono::microseconds EventLoopMonitor::getSlowHandlerBudget() noexcept
+    {
+        return std::chrono::microseconds{ slowHandlerBudget.load(std::memory_order_relaxed) };
+    }
+
+    Gauge& EventLoopMonitor::getPendingHandlers()
+    {
+        static auto& pendingHandlers = MetricsRegistry::get().gauge("eventLoop.pendingHandlers");
+        return pendingHandlers;
+    }
+
+    void EventLoopMonitor::reportSlowHandler
+    (
+        HandlerStatistics const& statistics,
+        Clock::duration const elapsed,
+        std::string_view const session
+    )
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        logLine
+        (
+            LogLevel::warning,
+            "Slow handler of ", statistics.description,
+            ": took ", duration_cast<microseconds>(elapsed).count(),
+            "us, budget ", getSlowHandlerBudget().count(),
+            "us, session ", session.empty() ? "(unknown)" : session
+        );
+    }
+
+    EventLoopMonitor::HandlerScope::HandlerScope(HandlerStatistics& statistics) noexcept :
+        m_statistics{ &statistics },
+        m_start{ Clock::now() },
+        m_outermost{ handlerDepth == 0 }
+    {
+        ++handlerDepth;
+    }
+
+    EventLoopMonitor::HandlerScope::~HandlerScope()
+    {
+        finish();
+    }
+
+    std::optional<EventLoopMonitor::Clock::duration> EventLoopMonitor::HandlerScope::finish() noexcept
+    {
+        if (m_statistics == nullptr)
+        {
+            return std::nullopt;
+        }
+
+        auto const elapsed = Clock::now() - m_start;
+        --handlerDepth;
+        if (m_outermost && (currentWorker != nullptr) && !currentWorker->isMeasuring())
+        {
+            currentWorker->addBusyTime(elapsed);
+        }
+
+        auto& statistics = *std::exchange(m_statistics, nullptr);
+        statistics.duration.recordDuration(elapsed);
+        if (elapsed <= getSlowHandlerBudget())
+        {
+            return std::nullopt;
+        }
+        statistics.slow.add();
+        return elapsed;
+    }
+
+    EventLoopMonitor::WorkerScope::WorkerScope() :
+        m_busyMicroseconds{ MetricsRegistry::get().counter("eventLoop.worker.busyMicroseconds") },
+        m_busyPermille
+        {
+            [] () -> Gauge&
+            {
+                static auto nextIndex = std::atomic<int>{ 0 };
+                auto const index = nextIndex.fetch_add(1);
+                auto const name = "eventLoop.worker" + std::to_string(index) + ".busyPermille";
+                return MetricsRegistry::get().gauge(name);
+            }()
+        },
+        m_windowStart{ Clock::now() },
+        m_busyInWindow{},
+        m_previous{ std::exchange(currentWorker, this) },
+        m_measuring{ false }
+    {}
+
+    EventLoopMonitor::WorkerScope::~WorkerScope()
+    {
+        m_busyPermille.set(0);
+        currentWorker = m_previous;
+    }
+
+    void EventLoopMonitor::WorkerScope::addBusyTime(Clock::duration const elapsed) noexcept
+    {
+        m_busyInWindow += elapsed;
+        m_busyMicroseconds.add(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+
+    void EventLoopMonitor::WorkerScope::sample() noexcept
+    {
+        auto const now = Clock::now();
+        auto const window = now - m_windowStart;
+        if (window.count() > 0)
+        {
+            m_busyPermille.set((m_busyInWindow * 1000) / window);
+        }
+        m_windowStart = now;
+        m_busyInWindow = {};
+    }
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Diagnostics/Tracing.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Statistics shared by all the handlers of the same type
+    struct HandlerStatistics
+    {
+        std::string_view description;
+        Histogram& duration;
+        Histogram& lag;
+        Gauge& pending;
+        Counter& slow;
+
+        explicit HandlerStatistics(std::string_view const description);
+    };
+
+    template<typename Type>
+    HandlerStatistics& getHandlerStatistics()
+    {
+        static auto statistics = HandlerStatistics{ Type::description };
+        return statistics;
+    }
+
+    // Instrumentation of the io_context driven by IOManager::run:
+    // handler execution time, scheduling lag, pending handlers and worker thread load.
+    class EventLoopMonitor
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        class HandlerScope;
+        class WorkerScope;
+
+        static constexpr auto description = "EventLoopMonitor";
+        static constexpr auto defaultSlowHandlerBudget = std::chrono::microseconds{ 10'000 };
+
+        // Handlers running longer than the budget will be reported as slow handlers
+        static void setSlowHandlerBudget(std::chrono::microseconds const budget) noexcept;
+
+        static std::chrono::microseconds getSlowHandlerBudget() noexcept;
+
+        // Total amount of handlers scheduled but not executed yet
+        static Gauge& getPendingHandlers();
+
+        static void reportSlowHandler
+        (
+            HandlerStatistics const& statistics,
+            Clock::duration const elapsed,
+            std::string_view const session
+        );
+    };
+
+    // Measures the execution time of a handler
+    class EventLoopMonitor::HandlerScope
+    {
+    private:
+        HandlerStatistics* m_statistics;
+        Clock::time_point m_start;
+        bool m_outermost;
+
+    public:
+        explicit HandlerScope(HandlerStatistics& statistics) noexcept;
+        HandlerScope(HandlerScope const&) = delete;
+        HandlerScope& operator=(HandlerScope const&) = delete;
+        ~HandlerScope();
+
+        // Records the execution time.
+        // Returns: execution time, if the handler exceeded the budget
+        std::optional<Clock::duration> finish() noexcept;
+    };
+
+    // Keeps track of how busy a thread running the io_context is
+    class EventLoopMonitor::WorkerScope
+    {
+    private:
+        Counter& m_busyMicroseconds;
+        Gauge& m_busyPermille;
+        Clock::time_point m_windowStart;
+        Clock::duration m_busyInWindow;
+        WorkerScope* m_previous;
+        // Set while measureBusy is timing handlers, so their HandlerScopes don't count them twice
+        bool m_measuring;
+
+    public:
+        WorkerScope();
+        WorkerScope(WorkerScope const&) = delete;
+        WorkerScope& operator=(WorkerScope const&) = delete;
+        ~WorkerScope();
+
+        void addBusyTime(Clock::duration const elapsed) noexcept;
+
+        bool isMeasuring() const noexcept { return m_measuring; }
+
+        // Calls `run`, which executes handlers and returns how many,
+        // and counts the whole call as busy time if any was executed.
+        template<typename Run>
+        std::size_t measureBusy(Run&& run)
+        {
+            m_measuring = true;
+            auto const start = Clock::now();
+            auto const executed = run();
+            m_measuring = false;
+            if (executed != 0)
+            {
+                addBusyTime(Clock::now() - start);
+            }
+            return executed;
+        }
+
+        // Updates the load of this worker since the last sample
+        void sample() noexcept;
+    };
+
+    // Invokes a handler scheduled on an executor, recording how long it waited to run.
+    // The handler runs in the trace context of the code which scheduled it.
+    template<typename Handler, bool measureDuration>
+    class ScheduledHandler
+    {
+    private:
+        HandlerStatistics* m_statistics;
+        EventLoopMonitor::Clock::time_point m_scheduledAt;
+        PendingSpan m_span;
+        bool m_pending;
+        Handler m_handler;
+
+    public:
+        template<typename InputHandler>
+        ScheduledHandler(HandlerStatistics& statistics, InputHandler&& handler) :
+            m_statistics{ &statistics },
+            m_scheduledAt{ EventLoopMonitor::Clock::now() },
+            m_span{},
+            m_pending{ true },
+            m_handler{ std::forward<InputHandler>(handler) }
+        {
+            m_statistics->pending.add(1);
+            EventLoopMonitor::getPendingHandlers().add(1);
+        }
+
+        ScheduledHandler(ScheduledHandler&& other) :
+            m_statistics{ other.m_statistics },
+            m_scheduledAt{ other.m_scheduledAt },
+            m_span{ other.m_span },
+            m_pending{ std::exchange(other.m_pending, false) },
+            m_handler{ std::move(other.m_handler) }
+        {}
+
+        ScheduledHandler& operator=(ScheduledHandler&&) = delete;
+
+        ~ScheduledHandler()
+        {
+            // The handler was destroyed without being executed
+            setNotPending();
+        }
+
+        void operator()()
+        {
+            setNotPending();
+            m_statistics->lag.recordDuration(EventLoopMonitor::Clock::now() - m_scheduledAt);
+            m_span.finish("defer", m_statistics->description);
+
+            if constexpr (measureDuration)
+            {
+                auto scope = EventLoopMonitor::HandlerScope{ *m_statistics };
+                auto const trace = TraceContext::Scope{ m_span.getTarget(), "handler", m_statistics->description };
+                m_handler();
+                if (auto const elapsed = scope.finish(); elapsed.has_value())
+                {
+                    EventLoopMonitor::reportSlowHandler(*m_statistics, elapsed.value(), {});
+                }
+            }
+            else
+            {
+                auto const trace = TraceContext::Scope{ m_span.getTarget() };
+                m_handler();
+            }
+        }
+
+    private:
+        void setNotPending() noexcept
+        {
+            if (m_pending)
+            {
+                m_pending = false;
+                m_statistics->pending.add(-1);
+                EventLoopMonitor::getPendingHandlers().add(-1);
+            }
+        }
+    };
+}
@@ -0,0 +1,242 @@
+#include "Metrics.hpp"
+#include <precompiled.hpp>
+#include <Utility/JsonWriter.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        template<typename T>
+        T& findOrCreate
+        (
+            std::mutex& mutex,
+            std::map<std::string, std::unique_ptr<T>, std::less<>>& map,
+            std::atomic<std::uint64_t>& generation,
+            std::string_view const name
+        )
+        {
+            auto const lock = std::scoped_lock{ mutex };
+            auto iterator = map.find(name);
+            if (iterator == map.end())
+            {
+                iterator = map.emplace(std::string{ name }, std::make_unique<T>()).first;
+                generation.fetch_add(1, std::memory_order_release);
+            }
+            return *iterator->second;
+        }
+    }
+
+    double Histogram::Snapshot::mean() const noexcept
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+        return static_cast<double>(sum) / static_cast<double>(count);
+    }
+
+    std::uint64_t Histogram::Snapshot::percentile(double const fraction) const noexcept
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        auto const rank = static_cast<std::uint64_t>(std::ceil(fraction * static_cast<double>(count)));
+        auto accumulated = std::uint64_t{ 0 };
+        for (auto i = std::size_t{ 0 }; i < buckets.size(); ++i)
+        {
+            accumulated += buckets[i];
+            if (accumulated >= rank)
+            {
+                return std::min(getBucketUpperBound(i), max);
+            }
+        }
+        return max;
+    }
+
+    std::size_t Histogram::getBucketIndex(std::uint64_t const value) noexcept
+    {
+        auto index = std::size_t{ 0 };
+        for (auto remaining = value; remaining != 0; remaining >>= 1)
+        {
+            ++index;
+        }
+        return std::min(index, bucketCount - 1);
+    }
+
+    std::uint64_t Histogram::getBucketUpperBound(std::size_t const index) noexcept
+    {
+        if (index == 0)
+        {
+            return 0;
+        }
+        return (std::uint64_t{ 1 } << index) - 1;
+    }
+
+    void Histogram::record(std::uint64_t const value) noexcept
+    {
+        m_buckets[getBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+
+        auto currentMax = m_max.load(std::memory_order_relaxed);
+        while (currentMax < value)
+        {
+            if (m_max.compare_exchange_weak(currentMax, value, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+    }
+
+    Histogram::Snapshot Histogram::snapshot() const noexcept
+    {
+        auto result = Snapshot{};
+        for (auto i = std::size_t{ 0 }; i < m_buckets.size(); ++i)
+        {
+            result.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+            result.count += result.buckets[i];
+        }
+        result.sum = m_sum.load(std::memory_order_relaxed);
+        result.max = m_max.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    MetricsRegistry& MetricsRegistry::get()
+    {
+        static auto registry = MetricsRegistry{};
+        return registry;
+    }
+
+    Counter& MetricsRegistry::counter(std::string_view const name)
+    {
+        return findOrCreate(m_mutex, m_counters, m_generation, name);
+    }
+
+    Gauge& MetricsRegistry::gauge(std::string_view const name)
+    {
+        return findOrCreate(m_mutex, m_gauges, m_generation, name);
+    }
+
+    Histogram& MetricsRegistry::histogram(std::string_view const name)
+    {
+        return findOrCreate(m_mutex, m_histograms, m_generation, name);
+    }
+
+    void MetricsRegistry::addCollector(std::function<void()> collector)
+    {
+        auto const lock = std::scoped_lock{ m_collectorsMutex };
+        m_collectors.push_back(std::move(collector));
+    }
+
+    void MetricsRegistry::collect() const
+    {
+        auto const lock = std::scoped_lock{ m_collectorsMutex };
+        for (auto const& collector : m_collectors)
+        {
+            collector();
+        }
+    }
+
+    std::vector<MetricsRegistry::Entry> MetricsRegistry::snapshot() const
+    {
+        collect();
+
+        auto entries = std::vector<Entry>{};
+        {
+            auto const lock = std::scoped_lock{ m_mutex };
+            entries.reserve(m_counters.size() + m_gauges.size() + m_histograms.size());
+            for (auto const& [name, counter] : m_counters)
+            {
+                entries.push_back({ name, Kind::counter, static_cast<std::int64_t>(counter->get()), {} });
+            }
+            for (auto const& [name, gauge] : m_gauges)
+            {
+                entries.push_back({ name, Kind::gauge, gauge->get(), {} });
+            }
+            for (auto const& [name, histogram] : m_histograms)
+            {
+                auto snapshot = histogram->snapshot();
+                auto const count = static_cast<std::int64_t>(snapshot.count);
+                entries.push_back({ name, Kind::histogram, count, snapshot });
+            }
+        }
+
+        std::sort(entries.begin(), entries.end(), [](Entry const& a, Entry const& b)
+        {
+            return a.name < b.name;
+        });
+        return entries;
+    }
+
+    std::vector<MetricsRegistry::Reference> MetricsRegistry::getReferences() const
+    {
+        auto references = std::vector<Reference>{};
+        {
+            auto const lock = std::scoped_lock{ m_mutex };
+            references.reserve(m_counters.size() + m_gauges.size() + m_histograms.size());
+            for (auto const& [name, counter] : m_counters)
+            {
+                references.push_back({ name, Kind::counter, counter.get(), nullptr, nullptr });
+            }
+            for (auto const& [name, gauge] : m_gauges)
+            {
+                references.push_back({ name, Kind::gauge, nullptr, gauge.get(), nullptr });
+            }
+            for (auto const& [name, histogram] : m_histograms)
+            {
+                references.push_back({ name, Kind::histogram, nullptr, nullptr, histogram.get() });
+            }
+        }
+
+        std::sort(references.begin(), references.end(), [](Reference const& a, Reference const& b)
+        {
+            return a.name < b.name;
+        });
+        return references;
+    }
+
+    std::ostream& operator<<(std::ostream& out, MetricsRegistry::Entry const& entry)
+    {
+        out << entry.name << " = ";
+        if (entry.kind != MetricsRegistry::Kind::histogram)
+        {
+            return out << entry.value;
+        }
+
+        auto const& histogram = entry.histogram;
+        return out << "{ count " << histogram.count
+            << ", mean " << histogram.mean()
+            << ", p50 " << histogram.percentile(0.5)
+            << ", p99 " << histogram.percentile(0.99)
+            << ", max " << histogram.max << " }";
+    }
+
+    void writeMetricsJson(std::ostream& out, std::vector<MetricsRegistry::Entry> const& entries)
+    {
+        auto json = Utility::JsonWriter{ out };
+        json.beginObject();
+        for (auto const& entry : entries)
+        {
+            json.key(entry.name);
+            if (entry.kind != MetricsRegistry::Kind::histogram)
+            {
+                json.value(entry.value);
+                continue;
+            }
+
+            auto const& histogram = entry.histogram;
+            json.beginObject();
+            json.member("count", histogram.count);
+            json.member("sum", histogram.sum);
+            json.member("mean", histogram.mean());
+            json.member("p50", histogram.percentile(0.5));
+            json.member("p90", histogram.percentile(0.9));
+            json.member("p99", histogram.percentile(0.99));
+            json.member("max", histogram.max);
+            json.endObject();
+        }
+        json.endObject();
+    }
+}
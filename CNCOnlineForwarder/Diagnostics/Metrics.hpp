@@ -0,0 +1,172 @@
+#pragma once
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Monotonically increasing value, safe to update from any thread
+    class Counter
+    {
+    private:
+        std::atomic<std::uint64_t> m_value{ 0 };
+
+    public:
+        void add(std::uint64_t const value = 1) noexcept
+        {
+            m_value.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        std::uint64_t get() const noexcept
+        {
+            return m_value.load(std::memory_order_relaxed);
+        }
+    };
+
+    // Value which can go up and down, safe to update from any thread
+    class Gauge
+    {
+    private:
+        std::atomic<std::int64_t> m_value{ 0 };
+
+    public:
+        void set(std::int64_t const value) noexcept
+        {
+            m_value.store(value, std::memory_order_relaxed);
+        }
+
+        void add(std::int64_t const delta) noexcept
+        {
+            m_value.fetch_add(delta, std::memory_order_relaxed);
+        }
+
+        std::int64_t get() const noexcept
+        {
+            return m_value.load(std::memory_order_relaxed);
+        }
+    };
+
+    // Histogram with power-of-two buckets: bucket 0 counts zeros,
+    // bucket i counts values in [2^(i - 1), 2^i).
+    // Durations are recorded in microseconds.
+    class Histogram
+    {
+    public:
+        static constexpr auto bucketCount = std::size_t{ 40 };
+
+        struct Snapshot
+        {
+            std::array<std::uint64_t, bucketCount> buckets{};
+            std::uint64_t count = 0;
+            std::uint64_t sum = 0;
+            std::uint64_t max = 0;
+
+            double mean() const noexcept;
+
+            // Returns: upper bound of the bucket containing the given percentile
+            std::uint64_t percentile(double const fraction) const noexcept;
+        };
+
+    private:
+        std::array<std::atomic<std::uint64_t>, bucketCount> m_buckets{};
+        std::atomic<std::uint64_t> m_count{ 0 };
+        std::atomic<std::uint64_t> m_sum{ 0 };
+        std::atomic<std::uint64_t> m_max{ 0 };
+
+    public:
+        static std::size_t getBucketIndex(std::uint64_t const value) noexcept;
+
+        static std::uint64_t getBucketUpperBound(std::size_t const index) noexcept;
+
+        void record(std::uint64_t const value) noexcept;
+
+        template<typename Rep, typename Period>
+        void recordDuration(std::chrono::duration<Rep, Period> const duration) noexcept
+        {
+            auto const microseconds = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+            record(static_cast<std::uint64_t>(std::max<decltype(microseconds)>(microseconds, 0)));
+        }
+
+        Snapshot snapshot() const noexcept;
+    };
+
+    // Process-wide collection of named metrics.
+    // Metrics are never removed, so references returned
+    // by the registry stay valid for the lifetime of the process.
+    class MetricsRegistry
+    {
+    public:
+        enum class Kind
+        {
+            counter,
+            gauge,
+            histogram,
+        };
+
+        struct Entry
+        {
+            std::string name;
+            Kind kind;
+            std::int64_t value;
+            Histogram::Snapshot histogram;
+        };
+
+        // Direct access to a metric, for publishing it without going through the registry
+        struct Reference
+        {
+            std::string name;
+            Kind kind;
+            Counter const* counter;
+            Gauge const* gauge;
+            Histogram const* histogram;
+        };
+
+    private:
+        template<typename T>
+        using Map = std::map<std::string, std::unique_ptr<T>, std::less<>>;
+
+        std::mutex mutable m_mutex;
+        Map<Counter> m_counters;
+        Map<Gauge> m_gauges;
+        Map<Histogram> m_histograms;
+        std::atomic<std::uint64_t> m_generation{ 0 };
+        std::mutex mutable m_collectorsMutex;
+        std::vector<std::function<void()>> m_collectors;
+
+    public:
+        static constexpr auto description = "MetricsRegistry";
+
+        static MetricsRegistry& get();
+
+        Counter& counter(std::string_view const name);
+
+        Gauge& gauge(std::string_view const name);
+
+        Histogram& histogram(std::string_view const name);
+
+        // Registers a function run before the registry is read,
+        // for metrics sampled from somewhere else instead of being updated in place
+        void addCollector(std::function<void()> collector);
+
+        // Runs the collectors. Already done by snapshot().
+        void collect() const;
+
+        // Returns: all metrics sorted by name
+        std::vector<Entry> snapshot() const;
+
+        // Returns: all metrics sorted by name
+        std::vector<Reference> getReferences() const;
+
+        // Changes whenever a new metric is added
+        std::uint64_t getGeneration() const noexcept
+        {
+            return m_generation.load(std::memory_order_acquire);
+        }
+
+    private:
+        MetricsRegistry() = default;
+    };
+
+    std::ostream& operator<<(std::ostream& out, MetricsRegistry::Entry const& entry);
+
+    // Writes the entries as a JSON object keyed by metric name
+    void writeMetricsJson(std::ostream& out, std::vector<MetricsRegistry::Entry> const& entries);
+}
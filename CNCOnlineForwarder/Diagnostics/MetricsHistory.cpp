@@ -0,0 +1,309 @@
+#include "MetricsHistory.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+#include <Utility/JsonWriter.hpp>
+
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<MetricsHistory>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        bool matches(std::string_view const name, std::string_view const prefix, std::string_view const suffix) noexcept
+        {
+            return (name.size() >= (prefix.size() + suffix.size()))
+                && (name.substr(0, prefix.size()) == prefix)
+                && (name.substr(name.size() - suffix.size()) == suffix);
+        }
+
+        constexpr auto noValue = std::numeric_limits<double>::quiet_NaN();
+    }
+
+    // Ring of points at one resolution, plus the point being accumulated
+    class MetricsHistory::Tier
+    {
+    private:
+        struct Accumulator
+        {
+            double sum = 0;
+            double max = noValue;
+            std::uint32_t count = 0;
+        };
+
+        std::int64_t m_step;
+        std::vector<Point> m_points;
+        std::size_t m_next;
+        std::size_t m_size;
+        std::optional<std::int64_t> m_currentTime;
+        std::array<Accumulator, seriesCount> m_current;
+
+    public:
+        explicit Tier(Resolution const resolution) :
+            m_step{ resolution.step.count() },
+            m_points(resolution.capacity),
+            m_next{ 0 },
+            m_size{ 0 },
+            m_currentTime{},
+            m_current{}
+        {}
+
+        std::int64_t getStep() const noexcept { return m_step; }
+
+        std::int64_t getCoverage() const noexcept
+        {
+            return m_step * static_cast<std::int64_t>(m_points.size());
+        }
+
+        void add(std::int64_t const time, std::array<double, seriesCount> const& values)
+        {
+            auto const pointTime = time - (time % m_step);
+            if (m_currentTime.has_value() && (m_currentTime.value() != pointTime))
+            {
+                flush();
+            }
+            m_currentTime = pointTime;
+
+            for (auto i = std::size_t{ 0 }; i < seriesCount; ++i)
+            {
+                if (std::isnan(values[i]))
+                {
+                    continue;
+                }
+                auto& accumulator = m_current[i];
+                accumulator.sum += values[i];
+                accumulator.max = std::isnan(accumulator.max) ? values[i] : std::max(accumulator.max, values[i]);
+                ++accumulator.count;
+            }
+        }
+
+        // Returns: points not older than `since`, including the one being accumulated
+        std::vector<Point> getPoints(std::int64_t const since) const
+        {
+            auto result = std::vector<Point>{};
+            result.reserve(m_size + 1);
+            auto const first = (m_next + m_points.size() - m_size) % m_points.size();
+            for (auto i = std::size_t{ 0 }; i < m_size; ++i)
+            {
+                auto const& point = m_points[(first + i) % m_points.size()];
+                if (point.time >= since)
+                {
+                    result.push_back(point);
+                }
+            }
+            if (m_currentTime.has_value())
+            {
+                result.push_back(getCurrentPoint());
+            }
+            return result;
+        }
+
+    private:
+        Point getCurrentPoint() const noexcept
+        {
+            auto point = Point{ m_currentTime.value_or(0), {}, {} };
+            for (auto i = std::size_t{ 0 }; i < seriesCount; ++i)
+            {
+                auto const& accumulator = m_current[i];
+                point.mean[i] = (accumulator.count == 0) ? noValue : (accumulator.sum / accumulator.count);
+                point.max[i] = accumulator.max;
+            }
+            return point;
+        }
+
+        void flush()
+        {
+            m_points[m_next] = getCurrentPoint();
+            m_next = (m_next + 1) % m_points.size();
+            m_size = std::min(m_size + 1, m_points.size());
+            m_current = {};
+        }
+    };
+
+    std::shared_ptr<MetricsHistory> MetricsHistory::create(IOManager::ObjectMaker const& objectMaker)
+    {
+        auto const self = std::make_shared<MetricsHistory>(PrivateConstructor{}, objectMaker);
+        periodicallySample(self, SteadyClock::now() + std::chrono::seconds{ 1 });
+        return self;
+    }
+
+    MetricsHistory::MetricsHistory(PrivateConstructor, IOManager::ObjectMaker const& objectMaker) :
+        m_objectMaker{ objectMaker },
+        m_mutex{},
+        m_tiers{},
+        m_previous{}
+    {
+        for (auto const resolution : resolutions)
+        {
+            m_tiers.emplace_back(resolution);
+        }
+    }
+
+    MetricsHistory::~MetricsHistory() = default;
+
+    std::string_view MetricsHistory::getSeriesName(Series const series) noexcept
+    {
+        switch (series)
+        {
+        case Series::packetsPerSecond:
+            return "packetsPerSecond";
+        case Series::liveSessions:
+            return "liveSessions";
+        case Series::handshakeSuccessRate:
+            return "handshakeSuccessRate";
+        case Series::relayLatencyP99:
+            return "relayLatencyP99Microseconds";
+        case Series::kernelDropsPerSecond:
+            return "kernelDropsPerSecond";
+        }
+        return "unknown";
+    }
+
+    void MetricsHistory::sample(SystemClock::time_point const now)
+    {
+        auto totals = Totals{};
+        totals.time = SteadyClock::now();
+        auto liveSessions = std::int64_t{ 0 };
+        for (auto const& entry : MetricsRegistry::get().snapshot())
+        {
+            auto const value = static_cast<std::uint64_t>(std::max<std::int64_t>(entry.value, 0));
+            if (matches(entry.name, "udp.", ".packets"))
+            {
+                totals.packets += value;
+            }
+            else if (matches(entry.name, "udp.", ".kernelDrops"))
+            {
+                totals.kernelDrops += value;
+            }
+            else if (matches(entry.name, "udp.GameConnection.", ".processingTimeMicroseconds"))
+            {
+                for (auto i = std::size_t{ 0 }; i < Histogram::bucketCount; ++i)
+                {
+                    totals.relayLatency[i] += entry.histogram.buckets[i];
+                }
+            }
+            else if (matches(entry.name, "sessions.", ".live"))
+            {
+                liveSessions += entry.value;
+            }
+            else if (matches(entry.name, "natneg.funnel.outcome.", ""))
+            {
+                totals.endedHandshakes += value;
+                if (entry.name == "natneg.funnel.outcome.completed")
+                {
+                    totals.completedHandshakes += value;
+                }
+            }
+        }
+
+        auto const lock = std::scoped_lock{ m_mutex };
+        auto values = std::array<double, seriesCount>{};
+        values.fill(noValue);
+        values[static_cast<std::size_t>(Series::liveSessions)] = static_cast<double>(liveSessions);
+        if (m_previous.has_value())
+        {
+            auto const& previous = m_previous.value();
+            auto const elapsed = std::chrono::duration<double>{ totals.time - previous.time }.count();
+            if (elapsed > 0)
+            {
+                values[static_cast<std::size_t>(Series::packetsPerSecond)] = (totals.packets - previous.packets) / elapsed;
+                values[static_cast<std::size_t>(Series::kernelDropsPerSecond)] = (totals.kernelDrops - previous.kernelDrops) / elapsed;
+            }
+
+            if (auto const ended = totals.endedHandshakes - previous.endedHandshakes; ended != 0)
+            {
+                auto const completed = totals.completedHandshakes - previous.completedHandshakes;
+                values[static_cast<std::size_t>(Series::handshakeSuccessRate)] = static_cast<double>(completed) / ended;
+            }
+
+            auto latency = Histogram::Snapshot{};
+            for (auto i = std::size_t{ 0 }; i < Histogram::bucketCount; ++i)
+            {
+                latency.buckets[i] = totals.relayLatency[i] - previous.relayLatency[i];
+                latency.count += latency.buckets[i];
+            }
+            if (latency.count != 0)
+            {
+                values[static_cast<std::size_t>(Series::relayLatencyP99)] = static_cast<double>(latency.percentile(0.99));
+            }
+        }
+        m_previous = totals;
+
+        auto const time = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+        for (auto& tier : m_tiers)
+        {
+            tier.add(time, values);
+        }
+    }
+
+    MetricsHistory::View MetricsHistory::getView(std::chrono::seconds const window) const
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        auto const tier = std::find_if(m_tiers.begin(), m_tiers.end(), [window](Tier const& candidate)
+        {
+            return candidate.getCoverage() >= window.count();
+        });
+        auto const& chosen = (tier != m_tiers.end()) ? *tier : m_tiers.back();
+
+        auto const now = std::chrono::duration_cast<std::chrono::seconds>(SystemClock::now().time_since_epoch());
+        return View
+        {
+            std::chrono::seconds{ chosen.getStep() },
+            chosen.getPoints((now - window).count())
+        };
+    }
+
+    void MetricsHistory::periodicallySample(std::weak_ptr<MetricsHistory> const& ref, SteadyClock::time_point const next)
+    {
+        auto const self = ref.lock();
+        if (!self)
+        {
+            logLine(LogLevel::info, "MetricsHistory expired, not sampling anymore");
+            return;
+        }
+
+        using Timer = boost::asio::steady_timer;
+        auto const timer = std::make_shared<Timer>(self->m_objectMaker.make<Timer>());
+        // Scheduled from the previous deadline, so samples don't drift
+        timer->expires_at(next);
+        timer->async_wait([ref, timer, next](ErrorCode const& code)
+        {
+            if (code.failed())
+            {
+                throw std::system_error{ code, "MetricsHistory: async wait failed" };
+            }
+
+            if (auto const self = ref.lock())
+            {
+                self->sample(SystemClock::now());
+            }
+            // If we fell behind, skip the missed samples instead of taking them in a burst
+            periodicallySample(ref, std::max(next + std::chrono::seconds{ 1 }, SteadyClock::now()));
+        });
+    }
+
+    void writeHistoryJson(std::ostream& out, MetricsHistory::View const& view)
+    {
+        auto json = Utility::JsonWriter{ out };
+        json.beginObject();
+        json.member("stepSeconds", view.step.count());
+        json.key("series").beginObject();
+        for (auto i = std::size_t{ 0 }; i < MetricsHistory::seriesCount; ++i)
+        {
+            json.key(MetricsHistory::getSeriesName(static_cast<MetricsHistory::Series>(i))).beginArray();
+            for (auto const& point : view.points)
+            {
+                json.beginArray().value(point.time).value(point.mean[i]).value(point.max[i]).endArray();
+            }
+            json.endArray();
+        }
+        json.endObject();
+        json.endObject();
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <Diagnostics/Metrics.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Keeps the last 24 hours of a few key metrics in memory, so what happened
+    // during a lag spike can be seen without an external time series database.
+    // Sampled every second, then downsampled into fixed size rings:
+    // 1 s points for 10 minutes, 10 s points for 2 hours and 1 min points for 24 hours.
+    class MetricsHistory : public std::enable_shared_from_this<MetricsHistory>
+    {
+    public:
+        using SteadyClock = std::chrono::steady_clock;
+        using SystemClock = std::chrono::system_clock;
+
+        enum class Series
+        {
+            // Received by all the sockets of the forwarder
+            packetsPerSecond,
+            liveSessions,
+            // Completed handshakes among the ones which ended
+            handshakeSuccessRate,
+            // 99th percentile of the time spent by game packets inside the forwarder
+            relayLatencyP99,
+            kernelDropsPerSecond,
+        };
+        static constexpr auto seriesCount = std::size_t{ 5 };
+
+        struct Resolution
+        {
+            std::chrono::seconds step;
+            std::size_t capacity;
+        };
+        static constexpr auto resolutions = std::array<Resolution, 3>
+        {
+            Resolution{ std::chrono::seconds{ 1 }, 600 },
+            Resolution{ std::chrono::seconds{ 10 }, 720 },
+            Resolution{ std::chrono::seconds{ 60 }, 1440 },
+        };
+        // Covered by the coarsest resolution
+        static constexpr auto maximumWindow = resolutions.back().step * static_cast<std::int64_t>(resolutions.back().capacity);
+
+        // Aggregate of the samples taken during one step.
+        // Values are NaN if there is nothing to measure, for example no handshake ended.
+        struct Point
+        {
+            // Start of the step, in seconds since the Unix epoch
+            std::int64_t time;
+            std::array<double, seriesCount> mean;
+            std::array<double, seriesCount> max;
+        };
+
+        struct View
+        {
+            std::chrono::seconds step;
+            // In chronological order
+            std::vector<Point> points;
+        };
+
+    private:
+        struct PrivateConstructor {};
+
+        class Tier;
+
+        // Totals read from the registry at the previous sample
+        struct Totals
+        {
+            SteadyClock::time_point time;
+            std::uint64_t packets = 0;
+            std::uint64_t kernelDrops = 0;
+            std::uint64_t completedHandshakes = 0;
+            std::uint64_t endedHandshakes = 0;
+            std::array<std::uint64_t, Histogram::bucketCount> relayLatency{};
+        };
+
+        IOManager::ObjectMaker m_objectMaker;
+        std::mutex mutable m_mutex;
+        std::vector<Tier> m_tiers;
+        std::optional<Totals> m_previous;
+
+    public:
+        static constexpr auto description = "MetricsHistory";
+
+        static std::shared_ptr<MetricsHistory> create(IOManager::ObjectMaker const& objectMaker);
+
+        MetricsHistory(PrivateConstructor, IOManager::ObjectMaker const& objectMaker);
+        ~MetricsHistory();
+
+        static std::string_view getSeriesName(Series const series) noexcept;
+
+        // Reads the registry and records one sample
+        void sample(SystemClock::time_point const now);
+
+        // Returns: points covering at least the last `window`, at the finest resolution available
+        View getView(std::chrono::seconds const window) const;
+
+    private:
+        static void periodicallySample(std::weak_ptr<MetricsHistory> const& ref, SteadyClock::time_point const next);
+    };
+
+    // Writes the view as a JSON object: step, then one array of [time, mean, max] per series
+    void writeHistoryJson(std::ostream& out, MetricsHistory::View const& view);
+}
@@ -0,0 +1,83 @@
+#include "MetricsReporter.hpp"
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Logging/Logging.hpp>
+
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<MetricsReporter>(level, std::forward<Arguments>(arguments)...);
+        }
+    }
+
+    std::shared_ptr<MetricsReporter> MetricsReporter::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        Interval const interval
+    )
+    {
+        auto const self = std::make_shared<MetricsReporter>
+        (
+            PrivateConstructor{},
+            objectMaker,
+            interval
+        );
+        periodicallyReport(self);
+        return self;
+    }
+
+    MetricsReporter::MetricsReporter
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        Interval const interval
+    ) :
+        m_objectMaker{ objectMaker },
+        m_interval{ interval }
+    {}
+
+    void MetricsReporter::report() const
+    {
+        for (auto const& entry : MetricsRegistry::get().snapshot())
+        {
+            if (entry.value != 0)
+            {
+                logLine(LogLevel::info, entry);
+            }
+        }
+    }
+
+    void MetricsReporter::periodicallyReport(std::weak_ptr<MetricsReporter> const& ref)
+    {
+        auto const self = ref.lock();
+        if (!self)
+        {
+            logLine(LogLevel::info, "MetricsReporter expired, not reporting anymore");
+            return;
+        }
+
+        using Timer = boost::asio::steady_timer;
+        auto const timer = std::make_shared<Timer>(self->m_objectMaker.make<Timer>());
+        timer->expires_after(self->m_interval);
+        timer->async_wait([ref, timer](ErrorCode const& code)
+        {
+            if (code.failed())
+            {
+                throw std::system_error{ code, "MetricsReporter: async wait failed" };
+            }
+
+            if (auto const self = ref.lock())
+            {
+                self->report();
+            }
+            periodicallyReport(ref);
+        });
+    }
+}
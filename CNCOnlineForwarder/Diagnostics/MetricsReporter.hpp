@@ -0,0 +1,39 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Periodically writes all the non-empty metrics to the log
+    class MetricsReporter : public std::enable_shared_from_this<MetricsReporter>
+    {
+    public:
+        using Interval = std::chrono::seconds;
+    private:
+        struct PrivateConstructor {};
+    private:
+        IOManager::ObjectMaker m_objectMaker;
+        Interval m_interval;
+    public:
+
+        static constexpr auto description = "MetricsReporter";
+
+        static std::shared_ptr<MetricsReporter> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            Interval const interval
+        );
+
+        MetricsReporter
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            Interval const interval
+        );
+
+        void report() const;
+
+    private:
+        static void periodicallyReport(std::weak_ptr<MetricsReporter> const& ref);
+    };
+}
@@ -0,0 +1,344 @@
+#include "PacketCapture.hpp"
+#include <precompiled.hpp>
+#include <Diagnostics/Sampling.hpp>
+#include <Logging/Logging.hpp>
+
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<PacketCapture>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        // Checked without locking, so recording costs nothing when there is no capture
+        std::atomic<PacketCapture*> activeCapture{ nullptr };
+        // Protects activeCapture while it's being used, and the queue of the active capture
+        std::mutex captureMutex;
+
+        constexpr auto sectionHeaderBlock = std::uint32_t{ 0x0A0D0D0A };
+        constexpr auto interfaceDescriptionBlock = std::uint32_t{ 1 };
+        constexpr auto enhancedPacketBlock = std::uint32_t{ 6 };
+        constexpr auto byteOrderMagic = std::uint32_t{ 0x1A2B3C4D };
+        constexpr auto linkTypeIPv4 = std::uint16_t{ 228 };
+        constexpr auto optionEnd = std::uint16_t{ 0 };
+        constexpr auto optionUserApplication = std::uint16_t{ 4 };
+        constexpr auto optionInterfaceName = std::uint16_t{ 2 };
+        constexpr auto optionTimestampResolution = std::uint16_t{ 9 };
+        constexpr auto optionPacketFlags = std::uint16_t{ 2 };
+        constexpr auto nanosecondResolution = std::uint8_t{ 9 };
+        constexpr auto ipHeaderSize = std::size_t{ 20 };
+        constexpr auto udpHeaderSize = std::size_t{ 8 };
+
+        constexpr auto interfaces = std::array
+        {
+            CaptureInterface::natNegProxy,
+            CaptureInterface::publicSocketForClient,
+            CaptureInterface::fakeRemotePlayerSocket,
+        };
+
+        // Blocks are written in the byte order of the machine, as the pcapng format allows
+        class BlockWriter
+        {
+        private:
+            std::string& m_output;
+            std::size_t m_begin;
+
+        public:
+            BlockWriter(std::string& output, std::uint32_t const type) :
+                m_output{ output },
+                m_begin{ output.size() }
+            {
+                write(type);
+                // Length, written by finish()
+                write(std::uint32_t{ 0 });
+            }
+
+            template<typename Integer>
+            void write(Integer const value)
+            {
+                m_output.append(reinterpret_cast<char const*>(&value), sizeof(value));
+            }
+
+            void writePadded(std::string_view const data)
+            {
+                m_output.append(data);
+                m_output.append((4 - (data.size() % 4)) % 4, '\0');
+            }
+
+            void writeOption(std::uint16_t const code, std::string_view const value)
+            {
+                write(code);
+                write(static_cast<std::uint16_t>(value.size()));
+                writePadded(value);
+            }
+
+            template<typename Integer>
+            void writeOption(std::uint16_t const code, Integer const value)
+            {
+                writeOption(code, std::string_view{ reinterpret_cast<char const*>(&value), sizeof(value) });
+            }
+
+            void finish()
+            {
+                write(optionEnd);
+                write(std::uint16_t{ 0 });
+                auto const length = static_cast<std::uint32_t>(m_output.size() - m_begin + sizeof(std::uint32_t));
+                write(length);
+                std::memcpy(m_output.data() + m_begin + sizeof(std::uint32_t), &length, sizeof(length));
+            }
+        };
+
+        std::uint16_t getIPv4Checksum(std::array<std::uint8_t, ipHeaderSize> const& header) noexcept
+        {
+            auto sum = std::uint32_t{ 0 };
+            for (auto i = std::size_t{ 0 }; i < header.size(); i += 2)
+            {
+                sum += (std::uint32_t{ header[i] } << 8) | header[i + 1];
+            }
+            while ((sum >> 16) != 0)
+            {
+                sum = (sum & 0xFFFF) + (sum >> 16);
+            }
+            return static_cast<std::uint16_t>(~sum);
+        }
+
+        // Made up IPv4 and UDP headers around the datagram
+        std::string makeHeaders
+        (
+            PacketCapture::EndPoint const& source,
+            PacketCapture::EndPoint const& destination,
+            std::size_t const size
+        )
+        {
+            auto header = std::array<std::uint8_t, ipHeaderSize>{};
+            auto const totalLength = static_cast<std::uint16_t>(ipHeaderSize + udpHeaderSize + size);
+            header[0] = 0x45;
+            header[2] = static_cast<std::uint8_t>(totalLength >> 8);
+            header[3] = static_cast<std::uint8_t>(totalLength);
+            header[8] = 64;
+            header[9] = 17;
+            auto const sourceAddress = source.address().to_v4().to_bytes();
+            auto const destinationAddress = destination.address().to_v4().to_bytes();
+            std::copy(sourceAddress.begin(), sourceAddress.end(), header.begin() + 12);
+            std::copy(destinationAddress.begin(), destinationAddress.end(), header.begin() + 16);
+            auto const checksum = getIPv4Checksum(header);
+            header[10] = static_cast<std::uint8_t>(checksum >> 8);
+            header[11] = static_cast<std::uint8_t>(checksum);
+
+            auto headers = std::string{ reinterpret_cast<char const*>(header.data()), header.size() };
+            auto const appendBigEndian = [&headers](std::uint16_t const value)
+            {
+                auto const converted = boost::endian::native_to_big(value);
+                headers.append(reinterpret_cast<char const*>(&converted), sizeof(converted));
+            };
+            appendBigEndian(source.port());
+            appendBigEndian(destination.port());
+            appendBigEndian(static_cast<std::uint16_t>(udpHeaderSize + size));
+            // No checksum
+            appendBigEndian(0);
+            return headers;
+        }
+    }
+
+    std::unique_ptr<PacketCapture> PacketCapture::create(Options const& options)
+    {
+        auto const file = std::fopen(options.path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            logLine(LogLevel::error, "Cannot create capture file ", options.path, ": ", std::strerror(errno));
+            return nullptr;
+        }
+
+        logLine(LogLevel::info, "Capturing one negotiation out of ", options.sampleRate, " to ", options.path);
+        return std::make_unique<PacketCapture>(PrivateConstructor{}, options, file);
+    }
+
+    PacketCapture::PacketCapture(PrivateConstructor, Options const& options, std::FILE* const file) :
+        m_options{ options },
+        m_file{ file },
+        m_fileBytes{ 0 },
+        m_captured{ MetricsRegistry::get().counter("capture.captured") },
+        m_written{ MetricsRegistry::get().counter("capture.written") },
+        m_dropped{ MetricsRegistry::get().counter("capture.dropped") },
+        m_blocks{},
+        m_queue{ captureMutex, queueCapacity }
+    {
+        m_options.sampleRate = std::max(m_options.sampleRate, std::uint32_t{ 1 });
+
+        auto headers = std::string{};
+        {
+            auto block = BlockWriter{ headers, sectionHeaderBlock };
+            block.write(byteOrderMagic);
+            block.write(std::uint16_t{ 1 });
+            block.write(std::uint16_t{ 0 });
+            // Unknown section length
+            block.write(std::int64_t{ -1 });
+            block.writeOption(optionUserApplication, std::string_view{ PROJECT_NAME });
+            block.finish();
+        }
+        for (auto const interface : interfaces)
+        {
+            auto block = BlockWriter{ headers, interfaceDescriptionBlock };
+            block.write(linkTypeIPv4);
+            block.write(std::uint16_t{ 0 });
+            block.write(static_cast<std::uint32_t>(ipHeaderSize + udpHeaderSize + snapLength));
+            block.writeOption(optionInterfaceName, getInterfaceName(interface));
+            block.writeOption(optionTimestampResolution, nanosecondResolution);
+            block.finish();
+        }
+        write(headers);
+
+        m_queue.start([this](std::vector<Record> const& records) { writeAll(records); });
+
+        auto const lock = std::scoped_lock{ captureMutex };
+        if (activeCapture.load() != nullptr)
+        {
+            logLine(LogLevel::warning, "Replacing the previous packet capture");
+        }
+        activeCapture.store(this);
+    }
+
+    PacketCapture::~PacketCapture()
+    {
+        {
+            auto const lock = std::scoped_lock{ captureMutex };
+            if (activeCapture.load() == this)
+            {
+                activeCapture.store(nullptr);
+            }
+        }
+        m_queue.stop();
+        std::fclose(m_file);
+        logLine(LogLevel::info, "Capture closed, ", m_fileBytes, " bytes written to ", m_options.path);
+    }
+
+    void PacketCapture::record
+    (
+        CapturePoint const& point,
+        CaptureDirection const direction,
+        std::optional<std::uint32_t> const natNegID,
+        EndPoint const& remote,
+        std::string_view const data,
+        Clock::time_point const timestamp
+    )
+    {
+        if (activeCapture.load(std::memory_order_relaxed) == nullptr)
+        {
+            return;
+        }
+
+        auto const lock = std::scoped_lock{ captureMutex };
+        if (auto const capture = activeCapture.load(); (capture != nullptr) && capture->matches(natNegID, remote))
+        {
+            capture->enqueue(point, direction, remote, data, timestamp);
+        }
+    }
+
+    std::string_view PacketCapture::getInterfaceName(CaptureInterface const interface) noexcept
+    {
+        switch (interface)
+        {
+        case CaptureInterface::natNegProxy:
+            return "NatNegProxy.server";
+        case CaptureInterface::publicSocketForClient:
+            return "GameConnection.publicForClient";
+        case CaptureInterface::fakeRemotePlayerSocket:
+            return "GameConnection.fakeRemotePlayer";
+        }
+        return "unknown";
+    }
+
+    bool PacketCapture::matches(std::optional<std::uint32_t> const natNegID, EndPoint const& remote) const noexcept
+    {
+        if (m_options.address.has_value() && (remote.address() != m_options.address.value()))
+        {
+            return false;
+        }
+
+        if (m_options.sampleRate == 1)
+        {
+            return true;
+        }
+        // Sample whole negotiations, so they can be replayed
+        return natNegID.has_value() && isSampled(natNegID.value(), m_options.sampleRate);
+    }
+
+    void PacketCapture::enqueue
+    (
+        CapturePoint const& point,
+        CaptureDirection const direction,
+        EndPoint const& remote,
+        std::string_view const data,
+        Clock::time_point const timestamp
+    )
+    {
+        m_captured.add();
+        auto const fill = [&](Record& record)
+        {
+            record.timestamp = timestamp;
+            record.point = point;
+            record.direction = direction;
+            record.remote = remote;
+            record.size = data.size();
+            std::copy_n(data.begin(), std::min(data.size(), snapLength), record.data.begin());
+        };
+        if (!remote.address().is_v4() || !m_queue.push(fill))
+        {
+            m_dropped.add();
+        }
+    }
+
+    void PacketCapture::writeAll(std::vector<Record> const& records)
+    {
+        m_blocks.clear();
+        for (auto const& record : records)
+        {
+            auto const local = EndPoint{ boost::asio::ip::address_v4::any(), record.point.localPort };
+            auto const inbound = (record.direction == CaptureDirection::inbound);
+            auto packet = makeHeaders(inbound ? record.remote : local, inbound ? local : record.remote, record.size);
+            packet.append(record.data.data(), std::min(record.size, snapLength));
+            auto const time = std::chrono::duration_cast<std::chrono::nanoseconds>(record.timestamp.time_since_epoch());
+            auto const nanoseconds = static_cast<std::uint64_t>(time.count());
+
+            auto block = BlockWriter{ m_blocks, enhancedPacketBlock };
+            block.write(static_cast<std::uint32_t>(record.point.interface));
+            block.write(static_cast<std::uint32_t>(nanoseconds >> 32));
+            block.write(static_cast<std::uint32_t>(nanoseconds));
+            block.write(static_cast<std::uint32_t>(packet.size()));
+            block.write(static_cast<std::uint32_t>(ipHeaderSize + udpHeaderSize + record.size));
+            block.writePadded(packet);
+            block.writeOption(optionPacketFlags, static_cast<std::uint32_t>(record.direction));
+            block.finish();
+        }
+
+        if ((m_fileBytes + m_blocks.size()) > m_options.maxFileBytes)
+        {
+            m_dropped.add(records.size());
+        }
+        else if (write(m_blocks))
+        {
+            m_written.add(records.size());
+        }
+        else
+        {
+            m_dropped.add(records.size());
+        }
+    }
+
+    bool PacketCapture::write(std::string_view const blocks)
+    {
+        auto const written = std::fwrite(blocks.data(), 1, blocks.size(), m_file);
+        m_fileBytes += written;
+        if ((written != blocks.size()) || (std::fflush(m_file) != 0))
+        {
+            logLine(LogLevel::error, "Cannot write to capture file ", m_options.path, ": ", std::strerror(errno));
+            return false;
+        }
+        return true;
+    }
+}
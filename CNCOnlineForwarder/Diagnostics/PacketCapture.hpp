@@ -0,0 +1,126 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/BackgroundQueue.hpp>
+#include <Diagnostics/Metrics.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Sockets of the forwarder whose datagrams can be captured,
+    // each one is an interface of the capture file
+    enum class CaptureInterface : std::uint8_t
+    {
+        // NatNegProxy's socket, receiving the NatNeg packets of players
+        natNegProxy = 0,
+        // GameConnection's socket talking to the NatNeg server and to the remote player
+        publicSocketForClient = 1,
+        // GameConnection's socket pretending to be the remote player
+        fakeRemotePlayerSocket = 2,
+    };
+
+    enum class CaptureDirection : std::uint8_t
+    {
+        inbound = 1,
+        outbound = 2,
+    };
+
+    // Where a datagram was seen, kept by the owner of the socket
+    struct CapturePoint
+    {
+        CaptureInterface interface;
+        std::uint16_t localPort;
+    };
+
+    // Writes the datagrams seen by the forwarder into a pcapng file, to reproduce incidents
+    // and to replay real traffic in benchmarks (see CNCOnlineForwarder.Replay).
+    // Each CaptureInterface is an interface of the file, with raw IPv4 link type:
+    // datagrams are wrapped in made up IPv4 and UDP headers, where the forwarder's side
+    // is 0.0.0.0 and the local port of the socket. The direction is stored in epb_flags.
+    // Like the session event stream, datagrams are queued in a BackgroundQueue
+    // and written by its thread, anything which doesn't fit is dropped and counted.
+    class PacketCapture
+    {
+    public:
+        using EndPoint = boost::asio::ip::udp::endpoint;
+        using Clock = std::chrono::system_clock;
+
+        static constexpr auto snapLength = std::size_t{ 1024 };
+        static constexpr auto queueCapacity = std::size_t{ 4096 };
+
+        struct Options
+        {
+            std::string path;
+            // Capture one NatNeg negotiation out of sampleRate, with both its players
+            std::uint32_t sampleRate = 1;
+            // Only capture datagrams exchanged with this address
+            std::optional<boost::asio::ip::address_v4> address;
+            // Stops capturing once the file reaches this size
+            std::uint64_t maxFileBytes = std::uint64_t{ 1 } << 30;
+        };
+
+    private:
+        struct PrivateConstructor {};
+
+        struct Record
+        {
+            Clock::time_point timestamp;
+            CapturePoint point;
+            CaptureDirection direction;
+            EndPoint remote;
+            std::size_t size;
+            std::array<char, snapLength> data;
+        };
+
+        Options m_options;
+        std::FILE* m_file;
+        std::uint64_t m_fileBytes;
+        Counter& m_captured;
+        Counter& m_written;
+        Counter& m_dropped;
+        std::string m_blocks;
+        // Protected by the same mutex as the active capture
+        BackgroundQueue<Record> m_queue;
+
+    public:
+        static constexpr auto description = "PacketCapture";
+
+        // Returns: nullptr if the file could not be created.
+        // Once created, the capture receives the matching datagrams until it's destroyed.
+        static std::unique_ptr<PacketCapture> create(Options const& options);
+
+        PacketCapture(PrivateConstructor, Options const& options, std::FILE* const file);
+        PacketCapture(PacketCapture const&) = delete;
+        PacketCapture& operator=(PacketCapture const&) = delete;
+        ~PacketCapture();
+
+        // Never blocks on the file, does nothing if there is no capture.
+        // Datagrams without a NatNegID are only captured if every negotiation is.
+        static void record
+        (
+            CapturePoint const& point,
+            CaptureDirection const direction,
+            std::optional<std::uint32_t> const natNegID,
+            EndPoint const& remote,
+            std::string_view const data,
+            Clock::time_point const timestamp = Clock::now()
+        );
+
+        static std::string_view getInterfaceName(CaptureInterface const interface) noexcept;
+
+    private:
+        bool matches(std::optional<std::uint32_t> const natNegID, EndPoint const& remote) const noexcept;
+
+        void enqueue
+        (
+            CapturePoint const& point,
+            CaptureDirection const direction,
+            EndPoint const& remote,
+            std::string_view const data,
+            Clock::time_point const timestamp
+        );
+
+        // Encodes the records as pcapng blocks and appends them to the file
+        void writeAll(std::vector<Record> const& records);
+
+        bool write(std::string_view const blocks);
+    };
+}
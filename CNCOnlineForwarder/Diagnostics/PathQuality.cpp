@@ -0,0 +1,259 @@
+#include "PathQuality.hpp"
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        std::string makeName(std::string_view const leg, std::string_view const metric)
+        {
+            auto name = std::string{ "relay." };
+            name.append(leg).append(".").append(metric);
+            return name;
+        }
+
+        // Larger gaps are more likely a restart of the stream than lost packets
+        constexpr auto maxGap = 1024;
+        // Forget the locked sequence when too many recent packets don't follow it
+        constexpr auto maxMismatches = 16;
+    }
+
+    SequenceTracker::SequenceTracker() :
+        m_candidates{},
+        m_locked{},
+        m_expected{ 0 },
+        m_mismatches{ 0 },
+        m_missing{},
+        m_expectedPackets{ 0 },
+        m_lostPackets{ 0 },
+        m_reorderedPackets{ 0 }
+    {
+        for (auto offset = std::size_t{ 0 }; offset < maxOffset; ++offset)
+        {
+            m_candidates.push_back({ offset, false, std::nullopt, 0 });
+            m_candidates.push_back({ offset, true, std::nullopt, 0 });
+        }
+    }
+
+    std::uint64_t SequenceTracker::record(std::string_view const payload)
+    {
+        if (!m_locked.has_value())
+        {
+            detect(payload);
+            return 0;
+        }
+
+        auto const value = read(m_locked.value(), payload);
+        if (!value.has_value())
+        {
+            return 0;
+        }
+
+        auto const gap = static_cast<std::uint16_t>(value.value() - m_expected);
+        if (gap == 0)
+        {
+            m_mismatches = std::max(m_mismatches - 1, 0);
+            return advance(value.value(), gap);
+        }
+
+        if (gap < maxGap)
+        {
+            return advance(value.value(), gap);
+        }
+
+        // Late, but still expected
+        auto const age = static_cast<std::uint16_t>(m_expected - 1 - value.value());
+        if ((age < reorderWindow) && m_missing.test(age))
+        {
+            m_missing.reset(age);
+            ++m_reorderedPackets;
+            return 0;
+        }
+
+        // Duplicated, too late, or not a sequence number after all
+        if (++m_mismatches > maxMismatches)
+        {
+            m_locked.reset();
+            m_mismatches = 0;
+            m_missing.reset();
+            for (auto& candidate : m_candidates)
+            {
+                candidate.last.reset();
+                candidate.score = 0;
+            }
+        }
+        return 0;
+    }
+
+    std::uint64_t SequenceTracker::advance(std::uint16_t const value, std::uint16_t const gap)
+    {
+        auto const shift = std::size_t{ gap } + 1;
+        auto lost = std::uint64_t{ 0 };
+        if (shift < reorderWindow)
+        {
+            lost = (m_missing >> (reorderWindow - shift)).count();
+            m_missing <<= shift;
+        }
+        else
+        {
+            // The oldest skipped numbers are already outside of the window
+            lost = m_missing.count() + (shift - reorderWindow);
+            m_missing.reset();
+        }
+        // Skipped numbers, value itself is bit 0
+        for (auto i = std::size_t{ 1 }; i <= std::min(std::size_t{ gap }, reorderWindow - 1); ++i)
+        {
+            m_missing.set(i);
+        }
+
+        m_expected = static_cast<std::uint16_t>(value + 1);
+        m_expectedPackets += shift;
+        m_lostPackets += lost;
+        return lost;
+    }
+
+    std::optional<std::uint16_t> SequenceTracker::read
+    (
+        Candidate const& candidate,
+        std::string_view const payload
+    ) noexcept
+    {
+        if (payload.size() < (candidate.offset + 2))
+        {
+            return std::nullopt;
+        }
+
+        auto const first = static_cast<std::uint8_t>(payload[candidate.offset]);
+        auto const second = static_cast<std::uint8_t>(payload[candidate.offset + 1]);
+        return static_cast<std::uint16_t>(candidate.bigEndian ? ((first << 8) | second) : ((second << 8) | first));
+    }
+
+    void SequenceTracker::detect(std::string_view const payload)
+    {
+        for (auto& candidate : m_candidates)
+        {
+            auto const value = read(candidate, payload);
+            if (!value.has_value())
+            {
+                candidate.score = 0;
+                continue;
+            }
+
+            auto const isNext = candidate.last.has_value()
+                && (value.value() == static_cast<std::uint16_t>(candidate.last.value() + 1));
+            candidate.score = isNext ? (candidate.score + 1) : 0;
+            candidate.last = value;
+
+            if (candidate.score >= lockThreshold)
+            {
+                m_locked = candidate;
+                m_expected = static_cast<std::uint16_t>(value.value() + 1);
+                m_mismatches = 0;
+                m_missing.reset();
+                return;
+            }
+        }
+    }
+
+    PathQuality::PathQuality(std::string_view const leg) :
+        m_rttHistogram{ MetricsRegistry::get().histogram(makeName(leg, "rttMicroseconds")) },
+        m_connectPingRTTHistogram{ MetricsRegistry::get().histogram(makeName(leg, "connectPingRttMicroseconds")) },
+        m_jitterHistogram{ MetricsRegistry::get().histogram(makeName(leg, "jitterMicroseconds")) },
+        m_lostCounter{ MetricsRegistry::get().counter(makeName(leg, "lostPackets")) },
+        m_awaitingReplySince{},
+        m_awaitingConnectPing{ false },
+        m_smoothedRTT{},
+        m_minimumRTT{},
+        m_lastArrival{},
+        m_lastInterarrival{},
+        m_jitter{ 0 },
+        m_received{ 0 },
+        m_sequence{}
+    {}
+
+    void PathQuality::recordSent(bool const isConnectPing)
+    {
+        // Only the first packet of a turn starts a measurement:
+        // if we keep sending, the peer's next packet doesn't answer the latest one
+        if (!m_awaitingReplySince.has_value())
+        {
+            m_awaitingReplySince = Clock::now();
+            m_awaitingConnectPing = isConnectPing;
+        }
+    }
+
+    void PathQuality::recordReceived
+    (
+        Utility::DatagramMetadata const& metadata,
+        std::string_view const payload,
+        bool const isNatNeg,
+        bool const isConnectPing
+    )
+    {
+        ++m_received;
+
+        // Best estimate of when the packet actually arrived
+        auto arrival = metadata.receivedAt;
+        if (auto const queueingDelay = metadata.getQueueingDelay(); queueingDelay.has_value())
+        {
+            arrival -= std::chrono::duration_cast<Clock::duration>(queueingDelay.value());
+        }
+
+        if (m_awaitingReplySince.has_value())
+        {
+            auto const rtt = arrival - m_awaitingReplySince.value();
+            if (rtt > Clock::duration::zero())
+            {
+                if (m_awaitingConnectPing && isConnectPing)
+                {
+                    m_connectPingRTTHistogram.recordDuration(rtt);
+                }
+                m_rttHistogram.recordDuration(rtt);
+                // Same smoothing as TCP (RFC 6298)
+                m_smoothedRTT = m_smoothedRTT.has_value() ? (m_smoothedRTT.value() * 7 + rtt) / 8 : rtt;
+                m_minimumRTT = m_minimumRTT.has_value() ? std::min(m_minimumRTT.value(), rtt) : rtt;
+            }
+            m_awaitingReplySince.reset();
+        }
+
+        if (m_lastArrival.has_value())
+        {
+            auto const interarrival = arrival - m_lastArrival.value();
+            if (m_lastInterarrival.has_value())
+            {
+                auto const variation = std::chrono::duration<double, std::nano>{ interarrival - m_lastInterarrival.value() };
+                m_jitter += (std::abs(variation.count()) - m_jitter) / 16;
+            }
+            m_lastInterarrival = interarrival;
+        }
+        m_lastArrival = arrival;
+
+        if (!isNatNeg)
+        {
+            m_lostCounter.add(m_sequence.record(payload));
+        }
+    }
+
+    PathQuality::Summary PathQuality::getSummary() const noexcept
+    {
+        return Summary
+        {
+            m_smoothedRTT,
+            m_minimumRTT,
+            std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::nano>{ m_jitter }),
+            m_received,
+            m_sequence.isLocked(),
+            m_sequence.getExpectedPackets(),
+            m_sequence.getLostPackets(),
+            m_sequence.getReorderedPackets()
+        };
+    }
+
+    void PathQuality::publishJitter()
+    {
+        if (m_lastInterarrival.has_value())
+        {
+            m_jitterHistogram.recordDuration(std::chrono::duration<double, std::nano>{ m_jitter });
+        }
+    }
+}
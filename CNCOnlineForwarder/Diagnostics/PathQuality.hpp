@@ -0,0 +1,128 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Utility/DatagramMetadata.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Finds a 16 bit counter incremented by one in every packet of a stream,
+    // without knowing the protocol, and uses it to count lost packets.
+    // A skipped number is only counted as lost once reorderWindow newer numbers have been seen:
+    // if it arrives before that, the packet was reordered.
+    class SequenceTracker
+    {
+    public:
+        static constexpr auto maxOffset = std::size_t{ 16 };
+        // Consecutive increments needed before trusting a candidate
+        static constexpr auto lockThreshold = 32;
+        static constexpr auto reorderWindow = std::size_t{ 64 };
+
+    private:
+        struct Candidate
+        {
+            std::size_t offset;
+            bool bigEndian;
+            std::optional<std::uint16_t> last;
+            int score;
+        };
+
+        std::vector<Candidate> m_candidates;
+        std::optional<Candidate> m_locked;
+        std::uint16_t m_expected;
+        // Recent packets which did not follow the locked sequence
+        int m_mismatches;
+        // Bit i is set if m_expected - 1 - i has been skipped and hasn't arrived since
+        std::bitset<reorderWindow> m_missing;
+        std::uint64_t m_expectedPackets;
+        std::uint64_t m_lostPackets;
+        std::uint64_t m_reorderedPackets;
+
+    public:
+        SequenceTracker();
+
+        bool isLocked() const noexcept { return m_locked.has_value(); }
+
+        std::uint64_t getExpectedPackets() const noexcept { return m_expectedPackets; }
+
+        std::uint64_t getLostPackets() const noexcept { return m_lostPackets; }
+
+        std::uint64_t getReorderedPackets() const noexcept { return m_reorderedPackets; }
+
+        // Returns: how many packets have just been found lost
+        std::uint64_t record(std::string_view const payload);
+
+    private:
+        static std::optional<std::uint16_t> read(Candidate const& candidate, std::string_view const payload) noexcept;
+
+        void detect(std::string_view const payload);
+
+        // Moves m_expected after `value`, which is `gap` numbers ahead of it
+        // Returns: how many skipped numbers have left the reorder window
+        std::uint64_t advance(std::uint16_t const value, std::uint16_t const gap);
+    };
+
+    // Passive estimation of the quality of one leg of a relayed stream
+    // (client <-> proxy, or proxy <-> remote player), only based on
+    // the timing and the content of the packets going through the proxy.
+    // Not thread safe, should only be used inside the strand of the session.
+    //  - RTT: time between forwarding a packet to the peer and the next packet from the peer.
+    //    Exact for connectPing exchanges. For game traffic it includes the processing time of the peer,
+    //    and packets crossing ours shorten it, so it's only indicative.
+    //  - Jitter: RFC 3550 style smoothed variation of the packet interarrival time,
+    //    using kernel receive timestamps when available.
+    //  - Loss and reordering: gaps in a sequence number found by SequenceTracker.
+    class PathQuality
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        struct Summary
+        {
+            std::optional<Clock::duration> smoothedRTT;
+            std::optional<Clock::duration> minimumRTT;
+            Clock::duration jitter;
+            std::uint64_t received;
+            bool sequenceDetected;
+            std::uint64_t expected;
+            std::uint64_t lost;
+            std::uint64_t reordered;
+        };
+
+    private:
+        Histogram& m_rttHistogram;
+        Histogram& m_connectPingRTTHistogram;
+        Histogram& m_jitterHistogram;
+        Counter& m_lostCounter;
+        std::optional<Clock::time_point> m_awaitingReplySince;
+        bool m_awaitingConnectPing;
+        std::optional<Clock::duration> m_smoothedRTT;
+        std::optional<Clock::duration> m_minimumRTT;
+        std::optional<Clock::time_point> m_lastArrival;
+        std::optional<Clock::duration> m_lastInterarrival;
+        // In nanoseconds
+        double m_jitter;
+        std::uint64_t m_received;
+        SequenceTracker m_sequence;
+
+    public:
+        // `leg` names the aggregate metrics, for example "client" or "remote"
+        explicit PathQuality(std::string_view const leg);
+
+        // A packet has been forwarded towards the peer of this leg
+        void recordSent(bool const isConnectPing);
+
+        // A packet has been received from the peer of this leg
+        void recordReceived
+        (
+            Utility::DatagramMetadata const& metadata,
+            std::string_view const payload,
+            bool const isNatNeg,
+            bool const isConnectPing
+        );
+
+        Summary getSummary() const noexcept;
+
+        // Adds the current jitter of this session to the aggregate jitter histogram
+        void publishJitter();
+    };
+}
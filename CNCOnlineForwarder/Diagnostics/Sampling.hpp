@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // splitmix64 finalizer: spreads sequential values, like NatNeg IDs, evenly over 64 bits
+    constexpr std::uint64_t mix(std::uint64_t value) noexcept
+    {
+        value += 0x9E3779B97F4A7C15;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+        return value ^ (value >> 31);
+    }
+
+    // Whether a NatNeg negotiation is part of a 1 out of `rate` sample (none if `rate` is 0).
+    // Shared by the tracer and the packet capture, so they sample the same negotiations.
+    constexpr bool isSampled(std::uint32_t const natNegID, std::uint32_t const rate) noexcept
+    {
+        return (rate != 0) && ((mix(natNegID) % rate) == 0);
+    }
+}
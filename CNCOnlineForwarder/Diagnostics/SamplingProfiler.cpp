@@ -0,0 +1,254 @@
+#include "SamplingProfiler.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#endif
+
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    struct SamplingProfiler::Sample
+    {
+        std::atomic<bool> complete{ false };
+        int depth = 0;
+        // Index of the interrupted function in `frames`, frames before it belong to the signal handler
+        int leaf = 0;
+        std::array<void*, maxFrames> frames{};
+    };
+
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<SamplingProfiler>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        // Accessed by the signal handler
+        std::atomic<SamplingProfiler*> activeProfiler{ nullptr };
+        std::atomic<int> handlersRunning{ 0 };
+
+#ifdef __linux__
+        void const* getInterruptedAddress(void* const context) noexcept
+        {
+            [[maybe_unused]] auto const& machineContext = static_cast<ucontext_t const*>(context)->uc_mcontext;
+#if defined(__x86_64__)
+            return reinterpret_cast<void const*>(machineContext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+            return reinterpret_cast<void const*>(machineContext.pc);
+#else
+            return nullptr;
+#endif
+        }
+
+        void onProfilingSignal(int, siginfo_t*, void* const context)
+        {
+            auto const savedErrno = errno;
+            handlersRunning.fetch_add(1);
+            if (auto const profiler = activeProfiler.load(); profiler != nullptr)
+            {
+                profiler->recordSample(getInterruptedAddress(context));
+            }
+            handlersRunning.fetch_sub(1);
+            errno = savedErrno;
+        }
+
+        bool setTimer(unsigned const frequency)
+        {
+            auto interval = ::itimerval{};
+            if (frequency != 0)
+            {
+                interval.it_interval.tv_usec = static_cast<suseconds_t>(1'000'000 / frequency);
+                interval.it_value = interval.it_interval;
+            }
+            return ::setitimer(ITIMER_PROF, &interval, nullptr) == 0;
+        }
+
+        std::string describeFrame(std::uintptr_t const address)
+        {
+            auto description = std::ostringstream{};
+            auto information = ::Dl_info{};
+            if (::dladdr(reinterpret_cast<void*>(address), &information) == 0 || information.dli_fname == nullptr)
+            {
+                description << "0x" << std::hex << address;
+                return description.str();
+            }
+
+            auto const moduleName = std::string_view{ information.dli_fname };
+            auto const offset = address - reinterpret_cast<std::uintptr_t>(information.dli_fbase);
+            description << moduleName.substr(moduleName.find_last_of('/') + 1) << "+0x" << std::hex << offset;
+            return description.str();
+        }
+#endif
+    }
+
+    SamplingProfiler& SamplingProfiler::get()
+    {
+        static auto profiler = SamplingProfiler{};
+        return profiler;
+    }
+
+    SamplingProfiler::SamplingProfiler() :
+        m_mutex{},
+        m_samples{},
+        m_capacity{ 0 },
+        m_next{ 0 },
+        m_dropped{ 0 },
+        m_frequency{ 0 },
+        m_startedAt{}
+    {}
+
+    bool SamplingProfiler::start(unsigned const frequency)
+    {
+#ifdef __linux__
+        auto const lock = std::scoped_lock{ m_mutex };
+        if (m_samples != nullptr)
+        {
+            return false;
+        }
+
+        m_frequency = std::clamp(frequency, 1u, maxFrequency);
+        m_capacity = maxSamples;
+        m_samples = std::make_unique<Sample[]>(m_capacity);
+        m_next.store(0);
+        m_dropped.store(0);
+
+        // The first call of backtrace loads libgcc, which is not safe inside a signal handler
+        auto warmUp = std::array<void*, 1>{};
+        ::backtrace(warmUp.data(), static_cast<int>(warmUp.size()));
+
+        struct sigaction action{};
+        action.sa_sigaction = &onProfilingSignal;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        ::sigemptyset(&action.sa_mask);
+        ::sigaction(SIGPROF, &action, nullptr);
+
+        activeProfiler.store(this);
+        m_startedAt = Clock::now();
+        if (!setTimer(m_frequency))
+        {
+            logLine(LogLevel::error, "setitimer failed: ", std::strerror(errno));
+            activeProfiler.store(nullptr);
+            m_samples.reset();
+            return false;
+        }
+
+        logLine(LogLevel::info, "Profiling started at ", m_frequency, " Hz");
+        return true;
+#else
+        static_cast<void>(frequency);
+        return false;
+#endif
+    }
+
+    std::optional<SamplingProfiler::Profile> SamplingProfiler::stop()
+    {
+#ifdef __linux__
+        auto const lock = std::scoped_lock{ m_mutex };
+        if (m_samples == nullptr)
+        {
+            return std::nullopt;
+        }
+
+        setTimer(0);
+        activeProfiler.store(nullptr);
+        // A handler which already got the profiler might still be running on another thread
+        while (handlersRunning.load() != 0)
+        {
+            std::this_thread::yield();
+        }
+        ::signal(SIGPROF, SIG_IGN);
+
+        auto profile = Profile{};
+        profile.frequency = m_frequency;
+        profile.duration = Clock::now() - m_startedAt;
+        profile.dropped = m_dropped.load();
+
+        auto const recorded = std::min(m_next.load(), m_capacity);
+        auto stack = std::vector<std::uintptr_t>{};
+        for (auto i = std::size_t{ 0 }; i < recorded; ++i)
+        {
+            auto const& sample = m_samples[i];
+            if (!sample.complete.load(std::memory_order_acquire) || (sample.leaf >= sample.depth))
+            {
+                continue;
+            }
+
+            stack.clear();
+            for (auto frame = sample.depth - 1; frame >= sample.leaf; --frame)
+            {
+                auto address = reinterpret_cast<std::uintptr_t>(sample.frames[frame]);
+                // Except for the interrupted function, addresses are return addresses:
+                // step back into the call instruction, so it is attributed to the right line
+                if (frame != sample.leaf)
+                {
+                    address -= 1;
+                }
+                stack.push_back(address);
+            }
+            ++profile.stacks[stack];
+            ++profile.samples;
+        }
+
+        m_samples.reset();
+        logLine(LogLevel::info, "Profiling stopped, ", profile.samples, " samples, ", profile.dropped, " dropped");
+        return profile;
+#else
+        return std::nullopt;
+#endif
+    }
+
+    void SamplingProfiler::recordSample([[maybe_unused]] void const* const interruptedAt) noexcept
+    {
+#ifdef __linux__
+        auto const index = m_next.fetch_add(1, std::memory_order_relaxed);
+        if (index >= m_capacity)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        auto& sample = m_samples[index];
+        sample.depth = ::backtrace(sample.frames.data(), static_cast<int>(sample.frames.size()));
+        // Skip the frames of the signal handler
+        sample.leaf = 0;
+        auto const interrupted = std::find(sample.frames.begin(), sample.frames.begin() + sample.depth, interruptedAt);
+        if (interrupted != (sample.frames.begin() + sample.depth))
+        {
+            sample.leaf = static_cast<int>(interrupted - sample.frames.begin());
+        }
+        sample.complete.store(true, std::memory_order_release);
+#endif
+    }
+
+    void SamplingProfiler::writeFoldedStacks(std::ostream& out, Profile const& profile)
+    {
+#ifdef __linux__
+        auto descriptions = std::unordered_map<std::uintptr_t, std::string>{};
+        for (auto const& [stack, count] : profile.stacks)
+        {
+            auto separator = "";
+            for (auto const address : stack)
+            {
+                auto [iterator, inserted] = descriptions.try_emplace(address);
+                if (inserted)
+                {
+                    iterator->second = describeFrame(address);
+                }
+                out << separator << iterator->second;
+                separator = ";";
+            }
+            out << ' ' << count << '\n';
+        }
+#else
+        static_cast<void>(out);
+        static_cast<void>(profile);
+#endif
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // CPU profiler based on SIGPROF: every 1 / frequency seconds of CPU time
+    // consumed by the process, the kernel interrupts the running thread and
+    // the signal handler records its call stack into a preallocated buffer.
+    // Stacks are kept as raw addresses and written as module+offset,
+    // symbolization is done offline (for example `addr2line -f -C -e <module> <offset>`),
+    // so no debug information needs to be deployed.
+    // Only available on Linux.
+    class SamplingProfiler
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr auto maxFrames = std::size_t{ 64 };
+        static constexpr auto maxSamples = std::size_t{ 1 << 16 };
+        static constexpr auto maxFrequency = 1000u;
+
+        struct Profile
+        {
+            // Call stacks from the outermost frame, and how many samples have hit them
+            std::map<std::vector<std::uintptr_t>, std::uint64_t> stacks;
+            std::uint64_t samples = 0;
+            // Samples lost because the buffer was full
+            std::uint64_t dropped = 0;
+            unsigned frequency = 0;
+            Clock::duration duration{};
+        };
+
+    private:
+        struct Sample;
+
+        std::mutex m_mutex;
+        std::unique_ptr<Sample[]> m_samples;
+        std::size_t m_capacity;
+        std::atomic<std::size_t> m_next;
+        std::atomic<std::uint64_t> m_dropped;
+        unsigned m_frequency;
+        Clock::time_point m_startedAt;
+
+    public:
+        static constexpr auto description = "SamplingProfiler";
+
+        static SamplingProfiler& get();
+
+        // Returns: false if a profile is already running, or if profiling is not supported
+        bool start(unsigned const frequency);
+
+        // Returns: the collected profile, or nothing if no profile was running
+        std::optional<Profile> stop();
+
+        // Called from the signal handler, must be async signal safe
+        void recordSample(void const* const interruptedAt) noexcept;
+
+        // Writes the profile in the folded stack format used by flamegraph.pl and speedscope:
+        // one line per stack, `outer;...;inner count`, each frame being `module+0xoffset`
+        static void writeFoldedStacks(std::ostream& out, Profile const& profile);
+
+    private:
+        SamplingProfiler();
+    };
+}
@@ -0,0 +1,244 @@
+#include "SessionEventStream.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<SessionEventStream>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        // Checked without locking, so publishing costs nothing when there is no stream
+        std::atomic<SessionEventStream*> activeStream{ nullptr };
+        // Protects activeStream while it's being used, and the pending records of the active stream.
+        // Only held to append one record or to swap the pending records out.
+        std::mutex streamMutex;
+
+        class RecordWriter
+        {
+        private:
+            std::array<char, SessionEventStream::maxRecordSize>& m_output;
+            std::size_t m_size;
+
+        public:
+            explicit RecordWriter(std::array<char, SessionEventStream::maxRecordSize>& output) noexcept :
+                m_output{ output },
+                m_size{ 0 }
+            {}
+
+            std::size_t getSize() const noexcept { return m_size; }
+
+            template<typename Integer>
+            void writeLittleEndian(Integer const value) noexcept
+            {
+                auto const converted = boost::endian::native_to_little(value);
+                writeBytes(&converted, sizeof(converted));
+            }
+
+            void writeEndPoint(std::optional<SessionEvent::EndPoint> const& endPoint) noexcept
+            {
+                if (!endPoint.has_value())
+                {
+                    writeLittleEndian(std::uint8_t{ 0 });
+                    return;
+                }
+
+                auto const address = endPoint->address();
+                if (address.is_v4())
+                {
+                    auto const bytes = address.to_v4().to_bytes();
+                    writeLittleEndian(static_cast<std::uint8_t>(bytes.size()));
+                    writeBytes(bytes.data(), bytes.size());
+                }
+                else
+                {
+                    auto const bytes = address.to_v6().to_bytes();
+                    writeLittleEndian(static_cast<std::uint8_t>(bytes.size()));
+                    writeBytes(bytes.data(), bytes.size());
+                }
+                auto const port = boost::endian::native_to_big(endPoint->port());
+                writeBytes(&port, sizeof(port));
+            }
+
+            void writeBytes(void const* const data, std::size_t const size) noexcept
+            {
+                std::memcpy(m_output.data() + m_size, data, size);
+                m_size += size;
+            }
+        };
+    }
+
+    std::unique_ptr<SessionEventStream> SessionEventStream::create(std::string const& socketPath)
+    {
+#ifdef __linux__
+        if (socketPath.size() >= sizeof(::sockaddr_un::sun_path))
+        {
+            logLine(LogLevel::error, "Socket path too long: ", socketPath);
+            return nullptr;
+        }
+
+        auto const socket = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (socket == -1)
+        {
+            logLine(LogLevel::error, "Cannot create socket: ", std::strerror(errno));
+            return nullptr;
+        }
+
+        logLine(LogLevel::info, "Publishing session events to ", socketPath);
+        return std::make_unique<SessionEventStream>(PrivateConstructor{}, socketPath, socket);
+#else
+        logLine(LogLevel::warning, "Session event stream is only supported on Linux");
+        static_cast<void>(socketPath);
+        return nullptr;
+#endif
+    }
+
+    SessionEventStream::SessionEventStream
+    (
+        PrivateConstructor,
+        std::string const& socketPath,
+        int const socket
+    ) :
+        m_socketPath{ socketPath },
+        m_socket{ socket },
+        m_published{ MetricsRegistry::get().counter("sessionEvents.published") },
+        m_sent{ MetricsRegistry::get().counter("sessionEvents.sent") },
+        m_dropped{ MetricsRegistry::get().counter("sessionEvents.dropped") },
+        m_datagram{},
+        m_queue{ streamMutex, queueCapacity }
+    {
+        m_datagram.reserve(maxDatagramSize);
+        m_queue.start([this](std::vector<Record> const& records) { sendAll(records); });
+
+        auto const lock = std::scoped_lock{ streamMutex };
+        if (activeStream.load() != nullptr)
+        {
+            logLine(LogLevel::warning, "Replacing the previous session event stream");
+        }
+        activeStream.store(this);
+    }
+
+    SessionEventStream::~SessionEventStream()
+    {
+        {
+            auto const lock = std::scoped_lock{ streamMutex };
+            if (activeStream.load() == this)
+            {
+                activeStream.store(nullptr);
+            }
+        }
+        m_queue.stop();
+#ifdef __linux__
+        ::close(m_socket);
+#endif
+    }
+
+    void SessionEventStream::publish(SessionEvent const& event)
+    {
+        if (activeStream.load(std::memory_order_relaxed) == nullptr)
+        {
+            return;
+        }
+
+        // Outside of the lock
+        auto record = Record{};
+        record.size = encode(event, record.data);
+
+        auto const lock = std::scoped_lock{ streamMutex };
+        if (auto const stream = activeStream.load(); stream != nullptr)
+        {
+            stream->enqueue(record);
+        }
+    }
+
+    std::size_t SessionEventStream::encode(SessionEvent const& event, std::array<char, maxRecordSize>& output) noexcept
+    {
+        auto writer = RecordWriter{ output };
+        // Length, written at the end
+        writer.writeLittleEndian(std::uint16_t{ 0 });
+        writer.writeLittleEndian(formatVersion);
+        writer.writeLittleEndian(static_cast<std::uint8_t>(event.type));
+        auto const time = std::chrono::system_clock::now().time_since_epoch();
+        writer.writeLittleEndian(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count()));
+        writer.writeLittleEndian(event.natNegID);
+        writer.writeLittleEndian(static_cast<std::int8_t>(event.playerID));
+        writer.writeLittleEndian(event.sessionKind);
+        writer.writeEndPoint(event.first);
+        writer.writeEndPoint(event.second);
+
+        auto const length = boost::endian::native_to_little(static_cast<std::uint16_t>(writer.getSize() - sizeof(std::uint16_t)));
+        std::memcpy(output.data(), &length, sizeof(length));
+        return writer.getSize();
+    }
+
+    void SessionEventStream::enqueue(Record const& record)
+    {
+        m_published.add();
+        if (!m_queue.push([&record](Record& slot) { slot = record; }))
+        {
+            m_dropped.add();
+        }
+    }
+
+    void SessionEventStream::sendAll(std::vector<Record> const& records)
+    {
+        auto batched = std::size_t{ 0 };
+        for (auto const& record : records)
+        {
+            if ((m_datagram.size() + record.size) > maxDatagramSize)
+            {
+                send(m_datagram, batched);
+                m_datagram.clear();
+                batched = 0;
+            }
+            m_datagram.append(record.data.data(), record.size);
+            ++batched;
+        }
+        if (batched != 0)
+        {
+            send(m_datagram, batched);
+            m_datagram.clear();
+        }
+    }
+
+    void SessionEventStream::send(std::string_view const datagram, std::size_t const records)
+    {
+#ifdef __linux__
+        auto address = ::sockaddr_un{};
+        address.sun_family = AF_UNIX;
+        std::copy(m_socketPath.begin(), m_socketPath.end(), address.sun_path);
+        auto const result = ::sendto
+        (
+            m_socket,
+            datagram.data(),
+            datagram.size(),
+            MSG_DONTWAIT,
+            reinterpret_cast<::sockaddr const*>(&address),
+            sizeof(address)
+        );
+        // Most likely, no consumer is listening (ENOENT, ECONNREFUSED)
+        // or it's not keeping up (EAGAIN)
+        if (result == -1)
+        {
+            m_dropped.add(records);
+            return;
+        }
+        m_sent.add(records);
+#else
+        static_cast<void>(datagram);
+        m_dropped.add(records);
+#endif
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/BackgroundQueue.hpp>
+#include <Diagnostics/Metrics.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    enum class SessionEventType : std::uint8_t
+    {
+        created = 1,
+        // A NatNeg packet from the server had the remote player's address replaced by the proxy's
+        // first: address of the remote player, second: address written into the packet
+        addressRewritten = 2,
+        // first: previous address of the client, second: new address
+        clientAddressUpdated = 3,
+        timedOut = 4,
+        closed = 5,
+    };
+
+    struct SessionEvent
+    {
+        using EndPoint = boost::asio::ip::udp::endpoint;
+
+        SessionEventType type;
+        // Same values as SessionRecord::Kind
+        std::uint8_t sessionKind;
+        std::uint32_t natNegID;
+        int playerID;
+        std::optional<EndPoint> first;
+        std::optional<EndPoint> second;
+    };
+
+    // Machine readable stream of session lifecycle events, for local analytics agents.
+    // The consumer binds a Unix datagram socket, the forwarder sends it datagrams
+    // made of one or more records, each one being (integers are little endian):
+    //      uint16  length of the rest of the record
+    //      uint8   format version (1)
+    //      uint8   SessionEventType
+    //      uint64  time, in nanoseconds since the Unix epoch
+    //      uint32  NatNeg ID
+    //      int8    player ID
+    //      uint8   session kind (0: InitialPhase, 1: GameConnection)
+    //      endpoint first, endpoint second
+    // where an endpoint is a uint8 address size (0 if absent, 4 or 16),
+    // the address and a uint16 port, both in network byte order.
+    // The relay never waits for the consumer: events are encoded by the publishing thread,
+    // then queued in a BackgroundQueue and sent from its thread.
+    // Anything which doesn't fit is dropped and counted.
+    class SessionEventStream
+    {
+    public:
+        static constexpr auto formatVersion = std::uint8_t{ 1 };
+        static constexpr auto maxRecordSize = std::size_t{ 64 };
+        static constexpr auto maxDatagramSize = std::size_t{ 4096 };
+        static constexpr auto queueCapacity = std::size_t{ 8192 };
+
+    private:
+        struct PrivateConstructor {};
+
+        struct Record
+        {
+            std::array<char, maxRecordSize> data;
+            std::size_t size;
+        };
+
+        std::string m_socketPath;
+        int m_socket;
+        Counter& m_published;
+        Counter& m_sent;
+        Counter& m_dropped;
+        std::string m_datagram;
+        // Protected by the same mutex as the active stream
+        BackgroundQueue<Record> m_queue;
+
+    public:
+        static constexpr auto description = "SessionEventStream";
+
+        // Returns: nullptr if the socket could not be created (or on platforms other than Linux).
+        // Once created, the stream receives all the published events until it's destroyed.
+        static std::unique_ptr<SessionEventStream> create(std::string const& socketPath);
+
+        SessionEventStream(PrivateConstructor, std::string const& socketPath, int const socket);
+        SessionEventStream(SessionEventStream const&) = delete;
+        SessionEventStream& operator=(SessionEventStream const&) = delete;
+        ~SessionEventStream();
+
+        // Never blocks on the consumer, does nothing if there is no stream
+        static void publish(SessionEvent const& event);
+
+        // Returns: size of the encoded record
+        static std::size_t encode(SessionEvent const& event, std::array<char, maxRecordSize>& output) noexcept;
+
+    private:
+        void enqueue(Record const& record);
+
+        // Batches as many records as possible in each datagram
+        void sendAll(std::vector<Record> const& records);
+
+        void send(std::string_view const datagram, std::size_t const records);
+    };
+}
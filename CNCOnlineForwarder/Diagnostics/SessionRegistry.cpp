@@ -0,0 +1,328 @@
+#include "SessionRegistry.hpp"
+#include <precompiled.hpp>
+#include <Utility/JsonWriter.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        Gauge& getLiveSessions(SessionRecord::Kind const kind)
+        {
+            auto name = std::string{ "sessions." };
+            name.append(SessionRecord::getKindName(kind)).append(".live");
+            return MetricsRegistry::get().gauge(name);
+        }
+
+        template<typename T>
+        void setNamed(std::vector<std::pair<std::string, T>>& entries, std::string_view const name, T const& value)
+        {
+            auto const existing = std::find_if(entries.begin(), entries.end(), [name](auto const& entry)
+            {
+                return entry.first == name;
+            });
+            if (existing != entries.end())
+            {
+                existing->second = value;
+                return;
+            }
+            entries.emplace_back(name, value);
+        }
+
+        template<typename Rep, typename Period>
+        auto toMicroseconds(std::chrono::duration<Rep, Period> const duration)
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        }
+
+        void writeOptionalMicroseconds
+        (
+            Utility::JsonWriter& json,
+            std::string_view const name,
+            std::optional<PathQuality::Clock::duration> const& duration
+        )
+        {
+            json.key(name);
+            if (duration.has_value())
+            {
+                json.value(toMicroseconds(duration.value()));
+                return;
+            }
+            json.null();
+        }
+
+        template<typename Rep, typename Period>
+        auto toMilliseconds(std::chrono::duration<Rep, Period> const duration)
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+        }
+    }
+
+    SessionRecord::SessionRecord
+    (
+        Kind const kind, 
+        std::uint32_t const natNegID, 
+        int const playerID
+    ) :
+        m_kind{ kind },
+        m_liveSessions{ getLiveSessions(kind) },
+        m_natNegID{ natNegID },
+        m_playerID{ playerID },
+        m_createdAt{ Clock::now() },
+        m_lastActivity{ m_createdAt.time_since_epoch().count() },
+        m_received{},
+        m_sent{},
+        m_stepsSeen{ 0 },
+        m_lastStep{ -1 },
+        m_endPointsMutex{},
+        m_endPoints{},
+        m_pathQuality{}
+    {
+        m_liveSessions.add(1);
+        publishEvent(SessionEventType::created);
+    }
+
+    SessionRecord::~SessionRecord()
+    {
+        m_liveSessions.add(-1);
+        publishEvent(SessionEventType::closed);
+    }
+
+    void SessionRecord::publishEvent
+    (
+        SessionEventType const type,
+        std::optional<EndPoint> const& first,
+        std::optional<EndPoint> const& second
+    ) const
+    {
+        SessionEventStream::publish
+        ({
+            type,
+            static_cast<std::uint8_t>(m_kind),
+            m_natNegID,
+            m_playerID,
+            first,
+            second
+        });
+    }
+
+    std::string_view SessionRecord::getKindName(Kind const kind) noexcept
+    {
+        switch (kind)
+        {
+        case Kind::initialPhase:
+            return "InitialPhase";
+        case Kind::gameConnection:
+            return "GameConnection";
+        }
+        return "Unknown";
+    }
+
+    void SessionRecord::recordReceived(std::size_t const bytes) noexcept
+    {
+        m_received.packets.fetch_add(1, std::memory_order_relaxed);
+        m_received.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        touch();
+    }
+
+    void SessionRecord::recordSent(std::size_t const bytes) noexcept
+    {
+        m_sent.packets.fetch_add(1, std::memory_order_relaxed);
+        m_sent.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        touch();
+    }
+
+    void SessionRecord::recordStep(int const step) noexcept
+    {
+        if (step >= 0 && step < 32)
+        {
+            m_stepsSeen.fetch_or(std::uint32_t{ 1 } << step, std::memory_order_relaxed);
+        }
+        m_lastStep.store(step, std::memory_order_relaxed);
+    }
+
+    void SessionRecord::setEndPoint(std::string_view const name, EndPoint const& endPoint)
+    {
+        auto const lock = std::scoped_lock{ m_endPointsMutex };
+        setNamed(m_endPoints, name, endPoint);
+    }
+
+    void SessionRecord::setPathQuality(std::string_view const leg, PathQuality::Summary const& summary)
+    {
+        auto const lock = std::scoped_lock{ m_endPointsMutex };
+        setNamed(m_pathQuality, leg, summary);
+    }
+
+    SessionRecord::Snapshot SessionRecord::snapshot() const
+    {
+        auto const now = Clock::now();
+        auto const lastActivity = Clock::time_point{ Clock::duration{ m_lastActivity.load(std::memory_order_relaxed) } };
+        auto const lastStep = m_lastStep.load(std::memory_order_relaxed);
+
+        auto result = Snapshot
+        {
+            m_kind,
+            m_natNegID,
+            m_playerID,
+            now - m_createdAt,
+            now - lastActivity,
+            { m_received.packets.load(std::memory_order_relaxed), m_received.bytes.load(std::memory_order_relaxed) },
+            { m_sent.packets.load(std::memory_order_relaxed), m_sent.bytes.load(std::memory_order_relaxed) },
+            m_stepsSeen.load(std::memory_order_relaxed),
+            lastStep < 0 ? std::nullopt : std::optional<int>{ lastStep },
+            {},
+            {}
+        };
+
+        auto const lock = std::scoped_lock{ m_endPointsMutex };
+        result.endPoints = m_endPoints;
+        result.pathQuality = m_pathQuality;
+        return result;
+    }
+
+    void SessionRecord::touch() noexcept
+    {
+        m_lastActivity.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    SessionRegistry& SessionRegistry::get()
+    {
+        static auto registry = SessionRegistry{};
+        return registry;
+    }
+
+    std::shared_ptr<SessionRecord> SessionRegistry::add
+    (
+        SessionRecord::Kind const kind,
+        std::uint32_t const natNegID,
+        int const playerID
+    )
+    {
+        auto record = std::make_shared<SessionRecord>(kind, natNegID, playerID);
+
+        auto const lock = std::scoped_lock{ m_mutex };
+        // Remove expired records now and then
+        if (m_sessions.size() == m_sessions.capacity())
+        {
+            auto const expired = [](std::weak_ptr<SessionRecord> const& session)
+            {
+                return session.expired();
+            };
+            m_sessions.erase(std::remove_if(m_sessions.begin(), m_sessions.end(), expired), m_sessions.end());
+        }
+        m_sessions.emplace_back(record);
+        return record;
+    }
+
+    std::vector<SessionRecord::Snapshot> SessionRegistry::snapshot(Filter const& filter) const
+    {
+        auto sessions = std::vector<std::shared_ptr<SessionRecord>>{};
+        {
+            auto const lock = std::scoped_lock{ m_mutex };
+            sessions.reserve(m_sessions.size());
+            for (auto const& session : m_sessions)
+            {
+                if (auto alive = session.lock())
+                {
+                    sessions.push_back(std::move(alive));
+                }
+            }
+        }
+
+        auto result = std::vector<SessionRecord::Snapshot>{};
+        for (auto const& session : sessions)
+        {
+            auto snapshot = session->snapshot();
+            if (filter.natNegID.has_value() && (snapshot.natNegID != filter.natNegID.value()))
+            {
+                continue;
+            }
+
+            if (filter.address.has_value())
+            {
+                auto const& endPoints = snapshot.endPoints;
+                auto const matches = std::any_of(endPoints.begin(), endPoints.end(), [&filter](auto const& entry)
+                {
+                    return entry.second.address() == filter.address.value();
+                });
+                if (!matches)
+                {
+                    continue;
+                }
+            }
+
+            result.push_back(std::move(snapshot));
+        }
+        return result;
+    }
+
+    void writeSessionsJson(std::ostream& out, std::vector<SessionRecord::Snapshot> const& sessions)
+    {
+        auto json = Utility::JsonWriter{ out };
+        json.beginArray();
+        for (auto const& session : sessions)
+        {
+            json.beginObject();
+            json.member("kind", SessionRecord::getKindName(session.kind));
+            json.member("natNegID", session.natNegID);
+            json.member("playerID", session.playerID);
+            json.member("ageMilliseconds", toMilliseconds(session.age));
+            json.member("idleMilliseconds", toMilliseconds(session.sinceLastActivity));
+
+            json.key("received").beginObject();
+            json.member("packets", session.received.packets);
+            json.member("bytes", session.received.bytes);
+            json.endObject();
+
+            json.key("sent").beginObject();
+            json.member("packets", session.sent.packets);
+            json.member("bytes", session.sent.bytes);
+            json.endObject();
+
+            json.key("stepsSeen").beginArray();
+            for (auto step = 0; step < 32; ++step)
+            {
+                if (session.stepsSeen & (std::uint32_t{ 1 } << step))
+                {
+                    json.value(step);
+                }
+            }
+            json.endArray();
+
+            json.key("lastStep");
+            if (session.lastStep.has_value())
+            {
+                json.value(session.lastStep.value());
+            }
+            else
+            {
+                json.null();
+            }
+
+            json.key("endPoints").beginObject();
+            for (auto const& [name, endPoint] : session.endPoints)
+            {
+                json.key(name).printed(endPoint);
+            }
+            json.endObject();
+
+            json.key("pathQuality").beginObject();
+            for (auto const& [leg, quality] : session.pathQuality)
+            {
+                json.key(leg).beginObject();
+                writeOptionalMicroseconds(json, "smoothedRttMicroseconds", quality.smoothedRTT);
+                writeOptionalMicroseconds(json, "minimumRttMicroseconds", quality.minimumRTT);
+                json.member("jitterMicroseconds", toMicroseconds(quality.jitter));
+                json.member("received", quality.received);
+                json.member("sequenceDetected", quality.sequenceDetected);
+                json.member("expected", quality.expected);
+                json.member("lost", quality.lost);
+                json.member("reordered", quality.reordered);
+                json.endObject();
+            }
+            json.endObject();
+
+            json.endObject();
+        }
+        json.endArray();
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Diagnostics/PathQuality.hpp>
+#include <Diagnostics/SessionEventStream.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Live information about a session (InitialPhase or GameConnection).
+    // Updated by the session from its own strand, and read by
+    // introspection from any thread without going through that strand.
+    class SessionRecord
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using EndPoint = boost::asio::ip::udp::endpoint;
+
+        enum class Kind
+        {
+            initialPhase,
+            gameConnection,
+        };
+
+        struct Traffic
+        {
+            std::uint64_t packets = 0;
+            std::uint64_t bytes = 0;
+        };
+
+        struct Snapshot
+        {
+            Kind kind;
+            std::uint32_t natNegID;
+            int playerID;
+            Clock::duration age;
+            Clock::duration sinceLastActivity;
+            Traffic received;
+            Traffic sent;
+            // Bit n is set if NatNeg step n has been seen
+            std::uint32_t stepsSeen;
+            std::optional<int> lastStep;
+            std::vector<std::pair<std::string, EndPoint>> endPoints;
+            // For each leg of a relayed stream
+            std::vector<std::pair<std::string, PathQuality::Summary>> pathQuality;
+        };
+
+    private:
+        struct AtomicTraffic
+        {
+            std::atomic<std::uint64_t> packets{ 0 };
+            std::atomic<std::uint64_t> bytes{ 0 };
+        };
+
+        Kind m_kind;
+        Gauge& m_liveSessions;
+        std::uint32_t m_natNegID;
+        int m_playerID;
+        Clock::time_point m_createdAt;
+        std::atomic<Clock::rep> m_lastActivity;
+        AtomicTraffic m_received;
+        AtomicTraffic m_sent;
+        std::atomic<std::uint32_t> m_stepsSeen;
+        std::atomic<int> m_lastStep;
+        std::mutex mutable m_endPointsMutex;
+        std::vector<std::pair<std::string, EndPoint>> m_endPoints;
+        std::vector<std::pair<std::string, PathQuality::Summary>> m_pathQuality;
+
+    public:
+        SessionRecord(Kind const kind, std::uint32_t const natNegID, int const playerID);
+        SessionRecord(SessionRecord const&) = delete;
+        SessionRecord& operator=(SessionRecord const&) = delete;
+        ~SessionRecord();
+
+        static std::string_view getKindName(Kind const kind) noexcept;
+
+        Kind getKind() const noexcept { return m_kind; }
+
+        void recordReceived(std::size_t const bytes) noexcept;
+
+        void recordSent(std::size_t const bytes) noexcept;
+
+        void recordStep(int const step) noexcept;
+
+        void setEndPoint(std::string_view const name, EndPoint const& endPoint);
+
+        void setPathQuality(std::string_view const leg, PathQuality::Summary const& summary);
+
+        // Publishes an event of this session to the SessionEventStream.
+        // Creation and destruction of the record are published automatically.
+        void publishEvent
+        (
+            SessionEventType const type,
+            std::optional<EndPoint> const& first = std::nullopt,
+            std::optional<EndPoint> const& second = std::nullopt
+        ) const;
+
+        Snapshot snapshot() const;
+
+    private:
+        void touch() noexcept;
+    };
+
+    // All the live sessions of the process
+    class SessionRegistry
+    {
+    public:
+        struct Filter
+        {
+            std::optional<std::uint32_t> natNegID;
+            // Matches sessions having any endpoint with this address
+            std::optional<boost::asio::ip::address> address;
+        };
+
+    private:
+        std::mutex mutable m_mutex;
+        std::vector<std::weak_ptr<SessionRecord>> m_sessions;
+
+    public:
+        static constexpr auto description = "SessionRegistry";
+
+        static SessionRegistry& get();
+
+        // Returns: a record which stays registered as long as it's alive
+        std::shared_ptr<SessionRecord> add
+        (
+            SessionRecord::Kind const kind,
+            std::uint32_t const natNegID,
+            int const playerID
+        );
+
+        std::vector<SessionRecord::Snapshot> snapshot(Filter const& filter) const;
+
+    private:
+        SessionRegistry() = default;
+    };
+
+    // Writes the snapshots as a JSON array
+    void writeSessionsJson(std::ostream& out, std::vector<SessionRecord::Snapshot> const& sessions);
+}
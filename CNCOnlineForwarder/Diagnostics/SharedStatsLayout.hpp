@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Layout of the shared memory segment published by SharedStatsPublisher.
+// Kept free of any other project header, so external readers only need this file.
+namespace CNCOnlineForwarder::Diagnostics::SharedStatsLayout
+{
+    // Name passed to shm_open, i.e. /dev/shm/CNCOnlineForwarder.stats on Linux
+    constexpr auto defaultSegmentName = std::string_view{ "/CNCOnlineForwarder.stats" };
+    // "CNCSTATS"
+    constexpr auto magic = std::uint64_t{ 0x5354'4154'5343'4E43 };
+    // Must be incremented whenever Header or Entry change
+    constexpr auto version = std::uint32_t{ 1 };
+    constexpr auto nameSize = std::size_t{ 96 };
+    constexpr auto capacity = std::uint32_t{ 2048 };
+
+    enum class Kind : std::uint32_t
+    {
+        counter = 0,
+        gauge = 1,
+        histogram = 2,
+    };
+
+    struct Entry
+    {
+        // Null terminated, truncated if necessary
+        char name[nameSize];
+        Kind kind;
+        std::uint32_t reserved;
+        // Counter and gauge value, or amount of samples for histograms
+        std::int64_t value;
+        // Histogram summary, zero for counters and gauges
+        std::uint64_t sum;
+        std::uint64_t max;
+        std::uint64_t p50;
+        std::uint64_t p90;
+        std::uint64_t p99;
+    };
+    static_assert(sizeof(Entry) == 152);
+
+    // The whole content of the segment after `sequence` is protected by a seqlock:
+    // the publisher makes `sequence` odd while writing and even again once done.
+    // A reader copies the content, and retries if `sequence` was odd or has changed meanwhile.
+    struct alignas(64) Header
+    {
+        std::uint64_t magic;
+        std::uint32_t version;
+        std::uint32_t headerSize;
+        std::uint32_t entrySize;
+        std::uint32_t capacity;
+        std::int64_t processID;
+        alignas(64) std::atomic<std::uint64_t> sequence;
+        // Nanoseconds since the Unix epoch
+        std::uint64_t publishedAt;
+        // Incremented every time the set of entries changes
+        std::uint64_t layoutGeneration;
+        std::uint32_t entryCount;
+        std::uint32_t reserved;
+    };
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+    constexpr std::size_t getSegmentSize() noexcept
+    {
+        return sizeof(Header) + sizeof(Entry) * capacity;
+    }
+
+    inline Entry* getEntries(Header* header) noexcept
+    {
+        return reinterpret_cast<Entry*>(reinterpret_cast<char*>(header) + sizeof(Header));
+    }
+
+    inline Entry const* getEntries(Header const* header) noexcept
+    {
+        return reinterpret_cast<Entry const*>(reinterpret_cast<char const*>(header) + sizeof(Header));
+    }
+
+    inline bool isCompatible(Header const& header) noexcept
+    {
+        return header.magic == magic
+            && header.version == version
+            && header.headerSize == sizeof(Header)
+            && header.entrySize == sizeof(Entry)
+            && header.capacity == capacity;
+    }
+
+    // Copies the header fields and `entryCount` entries into `entries`.
+    // Returns: false if the publisher was writing, in which case the caller should retry.
+    inline bool tryRead(Header const& header, Header& headerCopy, Entry* entries) noexcept
+    {
+        auto const before = header.sequence.load(std::memory_order_acquire);
+        if ((before & 1) != 0)
+        {
+            return false;
+        }
+
+        headerCopy.publishedAt = header.publishedAt;
+        headerCopy.layoutGeneration = header.layoutGeneration;
+        headerCopy.entryCount = header.entryCount;
+        auto const count = headerCopy.entryCount <= capacity ? headerCopy.entryCount : capacity;
+        std::memcpy(entries, getEntries(&header), sizeof(Entry) * count);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto const after = header.sequence.load(std::memory_order_relaxed);
+        if (before != after)
+        {
+            return false;
+        }
+        headerCopy.sequence.store(before, std::memory_order_relaxed);
+        headerCopy.entryCount = count;
+        return true;
+    }
+}
@@ -0,0 +1,259 @@
+#include "SharedStatsPublisher.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+
+#ifdef __linux__
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<SharedStatsPublisher>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        SharedStatsLayout::Kind toLayoutKind(MetricsRegistry::Kind const kind) noexcept
+        {
+            switch (kind)
+            {
+            case MetricsRegistry::Kind::counter:
+                return SharedStatsLayout::Kind::counter;
+            case MetricsRegistry::Kind::gauge:
+                return SharedStatsLayout::Kind::gauge;
+            case MetricsRegistry::Kind::histogram:
+                break;
+            }
+            return SharedStatsLayout::Kind::histogram;
+        }
+
+#ifdef __linux__
+        bool isProcessAlive(std::int64_t const processID) noexcept
+        {
+            if ((processID <= 0) || (processID == ::getpid()))
+            {
+                return false;
+            }
+            return (::kill(static_cast<pid_t>(processID), 0) == 0) || (errno == EPERM);
+        }
+
+        SharedStatsLayout::Header* mapSegment(std::string const& segmentName)
+        {
+            auto const size = SharedStatsLayout::getSegmentSize();
+            auto created = true;
+            auto descriptor = ::shm_open(segmentName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+            if ((descriptor == -1) && (errno == EEXIST))
+            {
+                // Left behind by an instance which did not exit cleanly, or still used by a running one
+                created = false;
+                descriptor = ::shm_open(segmentName.c_str(), O_RDWR, 0);
+            }
+            if (descriptor == -1)
+            {
+                logLine(LogLevel::error, "shm_open ", segmentName, " failed: ", std::strerror(errno));
+                return nullptr;
+            }
+
+            struct stat status{};
+            auto memory = MAP_FAILED;
+            if ((::fstat(descriptor, &status) == 0)
+                && (created || (static_cast<std::size_t>(status.st_size) == size))
+                && (::ftruncate(descriptor, static_cast<off_t>(size)) == 0))
+            {
+                memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+            }
+            auto const error = errno;
+            ::close(descriptor);
+            if (memory == MAP_FAILED)
+            {
+                logLine(LogLevel::error, "Mapping ", segmentName, " failed: ", created ? std::strerror(error) : "unexpected size");
+                if (created)
+                {
+                    ::shm_unlink(segmentName.c_str());
+                }
+                return nullptr;
+            }
+
+            auto const header = static_cast<SharedStatsLayout::Header*>(memory);
+            if (!created && isProcessAlive(header->processID))
+            {
+                logLine(LogLevel::error, segmentName, " is already published by process ", header->processID);
+                ::munmap(memory, size);
+                return nullptr;
+            }
+            return header;
+        }
+#endif
+    }
+
+    std::shared_ptr<SharedStatsPublisher> SharedStatsPublisher::create
+    (
+        std::string_view const segmentName,
+        Interval const interval
+    )
+    {
+#ifdef __linux__
+        auto const header = mapSegment(std::string{ segmentName });
+        if (header == nullptr)
+        {
+            return nullptr;
+        }
+
+        logLine(LogLevel::info, "Publishing metrics to ", segmentName, " every ", interval.count(), "us");
+        return std::make_shared<SharedStatsPublisher>
+        (
+            PrivateConstructor{},
+            segmentName,
+            interval,
+            header
+        );
+#else
+        logLine(LogLevel::warning, "Shared memory statistics are not supported on this platform");
+        return nullptr;
+#endif
+    }
+
+    SharedStatsPublisher::SharedStatsPublisher
+    (
+        PrivateConstructor,
+        std::string_view const segmentName,
+        Interval const interval,
+        SharedStatsLayout::Header* const header
+    ) :
+        m_segmentName{ segmentName },
+        m_interval{ interval },
+        m_header{ header },
+        m_registryGeneration{ 0 },
+        m_references{},
+        m_staging{},
+        m_stopping{ false },
+        m_thread{}
+    {
+        // Invalidate the segment while (re)initializing it,
+        // in case a reader is still attached to a previous instance
+        auto const previous = m_header->sequence.load(std::memory_order_relaxed);
+        m_header->sequence.store(previous | 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        m_header->magic = SharedStatsLayout::magic;
+        m_header->version = SharedStatsLayout::version;
+        m_header->headerSize = sizeof(SharedStatsLayout::Header);
+        m_header->entrySize = sizeof(SharedStatsLayout::Entry);
+        m_header->capacity = SharedStatsLayout::capacity;
+#ifdef __linux__
+        m_header->processID = ::getpid();
+#else
+        m_header->processID = 0;
+#endif
+        m_header->publishedAt = 0;
+        m_header->layoutGeneration = 0;
+        m_header->entryCount = 0;
+        m_header->sequence.store((previous | 1) + 1, std::memory_order_release);
+
+        m_thread = std::thread{ [this] { run(); } };
+    }
+
+    SharedStatsPublisher::~SharedStatsPublisher()
+    {
+        m_stopping.store(true, std::memory_order_relaxed);
+        m_thread.join();
+#ifdef __linux__
+        ::munmap(m_header, SharedStatsLayout::getSegmentSize());
+        ::shm_unlink(m_segmentName.c_str());
+#endif
+    }
+
+    void SharedStatsPublisher::run()
+    {
+        while (!m_stopping.load(std::memory_order_relaxed))
+        {
+            publish();
+            std::this_thread::sleep_for(m_interval);
+        }
+    }
+
+    void SharedStatsPublisher::publish()
+    {
+        MetricsRegistry::get().collect();
+        if (MetricsRegistry::get().getGeneration() != m_registryGeneration)
+        {
+            updateReferences();
+        }
+
+        // Gather everything first, to keep the write side of the seqlock as short as possible
+        for (auto i = std::size_t{ 0 }; i < m_staging.size(); ++i)
+        {
+            auto const& reference = m_references[i];
+            auto& entry = m_staging[i];
+            switch (reference.kind)
+            {
+            case MetricsRegistry::Kind::counter:
+                entry.value = static_cast<std::int64_t>(reference.counter->get());
+                break;
+            case MetricsRegistry::Kind::gauge:
+                entry.value = reference.gauge->get();
+                break;
+            case MetricsRegistry::Kind::histogram:
+            {
+                auto const snapshot = reference.histogram->snapshot();
+                entry.value = static_cast<std::int64_t>(snapshot.count);
+                entry.sum = snapshot.sum;
+                entry.max = snapshot.max;
+                entry.p50 = snapshot.percentile(0.5);
+                entry.p90 = snapshot.percentile(0.9);
+                entry.p99 = snapshot.percentile(0.99);
+                break;
+            }
+            }
+        }
+        auto const now = std::chrono::system_clock::now().time_since_epoch();
+        auto const publishedAt = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+
+        auto const sequence = m_header->sequence.load(std::memory_order_relaxed);
+        m_header->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        m_header->publishedAt = static_cast<std::uint64_t>(publishedAt);
+        m_header->layoutGeneration = m_registryGeneration;
+        m_header->entryCount = static_cast<std::uint32_t>(m_staging.size());
+        std::memcpy
+        (
+            SharedStatsLayout::getEntries(m_header),
+            m_staging.data(),
+            sizeof(SharedStatsLayout::Entry) * m_staging.size()
+        );
+
+        m_header->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    void SharedStatsPublisher::updateReferences()
+    {
+        m_registryGeneration = MetricsRegistry::get().getGeneration();
+        m_references = MetricsRegistry::get().getReferences();
+        if (m_references.size() > SharedStatsLayout::capacity)
+        {
+            logLine(LogLevel::warning, "Only the first ", SharedStatsLayout::capacity, " metrics will be published");
+            m_references.resize(SharedStatsLayout::capacity);
+        }
+
+        m_staging.assign(m_references.size(), SharedStatsLayout::Entry{});
+        for (auto i = std::size_t{ 0 }; i < m_references.size(); ++i)
+        {
+            auto const& name = m_references[i].name;
+            auto& entry = m_staging[i];
+            auto const length = std::min(name.size(), SharedStatsLayout::nameSize - 1);
+            std::memcpy(entry.name, name.data(), length);
+            entry.name[length] = '\0';
+            entry.kind = toLayoutKind(m_references[i].kind);
+        }
+    }
+}
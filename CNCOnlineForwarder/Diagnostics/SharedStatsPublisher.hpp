@@ -0,0 +1,57 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Diagnostics/SharedStatsLayout.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Periodically copies all the metrics into a shared memory segment (see SharedStatsLayout),
+    // so external tools can sample them at high frequency without talking to the process.
+    // Publishing happens on a dedicated thread: the io_context threads are never involved.
+    class SharedStatsPublisher
+    {
+    public:
+        using Interval = std::chrono::microseconds;
+    private:
+        struct PrivateConstructor {};
+    private:
+        std::string m_segmentName;
+        Interval m_interval;
+        SharedStatsLayout::Header* m_header;
+        std::uint64_t m_registryGeneration;
+        std::vector<MetricsRegistry::Reference> m_references;
+        std::vector<SharedStatsLayout::Entry> m_staging;
+        std::atomic<bool> m_stopping;
+        std::thread m_thread;
+
+    public:
+        static constexpr auto description = "SharedStatsPublisher";
+
+        // Returns: nullptr if the segment cannot be created on this platform,
+        // or if another running process is already publishing to it.
+        // A segment left behind by a process which has exited is taken over.
+        static std::shared_ptr<SharedStatsPublisher> create
+        (
+            std::string_view const segmentName,
+            Interval const interval
+        );
+
+        SharedStatsPublisher
+        (
+            PrivateConstructor,
+            std::string_view const segmentName,
+            Interval const interval,
+            SharedStatsLayout::Header* const header
+        );
+        SharedStatsPublisher(SharedStatsPublisher const&) = delete;
+        SharedStatsPublisher& operator=(SharedStatsPublisher const&) = delete;
+        ~SharedStatsPublisher();
+
+    private:
+        void run();
+
+        void publish();
+
+        void updateReferences();
+    };
+}
@@ -0,0 +1,55 @@
+#include "SocketStatistics.hpp"
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        std::string makeName(std::string_view const role, std::string_view const metric)
+        {
+            auto name = std::string{ "udp." };
+            name.append(role).append(".").append(metric);
+            return name;
+        }
+    }
+
+    SocketStatistics::SocketStatistics(std::string_view const role) :
+        m_role{ role },
+        m_packets{ MetricsRegistry::get().counter(makeName(role, "packets")) },
+        m_bytes{ MetricsRegistry::get().counter(makeName(role, "bytes")) },
+        m_kernelDrops{ MetricsRegistry::get().counter(makeName(role, "kernelDrops")) },
+        m_queueingDelay{ MetricsRegistry::get().histogram(makeName(role, "queueingDelayMicroseconds")) },
+        m_processingTime{ MetricsRegistry::get().histogram(makeName(role, "processingTimeMicroseconds")) },
+        m_lastDropCount{ 0 }
+    {}
+
+    void SocketStatistics::recordReceived
+    (
+        Utility::DatagramMetadata const& metadata, 
+        std::size_t const bytes
+    )
+    {
+        m_packets.add();
+        m_bytes.add(bytes);
+
+        if (auto const queueingDelay = metadata.getQueueingDelay(); queueingDelay.has_value())
+        {
+            m_queueingDelay.recordDuration(queueingDelay.value());
+        }
+
+        // SO_RXQ_OVFL reports the total number of drops of the socket,
+        // and is only attached when it's non zero
+        if (metadata.droppedByKernel.has_value())
+        {
+            auto const dropped = metadata.droppedByKernel.value();
+            m_kernelDrops.add(dropped - m_lastDropCount);
+            m_lastDropCount = dropped;
+        }
+    }
+
+    void SocketStatistics::recordProcessed(Utility::DatagramMetadata const& metadata)
+    {
+        m_processingTime.recordDuration(Utility::DatagramMetadata::SteadyClock::now() - metadata.receivedAt);
+        TraceContext::recordAsync("receive", m_role, metadata.receivedAt);
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Diagnostics/Tracing.hpp>
+#include <Utility/DatagramMetadata.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Receive statistics of one UDP socket, aggregated by the socket's role
+    // (for example, all the GameConnection sockets facing players).
+    // Not thread safe, should only be used inside the strand of the socket.
+    class SocketStatistics
+    {
+    private:
+        // Must have static storage duration, used to name trace spans
+        std::string_view m_role;
+        Counter& m_packets;
+        Counter& m_bytes;
+        Counter& m_kernelDrops;
+        Histogram& m_queueingDelay;
+        Histogram& m_processingTime;
+        std::uint32_t m_lastDropCount;
+
+    public:
+        explicit SocketStatistics(std::string_view const role);
+
+        void recordReceived(Utility::DatagramMetadata const& metadata, std::size_t const bytes);
+
+        void recordProcessed(Utility::DatagramMetadata const& metadata);
+    };
+}
@@ -0,0 +1,217 @@
+#include "Tracing.hpp"
+#include <precompiled.hpp>
+#include <Diagnostics/Sampling.hpp>
+#include <Utility/JsonWriter.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    namespace
+    {
+        thread_local auto currentTarget = TraceTarget{};
+
+        std::uint32_t getThreadIndex() noexcept
+        {
+            static auto nextIndex = std::atomic<std::uint32_t>{ 0 };
+            thread_local auto const index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+            return index;
+        }
+    }
+
+    Tracer& Tracer::get()
+    {
+        static auto tracer = Tracer{};
+        return tracer;
+    }
+
+    Tracer::Tracer() :
+        m_sampleRate{ 0 },
+        m_origin{ Clock::now() },
+        m_mutex{},
+        m_events{},
+        m_next{ 0 }
+    {}
+
+    void Tracer::setSampleRate(std::uint32_t const rate) noexcept
+    {
+        m_sampleRate.store(rate, std::memory_order_relaxed);
+    }
+
+    TraceTarget Tracer::getTarget(std::uint32_t const natNegID, int const playerID) const noexcept
+    {
+        auto const rate = m_sampleRate.load(std::memory_order_relaxed);
+        // Sample whole negotiations, so both players of a NatNeg session are traced
+        if (!isSampled(natNegID, rate))
+        {
+            return TraceTarget{};
+        }
+
+        auto const key = (std::uint64_t{ natNegID } << 32) | static_cast<std::uint32_t>(playerID);
+        return TraceTarget{ mix(key) | 1, natNegID, playerID };
+    }
+
+    void Tracer::recordComplete
+    (
+        TraceTarget const& target,
+        std::string_view const category,
+        std::string_view const name,
+        Clock::time_point const begin,
+        Clock::time_point const end
+    )
+    {
+        record(Event{ target, category, name, Phase::complete, begin, end - begin, getThreadIndex() });
+    }
+
+    void Tracer::recordAsync
+    (
+        TraceTarget const& target,
+        std::string_view const category,
+        std::string_view const name,
+        Clock::time_point const begin,
+        Clock::time_point const end
+    )
+    {
+        auto const thread = getThreadIndex();
+        record(Event{ target, category, name, Phase::asyncBegin, begin, {}, thread });
+        record(Event{ target, category, name, Phase::asyncEnd, end, {}, thread });
+    }
+
+    std::vector<Tracer::Event> Tracer::snapshot(std::optional<std::uint32_t> const natNegID) const
+    {
+        auto events = std::vector<Event>{};
+        {
+            auto const lock = std::scoped_lock{ m_mutex };
+            events.reserve(m_events.size());
+            // Oldest events are right after the next slot to be overwritten
+            for (auto i = std::size_t{ 0 }; i < m_events.size(); ++i)
+            {
+                auto const& event = m_events[(m_next + i) % m_events.size()];
+                if (!natNegID.has_value() || (event.target.natNegID == natNegID.value()))
+                {
+                    events.push_back(event);
+                }
+            }
+        }
+
+        std::stable_sort(events.begin(), events.end(), [](Event const& a, Event const& b)
+        {
+            return a.time < b.time;
+        });
+        return events;
+    }
+
+    void Tracer::writeChromeTrace(std::ostream& out, std::vector<Event> const& events) const
+    {
+        using std::chrono::duration;
+        using Microseconds = duration<double, std::micro>;
+
+        auto json = Utility::JsonWriter{ out };
+        json.beginObject();
+        json.member("displayTimeUnit", "ms");
+        json.key("traceEvents");
+        json.beginArray();
+
+        auto namedProcesses = std::unordered_set<std::uint32_t>{};
+        for (auto const& event : events)
+        {
+            if (namedProcesses.insert(event.target.natNegID).second)
+            {
+                auto name = std::ostringstream{};
+                name << "NatNeg " << event.target.natNegID;
+                json.beginObject();
+                json.member("ph", "M");
+                json.member("name", "process_name");
+                json.member("pid", event.target.natNegID);
+                json.key("args").beginObject().member("name", name.str()).endObject();
+                json.endObject();
+            }
+
+            char const phase[] = { static_cast<char>(event.phase), '\0' };
+            json.beginObject();
+            json.member("ph", std::string_view{ phase });
+            json.member("cat", event.category);
+            json.member("name", event.name);
+            json.member("pid", event.target.natNegID);
+            json.member("tid", event.thread);
+            // Integral, doubles would lose precision once the process has been running for a while
+            json.member("ts", std::chrono::duration_cast<std::chrono::microseconds>(event.time - m_origin).count());
+            if (event.phase == Phase::complete)
+            {
+                json.member("dur", Microseconds{ event.duration }.count());
+            }
+            else
+            {
+                // Async spans of each player get their own track
+                auto id = std::ostringstream{};
+                id << std::hex << "0x" << event.target.traceID;
+                json.member("id", id.str());
+            }
+            json.key("args").beginObject().member("playerID", event.target.playerID).endObject();
+            json.endObject();
+        }
+
+        json.endArray();
+        json.endObject();
+    }
+
+    void Tracer::record(Event const& event)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        if (m_events.size() < capacity)
+        {
+            m_events.push_back(event);
+            return;
+        }
+        m_events[m_next] = event;
+        m_next = (m_next + 1) % capacity;
+    }
+
+    TraceTarget const& TraceContext::getCurrent() noexcept
+    {
+        return currentTarget;
+    }
+
+    void TraceContext::recordAsync
+    (
+        std::string_view const category,
+        std::string_view const name,
+        Tracer::Clock::time_point const begin
+    )
+    {
+        if (currentTarget.isSampled())
+        {
+            Tracer::get().recordAsync(currentTarget, category, name, begin, Tracer::Clock::now());
+        }
+    }
+
+    TraceContext::Scope::Scope
+    (
+        TraceTarget const& target,
+        std::string_view const category,
+        std::string_view const name
+    ) noexcept :
+        m_previous{ currentTarget },
+        m_category{ category },
+        m_name{ name },
+        m_begin{ target.isSampled() ? Tracer::Clock::now() : Tracer::Clock::time_point{} }
+    {
+        currentTarget = target;
+    }
+
+    TraceContext::Scope::Scope(TraceTarget const& target) noexcept :
+        m_previous{ currentTarget },
+        m_category{},
+        m_name{},
+        m_begin{}
+    {
+        currentTarget = target;
+    }
+
+    TraceContext::Scope::~Scope()
+    {
+        if (currentTarget.isSampled() && !m_name.empty())
+        {
+            Tracer::get().recordComplete(currentTarget, m_category, m_name, m_begin, Tracer::Clock::now());
+        }
+        currentTarget = m_previous;
+    }
+}
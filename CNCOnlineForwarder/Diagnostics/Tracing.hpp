@@ -0,0 +1,159 @@
+#pragma once
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Diagnostics
+{
+    // Identifies the player being traced.
+    // Every component handling the same NatNegPlayerID derives the same target,
+    // so spans recorded by NatNegProxy, InitialPhase and GameConnection end up in one trace.
+    struct TraceTarget
+    {
+        // 0 if the session is not sampled
+        std::uint64_t traceID = 0;
+        std::uint32_t natNegID = 0;
+        int playerID = 0;
+
+        bool isSampled() const noexcept { return traceID != 0; }
+    };
+
+    // Collects spans of sampled sessions, in a bounded buffer keeping the most recent ones
+    class Tracer
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        enum class Phase : char
+        {
+            // Synchronous work, executed on the current thread
+            complete = 'X',
+            // Waiting for something (a strand, a resolve, a send completion...)
+            asyncBegin = 'b',
+            asyncEnd = 'e',
+        };
+
+        struct Event
+        {
+            TraceTarget target;
+            // Both must have static storage duration
+            std::string_view category;
+            std::string_view name;
+            Phase phase;
+            Clock::time_point time;
+            Clock::duration duration;
+            std::uint32_t thread;
+        };
+
+        static constexpr auto capacity = std::size_t{ 1 << 16 };
+
+    private:
+        std::atomic<std::uint32_t> m_sampleRate;
+        Clock::time_point m_origin;
+        std::mutex mutable m_mutex;
+        std::vector<Event> m_events;
+        std::size_t m_next;
+
+    public:
+        static constexpr auto description = "Tracer";
+
+        static Tracer& get();
+
+        // Trace one NatNeg negotiation out of `rate`, 0 disables tracing
+        void setSampleRate(std::uint32_t const rate) noexcept;
+
+        TraceTarget getTarget(std::uint32_t const natNegID, int const playerID) const noexcept;
+
+        // Records a synchronous span on the current thread
+        void recordComplete
+        (
+            TraceTarget const& target,
+            std::string_view const category,
+            std::string_view const name,
+            Clock::time_point const begin,
+            Clock::time_point const end
+        );
+
+        // Records a span spent waiting
+        void recordAsync
+        (
+            TraceTarget const& target,
+            std::string_view const category,
+            std::string_view const name,
+            Clock::time_point const begin,
+            Clock::time_point const end
+        );
+
+        // Returns: recorded events in chronological order
+        std::vector<Event> snapshot(std::optional<std::uint32_t> const natNegID) const;
+
+        // Writes the events in the Chrome trace event format,
+        // one process per NatNeg negotiation and one thread per worker
+        void writeChromeTrace(std::ostream& out, std::vector<Event> const& events) const;
+
+    private:
+        Tracer();
+
+        void record(Event const& event);
+    };
+
+    // The session currently handled by this thread.
+    // Captured when scheduling work, so the spans of deferred handlers
+    // and of send completions are attributed to the session which caused them.
+    class TraceContext
+    {
+    public:
+        class Scope;
+
+        static TraceTarget const& getCurrent() noexcept;
+
+        // Records an async span for the current session, if it's sampled
+        static void recordAsync
+        (
+            std::string_view const category,
+            std::string_view const name,
+            Tracer::Clock::time_point const begin
+        );
+    };
+
+    // Makes `target` the current session, optionally recording the execution of the scope as a span
+    class TraceContext::Scope
+    {
+    private:
+        TraceTarget m_previous;
+        std::string_view m_category;
+        std::string_view m_name;
+        Tracer::Clock::time_point m_begin;
+
+    public:
+        Scope(TraceTarget const& target, std::string_view const category, std::string_view const name) noexcept;
+        // Only propagates the session
+        explicit Scope(TraceTarget const& target) noexcept;
+        Scope(Scope const&) = delete;
+        Scope& operator=(Scope const&) = delete;
+        ~Scope();
+    };
+
+    // Captures the current session when some asynchronous operation starts,
+    // and records the time spent until completion
+    class PendingSpan
+    {
+    private:
+        TraceTarget m_target;
+        Tracer::Clock::time_point m_begin;
+
+    public:
+        PendingSpan() noexcept :
+            m_target{ TraceContext::getCurrent() },
+            m_begin{ m_target.isSampled() ? Tracer::Clock::now() : Tracer::Clock::time_point{} }
+        {}
+
+        TraceTarget const& getTarget() const noexcept { return m_target; }
+
+        void finish(std::string_view const category, std::string_view const name) const
+        {
+            if (m_target.isSampled())
+            {
+                Tracer::get().recordAsync(m_target, category, name, m_begin, Tracer::Clock::now());
+            }
+        }
+    };
+}
@@ -0,0 +1,519 @@
+#include "HTTPProxy.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+#include <Utility/Defer.hpp>
+#include <Utility/WeakRefHandler.hpp>
+
+using TCP = boost::asio::ip::tcp;
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+using SteadyClock = std::chrono::steady_clock;
+
+using CNCOnlineForwarder::Utility::makeWeakHandler;
+
+namespace Http = boost::beast::http;
+
+namespace CNCOnlineForwarder::HTTPProxy
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<HTTPProxy>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        std::uint64_t getMicroseconds(SteadyClock::time_point const start)
+        {
+            auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(SteadyClock::now() - start);
+            return static_cast<std::uint64_t>(elapsed.count());
+        }
+
+        Utility::HTTPClient::Options getClientOptions()
+        {
+            auto options = Utility::HTTPClient::Options{};
+            options.connectTimeout = std::chrono::seconds{ 10 };
+            options.responseTimeout = std::chrono::seconds{ 15 };
+            // The prefetched targets are refreshed more often than this
+            options.idleTimeout = std::chrono::minutes{ 2 };
+            options.maxConnectionsPerHost = 8;
+            return options;
+        }
+
+        // Fields of a player's request which are sent upstream: all of them except those
+        // about its own connection, and the validators, since the proxy revalidates with its own
+        template<typename Request>
+        HTTPProxy::Fields getForwardedFields(Request const& request)
+        {
+            auto fields = HTTPProxy::Fields{};
+            for (auto const& field : request)
+            {
+                switch (field.name())
+                {
+                case Http::field::host:
+                case Http::field::connection:
+                case Http::field::keep_alive:
+                case Http::field::proxy_connection:
+                case Http::field::te:
+                case Http::field::trailer:
+                case Http::field::transfer_encoding:
+                case Http::field::upgrade:
+                case Http::field::content_length:
+                case Http::field::if_none_match:
+                case Http::field::if_modified_since:
+                    continue;
+                default:
+                    fields.emplace_back(std::string{ field.name_string() }, std::string{ field.value() });
+                }
+            }
+            return fields;
+        }
+    }
+
+    // A connection of a player
+    class HTTPProxy::Session : public std::enable_shared_from_this<HTTPProxy::Session>
+    {
+    private:
+        using TCPStream = boost::beast::tcp_stream;
+        using FlatBuffer = boost::beast::flat_buffer;
+        using HTTPRequest = Http::request<Http::string_body>;
+        // Refers to the body of the cached response instead of copying it
+        using HTTPResponse = Http::response<Http::span_body<char const>>;
+
+    private:
+        std::weak_ptr<HTTPProxy> m_proxy;
+        TCPStream m_stream;
+        FlatBuffer m_buffer; // (Must persist between reads)
+        HTTPRequest m_request;
+        ResponsePointer m_cached;
+        HTTPResponse m_response;
+
+    public:
+        Session(std::weak_ptr<HTTPProxy> proxy, TCP::socket&& socket) :
+            m_proxy{ std::move(proxy) },
+            m_stream{ std::move(socket) },
+            m_buffer{},
+            m_request{},
+            m_cached{},
+            m_response{}
+        {}
+
+        void read()
+        {
+            m_request = {};
+            m_stream.expires_after(std::chrono::seconds(30));
+            Http::async_read
+            (
+                m_stream,
+                m_buffer,
+                m_request,
+                boost::beast::bind_front_handler(&Session::onRead, shared_from_this())
+            );
+        }
+
+    private:
+        void onRead(ErrorCode const& code, std::size_t const /* bytesTransferred */)
+        {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::http };
+
+            if (code == Http::error::end_of_stream)
+            {
+                return close();
+            }
+
+            if (code.failed())
+            {
+                logLine(LogLevel::debug, "Read failed: ", code);
+                return;
+            }
+
+            auto const proxy = m_proxy.lock();
+            if (!proxy)
+            {
+                logLine(LogLevel::warning, "HTTPProxy already died when handling request");
+                return close();
+            }
+
+            if ((m_request.method() != Http::verb::get) && (m_request.method() != Http::verb::head))
+            {
+                return respondError(Http::status::method_not_allowed, "Only GET and HEAD are supported\n");
+            }
+
+            auto responder = [self = shared_from_this()](ResponsePointer const& response, std::string_view const cacheStatus)
+            {
+                auto action = [self, response, cacheStatus]
+                {
+                    self->respond(response, cacheStatus);
+                };
+                boost::asio::dispatch(self->m_stream.get_executor(), std::move(action));
+            };
+            auto const target = m_request.target();
+            proxy->asyncGet({ target.data(), target.size() }, getForwardedFields(m_request), std::move(responder));
+        }
+
+        void respond(ResponsePointer const& response, std::string_view const cacheStatus)
+        {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::http };
+
+            if (!response)
+            {
+                return respondError(Http::status::bad_gateway, "The upstream server cannot be reached\n");
+            }
+
+            m_cached = response;
+            m_response = HTTPResponse{ response->base() };
+            m_response.version(m_request.version());
+            m_response.erase(Http::field::connection);
+            m_response.erase(Http::field::keep_alive);
+            m_response.erase(Http::field::transfer_encoding);
+            m_response.set("X-Cache", cacheStatus);
+            m_response.keep_alive(m_request.keep_alive());
+
+            auto const etag = response->find(Http::field::etag);
+            auto const ifNoneMatch = m_request.find(Http::field::if_none_match);
+            if ((etag != response->end()) && (ifNoneMatch != m_request.end()) && (etag->value() == ifNoneMatch->value()))
+            {
+                m_response.result(Http::status::not_modified);
+                m_response.erase(Http::field::content_length);
+                m_response.body() = {};
+            }
+            else
+            {
+                m_response.body() = { response->body().data(), response->body().size() };
+                m_response.prepare_payload();
+                if (m_request.method() == Http::verb::head)
+                {
+                    // Content-Length is kept
+                    m_response.body() = {};
+                }
+            }
+
+            write();
+        }
+
+        void respondError(Http::status const status, std::string_view const message)
+        {
+            // Only called with string literals, which outlive the write
+            m_cached = nullptr;
+            m_response = HTTPResponse{ status, m_request.version() };
+            m_response.set(Http::field::server, BOOST_BEAST_VERSION_STRING);
+            m_response.set(Http::field::content_type, "text/plain");
+            m_response.keep_alive(m_request.keep_alive());
+            m_response.body() = { message.data(), message.size() };
+            m_response.prepare_payload();
+            write();
+        }
+
+        void write()
+        {
+            Http::async_write
+            (
+                m_stream,
+                m_response,
+                boost::beast::bind_front_handler(&Session::onWrite, shared_from_this())
+            );
+        }
+
+        void onWrite(ErrorCode const& code, std::size_t const /* bytesTransferred */)
+        {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::http };
+
+            m_cached = nullptr;
+            if (code.failed())
+            {
+                logLine(LogLevel::debug, "Write failed: ", code);
+                return;
+            }
+
+            if (!m_response.keep_alive())
+            {
+                return close();
+            }
+
+            read();
+        }
+
+        void close()
+        {
+            auto code = ErrorCode{};
+            m_stream.socket().shutdown(TCP::socket::shutdown_send, code);
+        }
+    };
+
+    std::shared_ptr<HTTPProxy> HTTPProxy::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        Options const& options
+    )
+    {
+        auto const self = std::make_shared<HTTPProxy>
+        (
+            PrivateConstructor{},
+            objectMaker,
+            options
+        );
+
+        auto const action = [prefetchTargets = options.prefetchTargets](HTTPProxy& self)
+        {
+            logLine
+            (
+                LogLevel::info,
+                "HTTPProxy listening on ", self.m_acceptor->local_endpoint(),
+                ", upstream server ", self.m_upstreamHost, ":", self.m_upstreamPort,
+                ", prefetching ", prefetchTargets.size(), " targets"
+            );
+            self.prepareForNextConnection();
+            for (auto const& target : prefetchTargets)
+            {
+                self.m_cache.pin(target);
+            }
+            self.refreshPinned();
+        };
+        Utility::defer(self->m_strand, makeWeakHandler(self, action));
+
+        return self;
+    }
+
+    HTTPProxy::HTTPProxy
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        Options const& options
+    ) :
+        m_objectMaker{ objectMaker },
+        m_strand{ objectMaker.makeStrand() },
+        m_acceptor{ m_strand, options.localEndPoint },
+        m_refreshTimer{ m_strand },
+        m_upstreamHost{ options.upstreamHost },
+        m_upstreamPort{ options.upstreamPort },
+        m_client{ Utility::HTTPClient::create(objectMaker, getClientOptions()) },
+        m_cache{ options.cache },
+        m_requests{ Diagnostics::MetricsRegistry::get().counter("httpProxy.requests") },
+        m_hits{ Diagnostics::MetricsRegistry::get().counter("httpProxy.hits") },
+        m_staleHits{ Diagnostics::MetricsRegistry::get().counter("httpProxy.staleHits") },
+        m_misses{ Diagnostics::MetricsRegistry::get().counter("httpProxy.misses") },
+        m_bypassed{ Diagnostics::MetricsRegistry::get().counter("httpProxy.bypassed") },
+        m_revalidations{ Diagnostics::MetricsRegistry::get().counter("httpProxy.revalidations") },
+        m_notModified{ Diagnostics::MetricsRegistry::get().counter("httpProxy.notModified") },
+        m_upstreamFailures{ Diagnostics::MetricsRegistry::get().counter("httpProxy.upstreamFailures") },
+        m_cacheSize{ Diagnostics::MetricsRegistry::get().gauge("httpProxy.cacheBytes") },
+        m_responseTime{ Diagnostics::MetricsRegistry::get().histogram("httpProxy.responseMicroseconds") },
+        m_upstreamTime{ Diagnostics::MetricsRegistry::get().histogram("httpProxy.upstreamMicroseconds") }
+    {}
+
+    void HTTPProxy::asyncGet(std::string target, Fields fields, Responder responder)
+    {
+        auto action = [target = std::move(target), fields = std::move(fields), responder = std::move(responder)](HTTPProxy& self) mutable
+        {
+            self.get(target, fields, std::move(responder));
+        };
+        Utility::defer(m_strand, makeWeakHandler(this, std::move(action)));
+    }
+
+    void HTTPProxy::prepareForNextConnection()
+    {
+        auto const handler = [](HTTPProxy& self, ErrorCode const& code, TCP::socket socket)
+        {
+            self.prepareForNextConnection();
+            if (code.failed())
+            {
+                logLine(LogLevel::error, "Accept failed: ", code);
+                return;
+            }
+
+            std::make_shared<Session>(self.weak_from_this(), std::move(socket))->read();
+        };
+        m_acceptor->async_accept
+        (
+            m_objectMaker.makeStrand(),
+            boost::asio::bind_executor(m_strand, makeWeakHandler(this, handler))
+        );
+    }
+
+    void HTTPProxy::get(std::string const& target, Fields const& fields, Responder&& responder)
+    {
+        m_requests.add();
+        auto const start = SteadyClock::now();
+        auto timedResponder = [&responseTime = m_responseTime, start, responder = std::move(responder)]
+        (
+            ResponsePointer const& response,
+            std::string_view const cacheStatus
+        )
+        {
+            responseTime.record(getMicroseconds(start));
+            responder(response, cacheStatus);
+        };
+
+        if (!ResponseCache::isCacheable(fields))
+        {
+            m_bypassed.add();
+            return fetch(target, fields, false, std::move(timedResponder));
+        }
+
+        auto const lookup = m_cache.find(m_cache.getKey(target, fields), start);
+        switch (lookup.freshness)
+        {
+        case ResponseCache::Freshness::fresh:
+            m_hits.add();
+            return timedResponder(lookup.entry->response, "HIT");
+        case ResponseCache::Freshness::stale:
+            m_staleHits.add();
+            if (!lookup.entry->isRevalidating)
+            {
+                lookup.entry->isRevalidating = true;
+                m_revalidations.add();
+                fetch(target, fields, true, {});
+            }
+            return timedResponder(lookup.entry->response, "STALE");
+        default:
+            m_misses.add();
+            logLine(LogLevel::debug, "Fetching ", target);
+            return fetch(target, fields, true, std::move(timedResponder));
+        }
+    }
+
+    void HTTPProxy::fetch(std::string const& target, Fields const& fields, bool const useCache, Responder&& responder)
+    {
+        auto get = Utility::HTTPClient::Get{ m_upstreamHost, m_upstreamPort, target, fields };
+        // Expired responses are revalidated too, the body is not sent again if it is still the same
+        if (useCache)
+        {
+            if (auto const lookup = m_cache.find(m_cache.getKey(target, fields), SteadyClock::now()); lookup.entry != nullptr)
+            {
+                auto const validators = ResponseCache::getValidators(*lookup.entry);
+                get.fields.insert(get.fields.end(), validators.begin(), validators.end());
+            }
+        }
+
+        auto onFetched = [target, fields, useCache, start = SteadyClock::now(), responder = std::move(responder)]
+        (
+            HTTPProxy& self,
+            ErrorCode const& code,
+            ResponsePointer const& response
+        ) mutable
+        {
+            self.onFetched(target, fields, useCache, start, code, response, std::move(responder));
+        };
+        // Answered on the strand of the client
+        m_client->asyncGet
+        (
+            std::move(get),
+            [strand = m_strand, handler = makeWeakHandler(this, std::move(onFetched))](ErrorCode const& code, ResponsePointer const& response)
+            {
+                Utility::defer<HTTPProxy>(strand, [handler, code, response]() mutable
+                {
+                    handler(code, response);
+                });
+            }
+        );
+    }
+
+    void HTTPProxy::onFetched
+    (
+        std::string const& target,
+        Fields const& fields,
+        bool const useCache,
+        SteadyClock::time_point const start,
+        ErrorCode const& code,
+        ResponsePointer const& response,
+        Responder&& responder
+    )
+    {
+        m_upstreamTime.record(getMicroseconds(start));
+        auto const now = SteadyClock::now();
+        auto const key = m_cache.getKey(target, fields);
+
+        if (!useCache)
+        {
+            if (code.failed())
+            {
+                m_upstreamFailures.add();
+                logLine(LogLevel::warning, "Failed to fetch ", target, ": ", code.message());
+            }
+            if (responder)
+            {
+                responder(code.failed() ? nullptr : response, "BYPASS");
+            }
+            return;
+        }
+
+        if (code.failed() || (response->result_int() >= 500))
+        {
+            m_upstreamFailures.add();
+            logLine(LogLevel::warning, "Failed to fetch ", target, ": ", code.failed() ? code.message() : std::string{ response->reason() });
+
+            // During log in, an old response is still better than none
+            auto const lookup = m_cache.find(key, now);
+            if (lookup.entry != nullptr)
+            {
+                lookup.entry->isRevalidating = false;
+            }
+            if (!responder)
+            {
+                return;
+            }
+            if (lookup.entry != nullptr)
+            {
+                return responder(lookup.entry->response, "STALE");
+            }
+            return responder(response, "MISS");
+        }
+
+        if (response->result() == Http::status::not_modified)
+        {
+            m_notModified.add();
+            auto const entry = m_cache.refresh(key, *response, now);
+            m_cacheSize.set(static_cast<std::int64_t>(m_cache.getSize()));
+            if (entry == nullptr)
+            {
+                // Evicted in the meantime, fetched again without validators
+                if (responder)
+                {
+                    fetch(target, fields, true, std::move(responder));
+                }
+                return;
+            }
+            if (responder)
+            {
+                responder(entry->response, "REVALIDATED");
+            }
+            return;
+        }
+
+        if (!m_cache.store(target, fields, response, now))
+        {
+            // Not cacheable anymore, like a 404 or a no-store
+            m_cache.erase(key);
+        }
+        m_cacheSize.set(static_cast<std::int64_t>(m_cache.getSize()));
+        if (responder)
+        {
+            responder(response, "MISS");
+        }
+    }
+
+    void HTTPProxy::refreshPinned()
+    {
+        // Revalidated before they expire, so they are always answered from the cache
+        auto const now = SteadyClock::now();
+        for (auto const& target : m_cache.getPinnedToRefresh(now, 2 * refreshInterval))
+        {
+            if (auto const lookup = m_cache.find(target, now); lookup.entry != nullptr)
+            {
+                lookup.entry->isRevalidating = true;
+                m_revalidations.add();
+            }
+            fetch(target, {}, true, {});
+        }
+
+        auto const onExpired = [](HTTPProxy& self, ErrorCode const& code)
+        {
+            if (code == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+            self.refreshPinned();
+        };
+        m_refreshTimer.asyncWait(refreshInterval, boost::asio::bind_executor(m_strand, makeWeakHandler(this, onExpired)));
+    }
+}
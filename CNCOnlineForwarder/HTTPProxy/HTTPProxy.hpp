@@ -0,0 +1,110 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <HTTPProxy/ResponseCache.hpp>
+#include <Utility/HTTPClient.hpp>
+#include <Utility/WithStrand.hpp>
+
+namespace CNCOnlineForwarder::HTTPProxy
+{
+    // Reverse proxy of http.server.cnc-online.net, so the game does not time out during log in
+    // because of the latency to the upstream server.
+    // GETs are answered from ResponseCache when possible; stale responses are served while they
+    // are revalidated in the background. The header fields of the players are sent upstream,
+    // and requests with credentials (Authorization, Cookie) bypass the cache. The prefetched targets are fetched at startup and kept fresh,
+    // so they are always answered locally. Upstream connections are kept alive by HTTPClient.
+    class HTTPProxy : public std::enable_shared_from_this<HTTPProxy>
+    {
+    public:
+        using Strand = IOManager::StrandType;
+        using EndPoint = boost::asio::ip::tcp::endpoint;
+        using Acceptor = Utility::WithStrand<boost::asio::ip::tcp::acceptor>;
+        using Timer = Utility::WithStrand<boost::asio::steady_timer>;
+        using ResponsePointer = ResponseCache::ResponsePointer;
+        using Fields = ResponseCache::Fields;
+        // Called with a null response if the upstream server cannot be reached.
+        // The status tells how the response was found, sent to the clients in X-Cache.
+        using Responder = std::function<void(ResponsePointer const&, std::string_view const cacheStatus)>;
+
+        struct Options
+        {
+            EndPoint localEndPoint;
+            std::string upstreamHost = "http.server.cnc-online.net";
+            std::uint16_t upstreamPort = 80;
+            std::vector<std::string> prefetchTargets;
+            ResponseCache::Options cache;
+        };
+
+        // How often the prefetched targets are checked
+        static constexpr auto refreshInterval = std::chrono::seconds{ 10 };
+
+    private:
+        struct PrivateConstructor {};
+        class Session;
+
+        IOManager::ObjectMaker m_objectMaker;
+        Strand m_strand;
+        Acceptor m_acceptor;
+        Timer m_refreshTimer;
+        std::string m_upstreamHost;
+        std::uint16_t m_upstreamPort;
+        std::shared_ptr<Utility::HTTPClient> m_client;
+        ResponseCache m_cache;
+        Diagnostics::Counter& m_requests;
+        Diagnostics::Counter& m_hits;
+        Diagnostics::Counter& m_staleHits;
+        Diagnostics::Counter& m_misses;
+        Diagnostics::Counter& m_bypassed;
+        Diagnostics::Counter& m_revalidations;
+        Diagnostics::Counter& m_notModified;
+        Diagnostics::Counter& m_upstreamFailures;
+        Diagnostics::Gauge& m_cacheSize;
+        Diagnostics::Histogram& m_responseTime;
+        Diagnostics::Histogram& m_upstreamTime;
+
+    public:
+        static constexpr auto description = "HTTPProxy";
+        static constexpr auto allocationTag = Diagnostics::AllocationTag::http;
+
+        static std::shared_ptr<HTTPProxy> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            Options const& options
+        );
+
+        HTTPProxy
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            Options const& options
+        );
+
+        // Can be called from any thread.
+        // Fields: of the request of the player, sent upstream.
+        void asyncGet(std::string target, Fields fields, Responder responder);
+
+    private:
+        void prepareForNextConnection();
+
+        void get(std::string const& target, Fields const& fields, Responder&& responder);
+
+        // Without a responder, the response is only stored.
+        // Without useCache, the response is neither revalidated nor stored.
+        void fetch(std::string const& target, Fields const& fields, bool const useCache, Responder&& responder);
+
+        void onFetched
+        (
+            std::string const& target,
+            Fields const& fields,
+            bool const useCache,
+            std::chrono::steady_clock::time_point const start,
+            Utility::HTTPClient::ErrorCode const& code,
+            ResponsePointer const& response,
+            Responder&& responder
+        );
+
+        void refreshPinned();
+    };
+}
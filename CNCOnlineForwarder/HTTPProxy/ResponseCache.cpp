@@ -0,0 +1,341 @@
+#include "ResponseCache.hpp"
+#include <precompiled.hpp>
+#include <charconv>
+
+namespace Http = boost::beast::http;
+
+namespace CNCOnlineForwarder::HTTPProxy
+{
+    namespace
+    {
+        struct CacheControl
+        {
+            bool noStore = false;
+            bool noCache = false;
+            bool isPrivate = false;
+            std::optional<std::chrono::seconds> maxAge;
+        };
+
+        CacheControl parseCacheControl(std::string_view value)
+        {
+            auto result = CacheControl{};
+            auto sharedMaxAge = std::optional<std::chrono::seconds>{};
+            while (!value.empty())
+            {
+                auto const end = value.find(',');
+                auto directive = std::string{ value.substr(0, end) };
+                value.remove_prefix((end == value.npos) ? value.size() : (end + 1));
+
+                boost::algorithm::trim(directive);
+                auto const equals = directive.find('=');
+                auto name = directive.substr(0, equals);
+                std::transform(name.begin(), name.end(), name.begin(), [](unsigned char const c) { return static_cast<char>(std::tolower(c)); });
+                auto argument = (equals == directive.npos) ? std::string{} : directive.substr(equals + 1);
+                boost::algorithm::trim_if(argument, [](char const c) { return (c == '"') || (c == ' '); });
+
+                auto seconds = std::optional<std::chrono::seconds>{};
+                if (auto parsed = std::int64_t{}; !argument.empty())
+                {
+                    auto const [last, error] = std::from_chars(argument.data(), argument.data() + argument.size(), parsed);
+                    if ((error == std::errc{}) && (last == (argument.data() + argument.size())) && (parsed >= 0))
+                    {
+                        seconds = std::chrono::seconds{ parsed };
+                    }
+                }
+
+                if (name == "no-store")
+                {
+                    result.noStore = true;
+                }
+                else if (name == "no-cache")
+                {
+                    result.noCache = true;
+                }
+                else if (name == "private")
+                {
+                    result.isPrivate = true;
+                }
+                else if (name == "max-age")
+                {
+                    result.maxAge = seconds;
+                }
+                else if (name == "s-maxage")
+                {
+                    sharedMaxAge = seconds;
+                }
+            }
+            // This is a shared cache
+            if (sharedMaxAge.has_value())
+            {
+                result.maxAge = sharedMaxAge;
+            }
+            return result;
+        }
+
+        // Returns: nothing if the response varies on everything, like "Vary: *"
+        std::optional<std::vector<std::string>> parseVary(std::string_view value)
+        {
+            auto names = std::vector<std::string>{};
+            while (!value.empty())
+            {
+                auto const end = value.find(',');
+                auto name = std::string{ value.substr(0, end) };
+                value.remove_prefix((end == value.npos) ? value.size() : (end + 1));
+
+                boost::algorithm::trim(name);
+                std::transform(name.begin(), name.end(), name.begin(), [](unsigned char const c) { return static_cast<char>(std::tolower(c)); });
+                if (name == "*")
+                {
+                    return std::nullopt;
+                }
+                if (!name.empty() && (std::find(names.begin(), names.end(), name) == names.end()))
+                {
+                    names.push_back(std::move(name));
+                }
+            }
+            std::sort(names.begin(), names.end());
+            return names;
+        }
+    }
+
+    ResponseCache::ResponseCache(Options const& options) :
+        m_options{ options },
+        m_entries{},
+        m_varies{},
+        m_pinned{},
+        m_recent{},
+        m_size{ 0 }
+    {}
+
+    bool ResponseCache::isCacheable(Fields const& requestFields)
+    {
+        return std::none_of(requestFields.begin(), requestFields.end(), [](auto const& field)
+        {
+            return boost::beast::iequals(field.first, "Authorization") || boost::beast::iequals(field.first, "Cookie");
+        });
+    }
+
+    std::string ResponseCache::getKey(std::string const& target, Fields const& requestFields) const
+    {
+        auto key = target;
+        auto const vary = m_varies.find(target);
+        if (vary == m_varies.end())
+        {
+            return key;
+        }
+
+        for (auto const& name : vary->second)
+        {
+            auto const field = std::find_if(requestFields.begin(), requestFields.end(), [&name](auto const& field)
+            {
+                return boost::beast::iequals(field.first, name);
+            });
+            if ((field != requestFields.end()) && !field->second.empty())
+            {
+                key.append(1, '\n').append(name).append(": ").append(field->second);
+            }
+        }
+        return key;
+    }
+
+    ResponseCache::Lookup ResponseCache::find(std::string const& key, TimePoint const now)
+    {
+        auto const iterator = m_entries.find(key);
+        if (iterator == m_entries.end())
+        {
+            return {};
+        }
+
+        auto& entry = iterator->second;
+        m_recent.splice(m_recent.begin(), m_recent, entry.recent);
+
+        auto freshness = Freshness::expired;
+        if (now < entry.freshUntil)
+        {
+            freshness = Freshness::fresh;
+        }
+        else if (now < entry.staleUntil)
+        {
+            freshness = Freshness::stale;
+        }
+        return { &entry, freshness };
+    }
+
+    bool ResponseCache::store(std::string const& target, Fields const& requestFields, ResponsePointer const& response, TimePoint const now)
+    {
+        auto const timeToLive = getTimeToLive(*response);
+        auto const vary = parseVary((*response)[Http::field::vary]);
+        if (!timeToLive.has_value() || !vary.has_value())
+        {
+            return false;
+        }
+
+        if (vary->empty())
+        {
+            m_varies.erase(target);
+        }
+        else
+        {
+            m_varies[target] = vary.value();
+        }
+
+        auto const key = getKey(target, requestFields);
+        auto [iterator, inserted] = m_entries.try_emplace(key);
+        auto& entry = iterator->second;
+        if (inserted)
+        {
+            m_recent.push_front(key);
+            entry.recent = m_recent.begin();
+        }
+        else
+        {
+            m_size -= getEntrySize(key, entry);
+            m_recent.splice(m_recent.begin(), m_recent, entry.recent);
+        }
+
+        entry.response = response;
+        entry.freshUntil = now + timeToLive.value();
+        entry.staleUntil = entry.freshUntil + m_options.staleWhileRevalidate;
+        entry.isRevalidating = false;
+        entry.isPinned = (m_pinned.count(key) != 0);
+        m_size += getEntrySize(key, entry);
+        evict();
+        return true;
+    }
+
+    ResponseCache::Entry* ResponseCache::refresh(std::string const& key, Response const& notModified, TimePoint const now)
+    {
+        auto const iterator = m_entries.find(key);
+        if (iterator == m_entries.end())
+        {
+            return nullptr;
+        }
+
+        auto& entry = iterator->second;
+        entry.isRevalidating = false;
+
+        // Cached responses are shared with the sessions sending them, so they are never modified
+        auto updated = std::make_shared<Response>(*entry.response);
+        for (auto const field : { Http::field::cache_control, Http::field::etag, Http::field::expires, Http::field::last_modified, Http::field::date })
+        {
+            if (auto const value = notModified.find(field); value != notModified.end())
+            {
+                updated->set(field, value->value());
+            }
+        }
+
+        auto const timeToLive = getTimeToLive(*updated);
+        if (!timeToLive.has_value())
+        {
+            erase(key);
+            return nullptr;
+        }
+
+        m_size -= getEntrySize(key, entry);
+        entry.response = std::move(updated);
+        entry.freshUntil = now + timeToLive.value();
+        entry.staleUntil = entry.freshUntil + m_options.staleWhileRevalidate;
+        m_size += getEntrySize(key, entry);
+        return &entry;
+    }
+
+    void ResponseCache::erase(std::string const& key)
+    {
+        auto const iterator = m_entries.find(key);
+        if (iterator == m_entries.end())
+        {
+            return;
+        }
+
+        m_size -= getEntrySize(key, iterator->second);
+        m_recent.erase(iterator->second.recent);
+        m_entries.erase(iterator);
+    }
+
+    void ResponseCache::pin(std::string const& target)
+    {
+        m_pinned.insert(target);
+        if (auto const iterator = m_entries.find(target); iterator != m_entries.end())
+        {
+            iterator->second.isPinned = true;
+        }
+    }
+
+    std::vector<std::string> ResponseCache::getPinnedToRefresh(TimePoint const now, Duration const ahead) const
+    {
+        auto targets = std::vector<std::string>{};
+        for (auto const& target : m_pinned)
+        {
+            auto const iterator = m_entries.find(target);
+            if ((iterator == m_entries.end()) || (!iterator->second.isRevalidating && ((iterator->second.freshUntil - ahead) <= now)))
+            {
+                targets.push_back(target);
+            }
+        }
+        return targets;
+    }
+
+    std::vector<std::pair<std::string, std::string>> ResponseCache::getValidators(Entry const& entry)
+    {
+        auto validators = std::vector<std::pair<std::string, std::string>>{};
+        auto const& response = *entry.response;
+        if (auto const etag = response.find(Http::field::etag); etag != response.end())
+        {
+            validators.emplace_back("If-None-Match", std::string{ etag->value() });
+        }
+        if (auto const lastModified = response.find(Http::field::last_modified); lastModified != response.end())
+        {
+            validators.emplace_back("If-Modified-Since", std::string{ lastModified->value() });
+        }
+        return validators;
+    }
+
+    std::optional<ResponseCache::Duration> ResponseCache::getTimeToLive(Response const& response) const
+    {
+        if (response.result() != Http::status::ok)
+        {
+            return std::nullopt;
+        }
+
+        auto const cacheControl = parseCacheControl(response[Http::field::cache_control]);
+        // A session of a single player
+        if (cacheControl.noStore || cacheControl.isPrivate || (response.find(Http::field::set_cookie) != response.end()))
+        {
+            return std::nullopt;
+        }
+        if (cacheControl.noCache)
+        {
+            // Stored, but revalidated every time
+            return Duration::zero();
+        }
+        if (cacheControl.maxAge.has_value())
+        {
+            return cacheControl.maxAge.value();
+        }
+        return m_options.defaultTimeToLive;
+    }
+
+    std::size_t ResponseCache::getEntrySize(std::string const& key, Entry const& entry) noexcept
+    {
+        // Approximately, the fields are not counted
+        return key.size() + entry.response->body().size();
+    }
+
+    void ResponseCache::evict()
+    {
+        auto candidate = m_recent.end();
+        while ((m_size > m_options.maxSize) && (candidate != m_recent.begin()))
+        {
+            --candidate;
+            auto const iterator = m_entries.find(*candidate);
+            if (iterator->second.isPinned)
+            {
+                continue;
+            }
+
+            m_size -= getEntrySize(iterator->first, iterator->second);
+            m_entries.erase(iterator);
+            candidate = m_recent.erase(candidate);
+        }
+    }
+}
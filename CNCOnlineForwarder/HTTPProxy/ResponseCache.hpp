@@ -0,0 +1,111 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Utility/HTTPClient.hpp>
+
+namespace CNCOnlineForwarder::HTTPProxy
+{
+    // Responses of the upstream server by request target, with their freshness.
+    // Responses with a Vary are stored by target and the values of the request fields it names.
+    // Freshness follows the Cache-Control of the upstream server (max-age, no-cache, no-store, private),
+    // or defaultTimeToLive if it has none. Responses setting cookies are never stored. After they become stale, responses can still be served
+    // for staleWhileRevalidate while they are revalidated with their ETag or Last-Modified.
+    // Least recently used responses are evicted when the cache is larger than maxSize.
+    // Not thread safe.
+    class ResponseCache
+    {
+    public:
+        using Response = Utility::HTTPClient::Response;
+        using ResponsePointer = Utility::HTTPClient::ResponsePointer;
+        using TimePoint = std::chrono::steady_clock::time_point;
+        using Duration = std::chrono::steady_clock::duration;
+        using Fields = std::vector<std::pair<std::string, std::string>>;
+
+        struct Options
+        {
+            Duration defaultTimeToLive = std::chrono::minutes{ 1 };
+            Duration staleWhileRevalidate = std::chrono::hours{ 1 };
+            std::size_t maxSize = 64 * 1024 * 1024;
+        };
+
+        enum class Freshness
+        {
+            missing,
+            fresh,
+            // Can be served while it is revalidated
+            stale,
+            // Must be revalidated before being served
+            expired,
+        };
+
+        struct Entry
+        {
+            ResponsePointer response;
+            TimePoint freshUntil{};
+            TimePoint staleUntil{};
+            bool isRevalidating = false;
+            // Prefetched, and kept fresh even if nobody asks for it
+            bool isPinned = false;
+            std::list<std::string>::iterator recent;
+        };
+
+        struct Lookup
+        {
+            Entry* entry = nullptr;
+            Freshness freshness = Freshness::missing;
+        };
+
+    private:
+        Options m_options;
+        // By key, see getKey
+        std::unordered_map<std::string, Entry> m_entries;
+        // Lowercase names of the fields in the Vary of the last response, for the targets having one
+        std::unordered_map<std::string, std::vector<std::string>> m_varies;
+        std::set<std::string> m_pinned;
+        // Most recently used first
+        std::list<std::string> m_recent;
+        std::size_t m_size;
+
+    public:
+        explicit ResponseCache(Options const& options);
+
+        // Requests with credentials are answered for a single player, and must not use the cache
+        static bool isCacheable(Fields const& requestFields);
+
+        // The target, followed by the request fields named by the Vary of its responses.
+        // The key of a request without these fields is the target itself.
+        std::string getKey(std::string const& target, Fields const& requestFields) const;
+
+        // Marks the entry as used
+        Lookup find(std::string const& key, TimePoint const now);
+
+        // Returns: false if the response cannot be stored, like errors, responses with no-store or Set-Cookie
+        bool store(std::string const& target, Fields const& requestFields, ResponsePointer const& response, TimePoint const now);
+
+        // Applies a 304 Not Modified answered to a revalidation.
+        // Returns: the refreshed entry, or null if it was evicted in the meantime.
+        Entry* refresh(std::string const& key, Response const& notModified, TimePoint const now);
+
+        void erase(std::string const& key);
+
+        // Pinned targets are fetched without request fields, and never evicted
+        void pin(std::string const& target);
+
+        // Returns: the pinned targets which are missing, or not fresh anymore within `ahead`
+        std::vector<std::string> getPinnedToRefresh(TimePoint const now, Duration const ahead) const;
+
+        // Fields of a conditional GET revalidating the entry, empty if it has no validator
+        static std::vector<std::pair<std::string, std::string>> getValidators(Entry const& entry);
+
+        std::size_t getSize() const noexcept { return m_size; }
+
+        std::size_t getCount() const noexcept { return m_entries.size(); }
+
+    private:
+        // Returns: the time to live given by the Cache-Control of the response, if it can be stored
+        std::optional<Duration> getTimeToLive(Response const& response) const;
+
+        static std::size_t getEntrySize(std::string const& key, Entry const& entry) noexcept;
+
+        void evict();
+    };
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <precompiled.hpp>
+#include <Diagnostics/EventLoopMonitor.hpp>
 
 namespace CNCOnlineForwarder
 {
@@ -31,7 +32,30 @@ namespace CNCOnlineForwarder
         { 
             try
             {
-                return m_context.run();
+                using Clock = Diagnostics::EventLoopMonitor::Clock;
+                constexpr auto samplePeriod = std::chrono::seconds{ 1 };
+                auto worker = Diagnostics::EventLoopMonitor::WorkerScope{};
+                auto executed = std::size_t{ 0 };
+                auto nextSample = Clock::now() + samplePeriod;
+                while (!m_context.stopped())
+                {
+                    // Every ready handler is timed, whether it's instrumented or not
+                    auto ran = worker.measureBusy([this] { return m_context.poll_one(); });
+                    if (ran == 0)
+                    {
+                        // Idle: the wait can't be told apart from the handler which ends it,
+                        // so only instrumented handlers (HandlerScope) count as busy here
+                        ran = m_context.run_one_until(nextSample);
+                    }
+                    executed += ran;
+
+                    if (auto const now = Clock::now(); now >= nextSample)
+                    {
+                        worker.sample();
+                        nextSample = now + samplePeriod;
+                    }
+                }
+                return executed;
             }
             catch (...)
             {
@@ -39,6 +63,17 @@ namespace CNCOnlineForwarder
                 throw;
             }
         }
+
+        // Executes the ready handlers on the calling thread, without waiting.
+        // Used by the simulation, which drives the context from its own event loop.
+        auto poll()
+        {
+            if (m_context.stopped())
+            {
+                m_context.restart();
+            }
+            return m_context.poll();
+        }
     };
 
     class IOManager::ObjectMaker
@@ -4,6 +4,11 @@
 
 namespace CNCOnlineForwarder::Logging
 {
+    namespace
+    {
+        // Might be changed before the first log, which sets up the sinks
+        auto filterLevel = std::atomic<Level>{ Level::info };
+    }
 
     Logging::Logging()
     {
@@ -19,13 +24,14 @@ namespace CNCOnlineForwarder::Logging
             keywords::format = "[%TimeStamp%]: %Message%"
         );
 
-        setFilterLevel(Level::info);
+        setFilterLevel(filterLevel);
 
         logging::add_common_attributes();
     }
 
 
     Logging::LogProxy::LogProxy(Logging::SeverityLogger& logger, Level level) :
+        m_allocationScope{ Diagnostics::AllocationTag::logging },
         m_logger{ logger },
         m_record{ logger.open_record(boost::log::keywords::severity = level) }
     {
@@ -66,12 +72,7 @@ namespace CNCOnlineForwarder::Logging
 
     void setFilterLevel(Level level)
     {
-        static auto firstTime = true;
-        if (!firstTime)
-        {
-            throw std::runtime_error{ "Not implemented yet" };
-        }
-        firstTime = false;
+        filterLevel = level;
         boost::log::core::get()->set_filter(boost::log::trivial::severity >= level);
     }
 
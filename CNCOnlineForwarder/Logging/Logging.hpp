@@ -1,5 +1,6 @@
 #pragma once
 #include <precompiled.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
 
 namespace CNCOnlineForwarder::Logging
 {
@@ -19,6 +20,8 @@ namespace CNCOnlineForwarder::Logging
     class Logging::LogProxy
     {
     private:
+        // Everything allocated while formatting and writing the record
+        Diagnostics::AllocationScope m_allocationScope;
         SeverityLogger& m_logger;
         LogRecord m_record;
         LogStream m_stream;
@@ -2,6 +2,7 @@
 #include <precompiled.hpp>
 #include <NatNeg/NatNegProxy.hpp>
 #include <Logging/Logging.hpp>
+#include <Utility/Defer.hpp>
 #include <Utility/WeakRefHandler.hpp>
 
 
@@ -26,14 +27,24 @@ namespace CNCOnlineForwarder::NatNeg
         std::size_t m_size;
         GameConnection::Buffer m_buffer;
         std::unique_ptr<GameConnection::EndPoint> m_from;
+        std::unique_ptr<Utility::DatagramMetadata> m_metadata;
+        // Owned by GameConnection, which is alive when this handler is invoked
+        Diagnostics::SocketStatistics* m_statistics;
         NextAction m_nextAction;
         Handler m_handler;
     public:
         template<typename InputNextAction, typename InputNextHandler>
-        ReceiveHandler(InputNextAction&& nextAction, InputNextHandler&& handler) :
+        ReceiveHandler
+        (
+            Diagnostics::SocketStatistics& statistics,
+            InputNextAction&& nextAction, 
+            InputNextHandler&& handler
+        ) :
             m_size{ 512 },
             m_buffer{ std::make_unique<char[]>(m_size) },
             m_from{ std::make_unique<GameConnection::EndPoint>() },
+            m_metadata{ std::make_unique<Utility::DatagramMetadata>() },
+            m_statistics{ &statistics },
             m_nextAction{ std::forward<InputNextAction>(nextAction) },
             m_handler{ std::forward<InputNextHandler>(handler) }
         {}
@@ -48,6 +59,11 @@ namespace CNCOnlineForwarder::NatNeg
             return *m_from;
         }
 
+        Utility::DatagramMetadata& getMetadata() const noexcept
+        {
+            return *m_metadata;
+        }
+
         void operator()
         (
             GameConnection& self, 
@@ -68,13 +84,16 @@ namespace CNCOnlineForwarder::NatNeg
                 logLine(LogLevel::warning, "Received data may be truncated: ", bytesReceived, "/",  m_size);
             }
 
-            return m_handler
+            m_statistics->recordReceived(*m_metadata, bytesReceived);
+            m_handler
             (
                 self, 
                 std::move(m_buffer), 
                 bytesReceived, 
-                getFrom()
+                getFrom(),
+                getMetadata()
             );
+            m_statistics->recordProcessed(*m_metadata);
         }
     };
 
@@ -82,6 +101,7 @@ namespace CNCOnlineForwarder::NatNeg
     auto makeReceiveHandler
     (
         GameConnection* pointer, 
+        Diagnostics::SocketStatistics& statistics,
         NextAction&& nextAction, 
         Handler&& hanlder
     )
@@ -94,6 +114,7 @@ namespace CNCOnlineForwarder::NatNeg
             pointer, 
             ReceiveHandler<NextActionValue, HandlerValue>
             {
+                statistics,
                 std::forward<NextAction>(nextAction),
                 std::forward<Handler>(hanlder)
             }
@@ -105,6 +126,7 @@ namespace CNCOnlineForwarder::NatNeg
     private:
         GameConnection::Buffer m_buffer;
         std::size_t m_bytes;
+        Diagnostics::PendingSpan m_span;
     public:
         SendHandler
         (
@@ -112,7 +134,8 @@ namespace CNCOnlineForwarder::NatNeg
             std::size_t const bytes
         ) :
             m_buffer{ std::move(buffer) },
-            m_bytes{ bytes }
+            m_bytes{ bytes },
+            m_span{}
         {}
 
         boost::asio::const_buffer getBuffer() const noexcept
@@ -122,6 +145,7 @@ namespace CNCOnlineForwarder::NatNeg
 
         void operator()(ErrorCode const& code, std::size_t const bytesSent) const
         {
+            m_span.finish("send", GameConnection::description);
             if (code.failed())
             {
                 logLine(LogLevel::error, "Async write failed: ", code);
@@ -141,6 +165,7 @@ namespace CNCOnlineForwarder::NatNeg
         IOManager::ObjectMaker const& objectMaker,
         std::weak_ptr<NatNegProxy> const& proxy,
         std::weak_ptr<ProxyAddressTranslator> const& addressTranslator,
+        PlayerID const id,
         EndPoint const& server,
         EndPoint const& client
     )
@@ -151,6 +176,7 @@ namespace CNCOnlineForwarder::NatNeg
             objectMaker, 
             proxy, 
             addressTranslator,
+            id,
             server, 
             client
         );
@@ -161,7 +187,7 @@ namespace CNCOnlineForwarder::NatNeg
             self->extendLife();
             self->prepareForNextPacketToClient();
         };
-        boost::asio::defer(self->m_strand, action);
+        Utility::defer<GameConnection>(self->m_strand, action);
 
         return self;
     }
@@ -172,26 +198,67 @@ namespace CNCOnlineForwarder::NatNeg
         IOManager::ObjectMaker const& objectMaker,
         std::weak_ptr<NatNegProxy> const& proxy,
         std::weak_ptr<ProxyAddressTranslator> const& addressTranslator,
+        PlayerID const id,
         EndPoint const& server,
         EndPoint const& clientPublicAddress
     ) :
         m_strand{ objectMaker.makeStrand() },
         m_proxy{ proxy },
         m_addressTranslator{ addressTranslator },
+        m_id{ id },
         m_server{ server },
         m_clientPublicAddress{ clientPublicAddress },
         m_clientRealAddress{ clientPublicAddress },
         m_remotePlayer{},
         m_publicSocketForClient{ m_strand, EndPoint{ UDP::v4(), 0 } },
         m_fakeRemotePlayerSocket{ m_strand, EndPoint{ UDP::v4(), 0 } },
-        m_timeout{ m_strand }
-    {}
+        m_publicSocketForClientStatistics{ "GameConnection.publicForClient" },
+        m_fakeRemotePlayerSocketStatistics{ "GameConnection.fakeRemotePlayer" },
+        m_publicSocketForClientCapture{ Diagnostics::CaptureInterface::publicSocketForClient, 0 },
+        m_fakeRemotePlayerSocketCapture{ Diagnostics::CaptureInterface::fakeRemotePlayerSocket, 0 },
+        m_clientPathQuality{ "client" },
+        m_remotePathQuality{ "remote" },
+        m_pathQualityPublishedAt{},
+        m_timeout{ m_strand },
+        m_sessionRecord
+        { 
+            Diagnostics::SessionRegistry::get().add
+            (
+                Diagnostics::SessionRecord::Kind::gameConnection, 
+                id.natNegID, 
+                id.playerID
+            ) 
+        },
+        m_traceTarget{ Diagnostics::Tracer::get().getTarget(id.natNegID, id.playerID) }
+    {
+        m_publicSocketForClient.enableDatagramMetadata();
+        m_fakeRemotePlayerSocket.enableDatagramMetadata();
+        m_sessionRecord->setEndPoint("server", m_server);
+        m_sessionRecord->setEndPoint("clientPublicAddress", m_clientPublicAddress);
+        m_sessionRecord->setEndPoint("clientRealAddress", m_clientRealAddress);
+        auto const publicSocketForClientAddress = m_publicSocketForClient->local_endpoint();
+        auto const fakeRemotePlayerSocketAddress = m_fakeRemotePlayerSocket->local_endpoint();
+        m_sessionRecord->setEndPoint("publicSocketForClient", publicSocketForClientAddress);
+        m_sessionRecord->setEndPoint("fakeRemotePlayerSocket", fakeRemotePlayerSocketAddress);
+        m_publicSocketForClientCapture.localPort = publicSocketForClientAddress.port();
+        m_fakeRemotePlayerSocketCapture.localPort = fakeRemotePlayerSocketAddress.port();
+    }
 
     GameConnection::EndPoint const& GameConnection::getClientPublicAddress() const noexcept
     {
         return m_clientPublicAddress;
     }
 
+    void GameConnection::describeSession(std::ostream& out) const
+    {
+        out << "GameConnection of client " << m_clientPublicAddress << ", remote player " << m_remotePlayer;
+    }
+
+    Diagnostics::TraceTarget const& GameConnection::getTraceTarget() const noexcept
+    {
+        return m_traceTarget;
+    }
+
     void GameConnection::handlePacketToServer(PacketView const packet)
     {
         auto action = [data = packet.copyBuffer()](GameConnection& self)
@@ -205,8 +272,12 @@ namespace CNCOnlineForwarder::NatNeg
 
             logLine(LogLevel::info, "Packet to server handler: NatNeg step ", packet.getStep());
             logLine(LogLevel::info, "Sending data to server through client public socket...");
+            self.m_sessionRecord->recordReceived(packet.getView().size());
+            self.m_sessionRecord->recordStep(static_cast<int>(packet.getStep()));
+            self.m_sessionRecord->recordSent(packet.getView().size());
 
             auto const& packetContent = packet.getView();
+            self.capture(self.m_publicSocketForClientCapture, Diagnostics::CaptureDirection::outbound, self.m_server, packetContent);
             auto copy = std::make_unique<char[]>(packetContent.size());
             std::copy_n(packetContent.begin(), packetContent.size(), copy.get());
             auto handler = SendHandler{ std::move(copy), packetContent.size() };
@@ -220,7 +291,7 @@ namespace CNCOnlineForwarder::NatNeg
             self.extendLife();
         };
 
-        boost::asio::defer(m_strand, makeWeakHandler(this, std::move(action)));
+        Utility::defer(m_strand, makeWeakHandler(this, std::move(action)));
     }
 
     void GameConnection::handleCommunicationPacketFromServer
@@ -238,7 +309,7 @@ namespace CNCOnlineForwarder::NatNeg
             );
         };
 
-        boost::asio::defer(m_strand, makeWeakHandler(this, std::move(action)));
+        Utility::defer(m_strand, makeWeakHandler(this, std::move(action)));
     }
 
     void GameConnection::extendLife()
@@ -256,11 +327,51 @@ namespace CNCOnlineForwarder::NatNeg
             }
 
             logLine(LogLevel::error, "Timeout reached, closing self: ", self.get());
+            self->m_sessionRecord->publishEvent(Diagnostics::SessionEventType::timedOut);
         };
 
         m_timeout.asyncWait(std::chrono::minutes{ 1 }, std::move(waitHandler));
     }
 
+    void GameConnection::capture
+    (
+        Diagnostics::CapturePoint const& point,
+        Diagnostics::CaptureDirection const direction,
+        EndPoint const& remote,
+        std::string_view const data
+    ) const
+    {
+        Diagnostics::PacketCapture::record(point, direction, m_id.natNegID, remote, data);
+    }
+
+    void GameConnection::capture
+    (
+        Diagnostics::CapturePoint const& point,
+        Diagnostics::CaptureDirection const direction,
+        EndPoint const& remote,
+        std::string_view const data,
+        Utility::DatagramMetadata const& metadata
+    ) const
+    {
+        auto const receivedAt = metadata.kernelTimestamp.value_or(metadata.userspaceTimestamp);
+        Diagnostics::PacketCapture::record(point, direction, m_id.natNegID, remote, data, receivedAt);
+    }
+
+    void GameConnection::publishPathQuality()
+    {
+        auto const now = std::chrono::steady_clock::now();
+        if ((now - m_pathQualityPublishedAt) < std::chrono::seconds{ 1 })
+        {
+            return;
+        }
+        m_pathQualityPublishedAt = now;
+
+        m_clientPathQuality.publishJitter();
+        m_remotePathQuality.publishJitter();
+        m_sessionRecord->setPathQuality("client", m_clientPathQuality.getSummary());
+        m_sessionRecord->setPathQuality("remote", m_remotePathQuality.getSummary());
+    }
+
     void GameConnection::prepareForNextPacketFromClient()
     {
         auto const then = [](GameConnection& self)
@@ -273,17 +384,20 @@ namespace CNCOnlineForwarder::NatNeg
             GameConnection& self, 
             Buffer&& data, 
             std::size_t const size,
-            EndPoint const& from
+            EndPoint const& from,
+            Utility::DatagramMetadata const& metadata
         )
         {
-            return self.handlePacketToRemotePlayer(std::move(data), size, from);
+            self.capture(self.m_fakeRemotePlayerSocketCapture, Diagnostics::CaptureDirection::inbound, from, { data.get(), size }, metadata);
+            return self.handlePacketToRemotePlayer(std::move(data), size, from, metadata);
         };
 
-        auto handler = makeReceiveHandler(this, then, dispatcher);
+        auto handler = makeReceiveHandler(this, m_fakeRemotePlayerSocketStatistics, then, dispatcher);
         m_fakeRemotePlayerSocket.asyncReceiveFrom
         (
             handler->getBuffer(),
             handler->getFrom(),
+            handler->getMetadata(),
             std::move(handler)
         );
     }
@@ -300,21 +414,24 @@ namespace CNCOnlineForwarder::NatNeg
             GameConnection& self, 
             Buffer&& data,
             std::size_t const size,
-            EndPoint const& from
+            EndPoint const& from,
+            Utility::DatagramMetadata const& metadata
         )
         {
+            self.capture(self.m_publicSocketForClientCapture, Diagnostics::CaptureDirection::inbound, from, { data.get(), size }, metadata);
             if (from == self.m_server)
             {
                 return self.handlePacketFromServer(std::move(data), size);
             }
 
-            return self.handlePacketFromRemotePlayer(std::move(data), size, from);
+            return self.handlePacketFromRemotePlayer(std::move(data), size, from, metadata);
         };
-        auto handler = makeReceiveHandler(this, then, dispatcher);
+        auto handler = makeReceiveHandler(this, m_publicSocketForClientStatistics, then, dispatcher);
         m_publicSocketForClient.asyncReceiveFrom
         (
             handler->getBuffer(),
             handler->getFrom(),
+            handler->getMetadata(),
             std::move(handler)
         );
     }
@@ -338,6 +455,10 @@ namespace CNCOnlineForwarder::NatNeg
 
         logLine(LogLevel::info, "Packet from server handler: NatNeg step ", packet.getStep());
         logLine(LogLevel::info, "Packet from server will be send to client from proxy.");
+        m_sessionRecord->recordReceived(size);
+        m_sessionRecord->recordStep(static_cast<int>(packet.getStep()));
+        m_sessionRecord->recordSent(size);
+        proxy->getHandshakeFunnel().recordStepIfFollowed(m_id, packet.getStep());
         proxy->sendFromProxySocket(packet, m_clientPublicAddress);
 
         extendLife();
@@ -357,6 +478,8 @@ namespace CNCOnlineForwarder::NatNeg
         }
 
         logLine(LogLevel::info, "CommPacket handler: NatNeg step ", packet.getStep());
+        m_sessionRecord->recordReceived(packet.getView().size());
+        m_sessionRecord->recordStep(static_cast<int>(packet.getStep()));
 
         auto outputBuffer = std::string{ packet.getView() };
         auto const addressOffset = PacketView::getAddressOffset(packet.getStep());
@@ -369,6 +492,7 @@ namespace CNCOnlineForwarder::NatNeg
                 m_remotePlayer.address(boost::asio::ip::address_v4{ ip });
                 m_remotePlayer.port(boost::endian::big_to_native(port));
                 logLine(LogLevel::info, "CommPacket's address stored in m_remotePlayer: ", m_remotePlayer);
+                m_sessionRecord->setEndPoint("remotePlayer", m_remotePlayer);
             }
 
             auto const fakeRemotePlayerAddress = m_fakeRemotePlayerSocket->local_endpoint();
@@ -386,10 +510,12 @@ namespace CNCOnlineForwarder::NatNeg
             rewriteAddress(outputBuffer, addressOffset.value(), ip, port);
 
             logLine(LogLevel::info, "Address rewritten as ", publicRemoteFakeAddress);
+            m_sessionRecord->publishEvent(Diagnostics::SessionEventType::addressRewritten, m_remotePlayer, publicRemoteFakeAddress);
             logLine(LogLevel::info, "Preparing to receive packet from player to fakeRemote");
             prepareForNextPacketFromClient();
         }
         logLine(LogLevel::info, "CommPacket from server will be send to client from proxy.");
+        m_sessionRecord->recordSent(outputBuffer.size());
         proxy->sendFromProxySocket(PacketView{ outputBuffer }, communicationAddress);
 
         extendLife();
@@ -399,20 +525,31 @@ namespace CNCOnlineForwarder::NatNeg
     (
         Buffer buffer,
         std::size_t const size,
-        EndPoint const& from
+        EndPoint const& from,
+        Utility::DatagramMetadata const& metadata
     )
     {
         if (m_remotePlayer != from)
         {
             logLine(LogLevel::warning, "Updating remote player address from ", m_remotePlayer, " to ", from);
             m_remotePlayer = from;
+            m_sessionRecord->setEndPoint("remotePlayer", m_remotePlayer);
         }
+        m_sessionRecord->recordReceived(size);
 
-        if (PacketView{ { buffer.get(), size } }.isNatNeg())
+        auto const packet = PacketView{ { buffer.get(), size } };
+        auto const isNatNeg = packet.isNatNeg();
+        auto const isConnectPing = isNatNeg && (packet.getStep() == NatNegStep::connectPing);
+        if (isNatNeg)
         {
             logLine(LogLevel::info, "Forwarding NatNeg Packet from remote ", m_remotePlayer, " to ", m_clientRealAddress);
         }
+        m_remotePathQuality.recordReceived(metadata, packet.getView(), isNatNeg, isConnectPing);
+        m_clientPathQuality.recordSent(isConnectPing);
+        publishPathQuality();
 
+        m_sessionRecord->recordSent(size);
+        capture(m_fakeRemotePlayerSocketCapture, Diagnostics::CaptureDirection::outbound, m_clientRealAddress, packet.getView());
         auto handler = SendHandler{ std::move(buffer), size };
         m_fakeRemotePlayerSocket.asyncSendTo
         (
@@ -428,20 +565,32 @@ namespace CNCOnlineForwarder::NatNeg
     (
         Buffer buffer,
         std::size_t const size,
-        EndPoint const& from
+        EndPoint const& from,
+        Utility::DatagramMetadata const& metadata
     )
     {
         if (from != m_clientRealAddress)
         {
             logLine(LogLevel::warning, "Updating client address from ", m_clientRealAddress, " to ", from);
+            m_sessionRecord->publishEvent(Diagnostics::SessionEventType::clientAddressUpdated, m_clientRealAddress, from);
             m_clientRealAddress = from;
+            m_sessionRecord->setEndPoint("clientRealAddress", m_clientRealAddress);
         }
+        m_sessionRecord->recordReceived(size);
 
-        if (PacketView{ { buffer.get(), size } }.isNatNeg())
+        auto const packet = PacketView{ { buffer.get(), size } };
+        auto const isNatNeg = packet.isNatNeg();
+        auto const isConnectPing = isNatNeg && (packet.getStep() == NatNegStep::connectPing);
+        if (isNatNeg)
         {
             logLine(LogLevel::info, "Forwarding NatNeg Packet from client ", m_remotePlayer, " to ", m_clientRealAddress);
         }
+        m_clientPathQuality.recordReceived(metadata, packet.getView(), isNatNeg, isConnectPing);
+        m_remotePathQuality.recordSent(isConnectPing);
+        publishPathQuality();
 
+        m_sessionRecord->recordSent(size);
+        capture(m_publicSocketForClientCapture, Diagnostics::CaptureDirection::outbound, m_remotePlayer, packet.getView());
         auto handler = SendHandler{ std::move(buffer), size };
         m_publicSocketForClient.asyncSendTo
         (
@@ -1,6 +1,12 @@
 #pragma once
 #include <precompiled.hpp>
 #include <IOManager.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
+#include <Diagnostics/PacketCapture.hpp>
+#include <Diagnostics/PathQuality.hpp>
+#include <Diagnostics/SessionRegistry.hpp>
+#include <Diagnostics/SocketStatistics.hpp>
+#include <Diagnostics/Tracing.hpp>
 #include <NatNeg/NatNegPacket.hpp>
 #include <Utility/ProxyAddressTranslator.hpp>
 #include <Utility/WithStrand.hpp>
@@ -28,22 +34,36 @@ namespace CNCOnlineForwarder::NatNeg
         Strand m_strand;
         std::weak_ptr<NatNegProxy> m_proxy;
         std::weak_ptr<ProxyAddressTranslator> m_addressTranslator;
+        PlayerID m_id;
         EndPoint m_server;
         EndPoint m_clientPublicAddress;
         EndPoint m_clientRealAddress;
         EndPoint m_remotePlayer;
         Socket m_publicSocketForClient;
         Socket m_fakeRemotePlayerSocket;
+        Diagnostics::SocketStatistics m_publicSocketForClientStatistics;
+        Diagnostics::SocketStatistics m_fakeRemotePlayerSocketStatistics;
+        Diagnostics::CapturePoint m_publicSocketForClientCapture;
+        Diagnostics::CapturePoint m_fakeRemotePlayerSocketCapture;
+        // Client <-> proxy
+        Diagnostics::PathQuality m_clientPathQuality;
+        // Proxy <-> remote player
+        Diagnostics::PathQuality m_remotePathQuality;
+        std::chrono::steady_clock::time_point m_pathQualityPublishedAt;
         Timer m_timeout;
+        std::shared_ptr<Diagnostics::SessionRecord> m_sessionRecord;
+        Diagnostics::TraceTarget m_traceTarget;
 
     public:
         static constexpr auto description = "GameConnection";
+        static constexpr auto allocationTag = Diagnostics::AllocationTag::natNegSession;
 
         static std::shared_ptr<GameConnection> create
         (
             IOManager::ObjectMaker const& objectMaker,
             std::weak_ptr<NatNegProxy> const& proxy,
             std::weak_ptr<ProxyAddressTranslator> const& addressTranslator,
+            PlayerID const id,
             EndPoint const& server,
             EndPoint const& clientPublicAddress
         );
@@ -54,12 +74,17 @@ namespace CNCOnlineForwarder::NatNeg
             IOManager::ObjectMaker const& objectMaker,
             std::weak_ptr<NatNegProxy> const& proxy,
             std::weak_ptr<ProxyAddressTranslator> const& addressTranslator,
+            PlayerID const id,
             EndPoint const& server,
             EndPoint const& clientPublicAddress
         );
 
         EndPoint const& getClientPublicAddress() const noexcept;
 
+        void describeSession(std::ostream& out) const;
+
+        Diagnostics::TraceTarget const& getTraceTarget() const noexcept;
+
         void handlePacketToServer(PacketView const packet);
 
         void handleCommunicationPacketFromServer
@@ -72,6 +97,26 @@ namespace CNCOnlineForwarder::NatNeg
 
         void extendLife();
 
+        void publishPathQuality();
+
+        void capture
+        (
+            Diagnostics::CapturePoint const& point,
+            Diagnostics::CaptureDirection const direction,
+            EndPoint const& remote,
+            std::string_view const data
+        ) const;
+
+        // Timestamped when the datagram was received
+        void capture
+        (
+            Diagnostics::CapturePoint const& point,
+            Diagnostics::CaptureDirection const direction,
+            EndPoint const& remote,
+            std::string_view const data,
+            Utility::DatagramMetadata const& metadata
+        ) const;
+
         void prepareForNextPacketFromClient();
 
         void prepareForNextPacketToClient();
@@ -88,14 +133,16 @@ namespace CNCOnlineForwarder::NatNeg
         (
             Buffer buffer, 
             std::size_t const size, 
-            EndPoint const& from
+            EndPoint const& from,
+            Utility::DatagramMetadata const& metadata
         );
 
         void handlePacketToRemotePlayer
         (
             Buffer buffer, 
             std::size_t const size, 
-            EndPoint const& from
+            EndPoint const& from,
+            Utility::DatagramMetadata const& metadata
         );
     };
 }
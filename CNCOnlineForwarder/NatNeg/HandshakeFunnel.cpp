@@ -0,0 +1,174 @@
+#include "HandshakeFunnel.hpp"
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::NatNeg
+{
+    namespace
+    {
+        std::string makeName(std::string_view const group, std::string_view const name, std::string_view const metric)
+        {
+            auto result = std::string{ "natneg.funnel." };
+            result.append(group).append(".").append(name);
+            if (!metric.empty())
+            {
+                result.append(".").append(metric);
+            }
+            return result;
+        }
+    }
+
+    HandshakeFunnel::HandshakeFunnel() :
+        m_stages{},
+        m_outcomes{},
+        m_handshakeTime{ Diagnostics::MetricsRegistry::get().histogram("natneg.funnel.handshakeMicroseconds") },
+        m_inProgress{ Diagnostics::MetricsRegistry::get().gauge("natneg.funnel.inProgress") },
+        m_mutex{},
+        m_progress{}
+    {
+        auto& registry = Diagnostics::MetricsRegistry::get();
+        m_stages.reserve(stageCount);
+        for (auto i = std::size_t{ 0 }; i < stageCount; ++i)
+        {
+            auto const name = getStageName(static_cast<Stage>(i));
+            m_stages.push_back
+            ({
+                registry.counter(makeName("stage", name, "reached")),
+                registry.histogram(makeName("stage", name, "latencyMicroseconds"))
+            });
+        }
+
+        for (auto const outcome : { HandshakeOutcome::completed, HandshakeOutcome::timedOut, HandshakeOutcome::expiredPending })
+        {
+            m_outcomes.push_back(&registry.counter(makeName("outcome", getOutcomeName(outcome), {})));
+        }
+    }
+
+    std::optional<HandshakeFunnel::Stage> HandshakeFunnel::getStage(NatNegStep const step) noexcept
+    {
+        switch (step)
+        {
+        case NatNegStep::preInit:
+            return Stage::preInit;
+        case NatNegStep::init:
+            return Stage::init;
+        case NatNegStep::connect:
+            return Stage::connect;
+        case NatNegStep::connectAck:
+            return Stage::connectAck;
+        case NatNegStep::report:
+            return Stage::report;
+        default:
+            return std::nullopt;
+        }
+    }
+
+    std::string_view HandshakeFunnel::getStageName(Stage const stage) noexcept
+    {
+        switch (stage)
+        {
+        case Stage::preInit:
+            return "preInit";
+        case Stage::init:
+            return "init";
+        case Stage::connect:
+            return "connect";
+        case Stage::connectAck:
+            return "connectAck";
+        case Stage::report:
+            return "report";
+        }
+        return "unknown";
+    }
+
+    std::string_view HandshakeFunnel::getOutcomeName(HandshakeOutcome const outcome) noexcept
+    {
+        switch (outcome)
+        {
+        case HandshakeOutcome::completed:
+            return "completed";
+        case HandshakeOutcome::timedOut:
+            return "timedOut";
+        case HandshakeOutcome::expiredPending:
+            return "expiredPending";
+        }
+        return "unknown";
+    }
+
+    void HandshakeFunnel::recordStep(NatNegPlayerID const id, NatNegStep const step)
+    {
+        record(id, step, true);
+    }
+
+    void HandshakeFunnel::recordStepIfFollowed(NatNegPlayerID const id, NatNegStep const step)
+    {
+        record(id, step, false);
+    }
+
+    void HandshakeFunnel::record(NatNegPlayerID const id, NatNegStep const step, bool const canStart)
+    {
+        auto const stage = getStage(step);
+        if (!stage.has_value())
+        {
+            return;
+        }
+
+        auto const now = Clock::now();
+        auto const stageIndex = static_cast<std::size_t>(stage.value());
+        auto const stageBit = std::uint32_t{ 1 } << stageIndex;
+
+        auto const lock = std::scoped_lock{ m_mutex };
+        auto iterator = m_progress.find(id);
+        if (iterator == m_progress.end())
+        {
+            // Otherwise, it would never be finished
+            if (!canStart)
+            {
+                return;
+            }
+            iterator = m_progress.emplace(id, Progress{ now, now, 0, false }).first;
+            m_inProgress.add(1);
+        }
+        auto& progress = iterator->second;
+
+        // Retransmissions, and packets exchanged after the handshake, are not interesting
+        if (progress.completed || ((progress.reached & stageBit) != 0))
+        {
+            return;
+        }
+
+        auto& statistics = m_stages[stageIndex];
+        statistics.reached.add();
+        if (progress.reached != 0)
+        {
+            statistics.latency.recordDuration(now - progress.lastStageAt);
+        }
+        progress.reached |= stageBit;
+        progress.lastStageAt = now;
+
+        // Once the client acknowledges the connect (or reports the result), the proxy's job is done
+        if ((stage == Stage::connectAck) || (stage == Stage::report))
+        {
+            progress.completed = true;
+            m_handshakeTime.recordDuration(now - progress.startedAt);
+            m_outcomes[static_cast<std::size_t>(HandshakeOutcome::completed)]->add();
+            m_inProgress.add(-1);
+        }
+    }
+
+    void HandshakeFunnel::finish(NatNegPlayerID const id, HandshakeOutcome const unfinishedOutcome)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        auto const iterator = m_progress.find(id);
+        if (iterator == m_progress.end())
+        {
+            return;
+        }
+
+        if (!iterator->second.completed)
+        {
+            m_outcomes[static_cast<std::size_t>(unfinishedOutcome)]->add();
+            m_inProgress.add(-1);
+        }
+        m_progress.erase(iterator);
+    }
+}
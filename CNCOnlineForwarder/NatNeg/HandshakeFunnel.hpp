@@ -0,0 +1,88 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <NatNeg/NatNegPacket.hpp>
+
+namespace CNCOnlineForwarder::NatNeg
+{
+    enum class HandshakeOutcome
+    {
+        completed,
+        timedOut,
+        // Gave up while actions were still waiting in PendingActions
+        // (for example, the server hostname was never resolved)
+        expiredPending,
+    };
+
+    // Follows every NatNegPlayerID through the stages of a NatNeg handshake:
+    // preInit -> init -> connect -> connectAck / report.
+    // Records how many players reach each stage, the latency between stages,
+    // the total handshake time and the outcome. Thread safe.
+    class HandshakeFunnel
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        enum class Stage
+        {
+            preInit,
+            init,
+            connect,
+            connectAck,
+            report,
+        };
+        static constexpr auto stageCount = std::size_t{ 5 };
+
+    private:
+        struct Progress
+        {
+            Clock::time_point startedAt;
+            Clock::time_point lastStageAt;
+            // Bit n is set if Stage n has been reached
+            std::uint32_t reached;
+            bool completed;
+        };
+
+        struct StageStatistics
+        {
+            Diagnostics::Counter& reached;
+            // Time since the previous stage reached by the same player
+            Diagnostics::Histogram& latency;
+        };
+
+        std::vector<StageStatistics> m_stages;
+        std::vector<Diagnostics::Counter*> m_outcomes;
+        Diagnostics::Histogram& m_handshakeTime;
+        Diagnostics::Gauge& m_inProgress;
+        std::mutex m_mutex;
+        std::unordered_map<NatNegPlayerID, Progress, NatNegPlayerID::Hash> m_progress;
+
+    public:
+        static constexpr auto description = "HandshakeFunnel";
+
+        HandshakeFunnel();
+        HandshakeFunnel(HandshakeFunnel const&) = delete;
+        HandshakeFunnel& operator=(HandshakeFunnel const&) = delete;
+
+        static std::optional<Stage> getStage(NatNegStep const step) noexcept;
+
+        static std::string_view getStageName(Stage const stage) noexcept;
+
+        static std::string_view getOutcomeName(HandshakeOutcome const outcome) noexcept;
+
+        // Can be called for packets in both directions, steps which are not part of the funnel are ignored.
+        // Starts following the player if needed, so must only be called while its session is open.
+        void recordStep(NatNegPlayerID const id, NatNegStep const step);
+
+        // Like recordStep, but ignored if the player is not followed (anymore):
+        // for components which can outlive the session, like GameConnection.
+        void recordStepIfFollowed(NatNegPlayerID const id, NatNegStep const step);
+
+        // Called when the player's session is closed.
+        // `unfinishedOutcome` is only recorded if the handshake did not complete.
+        void finish(NatNegPlayerID const id, HandshakeOutcome const unfinishedOutcome);
+
+    private:
+        void record(NatNegPlayerID const id, NatNegStep const step, bool const canStart);
+    };
+}
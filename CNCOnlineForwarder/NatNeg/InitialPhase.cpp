@@ -4,11 +4,12 @@
 #include <NatNeg/NatNegProxy.hpp>
 #include <Logging/Logging.hpp>
 #include <Utility/SimpleWriteHandler.hpp>
+#include <Utility/Defer.hpp>
 #include <Utility/WeakRefHandler.hpp>
 
 using AddressV4 = boost::asio::ip::address_v4;
 using UDP = boost::asio::ip::udp;
-using Resolved = boost::asio::ip::udp::resolver::results_type;
+using Addresses = CNCOnlineForwarder::Utility::ResolverCache::Addresses;
 using ErrorCode = boost::system::error_code;
 using LogLevel = CNCOnlineForwarder::Logging::Level;
 
@@ -28,6 +29,7 @@ namespace CNCOnlineForwarder::NatNeg
     private:
         std::unique_ptr<std::array<char, 1024>> m_buffer;
         std::unique_ptr<EndPoint> m_from;
+        std::unique_ptr<Utility::DatagramMetadata> m_metadata;
 
     public:
         static auto create(InitialPhase* pointer)
@@ -45,6 +47,11 @@ namespace CNCOnlineForwarder::NatNeg
             return *m_from; 
         }
 
+        Utility::DatagramMetadata& getMetadata()
+        {
+            return *m_metadata;
+        }
+
         void operator()(InitialPhase& self, ErrorCode const& code, std::size_t const bytesReceived) const
         {
             self.prepareForNextPacketToCommunicationAddress();
@@ -55,6 +62,8 @@ namespace CNCOnlineForwarder::NatNeg
                 return;
             }
 
+            self.m_communicationSocketStatistics.recordReceived(*m_metadata, bytesReceived);
+
             // When receiving, server is already resolved
             if (*m_from != self.m_server->getEndPoint())
             {
@@ -63,13 +72,16 @@ namespace CNCOnlineForwarder::NatNeg
             }
 
             auto const packet = PacketView{ {m_buffer->data(), bytesReceived} };
-            return self.handlePacketFromServer(packet);
+            self.m_sessionRecord->recordReceived(bytesReceived);
+            self.handlePacketFromServer(packet);
+            self.m_communicationSocketStatistics.recordProcessed(*m_metadata);
         }
 
     private:
         ReceiveHandler() :
             m_buffer{ std::make_unique<std::array<char, 1024>>() },
-            m_from{ std::make_unique<EndPoint>() }
+            m_from{ std::make_unique<EndPoint>() },
+            m_metadata{ std::make_unique<Utility::DatagramMetadata>() }
         {}
     };
 
@@ -90,35 +102,47 @@ namespace CNCOnlineForwarder::NatNeg
             id
         );
 
-        auto const action = [self, natNegServer, natNegPort]
+        auto const action = [self, objectMaker, natNegServer, natNegPort]
         {
             logLine(LogLevel::info, "InitialPhase creating, id = ", self->m_id);
             self->extendLife();
 
-            auto const onResolved = []
-            (
-                InitialPhase& self,
-                ErrorCode const& code,
-                Resolved const resolved
-            )
+            // Usually kept resolved by NatNegProxy, otherwise share the resolution in progress
+            auto& resolverCache = Utility::ResolverCache::get();
+            if (auto const addresses = resolverCache.tryGet(natNegServer); addresses.has_value())
             {
-                if (code.failed())
+                self->handleServerResolved({}, addresses.value(), natNegPort);
+            }
+            else
+            {
+                auto const onResolved = [natNegPort, resolving = Diagnostics::PendingSpan{}]
+                (
+                    InitialPhase& self,
+                    ErrorCode const& code,
+                    Addresses const& addresses
+                )
                 {
-                    logLine(LogLevel::error, "Failed to resolve server hostname: ", code);
-                    return;
-                }
-
-                self.m_server->setEndPoint(*resolved);
-                logLine(LogLevel::info, "server hostname resolved: ", self.m_server->getEndPoint());
-                self.m_server.trySetReady();
-            };
-            logLine(LogLevel::info, "Resolving server hostname: ", natNegServer);
-            self->m_resolver.asyncResolve
-            (
-                natNegServer,
-                std::to_string(natNegPort),
-                makeWeakHandler(self, onResolved)
-            );
+                    resolving.finish("resolve", InitialPhase::description);
+                    self.handleServerResolved(code, addresses, natNegPort);
+                };
+                logLine(LogLevel::info, "Resolving server hostname: ", natNegServer);
+                resolverCache.asyncResolve
+                (
+                    objectMaker,
+                    natNegServer,
+                    [strand = self->m_strand, handler = makeWeakHandler(self, onResolved)]
+                    (
+                        ErrorCode const& code,
+                        Addresses const& addresses
+                    )
+                    {
+                        Utility::defer<InitialPhase>(strand, [handler, code, addresses]() mutable
+                        {
+                            handler(code, addresses);
+                        });
+                    }
+                );
+            }
 
             self->m_server.asyncDo
             (
@@ -129,7 +153,7 @@ namespace CNCOnlineForwarder::NatNeg
                 }
             );
         };
-        boost::asio::defer(self->m_strand, action);
+        Utility::defer<InitialPhase>(self->m_strand, action);
 
         return self;
     }
@@ -142,16 +166,29 @@ namespace CNCOnlineForwarder::NatNeg
         NatNegPlayerID const id
     ) :
         m_strand{ objectMaker.makeStrand() },
-        m_resolver{ m_strand },
         m_communicationSocket{ m_strand, EndPoint{ UDP::v4(), 0 } },
+        m_communicationSocketStatistics{ "InitialPhase.communication" },
         m_timeout{ m_strand },
         m_proxy{ proxy },
         m_connection{ {} },
         m_id{ id },
         m_server{ {} }, 
-        m_clientCommunication{}/*,
-        socketReadyToReceive{ {} }*/
-    {}
+        m_clientCommunication{},/*
+        socketReadyToReceive{ {} },*/
+        m_sessionRecord
+        { 
+            Diagnostics::SessionRegistry::get().add
+            (
+                Diagnostics::SessionRecord::Kind::initialPhase, 
+                id.natNegID, 
+                id.playerID
+            ) 
+        },
+        m_traceTarget{ Diagnostics::Tracer::get().getTarget(id.natNegID, id.playerID) }
+    {
+        m_communicationSocket.enableDatagramMetadata();
+        m_sessionRecord->setEndPoint("communicationSocket", m_communicationSocket->local_endpoint());
+    }
 
     void InitialPhase::prepareGameConnection
     (
@@ -172,6 +209,7 @@ namespace CNCOnlineForwarder::NatNeg
                     objectMaker,
                     m_proxy,
                     addressTranslator,
+                    m_id,
                     server,
                     client
                 );
@@ -182,7 +220,7 @@ namespace CNCOnlineForwarder::NatNeg
         {
             self.m_server.asyncDo(maker);
         };
-        boost::asio::defer(m_strand, makeWeakHandler(this, action));
+        Utility::defer(m_strand, makeWeakHandler(this, action));
     }
 
     void InitialPhase::handlePacketToServer
@@ -198,6 +236,7 @@ namespace CNCOnlineForwarder::NatNeg
                 logLine(LogLevel::warning, "Packet to server dispatcher: Not NatNeg, discarded.");
                 return;
             }
+            self.m_sessionRecord->recordStep(static_cast<int>(PacketView{ data }.getStep()));
 
             // Handle packet "locally" if it's from communication address,
             // otherwise, dispatch it to GameConnection
@@ -235,7 +274,17 @@ namespace CNCOnlineForwarder::NatNeg
             self.m_connection.asyncDo(std::move(dispatcher));
         };
 
-        boost::asio::defer(m_strand, makeWeakHandler(this, std::move(action)));
+        Utility::defer(m_strand, makeWeakHandler(this, std::move(action)));
+    }
+
+    void InitialPhase::describeSession(std::ostream& out) const
+    {
+        out << "InitialPhase " << m_id << ", client communication " << m_clientCommunication;
+    }
+
+    Diagnostics::TraceTarget const& InitialPhase::getTraceTarget() const noexcept
+    {
+        return m_traceTarget;
     }
 
     void InitialPhase::close()
@@ -246,7 +295,9 @@ namespace CNCOnlineForwarder::NatNeg
             logLine(LogLevel::warning, "Proxy already died when closing InitialPhase");
             return;
         }
-        proxy->removeConnection(m_id);
+
+        auto const stillPending = m_server.hasPendingActions() || m_connection.hasPendingActions();
+        proxy->removeConnection(m_id, stillPending ? HandshakeOutcome::expiredPending : HandshakeOutcome::timedOut);
     }
 
     void InitialPhase::extendLife()
@@ -264,11 +315,42 @@ namespace CNCOnlineForwarder::NatNeg
             }
 
             logLine(LogLevel::info, "Closing self (natNegId ", self->m_id, ")");
+            self->m_sessionRecord->publishEvent(Diagnostics::SessionEventType::timedOut);
             self->close();
         };
         m_timeout.asyncWait(std::chrono::minutes{ 1 }, std::move(waitHandler));
     }
 
+    void InitialPhase::handleServerResolved
+    (
+        ErrorCode const& code,
+        Addresses const& addresses,
+        std::uint16_t const natNegPort
+    )
+    {
+        if (code.failed())
+        {
+            logLine(LogLevel::error, "Failed to resolve server hostname: ", code);
+            return;
+        }
+
+        // The communication socket is IPv4
+        auto const address = std::find_if(addresses.begin(), addresses.end(), [](auto const& address)
+        {
+            return address.is_v4();
+        });
+        if (address == addresses.end())
+        {
+            logLine(LogLevel::error, "Server hostname has no IPv4 address");
+            return;
+        }
+
+        m_server->setEndPoint(EndPoint{ *address, natNegPort });
+        logLine(LogLevel::info, "server hostname resolved: ", m_server->getEndPoint());
+        m_sessionRecord->setEndPoint("server", m_server->getEndPoint());
+        m_server.trySetReady();
+    }
+
     void InitialPhase::prepareForNextPacketToCommunicationAddress()
     {
         /*const auto action = [this]
@@ -278,6 +360,7 @@ namespace CNCOnlineForwarder::NatNeg
         (
             handler->getBuffer(),
             handler->getFrom(),
+            handler->getMetadata(),
             std::move(handler)
         );
         /*};
@@ -300,6 +383,8 @@ namespace CNCOnlineForwarder::NatNeg
             return;
         }
 
+        m_sessionRecord->recordStep(static_cast<int>(packet.getStep()));
+        proxy->getHandshakeFunnel().recordStep(m_id, packet.getStep());
         logLine(LogLevel::info, "Packet from server will be processed by GameConnection.");
         // When handlePacketFromServer is called, connection should already be ready.
         auto const connection = m_connection->ref().lock();
@@ -329,7 +414,13 @@ namespace CNCOnlineForwarder::NatNeg
         // TODO: Don't update address if packet is init and seqnum is not 1
         logLine(LogLevel::info, "Packet to server handler: NatNeg step ", packet.getStep());
         logLine(LogLevel::info, "Updating clientCommunication endpoint to ", from);
+        if (from != m_clientCommunication)
+        {
+            m_sessionRecord->publishEvent(Diagnostics::SessionEventType::clientAddressUpdated, m_clientCommunication, from);
+        }
         m_clientCommunication = from;
+        m_sessionRecord->setEndPoint("clientCommunication", from);
+        m_sessionRecord->recordReceived(packet.getView().size());
         /*auto writeHandler = makeWeakWriteHandler
         (
             packet.copyBuffer(), 
@@ -337,6 +428,7 @@ namespace CNCOnlineForwarder::NatNeg
             [](InitialPhase& self) { return self.socketReadyToReceive; }
         );*/
         auto writeHandler = makeWriteHandler<InitialPhase>(packet.copyBuffer());
+        m_sessionRecord->recordSent(packet.getView().size());
         m_communicationSocket.asyncSendTo
         (
             writeHandler.getData(),
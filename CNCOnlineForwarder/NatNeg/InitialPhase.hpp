@@ -1,9 +1,14 @@
 #pragma once
 #include <precompiled.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
+#include <Diagnostics/SessionRegistry.hpp>
+#include <Diagnostics/SocketStatistics.hpp>
+#include <Diagnostics/Tracing.hpp>
 #include <NatNeg/NatNegPacket.hpp>
 #include <IOManager.hpp>
 #include <Utility/PendingActions.hpp>
 #include <Utility/ProxyAddressTranslator.hpp>
+#include <Utility/ResolverCache.hpp>
 #include <Utility/WithStrand.hpp>
 
 namespace CNCOnlineForwarder::NatNeg
@@ -18,7 +23,6 @@ namespace CNCOnlineForwarder::NatNeg
         using EndPoint = boost::asio::ip::udp::endpoint;
         using Socket = Utility::WithStrand<boost::asio::ip::udp::socket>;
         using Timer = Utility::WithStrand<boost::asio::steady_timer>;
-        using Resolver = Utility::WithStrand<boost::asio::ip::udp::resolver>;
         using ProxyAddressTranslator = Utility::ProxyAddressTranslator;
         using PlayerID = NatNegPlayerID;
         using PacketView = NatNegPacketView;
@@ -37,6 +41,7 @@ namespace CNCOnlineForwarder::NatNeg
             std::optional<EndPoint> m_endPoint;
 
         public:
+            static constexpr auto description = "InitialPhase.server";
 
             EndPoint const& getEndPoint() const { return m_endPoint.value(); }
             void setEndPoint(EndPoint&& value) { m_endPoint = std::move(value); }
@@ -56,6 +61,7 @@ namespace CNCOnlineForwarder::NatNeg
             std::weak_ptr<GameConnection> m_ref;
 
         public:
+            static constexpr auto description = "InitialPhase.connection";
 
             std::weak_ptr<GameConnection>& ref() noexcept { return m_ref; }
 
@@ -79,8 +85,8 @@ namespace CNCOnlineForwarder::NatNeg
 
     private:
         Strand m_strand;
-        Resolver m_resolver;
         Socket m_communicationSocket;
+        Diagnostics::SocketStatistics m_communicationSocketStatistics;
         Timer m_timeout;
 
         std::weak_ptr<NatNegProxy> m_proxy;
@@ -89,9 +95,12 @@ namespace CNCOnlineForwarder::NatNeg
         PlayerID m_id;
         FutureEndPoint m_server;
         EndPoint m_clientCommunication;
+        std::shared_ptr<Diagnostics::SessionRecord> m_sessionRecord;
+        Diagnostics::TraceTarget m_traceTarget;
 
     public:
         static constexpr auto description = "InitialPhase";
+        static constexpr auto allocationTag = Diagnostics::AllocationTag::natNegSession;
 
         static std::shared_ptr<InitialPhase> create
         (
@@ -122,11 +131,22 @@ namespace CNCOnlineForwarder::NatNeg
 
         void handlePacketToServer(PacketView const packet, EndPoint const& from);
 
+        void describeSession(std::ostream& out) const;
+
+        Diagnostics::TraceTarget const& getTraceTarget() const noexcept;
+
     private:
         void close();
 
         void extendLife();
 
+        void handleServerResolved
+        (
+            boost::system::error_code const& code,
+            Utility::ResolverCache::Addresses const& addresses,
+            std::uint16_t const natNegPort
+        );
+
         void prepareForNextPacketToCommunicationAddress();
 
         void handlePacketFromServer(PacketView const packet);
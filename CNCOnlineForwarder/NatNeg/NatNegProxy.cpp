@@ -3,6 +3,8 @@
 #include <NatNeg/InitialPhase.hpp>
 #include <Logging/Logging.hpp>
 #include <Utility/SimpleWriteHandler.hpp>
+#include <Utility/Defer.hpp>
+#include <Utility/ResolverCache.hpp>
 #include <Utility/WeakRefHandler.hpp>
 
 using UDP = boost::asio::ip::udp;
@@ -19,11 +21,43 @@ namespace CNCOnlineForwarder::NatNeg
         return Logging::logLine<NatNegProxy>(level, std::forward<Arguments>(arguments)...);
     }
 
+    namespace
+    {
+        // Used to sample captured datagrams, which can be anything
+        std::optional<NatNegID> getNatNegID(NatNegPacketView const packet) noexcept
+        {
+            try
+            {
+                return packet.isNatNeg() ? packet.getNatNegID() : std::nullopt;
+            }
+            catch (std::invalid_argument const&)
+            {
+                return std::nullopt;
+            }
+        }
+
+        Diagnostics::TraceTarget getTraceTarget(NatNegPacketView const packet)
+        {
+            if (!packet.isNatNeg())
+            {
+                return {};
+            }
+
+            auto const playerID = packet.getNatNegPlayerID();
+            if (!playerID.has_value())
+            {
+                return {};
+            }
+            return Diagnostics::Tracer::get().getTarget(playerID->natNegID, playerID->playerID);
+        }
+    }
+
     class NatNegProxy::ReceiveHandler
     {
     private:
         std::unique_ptr<std::array<char, 1024>> m_buffer;
         std::unique_ptr<EndPoint> m_from;
+        std::unique_ptr<Utility::DatagramMetadata> m_metadata;
 
     public:
         static auto create(NatNegProxy* pointer)
@@ -41,6 +75,11 @@ namespace CNCOnlineForwarder::NatNeg
             return *m_from; 
         }
 
+        Utility::DatagramMetadata& getMetadata()
+        {
+            return *m_metadata;
+        }
+
         void operator()(NatNegProxy& self, ErrorCode const& code, std::size_t const bytesReceived) const
         {
             self.prepareForNextPacketToServer();
@@ -51,14 +90,27 @@ namespace CNCOnlineForwarder::NatNeg
                 return;
             }
 
+            self.m_serverSocketStatistics.recordReceived(*m_metadata, bytesReceived);
             auto const view = PacketView{ {m_buffer->data(), bytesReceived} };
+            Diagnostics::PacketCapture::record
+            (
+                self.m_serverSocketCapture,
+                Diagnostics::CaptureDirection::inbound,
+                getNatNegID(view),
+                *m_from,
+                view.getView(),
+                m_metadata->kernelTimestamp.value_or(m_metadata->userspaceTimestamp)
+            );
+            auto const trace = Diagnostics::TraceContext::Scope{ getTraceTarget(view), "handler", NatNegProxy::description };
             self.handlePacketToServer(view, *m_from);
+            self.m_serverSocketStatistics.recordProcessed(*m_metadata);
         }
 
     private:
         ReceiveHandler() :
             m_buffer{ std::make_unique<std::array<char, 1024>>() },
-            m_from{ std::make_unique<EndPoint>() }
+            m_from{ std::make_unique<EndPoint>() },
+            m_metadata{ std::make_unique<Utility::DatagramMetadata>() }
         {}
     };
 
@@ -67,6 +119,7 @@ namespace CNCOnlineForwarder::NatNeg
         IOManager::ObjectMaker const& objectMaker,
         std::string_view const serverHostName,
         std::uint16_t const serverPort,
+        std::uint16_t const listenPort,
         std::weak_ptr<ProxyAddressTranslator> const& addressTranslator
     )
     {
@@ -76,15 +129,18 @@ namespace CNCOnlineForwarder::NatNeg
             objectMaker, 
             serverHostName,
             serverPort,
+            listenPort,
             addressTranslator
         );
 
         auto const action = [](NatNegProxy& self)
         {
             logLine(LogLevel::info, "NatNegProxy created.");
+            // So the InitialPhases do not have to wait for the DNS
+            Utility::ResolverCache::get().keepResolved(self.m_objectMaker, self.m_serverHostName);
             self.prepareForNextPacketToServer();
         };
-        boost::asio::defer(self->m_proxyStrand, makeWeakHandler(self, action));
+        Utility::defer(self->m_proxyStrand, makeWeakHandler(self, action));
 
         return self;
     }
@@ -95,18 +151,33 @@ namespace CNCOnlineForwarder::NatNeg
         IOManager::ObjectMaker const& objectMaker,
         std::string_view const serverHostName,
         std::uint16_t const serverPort,
+        std::uint16_t const listenPort,
         std::weak_ptr<ProxyAddressTranslator> const& addressTranslator
     ) :
         m_objectMaker{ objectMaker },
         m_proxyStrand{ objectMaker.makeStrand() },
-        m_serverSocket{ m_proxyStrand, EndPoint{ UDP::v4(), serverPort } },
+        m_serverSocket{ m_proxyStrand, EndPoint{ UDP::v4(), listenPort } },
+        m_serverSocketStatistics{ "NatNegProxy.server" },
+        m_serverSocketCapture{ Diagnostics::CaptureInterface::natNegProxy, listenPort },
         m_serverHostName{ serverHostName },
         m_serverPort{ serverPort },
-        m_addressTranslator{ addressTranslator }
-    {}
+        m_addressTranslator{ addressTranslator },
+        m_handshakeFunnel{}
+    {
+        m_serverSocket.enableDatagramMetadata();
+    }
 
     void NatNegProxy::sendFromProxySocket(PacketView const packetView, EndPoint const& to)
     {
+        Diagnostics::PacketCapture::record
+        (
+            m_serverSocketCapture,
+            Diagnostics::CaptureDirection::outbound,
+            getNatNegID(packetView),
+            to,
+            packetView.getView()
+        );
+
         auto action = [data = packetView.copyBuffer(), to](NatNegProxy& self)
         {
             logLine(LogLevel::info, "Sending data to ", to);
@@ -119,28 +190,34 @@ namespace CNCOnlineForwarder::NatNeg
             );
         };
 
-        boost::asio::defer
+        Utility::defer
         (
             m_proxyStrand,
             makeWeakHandler(this, std::move(action))
         );
     }
 
-    void NatNegProxy::removeConnection(PlayerID const id)
+    void NatNegProxy::removeConnection(PlayerID const id, HandshakeOutcome const unfinishedOutcome)
     {
-        auto action = [id](NatNegProxy& self)
+        auto action = [id, unfinishedOutcome](NatNegProxy& self)
         {
             logLine(LogLevel::error, "Removing InitaialPhase ", id);
             self.m_initialPhases.erase(id);
+            self.m_handshakeFunnel.finish(id, unfinishedOutcome);
         };
 
-        boost::asio::defer
+        Utility::defer
         (
             m_proxyStrand, 
             makeWeakHandler(this, std::move(action))
         );
     }
 
+    HandshakeFunnel& NatNegProxy::getHandshakeFunnel() noexcept
+    {
+        return m_handshakeFunnel;
+    }
+
     void NatNegProxy::prepareForNextPacketToServer()
     {
         auto handler = ReceiveHandler::create(this);
@@ -148,6 +225,7 @@ namespace CNCOnlineForwarder::NatNeg
         (
             handler->getBuffer(),
             handler->getFrom(),
+            handler->getMetadata(),
             std::move(handler)
         );
     }
@@ -168,6 +246,17 @@ namespace CNCOnlineForwarder::NatNeg
             return;
         }
         auto const playerID = playerIDHolder.value();
+        // Connects cannot be rewritten before the public address is known, players will send their inits again
+        if (!m_addressTranslator->isReady())
+        {
+            auto const initialPhase = m_initialPhases.find(playerID);
+            if ((initialPhase == m_initialPhases.end()) || initialPhase->second.expired())
+            {
+                logLine(LogLevel::warning, "Public address is not known yet, packet of new NatNegPlayerID discarded: ", playerID);
+                return;
+            }
+        }
+        m_handshakeFunnel.recordStep(playerID, step);
 
         auto& initialPhaseRef = m_initialPhases[playerID];
         if (initialPhaseRef.expired())
@@ -187,7 +276,7 @@ namespace CNCOnlineForwarder::NatNeg
         if (!initialPhase)
         {
             logLine(LogLevel::error, "InitialPhase already expired: ", playerID);
-            removeConnection(playerID);
+            removeConnection(playerID, HandshakeOutcome::timedOut);
             return;
         }
 
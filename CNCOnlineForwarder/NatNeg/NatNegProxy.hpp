@@ -1,6 +1,10 @@
 #pragma once
 #include <precompiled.hpp>
 #include <IOManager.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
+#include <Diagnostics/PacketCapture.hpp>
+#include <Diagnostics/SocketStatistics.hpp>
+#include <NatNeg/HandshakeFunnel.hpp>
 #include <NatNeg/NatNegPacket.hpp>
 #include <Utility/ProxyAddressTranslator.hpp>
 #include <Utility/WithStrand.hpp>
@@ -28,19 +32,24 @@ namespace CNCOnlineForwarder::NatNeg
         IOManager::ObjectMaker m_objectMaker;
         Strand m_proxyStrand;
         Socket m_serverSocket;
+        Diagnostics::SocketStatistics m_serverSocketStatistics;
+        Diagnostics::CapturePoint m_serverSocketCapture;
         std::string m_serverHostName;
         std::uint16_t m_serverPort;
         std::unordered_map<NatNegPlayerID, std::weak_ptr<InitialPhase>, NatNegPlayerID::Hash> m_initialPhases;
         std::shared_ptr<ProxyAddressTranslator> m_addressTranslator;
+        HandshakeFunnel m_handshakeFunnel;
 
     public:
         static constexpr auto description = "NatNegProxy";
+        static constexpr auto allocationTag = Diagnostics::AllocationTag::natNegSession;
 
         static std::shared_ptr<NatNegProxy> create
         (
             IOManager::ObjectMaker const& objectMaker,
             std::string_view const serverHostName,
             std::uint16_t const serverPort,
+            std::uint16_t const listenPort,
             std::weak_ptr<ProxyAddressTranslator> const& addressTranslator
         );
 
@@ -50,12 +59,16 @@ namespace CNCOnlineForwarder::NatNeg
             IOManager::ObjectMaker const& objectMaker,
             std::string_view const serverHostName,
             std::uint16_t const serverPort,
+            std::uint16_t const listenPort,
             std::weak_ptr<ProxyAddressTranslator> const& addressTranslator
         );
 
         void sendFromProxySocket(PacketView const packetView, EndPoint const& to);
 
-        void removeConnection(PlayerID const id);
+        // `unfinishedOutcome` is recorded if the handshake of the player did not complete
+        void removeConnection(PlayerID const id, HandshakeOutcome const unfinishedOutcome);
+
+        HandshakeFunnel& getHandshakeFunnel() noexcept;
 
     private:
         void prepareForNextPacketToServer();
@@ -0,0 +1,121 @@
+#pragma once
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Peerchat
+{
+    // A line of the IRC protocol (RFC 1459): [":" prefix " "] command {" " parameter} [" :" trailing]
+    struct IRCMessage
+    {
+        std::string prefix;
+        std::string command;
+        std::vector<std::string> parameters;
+        // The last parameter was written after a colon, and may contain spaces
+        bool hasTrailing = false;
+
+        // Line can still end with "\r\n".
+        // Returns: nothing if there is no command.
+        static std::optional<IRCMessage> parse(std::string_view line)
+        {
+            while (!line.empty() && ((line.back() == '\n') || (line.back() == '\r')))
+            {
+                line.remove_suffix(1);
+            }
+
+            auto const next = [&line]
+            {
+                auto const end = line.find(' ');
+                auto const word = line.substr(0, end);
+                line.remove_prefix((end == line.npos) ? line.size() : (end + 1));
+                while (!line.empty() && (line.front() == ' '))
+                {
+                    line.remove_prefix(1);
+                }
+                return word;
+            };
+
+            auto message = IRCMessage{};
+            if (!line.empty() && (line.front() == ':'))
+            {
+                line.remove_prefix(1);
+                message.prefix = next();
+            }
+            message.command = next();
+            if (message.command.empty())
+            {
+                return std::nullopt;
+            }
+            std::transform(message.command.begin(), message.command.end(), message.command.begin(), [](unsigned char const c)
+            {
+                return static_cast<char>(std::toupper(c));
+            });
+
+            while (!line.empty())
+            {
+                if (line.front() == ':')
+                {
+                    message.parameters.emplace_back(line.substr(1));
+                    message.hasTrailing = true;
+                    break;
+                }
+                message.parameters.emplace_back(next());
+            }
+            return message;
+        }
+
+        // With "\r\n"
+        std::string toLine() const
+        {
+            auto line = std::string{};
+            if (!prefix.empty())
+            {
+                line.append(1, ':').append(prefix).append(1, ' ');
+            }
+            line.append(command);
+            for (auto i = std::size_t{ 0 }; i < parameters.size(); ++i)
+            {
+                auto const& parameter = parameters[i];
+                auto const isLast = (i + 1) == parameters.size();
+                line.append(1, ' ');
+                if (isLast && (hasTrailing || parameter.empty() || (parameter.find(' ') != parameter.npos) || (parameter.front() == ':')))
+                {
+                    line.append(1, ':');
+                }
+                line.append(parameter);
+            }
+            line.append("\r\n");
+            return line;
+        }
+
+        bool isNumeric() const noexcept
+        {
+            return (command.size() == 3) && std::all_of(command.begin(), command.end(), [](unsigned char const c)
+            {
+                return std::isdigit(c) != 0;
+            });
+        }
+
+        // The nick in a prefix like "nick!user@host"
+        std::string_view getSourceNick() const noexcept
+        {
+            auto const source = std::string_view{ prefix };
+            return source.substr(0, source.find('!'));
+        }
+
+        std::string const& getParameter(std::size_t const index) const
+        {
+            static auto const empty = std::string{};
+            return (index < parameters.size()) ? parameters[index] : empty;
+        }
+    };
+
+    // Nicks and channels are case insensitive
+    inline std::string toLowerCase(std::string_view const name)
+    {
+        auto result = std::string{ name };
+        std::transform(result.begin(), result.end(), result.begin(), [](unsigned char const c)
+        {
+            return static_cast<char>(std::tolower(c));
+        });
+        return result;
+    }
+}
@@ -0,0 +1,289 @@
+#include "LobbyCache.hpp"
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Peerchat
+{
+    namespace
+    {
+        constexpr auto namesPrefix = std::string_view{ "NAMES " };
+
+        // Without the channel mode (@ or +) of the names in RPL_NAMREPLY
+        std::string_view withoutMode(std::string_view nick) noexcept
+        {
+            while (!nick.empty() && ((nick.front() == '@') || (nick.front() == '+')))
+            {
+                nick.remove_prefix(1);
+            }
+            return nick;
+        }
+
+        bool isSameNick(std::string_view const name, std::string_view const nick)
+        {
+            return toLowerCase(withoutMode(name)) == toLowerCase(nick);
+        }
+    }
+
+    LobbyCache::LobbyCache(Options const& options) :
+        m_options{ options },
+        m_mutex{},
+        m_entries{},
+        m_count{ Diagnostics::MetricsRegistry::get().gauge("peerchat.cacheEntries") }
+    {}
+
+    std::optional<std::string> LobbyCache::getQueryKey(IRCMessage const& query)
+    {
+        if (query.command == "LIST")
+        {
+            auto key = query.command;
+            for (auto const& parameter : query.parameters)
+            {
+                key.append(1, ' ').append(toLowerCase(parameter));
+            }
+            return key;
+        }
+
+        // Only a single channel, and TOPIC without a new topic
+        auto const& channel = query.getParameter(0);
+        if ((query.parameters.size() != 1) || channel.empty() || (channel.find(',') != channel.npos))
+        {
+            return std::nullopt;
+        }
+        if (query.command == "NAMES")
+        {
+            return getNamesKey(channel);
+        }
+        if (query.command == "TOPIC")
+        {
+            return getTopicKey(channel);
+        }
+        return std::nullopt;
+    }
+
+    std::string LobbyCache::getNamesKey(std::string_view const channel)
+    {
+        return std::string{ namesPrefix }.append(toLowerCase(channel));
+    }
+
+    std::string LobbyCache::getTopicKey(std::string_view const channel)
+    {
+        return "TOPIC " + toLowerCase(channel);
+    }
+
+    LobbyCache::RepliesPointer LobbyCache::find(std::string const& key, TimePoint const now)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        auto const iterator = m_entries.find(key);
+        if (iterator == m_entries.end())
+        {
+            return nullptr;
+        }
+        if (iterator->second.expiresAt <= now)
+        {
+            m_entries.erase(iterator);
+            m_count.set(static_cast<std::int64_t>(m_entries.size()));
+            return nullptr;
+        }
+        return iterator->second.replies;
+    }
+
+    void LobbyCache::store(std::string const& key, Replies replies, TimePoint const now)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        if (m_entries.count(key) == 0)
+        {
+            evict(now);
+            if (m_entries.size() >= m_options.maxEntries)
+            {
+                return;
+            }
+        }
+        m_entries[key] = { std::make_shared<Replies const>(std::move(replies)), now + m_options.timeToLive };
+        m_count.set(static_cast<std::int64_t>(m_entries.size()));
+    }
+
+    void LobbyCache::onJoin(std::string_view const channel, std::string_view const nick, TimePoint const now)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        auto const iterator = m_entries.find(getNamesKey(channel));
+        if ((iterator == m_entries.end()) || (iterator->second.expiresAt <= now))
+        {
+            return;
+        }
+
+        updateNames(iterator->second, [nick](std::vector<std::string>& nicks)
+        {
+            // Every player in the channel relays the same JOIN
+            auto const found = std::find_if(nicks.begin(), nicks.end(), [nick](auto const& name) { return isSameNick(name, nick); });
+            if (found != nicks.end())
+            {
+                return false;
+            }
+            nicks.emplace_back(nick);
+            return true;
+        });
+    }
+
+    void LobbyCache::onLeave(std::string_view const channel, std::string_view const nick, TimePoint const now)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        auto const iterator = m_entries.find(getNamesKey(channel));
+        if ((iterator == m_entries.end()) || (iterator->second.expiresAt <= now))
+        {
+            return;
+        }
+
+        updateNames(iterator->second, [nick](std::vector<std::string>& nicks)
+        {
+            auto const removed = std::remove_if(nicks.begin(), nicks.end(), [nick](auto const& name) { return isSameNick(name, nick); });
+            if (removed == nicks.end())
+            {
+                return false;
+            }
+            nicks.erase(removed, nicks.end());
+            return true;
+        });
+    }
+
+    void LobbyCache::onQuit(std::string_view const nick, TimePoint const now)
+    {
+        updateAllNames(now, [nick](std::vector<std::string>& nicks)
+        {
+            auto const removed = std::remove_if(nicks.begin(), nicks.end(), [nick](auto const& name) { return isSameNick(name, nick); });
+            if (removed == nicks.end())
+            {
+                return false;
+            }
+            nicks.erase(removed, nicks.end());
+            return true;
+        });
+    }
+
+    void LobbyCache::onNickChanged(std::string_view const from, std::string_view const to, TimePoint const now)
+    {
+        updateAllNames(now, [from, to](std::vector<std::string>& nicks)
+        {
+            auto changed = false;
+            for (auto& name : nicks)
+            {
+                if (isSameNick(name, from))
+                {
+                    auto const modeSize = name.size() - withoutMode(name).size();
+                    name = name.substr(0, modeSize).append(to);
+                    changed = true;
+                }
+            }
+            return changed;
+        });
+    }
+
+    void LobbyCache::onTopicChanged(std::string_view const channel)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        m_entries.erase(getTopicKey(channel));
+        m_count.set(static_cast<std::int64_t>(m_entries.size()));
+    }
+
+    std::size_t LobbyCache::getCount()
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        return m_entries.size();
+    }
+
+    void LobbyCache::updateNames(Entry& entry, NamesUpdate const& update)
+    {
+        // Replies of NAMES are some RPL_NAMREPLY (353), then RPL_ENDOFNAMES (366)
+        auto const& replies = *entry.replies;
+        auto nicks = std::vector<std::string>{};
+        auto nameReply = std::optional<IRCMessage>{};
+        auto others = Replies{};
+        for (auto const& reply : replies)
+        {
+            if ((reply.command != "353") || reply.parameters.empty())
+            {
+                others.push_back(reply);
+                continue;
+            }
+
+            if (!nameReply.has_value())
+            {
+                nameReply = reply;
+            }
+            auto names = std::string_view{ reply.parameters.back() };
+            while (!names.empty())
+            {
+                auto const end = names.find(' ');
+                if (auto const name = names.substr(0, end); !name.empty())
+                {
+                    nicks.emplace_back(name);
+                }
+                names.remove_prefix((end == names.npos) ? names.size() : (end + 1));
+            }
+        }
+
+        if (!nameReply.has_value())
+        {
+            auto const end = std::find_if(others.begin(), others.end(), [](auto const& reply) { return reply.command == "366"; });
+            if (end == others.end())
+            {
+                return;
+            }
+            nameReply = IRCMessage{ end->prefix, "353", { end->getParameter(0), "=", end->getParameter(1), {} }, true };
+        }
+
+        if (!update(nicks))
+        {
+            return;
+        }
+
+        auto updated = Replies{};
+        auto names = std::string{};
+        auto const flush = [&updated, &names, &nameReply]
+        {
+            auto reply = nameReply.value();
+            reply.parameters.back() = std::move(names);
+            reply.hasTrailing = true;
+            updated.push_back(std::move(reply));
+            names.clear();
+        };
+        for (auto const& nick : nicks)
+        {
+            if (!names.empty() && ((names.size() + nick.size()) >= maxNamesLength))
+            {
+                flush();
+            }
+            names.append(names.empty() ? 0 : 1, ' ').append(nick);
+        }
+        if (!names.empty())
+        {
+            flush();
+        }
+        updated.insert(updated.end(), others.begin(), others.end());
+        // Replies already given to the connections are not modified
+        entry.replies = std::make_shared<Replies const>(std::move(updated));
+    }
+
+    void LobbyCache::updateAllNames(TimePoint const now, NamesUpdate const& update)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        for (auto& [key, entry] : m_entries)
+        {
+            if ((key.compare(0, namesPrefix.size(), namesPrefix) == 0) && (entry.expiresAt > now))
+            {
+                updateNames(entry, update);
+            }
+        }
+    }
+
+    void LobbyCache::evict(TimePoint const now)
+    {
+        if (m_entries.size() < m_options.maxEntries)
+        {
+            return;
+        }
+
+        for (auto iterator = m_entries.begin(); iterator != m_entries.end();)
+        {
+            iterator = (iterator->second.expiresAt <= now) ? m_entries.erase(iterator) : std::next(iterator);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Peerchat/IRCMessage.hpp>
+
+namespace CNCOnlineForwarder::Peerchat
+{
+    // Answers of the peerchat server to the read-only lobby queries (LIST, NAMES #channel and TOPIC #channel),
+    // shared by every player, so the queries repeated by each player joining a lobby can be answered locally.
+    // The cached NAMES follow the JOIN, PART, KICK, QUIT and NICK relayed to any player, and the cached TOPIC
+    // is dropped when it changes. What is not seen by the proxy, like the user counts of LIST,
+    // can be out of date for at most timeToLive.
+    // Replies are stored as the server sent them, addressed to the player who asked first.
+    // Safe to use from any thread.
+    class LobbyCache
+    {
+    public:
+        using Replies = std::vector<IRCMessage>;
+        using RepliesPointer = std::shared_ptr<Replies const>;
+        using TimePoint = std::chrono::steady_clock::time_point;
+        using Duration = std::chrono::steady_clock::duration;
+
+        struct Options
+        {
+            Duration timeToLive = std::chrono::seconds{ 5 };
+            std::size_t maxEntries = 4096;
+        };
+
+        // Longest list of names in a single RPL_NAMREPLY rebuilt by the cache
+        static constexpr auto maxNamesLength = std::size_t{ 400 };
+
+    private:
+        struct Entry
+        {
+            RepliesPointer replies;
+            TimePoint expiresAt{};
+        };
+
+        Options m_options;
+        std::mutex m_mutex;
+        std::unordered_map<std::string, Entry> m_entries;
+        Diagnostics::Gauge& m_count;
+
+    public:
+        explicit LobbyCache(Options const& options);
+
+        // Returns: the key of the query if its answer can be cached
+        static std::optional<std::string> getQueryKey(IRCMessage const& query);
+
+        static std::string getNamesKey(std::string_view const channel);
+
+        static std::string getTopicKey(std::string_view const channel);
+
+        // Returns: null if the answer is missing or expired
+        RepliesPointer find(std::string const& key, TimePoint const now);
+
+        void store(std::string const& key, Replies replies, TimePoint const now);
+
+        void onJoin(std::string_view const channel, std::string_view const nick, TimePoint const now);
+
+        // PART and KICK
+        void onLeave(std::string_view const channel, std::string_view const nick, TimePoint const now);
+
+        void onQuit(std::string_view const nick, TimePoint const now);
+
+        void onNickChanged(std::string_view const from, std::string_view const to, TimePoint const now);
+
+        void onTopicChanged(std::string_view const channel);
+
+        std::size_t getCount();
+
+    private:
+        using NamesUpdate = std::function<bool(std::vector<std::string>& nicks)>;
+
+        // Must be called with m_mutex held.
+        // Update returns false if it did not change the nicks.
+        void updateNames(Entry& entry, NamesUpdate const& update);
+
+        void updateAllNames(TimePoint const now, NamesUpdate const& update);
+
+        // Must be called with m_mutex held
+        void evict(TimePoint const now);
+    };
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Peerchat
+{
+    // Stream cipher of GameSpy peerchat, a variant of RC4.
+    // After the client sends "CRYPT des 1 GAMENAME", the server answers ":s 705 * SENDKEY RECEIVEKEY"
+    // in clear, then everything is encrypted: what the client sends with SENDKEY, what it receives with RECEIVEKEY.
+    // Both keys are 16 characters long, and are mixed with the secret key of the game.
+    class PeerchatCipher
+    {
+    public:
+        static constexpr auto challengeSize = std::size_t{ 16 };
+
+    private:
+        std::array<std::uint8_t, 256> m_state;
+        std::uint8_t m_first;
+        std::uint8_t m_second;
+
+    public:
+        PeerchatCipher(std::string_view const challenge, std::string_view const secretKey) :
+            m_state{},
+            m_first{ 0 },
+            m_second{ 0 }
+        {
+            auto key = std::array<std::uint8_t, challengeSize>{};
+            for (auto i = std::size_t{ 0 }; i < key.size(); ++i)
+            {
+                auto const c = (i < challenge.size()) ? challenge[i] : '\0';
+                auto const s = secretKey.empty() ? '\0' : secretKey[i % secretKey.size()];
+                key[i] = static_cast<std::uint8_t>(c ^ s);
+            }
+
+            for (auto i = std::size_t{ 0 }; i < m_state.size(); ++i)
+            {
+                m_state[i] = static_cast<std::uint8_t>(255 - i);
+            }
+
+            auto j = std::uint8_t{ 0 };
+            for (auto i = std::size_t{ 0 }; i < m_state.size(); ++i)
+            {
+                j = static_cast<std::uint8_t>(j + key[i % key.size()] + m_state[i]);
+                std::swap(m_state[i], m_state[j]);
+            }
+        }
+
+        // Encrypts or decrypts in place, the same operation
+        void apply(char* const data, std::size_t const size) noexcept
+        {
+            for (auto i = std::size_t{ 0 }; i < size; ++i)
+            {
+                ++m_first;
+                auto const t = m_state[m_first];
+                m_second = static_cast<std::uint8_t>(m_second + t);
+                m_state[m_first] = m_state[m_second];
+                m_state[m_second] = t;
+                auto const index = static_cast<std::uint8_t>(m_state[m_first] + m_state[m_second]);
+                data[i] = static_cast<char>(static_cast<std::uint8_t>(data[i]) ^ m_state[index]);
+            }
+        }
+    };
+}
@@ -0,0 +1,531 @@
+#include "PeerchatConnection.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+#include <Utility/Defer.hpp>
+
+using TCP = boost::asio::ip::tcp;
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Peerchat
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<PeerchatConnection>(level, std::forward<Arguments>(arguments)...);
+        }
+    }
+
+    std::shared_ptr<PeerchatConnection> PeerchatConnection::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        Socket::Type acceptedSocket,
+        EndPoint const& serverEndPoint,
+        std::shared_ptr<LobbyCache> const& cache,
+        std::shared_ptr<SecretKeys const> const& secretKeys
+    )
+    {
+        auto const self = std::make_shared<PeerchatConnection>
+        (
+            PrivateConstructor{},
+            objectMaker,
+            std::move(acceptedSocket),
+            cache,
+            secretKeys
+        );
+
+        // Nothing else owns the connection until it has pending operations
+        auto const action = [self, serverEndPoint]
+        {
+            logLine(LogLevel::info, "Relaying ", self->m_clientEndPoint, " to ", serverEndPoint);
+            self->checkIdle();
+            self->m_socketToServer->async_connect
+            (
+                serverEndPoint,
+                boost::asio::bind_executor
+                (
+                    self->m_strand,
+                    [self](ErrorCode const& code)
+                    {
+                        if (self->m_isClosed)
+                        {
+                            return;
+                        }
+
+                        if (code.failed())
+                        {
+                            logLine(LogLevel::warning, "Connect to server failed: ", code);
+                            return self->close("cannot connect to the server");
+                        }
+                        self->onConnected();
+                    }
+                )
+            );
+        };
+        Utility::defer<PeerchatConnection>(self->m_strand, action);
+
+        return self;
+    }
+
+    PeerchatConnection::PeerchatConnection
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        Socket::Type&& acceptedSocket,
+        std::shared_ptr<LobbyCache> const& cache,
+        std::shared_ptr<SecretKeys const> const& secretKeys
+    ) :
+        m_strand{ objectMaker.makeStrand() },
+        m_socketToClient{ m_strand, acceptedSocket.local_endpoint().protocol(), acceptedSocket.release() },
+        m_socketToServer{ m_strand },
+        m_timer{ m_strand },
+        m_clientEndPoint{},
+        m_lastActivity{ SteadyClock::now() },
+        m_cache{ cache },
+        m_secretKeys{ secretKeys },
+        m_client{ "client", &m_socketToClient },
+        m_server{ "server", &m_socketToServer },
+        m_gameName{},
+        m_isOpaque{ false },
+        m_nick{},
+        m_listQueries{},
+        m_list{},
+        m_names{},
+        m_topic{},
+        m_isConnected{ false },
+        m_isClosed{ false },
+        m_hits{ Diagnostics::MetricsRegistry::get().counter("peerchat.cacheHits") },
+        m_misses{ Diagnostics::MetricsRegistry::get().counter("peerchat.cacheMisses") },
+        m_clientLines{ Diagnostics::MetricsRegistry::get().counter("peerchat.clientLines") },
+        m_serverLines{ Diagnostics::MetricsRegistry::get().counter("peerchat.serverLines") },
+        m_opaqueConnections{ Diagnostics::MetricsRegistry::get().counter("peerchat.opaqueConnections") }
+    {
+        auto code = ErrorCode{};
+        m_clientEndPoint = m_socketToClient->remote_endpoint(code);
+    }
+
+    void PeerchatConnection::onConnected()
+    {
+        m_isConnected = true;
+        auto ignored = ErrorCode{};
+        m_socketToClient->set_option(TCP::no_delay{ true }, ignored);
+        m_socketToServer->set_option(TCP::no_delay{ true }, ignored);
+
+        checkIdle();
+        read(m_client);
+        read(m_server);
+    }
+
+    void PeerchatConnection::read(Side& side)
+    {
+        if (m_isClosed || side.isReading || side.isSourceClosed || (getQueuedBytes() >= maxQueuedBytes))
+        {
+            return;
+        }
+
+        side.isReading = true;
+        side.receiveBuffer.resize(bufferSize);
+        (*side.socket)->async_read_some
+        (
+            boost::asio::buffer(side.receiveBuffer),
+            boost::asio::bind_executor
+            (
+                m_strand,
+                [self = shared_from_this(), target = &side](ErrorCode const& code, std::size_t const bytesReceived)
+                {
+                    auto& side = *target;
+                    side.isReading = false;
+                    if (self->m_isClosed)
+                    {
+                        return;
+                    }
+
+                    if (code == boost::asio::error::eof)
+                    {
+                        side.isSourceClosed = true;
+                        // What is left is not a complete line, but still belongs to the other side
+                        auto& other = self->getOtherSide(side);
+                        self->send(other, side.received);
+                        side.received.clear();
+                        self->write(other);
+                        return self->shutdownIfFinished(other);
+                    }
+
+                    if (code.failed())
+                    {
+                        logLine(LogLevel::debug, "Read from ", side.name, " failed: ", code);
+                        return self->close("read failed");
+                    }
+
+                    self->onReceived(side, bytesReceived);
+                }
+            )
+        );
+    }
+
+    void PeerchatConnection::onReceived(Side& side, std::size_t const size)
+    {
+        m_lastActivity = SteadyClock::now();
+        if (side.decrypt.has_value())
+        {
+            side.decrypt->apply(side.receiveBuffer.data(), size);
+        }
+        side.received.append(side.receiveBuffer.data(), size);
+        processLines(side);
+        read(side);
+    }
+
+    void PeerchatConnection::processLines(Side& side)
+    {
+        auto& other = getOtherSide(side);
+        auto position = std::size_t{ 0 };
+        while (!m_isClosed)
+        {
+            if (m_isOpaque)
+            {
+                send(other, std::string_view{ side.received }.substr(position));
+                position = side.received.size();
+                break;
+            }
+
+            auto const end = side.received.find('\n', position);
+            if (end == side.received.npos)
+            {
+                break;
+            }
+
+            auto const line = std::string_view{ side.received }.substr(position, end + 1 - position);
+            position = end + 1;
+            auto const wasEncrypted = side.decrypt.has_value();
+            if (&side == &m_client)
+            {
+                onClientLine(line);
+            }
+            else
+            {
+                onServerLine(line);
+            }
+
+            // The server encrypts everything after its 705 reply, even in the same segment
+            if (!wasEncrypted && side.decrypt.has_value())
+            {
+                side.decrypt->apply(side.received.data() + position, side.received.size() - position);
+            }
+        }
+        side.received.erase(0, position);
+
+        if (side.received.size() > maxLineSize)
+        {
+            logLine(LogLevel::warning, "Line from ", side.name, " of ", m_clientEndPoint, " too long, relayed without parsing");
+            send(other, side.received);
+            side.received.clear();
+        }
+
+        // All the lines of a segment are written at once, replies from the cache included
+        write(m_client);
+        write(m_server);
+    }
+
+    void PeerchatConnection::onClientLine(std::string_view const line)
+    {
+        m_clientLines.add();
+        auto const message = IRCMessage::parse(line);
+        if (!message.has_value())
+        {
+            return send(m_server, line);
+        }
+
+        if (message->command == "CRYPT")
+        {
+            // CRYPT des 1 GAMENAME
+            m_gameName = message->getParameter(2);
+        }
+        else if (auto const key = LobbyCache::getQueryKey(message.value()); key.has_value() && !m_nick.empty())
+        {
+            if (auto const replies = m_cache->find(key.value(), SteadyClock::now()); replies)
+            {
+                m_hits.add();
+                return answerFromCache(*replies);
+            }
+
+            m_misses.add();
+            if (message->command == "LIST")
+            {
+                m_listQueries.push_back(key.value());
+            }
+        }
+        send(m_server, line);
+    }
+
+    void PeerchatConnection::onServerLine(std::string_view const line)
+    {
+        m_serverLines.add();
+        auto const message = IRCMessage::parse(line);
+        if (!message.has_value())
+        {
+            return send(m_client, line);
+        }
+
+        if (message->isNumeric() && !message->parameters.empty() && (message->parameters.front() != "*"))
+        {
+            m_nick = message->parameters.front();
+        }
+
+        if ((message->command == "705") && !m_gameName.empty() && !m_client.encrypt.has_value())
+        {
+            // Sent in clear, everything after it is encrypted
+            send(m_client, line);
+            auto const secretKey = m_secretKeys->find(m_gameName);
+            if (secretKey == m_secretKeys->end())
+            {
+                logLine(LogLevel::warning, "No secret key for game ", m_gameName, ", relaying ", m_clientEndPoint, " without reading it");
+                m_opaqueConnections.add();
+                m_isOpaque = true;
+                return;
+            }
+
+            // :s 705 * SENDKEY RECEIVEKEY, from the point of view of the client
+            auto const& sendKey = message->getParameter(1);
+            auto const& receiveKey = message->getParameter(2);
+            m_client.decrypt.emplace(sendKey, secretKey->second);
+            m_server.encrypt.emplace(sendKey, secretKey->second);
+            m_server.decrypt.emplace(receiveKey, secretKey->second);
+            m_client.encrypt.emplace(receiveKey, secretKey->second);
+            logLine(LogLevel::debug, "Decrypting ", m_gameName, " peerchat of ", m_clientEndPoint);
+            return;
+        }
+
+        collect(message.value(), SteadyClock::now());
+        send(m_client, line);
+    }
+
+    void PeerchatConnection::collect(IRCMessage const& message, TimePoint const now)
+    {
+        auto const& command = message.command;
+        // RPL_TOPICWHOTIME (333) may follow RPL_TOPIC (332)
+        if (m_topic.has_value() && (command != "333"))
+        {
+            m_cache->store(m_topic->key, std::move(m_topic->replies), now);
+            m_topic.reset();
+        }
+
+        if ((command == "321") || (command == "322"))
+        {
+            // RPL_LISTSTART is optional
+            if (!m_list.has_value() || (command == "321"))
+            {
+                m_list = Collected{ m_listQueries.empty() ? "LIST" : m_listQueries.front(), {} };
+                if (!m_listQueries.empty())
+                {
+                    m_listQueries.pop_front();
+                }
+            }
+            m_list->replies.push_back(message);
+        }
+        else if ((command == "323") && m_list.has_value())
+        {
+            m_list->replies.push_back(message);
+            m_cache->store(m_list->key, std::move(m_list->replies), now);
+            m_list.reset();
+        }
+        else if (command == "353")
+        {
+            // nick type channel :names
+            auto const key = LobbyCache::getNamesKey(message.getParameter(2));
+            auto& names = m_names[key];
+            names.key = key;
+            names.replies.push_back(message);
+        }
+        else if (command == "366")
+        {
+            auto const key = LobbyCache::getNamesKey(message.getParameter(1));
+            auto names = std::move(m_names[key]);
+            m_names.erase(key);
+            names.replies.push_back(message);
+            m_cache->store(key, std::move(names.replies), now);
+        }
+        else if (command == "331")
+        {
+            m_cache->store(LobbyCache::getTopicKey(message.getParameter(1)), { message }, now);
+        }
+        else if (command == "332")
+        {
+            m_topic = Collected{ LobbyCache::getTopicKey(message.getParameter(1)), { message } };
+        }
+        else if (command == "333")
+        {
+            if (m_topic.has_value() && (m_topic->key == LobbyCache::getTopicKey(message.getParameter(1))))
+            {
+                m_topic->replies.push_back(message);
+                m_cache->store(m_topic->key, std::move(m_topic->replies), now);
+                m_topic.reset();
+            }
+        }
+        else if (command == "JOIN")
+        {
+            m_cache->onJoin(message.getParameter(0), message.getSourceNick(), now);
+        }
+        else if (command == "PART")
+        {
+            m_cache->onLeave(message.getParameter(0), message.getSourceNick(), now);
+        }
+        else if (command == "KICK")
+        {
+            m_cache->onLeave(message.getParameter(0), message.getParameter(1), now);
+        }
+        else if (command == "QUIT")
+        {
+            m_cache->onQuit(message.getSourceNick(), now);
+        }
+        else if (command == "NICK")
+        {
+            m_cache->onNickChanged(message.getSourceNick(), message.getParameter(0), now);
+            if (toLowerCase(message.getSourceNick()) == toLowerCase(m_nick))
+            {
+                m_nick = message.getParameter(0);
+            }
+        }
+        else if (command == "TOPIC")
+        {
+            m_cache->onTopicChanged(message.getParameter(0));
+        }
+    }
+
+    void PeerchatConnection::answerFromCache(LobbyCache::Replies const& replies)
+    {
+        for (auto reply : replies)
+        {
+            // Addressed to whoever asked first
+            if (!reply.parameters.empty())
+            {
+                reply.parameters.front() = m_nick;
+            }
+            send(m_client, reply.toLine());
+        }
+    }
+
+    void PeerchatConnection::send(Side& side, std::string_view const data)
+    {
+        if (m_isClosed || side.isShutdown || data.empty())
+        {
+            return;
+        }
+
+        auto const start = side.sendBuffer.size();
+        side.sendBuffer.append(data);
+        if (side.encrypt.has_value())
+        {
+            side.encrypt->apply(side.sendBuffer.data() + start, data.size());
+        }
+    }
+
+    void PeerchatConnection::write(Side& side)
+    {
+        if (m_isClosed || side.isWriting || side.sendBuffer.empty())
+        {
+            return;
+        }
+
+        side.isWriting = true;
+        std::swap(side.writingBuffer, side.sendBuffer);
+        boost::asio::async_write
+        (
+            *side.socket->operator->(),
+            boost::asio::buffer(side.writingBuffer),
+            boost::asio::bind_executor
+            (
+                m_strand,
+                [self = shared_from_this(), target = &side](ErrorCode const& code, std::size_t const /* bytesSent */)
+                {
+                    auto& side = *target;
+                    side.isWriting = false;
+                    if (self->m_isClosed)
+                    {
+                        return;
+                    }
+
+                    if (code.failed())
+                    {
+                        logLine(LogLevel::debug, "Write to ", side.name, " failed: ", code);
+                        return self->close("write failed");
+                    }
+
+                    side.writingBuffer.clear();
+                    self->write(side);
+                    self->shutdownIfFinished(side);
+                    // Resumes reading if it was stopped by maxQueuedBytes
+                    self->read(self->m_client);
+                    self->read(self->m_server);
+                }
+            )
+        );
+    }
+
+    void PeerchatConnection::shutdownIfFinished(Side& side)
+    {
+        if (side.isShutdown || side.isWriting || !side.sendBuffer.empty() || !getOtherSide(side).isSourceClosed)
+        {
+            return;
+        }
+
+        side.isShutdown = true;
+        auto code = ErrorCode{};
+        (*side.socket)->shutdown(TCP::socket::shutdown_send, code);
+        if (code.failed())
+        {
+            logLine(LogLevel::debug, "Shutdown of ", side.name, " failed: ", code);
+        }
+
+        if (m_client.isShutdown && m_server.isShutdown)
+        {
+            close("both sides finished");
+        }
+    }
+
+    void PeerchatConnection::checkIdle()
+    {
+        auto delay = SteadyClock::duration{ connectTimeout };
+        if (m_isConnected)
+        {
+            auto const idle = SteadyClock::now() - m_lastActivity;
+            if (idle >= idleTimeout)
+            {
+                return close("idle for too long");
+            }
+            delay = idleTimeout - idle;
+        }
+
+        auto const onExpired = [weak = weak_from_this()](ErrorCode const& code)
+        {
+            auto const self = weak.lock();
+            if ((code == boost::asio::error::operation_aborted) || !self || self->m_isClosed)
+            {
+                return;
+            }
+
+            if (!self->m_isConnected)
+            {
+                return self->close("cannot connect to the server in time");
+            }
+            self->checkIdle();
+        };
+        m_timer.asyncWait(delay, boost::asio::bind_executor(m_strand, onExpired));
+    }
+
+    void PeerchatConnection::close(std::string_view const reason)
+    {
+        if (m_isClosed)
+        {
+            return;
+        }
+        m_isClosed = true;
+
+        logLine(LogLevel::info, "Connection of ", m_clientEndPoint, " closed: ", reason);
+        auto ignored = ErrorCode{};
+        m_socketToClient->close(ignored);
+        m_socketToServer->close(ignored);
+        m_timer->cancel();
+    }
+}
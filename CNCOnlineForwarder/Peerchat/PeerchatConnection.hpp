@@ -0,0 +1,165 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Peerchat/IRCMessage.hpp>
+#include <Peerchat/LobbyCache.hpp>
+#include <Peerchat/PeerchatCipher.hpp>
+#include <Utility/WithStrand.hpp>
+
+namespace CNCOnlineForwarder::Peerchat
+{
+    // Relays a player to the peerchat server line by line, decrypting both sides,
+    // and answers the lobby queries found in the LobbyCache instead of the server.
+    // The secret key of the game named in CRYPT is needed to decrypt; for other games,
+    // everything after CRYPT is relayed as is.
+    // Each side is encrypted with its own cipher, so replies can be added to what the server sends.
+    class PeerchatConnection : public std::enable_shared_from_this<PeerchatConnection>
+    {
+    public:
+        using Strand = IOManager::StrandType;
+        using EndPoint = boost::asio::ip::tcp::endpoint;
+        using Socket = Utility::WithStrand<boost::asio::ip::tcp::socket>;
+        using Timer = Utility::WithStrand<boost::asio::steady_timer>;
+        using SteadyClock = std::chrono::steady_clock;
+        using TimePoint = SteadyClock::time_point;
+        // By game name
+        using SecretKeys = std::map<std::string, std::string, std::less<>>;
+
+        struct Options
+        {
+            SecretKeys secretKeys = { { "redalert3pc", "uBZwpf" } };
+            LobbyCache::Options cache;
+        };
+
+    private:
+        struct PrivateConstructor {};
+
+        struct Side
+        {
+            char const* name;
+            Socket* socket;
+            std::vector<char> receiveBuffer{};
+            // Decrypted, not a complete line yet
+            std::string received{};
+            std::optional<PeerchatCipher> decrypt{};
+            std::optional<PeerchatCipher> encrypt{};
+            // Encrypted, waiting for the current write to complete
+            std::string sendBuffer{};
+            std::string writingBuffer{};
+            bool isReading = false;
+            bool isWriting = false;
+            bool isSourceClosed = false;
+            bool isShutdown = false;
+        };
+
+        // Replies being received for the cache
+        struct Collected
+        {
+            std::string key;
+            LobbyCache::Replies replies;
+        };
+
+    public:
+        static constexpr auto description = "PeerchatConnection";
+        static constexpr auto bufferSize = std::size_t{ 16 * 1024 };
+        // Of both sides together, reading stops above it
+        static constexpr auto maxQueuedBytes = std::size_t{ 256 * 1024 };
+        // Longer lines are relayed without being parsed
+        static constexpr auto maxLineSize = std::size_t{ 16 * 1024 };
+        static constexpr auto connectTimeout = std::chrono::seconds{ 10 };
+        static constexpr auto idleTimeout = std::chrono::minutes{ 10 };
+    private:
+        Strand m_strand;
+        Socket m_socketToClient;
+        Socket m_socketToServer;
+        Timer m_timer;
+        EndPoint m_clientEndPoint;
+        TimePoint m_lastActivity;
+        std::shared_ptr<LobbyCache> m_cache;
+        std::shared_ptr<SecretKeys const> m_secretKeys;
+        Side m_client;
+        Side m_server;
+        std::string m_gameName;
+        // Without the secret key, the encrypted lines cannot be parsed
+        bool m_isOpaque;
+        // As addressed by the server
+        std::string m_nick;
+        // Keys of the queries sent to the server, in order
+        std::deque<std::string> m_listQueries;
+        std::optional<Collected> m_list;
+        std::unordered_map<std::string, Collected> m_names;
+        std::optional<Collected> m_topic;
+        bool m_isConnected;
+        bool m_isClosed;
+        Diagnostics::Counter& m_hits;
+        Diagnostics::Counter& m_misses;
+        Diagnostics::Counter& m_clientLines;
+        Diagnostics::Counter& m_serverLines;
+        Diagnostics::Counter& m_opaqueConnections;
+
+    public:
+        static std::shared_ptr<PeerchatConnection> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            Socket::Type acceptedSocket,
+            EndPoint const& serverEndPoint,
+            std::shared_ptr<LobbyCache> const& cache,
+            std::shared_ptr<SecretKeys const> const& secretKeys
+        );
+
+        PeerchatConnection
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            Socket::Type&& acceptedSocket,
+            std::shared_ptr<LobbyCache> const& cache,
+            std::shared_ptr<SecretKeys const> const& secretKeys
+        );
+
+        PeerchatConnection(PeerchatConnection const&) = delete;
+        PeerchatConnection& operator=(PeerchatConnection const&) = delete;
+
+    private:
+        void onConnected();
+
+        void read(Side& side);
+
+        void onReceived(Side& side, std::size_t const size);
+
+        // Splits the decrypted bytes in lines
+        void processLines(Side& side);
+
+        void onClientLine(std::string_view const line);
+
+        void onServerLine(std::string_view const line);
+
+        // Updates the cache with a message sent by the server
+        void collect(IRCMessage const& message, TimePoint const now);
+
+        void answerFromCache(LobbyCache::Replies const& replies);
+
+        // Only encrypts and queues, until the next write
+        void send(Side& side, std::string_view const data);
+
+        void write(Side& side);
+
+        // Once the other side closed, and everything it sent has been written
+        void shutdownIfFinished(Side& side);
+
+        void checkIdle();
+
+        void close(std::string_view const reason);
+
+        Side& getOtherSide(Side& side) noexcept
+        {
+            return (&side == &m_client) ? m_server : m_client;
+        }
+
+        std::size_t getQueuedBytes() const noexcept
+        {
+            return m_client.sendBuffer.size() + m_client.writingBuffer.size()
+                + m_server.sendBuffer.size() + m_server.writingBuffer.size();
+        }
+    };
+}
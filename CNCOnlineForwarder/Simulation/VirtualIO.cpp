@@ -0,0 +1,95 @@
+#include "VirtualIO.hpp"
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Simulation
+{
+    VirtualSocket::VirtualSocket(Executor const& executor, EndPoint const& endPoint) :
+        m_executor{ executor },
+        m_localEndPoint{},
+        m_queue{},
+        m_pendingReceive{},
+        m_dropped{ 0 }
+    {
+        m_localEndPoint = VirtualNetwork::get().bind(*this, endPoint);
+    }
+
+    VirtualSocket::~VirtualSocket()
+    {
+        VirtualNetwork::get().unbind(m_localEndPoint);
+        if (m_pendingReceive.has_value())
+        {
+            m_pendingReceive->operation.post(boost::asio::error::operation_aborted, 0);
+        }
+    }
+
+    void VirtualSocket::deliver(EndPoint const& from, std::string_view const data)
+    {
+        if (m_queue.size() >= receiveQueueCapacity)
+        {
+            ++m_dropped;
+            return;
+        }
+        m_queue.push_back({ from, std::string{ data } });
+        tryCompleteReceive();
+    }
+
+    void VirtualSocket::tryCompleteReceive()
+    {
+        if (!m_pendingReceive.has_value() || m_queue.empty())
+        {
+            return;
+        }
+
+        auto pending = std::move(m_pendingReceive.value());
+        m_pendingReceive.reset();
+        auto const& datagram = m_queue.front();
+        // Like a real datagram socket, what doesn't fit in the buffers is discarded
+        auto const bytesReceived = boost::asio::buffer_copy(pending.buffers, boost::asio::buffer(datagram.data));
+        *pending.from = datagram.from;
+        m_queue.pop_front();
+        pending.operation.post(ErrorCode{}, bytesReceived);
+    }
+
+    VirtualTimer::VirtualTimer(Executor const& executor) :
+        m_executor{ executor },
+        m_state{ std::make_shared<State>() }
+    {}
+
+    VirtualTimer::~VirtualTimer()
+    {
+        cancel();
+    }
+
+    std::size_t VirtualTimer::expires_from_now(VirtualNetwork::Duration const duration)
+    {
+        auto const cancelled = cancel();
+        m_state->expiry = VirtualNetwork::get().now() + duration;
+        return cancelled;
+    }
+
+    std::size_t VirtualTimer::cancel()
+    {
+        // Expirations already scheduled will find a different generation and do nothing
+        ++m_state->generation;
+        if (!m_state->operation)
+        {
+            return 0;
+        }
+        m_state->operation.post(boost::asio::error::operation_aborted);
+        return 1;
+    }
+
+    void VirtualTimer::scheduleExpiration()
+    {
+        auto const generation = m_state->generation;
+        VirtualNetwork::get().schedule(m_state->expiry, [state = std::weak_ptr{ m_state }, generation]
+        {
+            auto const locked = state.lock();
+            if (!locked || (locked->generation != generation) || !locked->operation)
+            {
+                return;
+            }
+            locked->operation.post(ErrorCode{});
+        });
+    }
+}
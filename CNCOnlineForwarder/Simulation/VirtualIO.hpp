@@ -0,0 +1,228 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Simulation/VirtualNetwork.hpp>
+
+namespace CNCOnlineForwarder::Simulation
+{
+    using ErrorCode = boost::system::error_code;
+    using Executor = boost::asio::io_context::executor_type;
+
+    namespace Details
+    {
+        // Type erased, move only completion handler which remembers where it must be executed
+        template<typename... Arguments>
+        class PendingOperation
+        {
+        private:
+            class Base
+            {
+            public:
+                virtual ~Base() = default;
+                virtual void post(Arguments... arguments) = 0;
+            };
+
+            template<typename Handler>
+            class Concrete : public Base
+            {
+            private:
+                Handler m_handler;
+
+            public:
+                explicit Concrete(Handler&& handler) :
+                    m_handler{ std::move(handler) }
+                {}
+
+                void post(Arguments... arguments) override
+                {
+                    // If the handler is bound to a strand, it will be executed there
+                    auto const executor = boost::asio::get_associated_executor(m_handler);
+                    boost::asio::post(executor, [handler = std::move(m_handler), arguments...]() mutable
+                    {
+                        handler(arguments...);
+                    });
+                }
+            };
+
+            std::unique_ptr<Base> m_operation;
+
+        public:
+            PendingOperation() = default;
+
+            template<typename Handler>
+            PendingOperation(Executor const& executor, Handler&& handler) :
+                m_operation{ makeOperation(executor, std::forward<Handler>(handler)) }
+            {}
+
+            explicit operator bool() const noexcept
+            {
+                return m_operation != nullptr;
+            }
+
+            // Queues the handler for execution, the operation becomes empty
+            void post(Arguments... arguments)
+            {
+                auto operation = std::move(m_operation);
+                operation->post(arguments...);
+            }
+
+        private:
+            template<typename Handler>
+            static std::unique_ptr<Base> makeOperation(Executor const& executor, Handler&& handler)
+            {
+                // Handlers without an associated executor run on the io_context of the object
+                auto bound = boost::asio::bind_executor
+                (
+                    boost::asio::get_associated_executor(handler, executor),
+                    std::forward<Handler>(handler)
+                );
+                return std::make_unique<Concrete<decltype(bound)>>(std::move(bound));
+            }
+        };
+    }
+
+    // Stand-in of boost::asio::ip::udp::socket, bound to the VirtualNetwork
+    class VirtualSocket : private VirtualNetwork::Receiver
+    {
+    public:
+        using EndPoint = VirtualNetwork::EndPoint;
+
+        // Datagrams arriving while the queue is full are dropped, like a full receive buffer
+        static constexpr auto receiveQueueCapacity = std::size_t{ 256 };
+
+    private:
+        struct Datagram
+        {
+            EndPoint from;
+            std::string data;
+        };
+
+        struct PendingReceive
+        {
+            std::vector<boost::asio::mutable_buffer> buffers;
+            EndPoint* from;
+            Details::PendingOperation<ErrorCode, std::size_t> operation;
+        };
+
+        Executor m_executor;
+        EndPoint m_localEndPoint;
+        std::deque<Datagram> m_queue;
+        std::optional<PendingReceive> m_pendingReceive;
+        std::uint64_t m_dropped;
+
+    public:
+        VirtualSocket(Executor const& executor, EndPoint const& endPoint);
+        VirtualSocket(VirtualSocket const&) = delete;
+        VirtualSocket& operator=(VirtualSocket const&) = delete;
+        ~VirtualSocket();
+
+        EndPoint local_endpoint() const noexcept { return m_localEndPoint; }
+
+        std::uint64_t getDropped() const noexcept { return m_dropped; }
+
+        template<typename MutableBufferSequence, typename ReadHandler>
+        void async_receive_from(MutableBufferSequence const& buffers, EndPoint& from, ReadHandler&& handler)
+        {
+            m_pendingReceive.emplace(PendingReceive
+            {
+                { boost::asio::buffer_sequence_begin(buffers), boost::asio::buffer_sequence_end(buffers) },
+                &from,
+                { m_executor, std::forward<ReadHandler>(handler) }
+            });
+            tryCompleteReceive();
+        }
+
+        template<typename ConstBufferSequence, typename WriteHandler>
+        void async_send_to(ConstBufferSequence const& buffers, EndPoint const& to, WriteHandler&& handler)
+        {
+            auto data = std::string(boost::asio::buffer_size(buffers), '\0');
+            boost::asio::buffer_copy(boost::asio::buffer(data), buffers);
+            VirtualNetwork::get().send(m_localEndPoint, to, data);
+            auto operation = Details::PendingOperation<ErrorCode, std::size_t>{ m_executor, std::forward<WriteHandler>(handler) };
+            operation.post(ErrorCode{}, data.size());
+        }
+
+    private:
+        void deliver(EndPoint const& from, std::string_view const data) override;
+
+        void tryCompleteReceive();
+    };
+
+    // Stand-in of boost::asio::steady_timer, expiring on the virtual clock
+    class VirtualTimer
+    {
+    private:
+        // Shared with the scheduled expiration, which might outlive the timer
+        struct State
+        {
+            VirtualNetwork::TimePoint expiry{};
+            std::uint64_t generation = 0;
+            Details::PendingOperation<ErrorCode> operation;
+        };
+
+        Executor m_executor;
+        std::shared_ptr<State> m_state;
+
+    public:
+        explicit VirtualTimer(Executor const& executor);
+        VirtualTimer(VirtualTimer const&) = delete;
+        VirtualTimer& operator=(VirtualTimer const&) = delete;
+        ~VirtualTimer();
+
+        // Like boost::asio, cancels the pending wait.
+        // Returns: number of cancelled waits
+        std::size_t expires_from_now(VirtualNetwork::Duration const duration);
+
+        std::size_t cancel();
+
+        template<typename WaitHandler>
+        void async_wait(WaitHandler&& handler)
+        {
+            m_state->operation = { m_executor, std::forward<WaitHandler>(handler) };
+            scheduleExpiration();
+        }
+
+    private:
+        void scheduleExpiration();
+    };
+
+    // Stand-in of boost::asio::ip::basic_resolver, resolving the hosts of the VirtualNetwork
+    template<typename Protocol>
+    class VirtualResolver
+    {
+    public:
+        using Results = boost::asio::ip::basic_resolver_results<Protocol>;
+
+    private:
+        Executor m_executor;
+
+    public:
+        explicit VirtualResolver(Executor const& executor) :
+            m_executor{ executor }
+        {}
+
+        template<typename ResolveHandler>
+        void async_resolve(std::string_view const host, std::string_view const service, ResolveHandler&& handler)
+        {
+            auto& network = VirtualNetwork::get();
+            auto code = ErrorCode{};
+            auto results = Results{};
+            if (auto const address = network.resolve(host); address.has_value())
+            {
+                auto const port = static_cast<std::uint16_t>(std::strtoul(std::string{ service }.c_str(), nullptr, 10));
+                auto const endPoint = typename Protocol::endpoint{ address.value(), port };
+                results = Results::create(endPoint, std::string{ host }, std::string{ service });
+            }
+            else
+            {
+                code = boost::asio::error::host_not_found;
+            }
+
+            using Operation = Details::PendingOperation<ErrorCode, Results>;
+            auto const operation = std::make_shared<Operation>(m_executor, std::forward<ResolveHandler>(handler));
+            network.schedule(network.now() + network.getResolveLatency(), [operation, code, results]
+            {
+                operation->post(code, results);
+            });
+        }
+    };
+}
@@ -0,0 +1,186 @@
+#include "VirtualNetwork.hpp"
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Simulation
+{
+    namespace
+    {
+        constexpr auto fnvOffsetBasis = std::uint64_t{ 14695981039346656037ull };
+        constexpr auto fnvPrime = std::uint64_t{ 1099511628211ull };
+
+        void addToDigest(std::uint64_t& digest, void const* const data, std::size_t const size) noexcept
+        {
+            auto const bytes = static_cast<unsigned char const*>(data);
+            for (auto i = std::size_t{ 0 }; i < size; ++i)
+            {
+                digest = (digest ^ bytes[i]) * fnvPrime;
+            }
+        }
+
+        void addToDigest(std::uint64_t& digest, VirtualNetwork::EndPoint const& endPoint) noexcept
+        {
+            auto const address = endPoint.address().to_v4().to_bytes();
+            auto const port = endPoint.port();
+            addToDigest(digest, address.data(), address.size());
+            addToDigest(digest, &port, sizeof(port));
+        }
+    }
+
+    VirtualNetwork& VirtualNetwork::get()
+    {
+        static auto network = VirtualNetwork{};
+        return network;
+    }
+
+    VirtualNetwork::VirtualNetwork() :
+        m_now{ 0 },
+        m_nextSequence{ 0 },
+        m_events{},
+        m_receivers{},
+        m_nextEphemeralPorts{},
+        m_firstEphemeralPort{ 32768 },
+        m_lastEphemeralPort{ 60999 },
+        m_hosts{},
+        m_localAddress{ Address::loopback() },
+        m_latency{ 0 },
+        m_resolveLatency{ 0 },
+        m_statistics{ 0, 0, 0, 0, fnvOffsetBasis }
+    {}
+
+    void VirtualNetwork::setEphemeralPortRange(std::uint16_t const first, std::uint16_t const last) noexcept
+    {
+        m_firstEphemeralPort = std::min(first, last);
+        m_lastEphemeralPort = std::max(first, last);
+        m_nextEphemeralPorts.clear();
+    }
+
+    void VirtualNetwork::addHost(std::string const& name, Address const& address)
+    {
+        m_hosts[name] = address;
+    }
+
+    std::optional<VirtualNetwork::Address> VirtualNetwork::resolve(std::string_view const name) const
+    {
+        if (auto const host = m_hosts.find(std::string{ name }); host != m_hosts.end())
+        {
+            return host->second;
+        }
+
+        auto code = boost::system::error_code{};
+        auto const address = boost::asio::ip::make_address_v4(name, code);
+        if (code.failed())
+        {
+            return std::nullopt;
+        }
+        return address;
+    }
+
+    VirtualNetwork::EndPoint VirtualNetwork::bind(Receiver& receiver, EndPoint const& endPoint)
+    {
+        auto const address = endPoint.address().to_v4();
+        auto bound = EndPoint{ address, endPoint.port() };
+        if (bound.port() == 0)
+        {
+            // Like the kernel, look for a free port starting from the one after the last allocated
+            auto& next = m_nextEphemeralPorts.try_emplace(address, m_firstEphemeralPort).first->second;
+            auto const rangeSize = m_lastEphemeralPort - m_firstEphemeralPort + 1;
+            for (auto i = 0; (i < rangeSize) && (bound.port() == 0); ++i)
+            {
+                auto const candidate = next;
+                next = (next == m_lastEphemeralPort) ? m_firstEphemeralPort : static_cast<std::uint16_t>(next + 1);
+                if (m_receivers.find(EndPoint{ address, candidate }) == m_receivers.end())
+                {
+                    bound.port(candidate);
+                }
+            }
+            if (bound.port() == 0)
+            {
+                throw std::system_error{ std::make_error_code(std::errc::address_in_use), "VirtualNetwork: no free port" };
+            }
+        }
+
+        if (!m_receivers.try_emplace(bound, &receiver).second)
+        {
+            throw std::system_error{ std::make_error_code(std::errc::address_in_use), "VirtualNetwork: already bound" };
+        }
+        ++m_statistics.boundEndPoints;
+        return bound;
+    }
+
+    void VirtualNetwork::unbind(EndPoint const& endPoint) noexcept
+    {
+        if (m_receivers.erase(endPoint) != 0)
+        {
+            --m_statistics.boundEndPoints;
+        }
+    }
+
+    void VirtualNetwork::send(EndPoint const& from, EndPoint const& to, std::string_view const data)
+    {
+        auto const source = from.address().is_unspecified() ? EndPoint{ m_localAddress, from.port() } : from;
+        schedule(m_now + m_latency, [this, source, to, data = std::string{ data }]
+        {
+            deliver(source, to, data);
+        });
+    }
+
+    void VirtualNetwork::schedule(TimePoint const at, std::function<void()> action)
+    {
+        m_events.push_back({ std::max(at, m_now), m_nextSequence++, std::move(action) });
+        std::push_heap(m_events.begin(), m_events.end(), LaterFirst{});
+    }
+
+    bool VirtualNetwork::runUntil(IOManager& ioManager, TimePoint const until)
+    {
+        while (true)
+        {
+            ioManager.poll();
+            if (m_events.empty())
+            {
+                m_now = std::max(m_now, until);
+                return false;
+            }
+
+            if (m_events.front().at > until)
+            {
+                m_now = until;
+                return true;
+            }
+
+            std::pop_heap(m_events.begin(), m_events.end(), LaterFirst{});
+            auto event = std::move(m_events.back());
+            m_events.pop_back();
+            m_now = event.at;
+            ++m_statistics.events;
+            event.action();
+        }
+    }
+
+    VirtualNetwork::Statistics VirtualNetwork::getStatistics() const noexcept
+    {
+        return m_statistics;
+    }
+
+    void VirtualNetwork::deliver(EndPoint const& from, EndPoint const& to, std::string const& data)
+    {
+        auto receiver = m_receivers.find(to);
+        if (receiver == m_receivers.end())
+        {
+            receiver = m_receivers.find(EndPoint{ Address::any(), to.port() });
+        }
+        // Sockets bound to 0.0.0.0 also receive what is sent to the local address
+        if ((receiver == m_receivers.end()) || ((to.address() != m_localAddress) && (receiver->first.address() != to.address())))
+        {
+            ++m_statistics.unreachable;
+            return;
+        }
+
+        ++m_statistics.delivered;
+        auto& digest = m_statistics.digest;
+        addToDigest(digest, &m_now, sizeof(m_now));
+        addToDigest(digest, from);
+        addToDigest(digest, to);
+        addToDigest(digest, data.data(), data.size());
+        receiver->second->deliver(from, data);
+    }
+}
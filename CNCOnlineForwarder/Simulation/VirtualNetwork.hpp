@@ -0,0 +1,119 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+
+namespace CNCOnlineForwarder::Simulation
+{
+    // In-memory UDP network and event queue on a virtual clock, used instead of
+    // the real sockets, timers and resolvers when building with CNCONLINEFORWARDER_SIMULATION.
+    // Everything runs on the thread calling runUntil: handlers posted to the IOManager
+    // are executed until none is ready, then the clock jumps to the next event.
+    // Given the same inputs, a run always produces the same sequence of events.
+    class VirtualNetwork
+    {
+    public:
+        using Duration = std::chrono::nanoseconds;
+        // Since the beginning of the simulation
+        using TimePoint = Duration;
+        using EndPoint = boost::asio::ip::udp::endpoint;
+        using Address = boost::asio::ip::address_v4;
+
+        class Receiver
+        {
+        public:
+            virtual void deliver(EndPoint const& from, std::string_view const data) = 0;
+
+        protected:
+            ~Receiver() = default;
+        };
+
+        struct Statistics
+        {
+            std::uint64_t events;
+            std::uint64_t delivered;
+            // No one bound to the destination
+            std::uint64_t unreachable;
+            std::size_t boundEndPoints;
+            // FNV-1a of every delivered datagram, with its time, source and destination
+            std::uint64_t digest;
+        };
+
+    private:
+        struct Event
+        {
+            TimePoint at;
+            std::uint64_t sequence;
+            std::function<void()> action;
+        };
+
+        struct LaterFirst
+        {
+            bool operator()(Event const& a, Event const& b) const noexcept
+            {
+                return (a.at != b.at) ? (a.at > b.at) : (a.sequence > b.sequence);
+            }
+        };
+
+        TimePoint m_now;
+        std::uint64_t m_nextSequence;
+        std::vector<Event> m_events;
+        std::map<EndPoint, Receiver*> m_receivers;
+        std::map<Address, std::uint16_t> m_nextEphemeralPorts;
+        std::uint16_t m_firstEphemeralPort;
+        std::uint16_t m_lastEphemeralPort;
+        std::unordered_map<std::string, Address> m_hosts;
+        Address m_localAddress;
+        Duration m_latency;
+        Duration m_resolveLatency;
+        Statistics m_statistics;
+
+    public:
+        static constexpr auto description = "VirtualNetwork";
+
+        static VirtualNetwork& get();
+
+        VirtualNetwork(VirtualNetwork const&) = delete;
+        VirtualNetwork& operator=(VirtualNetwork const&) = delete;
+
+        TimePoint now() const noexcept { return m_now; }
+
+        // Source address of the datagrams sent from sockets bound to 0.0.0.0
+        void setLocalAddress(Address const& address) noexcept { m_localAddress = address; }
+
+        // One way delay of every datagram
+        void setLatency(Duration const latency) noexcept { m_latency = latency; }
+
+        void setResolveLatency(Duration const latency) noexcept { m_resolveLatency = latency; }
+
+        Duration getResolveLatency() const noexcept { return m_resolveLatency; }
+
+        // Ports given to sockets bound to port 0, by default the same as Linux (net.ipv4.ip_local_port_range).
+        // Each player costs the forwarder three of them, which limits the number of live sessions.
+        void setEphemeralPortRange(std::uint16_t const first, std::uint16_t const last) noexcept;
+
+        void addHost(std::string const& name, Address const& address);
+
+        std::optional<Address> resolve(std::string_view const name) const;
+
+        // Port 0 means any free port. Returns: the bound endpoint.
+        // Throws: std::system_error if the endpoint is already bound.
+        EndPoint bind(Receiver& receiver, EndPoint const& endPoint);
+
+        void unbind(EndPoint const& endPoint) noexcept;
+
+        // The datagram will be delivered to whoever is bound to `to` when it arrives
+        void send(EndPoint const& from, EndPoint const& to, std::string_view const data);
+
+        void schedule(TimePoint const at, std::function<void()> action);
+
+        // Returns: false if there was nothing left to do
+        bool runUntil(IOManager& ioManager, TimePoint const until);
+
+        Statistics getStatistics() const noexcept;
+
+    private:
+        VirtualNetwork();
+
+        void deliver(EndPoint const& from, EndPoint const& to, std::string const& data);
+    };
+}
@@ -1,45 +1,113 @@
 #include "TCPConnection.hpp"
 #include <precompiled.hpp>
 #include <Logging/Logging.hpp>
+#include <Utility/Defer.hpp>
 #include <Utility/WeakRefHandler.hpp>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using TCP = boost::asio::ip::tcp;
+using ErrorCode = boost::system::error_code;
 using LogLevel = CNCOnlineForwarder::Logging::Level;
 
 using CNCOnlineForwarder::Utility::makeWeakHandler;
 
 namespace CNCOnlineForwarder::TCPProxy
 {
-    template<typename... Arguments>
-    void logLine(LogLevel level, Arguments&&... arguments)
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<TCPConnection>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        ErrorCode getLastError()
+        {
+            return { errno, boost::system::system_category() };
+        }
+    }
+
+    TCPConnection::Pipe::~Pipe()
+    {
+#ifdef __linux__
+        for (auto const end : { readEnd, writeEnd })
+        {
+            if (end >= 0)
+            {
+                ::close(end);
+            }
+        }
+#endif
+    }
+
+    bool TCPConnection::Pipe::open()
     {
-        return CNCOnlineForwarder::Logging::logLine<TCPConnection>(level, std::forward<Arguments>(arguments)...);
+#ifdef __linux__
+        // splice() has no MSG_NOSIGNAL: the process must ignore SIGPIPE (see TCPProxy),
+        // or writing to a connection reset by its peer would kill it
+        int ends[2];
+        if (::pipe2(ends, O_NONBLOCK | O_CLOEXEC) != 0)
+        {
+            return false;
+        }
+        readEnd = ends[0];
+        writeEnd = ends[1];
+        return true;
+#else
+        return false;
+#endif
     }
 
     std::shared_ptr<TCPConnection> TCPConnection::create
     (
         IOManager::ObjectMaker const& objectMaker,
         Socket::Type acceptedSocket,
-        EndPoint const&/* serverEndPoint*/
+        EndPoint const& serverEndPoint,
+        RelayMode const mode
     )
     {
         auto const self = std::make_shared<TCPConnection>
         (
             PrivateConstructor{},
             objectMaker,
-            std::move(acceptedSocket)
+            std::move(acceptedSocket),
+            mode
         );
 
-        /*auto const action = [serverEndPoint](TCPConnection& self)
+        // Nothing else owns the connection until it has pending operations
+        auto const action = [self, serverEndPoint]
         {
-            logLine(LogLevel::info, "TCPConnection created, connecting to remote server...");
-            auto const onConnect = [](TCPConnection& self)
-            {
-                self.readFromClient();
-                self.readFromServer();
-            };
-            self.m_socketToServer->async_connect(serverEndPoint, makeWeakHandler(self, onConnect));
+            logLine(LogLevel::info, "Relaying ", self->m_clientEndPoint, " to ", serverEndPoint);
+            self->checkIdle();
+            self->m_socketToServer->async_connect
+            (
+                serverEndPoint,
+                boost::asio::bind_executor
+                (
+                    self->m_strand,
+                    [self](ErrorCode const& code)
+                    {
+                        if (self->m_isClosed)
+                        {
+                            return;
+                        }
+
+                        if (code.failed())
+                        {
+                            self->m_connectFailures.add();
+                            logLine(LogLevel::warning, "Connect to server failed: ", code);
+                            return self->close("cannot connect to the server");
+                        }
+                        self->onConnected();
+                    }
+                )
+            );
         };
-        boost::asio::defer(self->m_strand, makeWeakHandler(self, action));*/
+        Utility::defer<TCPConnection>(self->m_strand, action);
 
         return self;
     }
@@ -48,21 +116,369 @@ namespace CNCOnlineForwarder::TCPProxy
     (
         PrivateConstructor,
         IOManager::ObjectMaker const& objectMaker,
-        Socket::Type&& acceptedSocket
+        Socket::Type&& acceptedSocket,
+        RelayMode const mode
     ) :
         m_strand{ objectMaker.makeStrand() },
-        m_socketToClient{ m_strand, acceptedSocket.remote_endpoint().protocol(), acceptedSocket.release() },
+        m_socketToClient{ m_strand, acceptedSocket.local_endpoint().protocol(), acceptedSocket.release() },
         m_socketToServer{ m_strand },
+        m_timer{ m_strand },
+        m_clientEndPoint{},
         m_lastClientReply{ SteadyClock::now() },
-        m_lastServerReply{ SteadyClock::now() }
-    {}
+        m_lastServerReply{ SteadyClock::now() },
+        m_mode{ mode },
+        m_clientToServer{ "client to server", &m_socketToClient, &m_socketToServer, &m_lastClientReply },
+        m_serverToClient{ "server to client", &m_socketToServer, &m_socketToClient, &m_lastServerReply },
+        m_isConnected{ false },
+        m_isClosed{ false },
+        m_splicedBytes{ Diagnostics::MetricsRegistry::get().counter("tcpProxy.splicedBytes") },
+        m_copiedBytes{ Diagnostics::MetricsRegistry::get().counter("tcpProxy.copiedBytes") },
+        m_connectFailures{ Diagnostics::MetricsRegistry::get().counter("tcpProxy.connectFailures") },
+        m_active{ Diagnostics::MetricsRegistry::get().gauge("tcpProxy.activeConnections") }
+    {
+        auto code = ErrorCode{};
+        m_clientEndPoint = m_socketToClient->remote_endpoint(code);
+        m_active.add(1);
+    }
+
+    TCPConnection::~TCPConnection()
+    {
+        m_active.add(-1);
+    }
 
-    void TCPConnection::readFromClient()
+    void TCPConnection::onConnected()
     {
-        /*m_clientReceiveBuffer.resize(bufferSize);
-        auto const buffer = boost::asio::buffer(m_clientReceiveBuffer);*/
+        m_isConnected = true;
+        // Chat messages are small and should not wait for more
+        auto ignored = ErrorCode{};
+        m_socketToClient->set_option(TCP::no_delay{ true }, ignored);
+        m_socketToServer->set_option(TCP::no_delay{ true }, ignored);
 
-        //m_socketToClient->async_read_some(buffer, makeWeakHandler(this, onRead));
+        checkIdle();
+        startRelaying(m_clientToServer);
+        startRelaying(m_serverToClient);
     }
 
-}
\ No newline at end of file
+    void TCPConnection::startRelaying(Direction& direction)
+    {
+#ifdef __linux__
+        if (m_mode == RelayMode::automatic)
+        {
+            auto pipe = std::make_unique<Pipe>();
+            if (pipe->open())
+            {
+                // splice() must not block the thread, readiness is waited with async_wait instead
+                auto code = ErrorCode{};
+                (*direction.from)->native_non_blocking(true, code);
+                if (!code.failed())
+                {
+                    (*direction.to)->native_non_blocking(true, code);
+                }
+                if (!code.failed())
+                {
+                    direction.pipe = std::move(pipe);
+                    return pump(direction);
+                }
+                logLine(LogLevel::warning, "Cannot make socket non blocking, copying ", direction.name, " instead: ", code);
+            }
+            else
+            {
+                logLine(LogLevel::warning, "Cannot create pipe, copying ", direction.name, " instead: ", getLastError());
+            }
+        }
+#endif
+        readFromSource(direction);
+    }
+
+    void TCPConnection::readFromSource(Direction& direction)
+    {
+        if (m_isClosed || direction.isReading || direction.isSourceClosed || (direction.queuedBytes >= maxQueuedBytes))
+        {
+            return;
+        }
+
+        direction.isReading = true;
+        direction.receiveBuffer.resize(bufferSize);
+        (*direction.from)->async_read_some
+        (
+            boost::asio::buffer(direction.receiveBuffer),
+            boost::asio::bind_executor
+            (
+                m_strand,
+                [self = shared_from_this(), target = &direction](ErrorCode const& code, std::size_t const bytesReceived)
+                {
+                    auto& direction = *target;
+                    direction.isReading = false;
+                    if (self->m_isClosed)
+                    {
+                        return;
+                    }
+
+                    if (code == boost::asio::error::eof)
+                    {
+                        direction.isSourceClosed = true;
+                        if (!direction.isWriting)
+                        {
+                            self->finish(direction);
+                        }
+                        return;
+                    }
+
+                    if (code.failed())
+                    {
+                        logLine(LogLevel::debug, "Read ", direction.name, " failed: ", code);
+                        return self->close("read failed");
+                    }
+
+                    *direction.lastReceived = SteadyClock::now();
+                    direction.receiveBuffer.resize(bytesReceived);
+                    direction.queuedBytes += bytesReceived;
+                    direction.sendBuffer.push_back(std::move(direction.receiveBuffer));
+                    direction.receiveBuffer = {};
+                    self->writeToDestination(direction);
+                    self->readFromSource(direction);
+                }
+            )
+        );
+    }
+
+    void TCPConnection::writeToDestination(Direction& direction)
+    {
+        if (m_isClosed || direction.isWriting || direction.sendBuffer.empty())
+        {
+            return;
+        }
+
+        // Everything received since the last write is sent at once
+        direction.isWriting = true;
+        std::swap(direction.writingBuffer, direction.sendBuffer);
+        auto buffers = std::vector<boost::asio::const_buffer>{};
+        buffers.reserve(direction.writingBuffer.size());
+        for (auto const& buffer : direction.writingBuffer)
+        {
+            buffers.push_back(boost::asio::buffer(buffer));
+        }
+
+        boost::asio::async_write
+        (
+            *direction.to->operator->(),
+            buffers,
+            boost::asio::bind_executor
+            (
+                m_strand,
+                [self = shared_from_this(), target = &direction](ErrorCode const& code, std::size_t const bytesSent)
+                {
+                    auto& direction = *target;
+                    direction.isWriting = false;
+                    if (self->m_isClosed)
+                    {
+                        return;
+                    }
+
+                    if (code.failed())
+                    {
+                        logLine(LogLevel::debug, "Write ", direction.name, " failed: ", code);
+                        return self->close("write failed");
+                    }
+
+                    self->m_copiedBytes.add(bytesSent);
+                    direction.queuedBytes -= bytesSent;
+                    // Reuse a buffer for the next read instead of allocating again
+                    if ((direction.receiveBuffer.capacity() == 0) && !direction.writingBuffer.empty())
+                    {
+                        direction.receiveBuffer = std::move(direction.writingBuffer.back());
+                    }
+                    direction.writingBuffer.clear();
+
+                    if (!direction.sendBuffer.empty())
+                    {
+                        self->writeToDestination(direction);
+                    }
+                    else if (direction.isSourceClosed)
+                    {
+                        return self->finish(direction);
+                    }
+                    // Resumes reading if it was stopped by maxQueuedBytes
+                    self->readFromSource(direction);
+                }
+            )
+        );
+    }
+
+    void TCPConnection::pump(Direction& direction)
+    {
+#ifdef __linux__
+        auto& pipe = *direction.pipe;
+        auto const from = (*direction.from)->native_handle();
+        auto const to = (*direction.to)->native_handle();
+        auto constexpr flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+        for (auto i = 0; i < maxSplicesPerWakeUp; ++i)
+        {
+            // The pipe is emptied before reading again, so it bounds what is not sent yet
+            if (pipe.bytes > 0)
+            {
+                auto const sent = ::splice(pipe.readEnd, nullptr, to, nullptr, pipe.bytes, flags);
+                if (sent < 0)
+                {
+                    auto const error = getLastError();
+                    if (error == boost::system::errc::interrupted)
+                    {
+                        continue;
+                    }
+                    if (error == boost::system::errc::operation_would_block)
+                    {
+                        return waitThenPump(direction, *direction.to, TCP::socket::wait_write);
+                    }
+                    logLine(LogLevel::debug, "Splice ", direction.name, " to socket failed: ", error);
+                    return close("write failed");
+                }
+                pipe.bytes -= static_cast<std::size_t>(sent);
+                m_splicedBytes.add(static_cast<std::uint64_t>(sent));
+                continue;
+            }
+
+            if (direction.isSourceClosed)
+            {
+                return finish(direction);
+            }
+
+            auto const received = ::splice(from, nullptr, pipe.writeEnd, nullptr, spliceSize, flags);
+            if (received < 0)
+            {
+                auto const error = getLastError();
+                if (error == boost::system::errc::interrupted)
+                {
+                    continue;
+                }
+                if (error == boost::system::errc::operation_would_block)
+                {
+                    return waitThenPump(direction, *direction.from, TCP::socket::wait_read);
+                }
+                logLine(LogLevel::debug, "Splice ", direction.name, " to pipe failed: ", error);
+                return close("read failed");
+            }
+            if (received == 0)
+            {
+                direction.isSourceClosed = true;
+                continue;
+            }
+            pipe.bytes += static_cast<std::size_t>(received);
+            *direction.lastReceived = SteadyClock::now();
+        }
+
+        // Still busy, let the other connections of this thread run first
+        auto const action = [target = &direction](TCPConnection& self)
+        {
+            if (!self.m_isClosed)
+            {
+                self.pump(*target);
+            }
+        };
+        Utility::defer(m_strand, makeWeakHandler(this, action));
+#else
+        readFromSource(direction);
+#endif
+    }
+
+    void TCPConnection::waitThenPump
+    (
+        Direction& direction,
+        Socket& socket,
+        boost::asio::socket_base::wait_type const type
+    )
+    {
+        socket->async_wait
+        (
+            type,
+            boost::asio::bind_executor
+            (
+                m_strand,
+                [self = shared_from_this(), target = &direction](ErrorCode const& code)
+                {
+                    if (self->m_isClosed)
+                    {
+                        return;
+                    }
+
+                    if (code.failed())
+                    {
+                        logLine(LogLevel::debug, "Wait ", target->name, " failed: ", code);
+                        return self->close("wait failed");
+                    }
+                    self->pump(*target);
+                }
+            )
+        );
+    }
+
+    void TCPConnection::finish(Direction& direction)
+    {
+        if (direction.isFinished)
+        {
+            return;
+        }
+
+        direction.isFinished = true;
+        logLine(LogLevel::debug, "Finished relaying ", direction.name, " of ", m_clientEndPoint);
+        auto code = ErrorCode{};
+        (*direction.to)->shutdown(TCP::socket::shutdown_send, code);
+        if (code.failed())
+        {
+            logLine(LogLevel::debug, "Shutdown ", direction.name, " failed: ", code);
+        }
+
+        if (m_clientToServer.isFinished && m_serverToClient.isFinished)
+        {
+            close("both sides finished");
+        }
+    }
+
+    void TCPConnection::checkIdle()
+    {
+        auto delay = SteadyClock::duration{ connectTimeout };
+        if (m_isConnected)
+        {
+            auto const idle = SteadyClock::now() - std::max(m_lastClientReply, m_lastServerReply);
+            if (idle >= idleTimeout)
+            {
+                return close("idle for too long");
+            }
+            delay = idleTimeout - idle;
+        }
+
+        auto const onExpired = [weak = weak_from_this()](ErrorCode const& code)
+        {
+            auto const self = weak.lock();
+            if ((code == boost::asio::error::operation_aborted) || !self || self->m_isClosed)
+            {
+                return;
+            }
+
+            if (!self->m_isConnected)
+            {
+                self->m_connectFailures.add();
+                return self->close("cannot connect to the server in time");
+            }
+            self->checkIdle();
+        };
+        m_timer.asyncWait(delay, boost::asio::bind_executor(m_strand, onExpired));
+    }
+
+    void TCPConnection::close(std::string_view const reason)
+    {
+        if (m_isClosed)
+        {
+            return;
+        }
+        m_isClosed = true;
+
+        logLine(LogLevel::info, "Connection of ", m_clientEndPoint, " closed: ", reason);
+        // Pending operations are aborted, which releases the connection
+        auto ignored = ErrorCode{};
+        m_socketToClient->close(ignored);
+        m_socketToServer->close(ignored);
+        m_timer->cancel();
+        m_clientToServer.pipe.reset();
+        m_serverToClient.pipe.reset();
+    }
+}
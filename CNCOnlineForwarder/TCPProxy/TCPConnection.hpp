@@ -1,15 +1,34 @@
+#pragma once
 #include <precompiled.hpp>
 #include <IOManager.hpp>
+#include <Diagnostics/Metrics.hpp>
 #include <Utility/WithStrand.hpp>
 
 namespace CNCOnlineForwarder::TCPProxy
 {
+    enum class RelayMode
+    {
+        // splice() on Linux, copying otherwise
+        automatic,
+        // Always through the send buffers, mostly for comparisons
+        copy,
+        // Line by line with Peerchat::PeerchatConnection, which answers lobby queries from its cache
+        peerchat,
+    };
+
+    // Relays the bytes of an accepted client to the server, and back.
+    // On Linux, the bytes are moved by the kernel with splice() through a pipe per direction,
+    // without ever being copied to userspace. Otherwise they are read into buffers, queued, and
+    // written with gathered writes. Either way, reading stops while a direction has
+    // maxQueuedBytes not written yet, so a slow receiver throttles the sender.
+    // Shutdowns are forwarded, so each direction can be closed independently.
     class TCPConnection : public std::enable_shared_from_this<TCPConnection>
     {
     public:
         using Strand = IOManager::StrandType;
         using EndPoint = boost::asio::ip::tcp::endpoint;
         using Socket = Utility::WithStrand<boost::asio::ip::tcp::socket>;
+        using Timer = Utility::WithStrand<boost::asio::steady_timer>;
         using AddressV4 = boost::asio::ip::address_v4;
         using SteadyClock = std::chrono::steady_clock;
         using TimePoint = SteadyClock::time_point;
@@ -17,38 +36,112 @@ namespace CNCOnlineForwarder::TCPProxy
     private:
         struct PrivateConstructor {};
 
+        // Pipe of a spliced direction, owns its file descriptors
+        struct Pipe
+        {
+            int readEnd = -1;
+            int writeEnd = -1;
+            // Spliced from the source, not yet to the destination
+            std::size_t bytes = 0;
+
+            Pipe() = default;
+            Pipe(Pipe const&) = delete;
+            Pipe& operator=(Pipe const&) = delete;
+            ~Pipe();
+
+            // Returns: false if splice() cannot be used
+            bool open();
+        };
+
+        struct Direction
+        {
+            char const* name;
+            Socket* from;
+            Socket* to;
+            TimePoint* lastReceived;
+            Buffer receiveBuffer{};
+            // Received, waiting for the current write to complete
+            std::vector<Buffer> sendBuffer{};
+            // Being written
+            std::vector<Buffer> writingBuffer{};
+            std::size_t queuedBytes = 0;
+            bool isReading = false;
+            bool isWriting = false;
+            bool isSourceClosed = false;
+            bool isFinished = false;
+            std::unique_ptr<Pipe> pipe{};
+        };
+
     public:
         static constexpr auto description = "TCPConnection";
-        static constexpr auto bufferSize = 512;
+        static constexpr auto bufferSize = std::size_t{ 16 * 1024 };
+        static constexpr auto maxQueuedBytes = std::size_t{ 256 * 1024 };
+        // Bytes moved by a single splice() call
+        static constexpr auto spliceSize = std::size_t{ 64 * 1024 };
+        // Before letting the other handlers of the thread run
+        static constexpr auto maxSplicesPerWakeUp = 16;
+        static constexpr auto connectTimeout = std::chrono::seconds{ 10 };
+        // IRC servers send a PING every few minutes
+        static constexpr auto idleTimeout = std::chrono::minutes{ 10 };
     private:
         Strand m_strand;
         Socket m_socketToClient;
         Socket m_socketToServer;
+        Timer m_timer;
+        EndPoint m_clientEndPoint;
         TimePoint m_lastClientReply;
         TimePoint m_lastServerReply;
-        Buffer m_clientReceiveBuffer;
-        Buffer m_serverReceiveBuffer;
-        std::vector<Buffer> m_clientSendBuffer;
-        std::vector<Buffer> m_serverSendBuffer;
+        RelayMode m_mode;
+        Direction m_clientToServer;
+        Direction m_serverToClient;
+        bool m_isConnected;
+        bool m_isClosed;
+        Diagnostics::Counter& m_splicedBytes;
+        Diagnostics::Counter& m_copiedBytes;
+        Diagnostics::Counter& m_connectFailures;
+        Diagnostics::Gauge& m_active;
 
     public:
         static std::shared_ptr<TCPConnection> create
         (
             IOManager::ObjectMaker const& objectMaker,
             Socket::Type acceptedSocket,
-            EndPoint const& serverEndPoint
+            EndPoint const& serverEndPoint,
+            RelayMode const mode
         );
 
         TCPConnection
         (
             PrivateConstructor,
             IOManager::ObjectMaker const& objectMaker,
-            Socket::Type&& acceptedSocket
+            Socket::Type&& acceptedSocket,
+            RelayMode const mode
         );
 
+        TCPConnection(TCPConnection const&) = delete;
+        TCPConnection& operator=(TCPConnection const&) = delete;
+
+        ~TCPConnection();
+
     private:
-        void readFromClient();
-        void readFromServer();
-        
+        void onConnected();
+
+        void startRelaying(Direction& direction);
+
+        // Copying path
+        void readFromSource(Direction& direction);
+        void writeToDestination(Direction& direction);
+
+        // splice() path, moves as much as possible then waits on the blocking socket
+        void pump(Direction& direction);
+        void waitThenPump(Direction& direction, Socket& socket, boost::asio::socket_base::wait_type const type);
+
+        // Once every received byte has been sent
+        void finish(Direction& direction);
+
+        // Closes the connection if it did not connect in time, or stays idle for too long
+        void checkIdle();
+
+        void close(std::string_view const reason);
     };
-}
\ No newline at end of file
+}
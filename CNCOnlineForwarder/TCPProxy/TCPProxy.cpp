@@ -1,44 +1,96 @@
 #include "TCPProxy.hpp"
 #include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+#include <Utility/Defer.hpp>
+#include <Utility/ResolverCache.hpp>
 #include <Utility/WeakRefHandler.hpp>
 
 using TCP = boost::asio::ip::tcp;
 using ErrorCode = boost::system::error_code;
 using LogLevel = CNCOnlineForwarder::Logging::Level;
+using Addresses = CNCOnlineForwarder::Utility::ResolverCache::Addresses;
 
 using CNCOnlineForwarder::Utility::makeWeakHandler;
 
 namespace CNCOnlineForwarder::TCPProxy
 {
-    template<typename... Arguments>
-    void logLine(LogLevel level, Arguments&&... arguments)
+    namespace
     {
-        return CNCOnlineForwarder::Logging::logLine<TCPProxy>(level, std::forward<Arguments>(arguments)...);
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<TCPProxy>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        // IPv4 is preferred, like for the other servers
+        std::optional<boost::asio::ip::address> chooseAddress(Addresses const& addresses)
+        {
+            if (addresses.empty())
+            {
+                return std::nullopt;
+            }
+            auto const v4 = std::find_if(addresses.begin(), addresses.end(), [](auto const& address)
+            {
+                return address.is_v4();
+            });
+            return (v4 != addresses.end()) ? *v4 : addresses.front();
+        }
+
+#ifdef __linux__
+        using ReusePort = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+        constexpr auto canReusePort = true;
+#else
+        constexpr auto canReusePort = false;
+#endif
+
+        void listen(TCPProxy::Acceptor& acceptor, TCPProxy::EndPoint const& endPoint, bool const reusePort)
+        {
+            acceptor->open(endPoint.protocol());
+            acceptor->set_option(TCP::acceptor::reuse_address{ true });
+#ifdef __linux__
+            if (reusePort)
+            {
+                acceptor->set_option(ReusePort{ true });
+            }
+#else
+            (void)reusePort;
+#endif
+            acceptor->bind(endPoint);
+            acceptor->listen();
+            // The backlog is drained until accept() would block
+            acceptor->non_blocking(true);
+        }
     }
 
     std::shared_ptr<TCPProxy> TCPProxy::create
     (
         IOManager::ObjectMaker const& objectMaker,
-        std::uint16_t const localPort,
-        std::string_view const serverHostName,
-        std::uint16_t const serverPort
+        Options const& options
     )
     {
         auto const self = std::make_shared<TCPProxy>
         (
             PrivateConstructor{},
             objectMaker,
-            localPort,
-            serverHostName,
-            serverPort
+            options
         );
 
         auto const action = [](TCPProxy& self)
         {
-            logLine(LogLevel::info, "TCPProxy created.");
-            self.prepareForNextConnection();
+            logLine
+            (
+                LogLevel::info,
+                "TCPProxy listening on ", self.m_shards.front()->acceptor->local_endpoint(),
+                " with ", self.m_shards.size(), " acceptors, server ", self.m_serverHostName, ":", self.m_serverPort
+            );
+            // Connections are relayed without waiting for the DNS
+            Utility::ResolverCache::get().keepResolved(self.m_objectMaker, self.m_serverHostName);
+            for (auto const& shard : self.m_shards)
+            {
+                self.prepareForNextConnection(*shard);
+            }
         };
-        boost::asio::defer(self->m_strand, makeWeakHandler(self, action));
+        Utility::defer(self->m_strand, makeWeakHandler(self, action));
 
         return self;
     }
@@ -47,25 +99,164 @@ namespace CNCOnlineForwarder::TCPProxy
     (
         PrivateConstructor,
         IOManager::ObjectMaker const& objectMaker,
-        std::uint16_t const localPort,
-        std::string_view const/* serverHostName*/,
-        std::uint16_t const/* serverPort*/
+        Options const& options
     ) :
+        m_objectMaker{ objectMaker },
         m_strand{ objectMaker.makeStrand() },
-        m_acceptor{ m_strand, EndPoint{TCP::v4(), localPort} }
-    {}
+        m_shards{},
+        m_serverHostName{ options.serverHost },
+        m_serverPort{ options.serverPort },
+        m_mode{ options.mode },
+        m_lobbyCache{},
+        m_secretKeys{},
+        m_connections{ Diagnostics::MetricsRegistry::get().counter("tcpProxy.connections") },
+        m_acceptsPerWakeUp{ Diagnostics::MetricsRegistry::get().histogram("tcpProxy.acceptsPerWakeUp") },
+        m_acceptErrors{ Diagnostics::MetricsRegistry::get().counter("tcpProxy.acceptErrors") }
+    {
+        auto const count = canReusePort ? std::max<std::size_t>(options.acceptors, 1) : 1;
+        auto endPoint = options.localEndPoint;
+        for (auto i = std::size_t{ 0 }; i < count; ++i)
+        {
+            auto shard = std::make_unique<Shard>(objectMaker.makeStrand());
+            listen(shard->acceptor, endPoint, count > 1);
+            // The others bind the same port, even if the system chose it
+            endPoint = shard->acceptor->local_endpoint();
+            m_shards.push_back(std::move(shard));
+        }
+
+        if (m_mode == RelayMode::peerchat)
+        {
+            m_lobbyCache = std::make_shared<Peerchat::LobbyCache>(options.peerchat.cache);
+            m_secretKeys = std::make_shared<Peerchat::PeerchatConnection::SecretKeys const>(options.peerchat.secretKeys);
+        }
+    }
+
+    std::uint16_t TCPProxy::getLocalPort() const
+    {
+        return m_shards.front()->acceptor->local_endpoint().port();
+    }
+
+    void TCPProxy::prepareForNextConnection(Shard& shard)
+    {
+        // The shards live as long as the proxy, which is kept alive by the weak handler
+        auto const handler = [&shard](TCPProxy& self, ErrorCode const& code)
+        {
+            if (code == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+            if (code.failed())
+            {
+                logLine(LogLevel::error, "Wait for connections failed: ", code);
+                return self.retryLater(shard);
+            }
+            self.acceptPending(shard);
+        };
+        shard.acceptor->async_wait
+        (
+            TCP::acceptor::wait_read,
+            boost::asio::bind_executor(shard.strand, makeWeakHandler(this, handler))
+        );
+    }
 
-    void TCPProxy::prepareForNextConnection()
+    void TCPProxy::acceptPending(Shard& shard)
     {
-        auto const handler = [](TCPProxy& self, ErrorCode const& code, Socket::Type/* socket*/)
+        auto accepted = std::uint64_t{ 0 };
+        auto error = ErrorCode{};
+        for (auto i = 0; i < maxAcceptsPerWakeUp; ++i)
         {
-            self.prepareForNextConnection();
+            auto code = ErrorCode{};
+            auto socket = shard.acceptor->accept(code);
+            if ((code == boost::asio::error::would_block) || (code == boost::asio::error::try_again))
+            {
+                break;
+            }
+            // The client gave up before being accepted, the next one can still be
+            if (code == boost::asio::error::connection_aborted)
+            {
+                continue;
+            }
             if (code.failed())
             {
-                logLine(LogLevel::error, "Accept failed: ", code);
+                error = code;
+                break;
+            }
+
+            ++accepted;
+            connect(std::move(socket));
+        }
+
+        m_connections.add(accepted);
+        m_acceptsPerWakeUp.record(accepted);
+        if (error.failed())
+        {
+            // Most likely EMFILE or ENFILE: the connection stays in the backlog until descriptors are released
+            logLine(LogLevel::error, "Accept failed: ", error);
+            return retryLater(shard);
+        }
+        shard.retryDelay = {};
+        prepareForNextConnection(shard);
+    }
+
+    void TCPProxy::retryLater(Shard& shard)
+    {
+        m_acceptErrors.add();
+        shard.retryDelay = std::clamp<std::chrono::steady_clock::duration>(shard.retryDelay * 2, minRetryDelay, maxRetryDelay);
+        auto const onExpired = [&shard](TCPProxy& self, ErrorCode const& code)
+        {
+            if (code.failed())
+            {
+                return;
+            }
+            self.prepareForNextConnection(shard);
+        };
+        shard.retryTimer.asyncWait(shard.retryDelay, boost::asio::bind_executor(shard.strand, makeWeakHandler(this, onExpired)));
+    }
+
+    void TCPProxy::connect(Socket::Type&& socket)
+    {
+        auto& resolverCache = Utility::ResolverCache::get();
+        if (auto const addresses = resolverCache.tryGet(m_serverHostName); addresses.has_value())
+        {
+            if (auto const address = chooseAddress(addresses.value()); address.has_value())
+            {
+                return relay(std::move(socket), EndPoint{ address.value(), m_serverPort });
+            }
+        }
+
+        // Not resolved yet, the client waits on its socket meanwhile
+        auto const pending = std::make_shared<Socket::Type>(std::move(socket));
+        auto const onResolved = [pending](TCPProxy& self, ErrorCode const& code, Addresses const& addresses)
+        {
+            auto const address = chooseAddress(addresses);
+            if (code.failed() || !address.has_value())
+            {
+                logLine(LogLevel::error, "Failed to resolve server hostname ", self.m_serverHostName, ": ", code);
                 return;
             }
+            self.relay(std::move(*pending), EndPoint{ address.value(), self.m_serverPort });
         };
-        m_acceptor->async_accept(makeWeakHandler(this, handler));
+        resolverCache.asyncResolve
+        (
+            m_objectMaker,
+            m_serverHostName,
+            [strand = m_strand, handler = makeWeakHandler(this, onResolved)](ErrorCode const& code, Addresses const& addresses)
+            {
+                Utility::defer<TCPProxy>(strand, [handler, code, addresses]() mutable
+                {
+                    handler(code, addresses);
+                });
+            }
+        );
+    }
+
+    void TCPProxy::relay(Socket::Type&& socket, EndPoint const& serverEndPoint)
+    {
+        if (m_mode == RelayMode::peerchat)
+        {
+            Peerchat::PeerchatConnection::create(m_objectMaker, std::move(socket), serverEndPoint, m_lobbyCache, m_secretKeys);
+            return;
+        }
+        TCPConnection::create(m_objectMaker, std::move(socket), serverEndPoint, m_mode);
     }
-}
\ No newline at end of file
+}
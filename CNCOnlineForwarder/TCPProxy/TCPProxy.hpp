@@ -1,46 +1,109 @@
+#pragma once
 #include <precompiled.hpp>
 #include <IOManager.hpp>
+#include <Peerchat/PeerchatConnection.hpp>
+#include <TCPProxy/TCPConnection.hpp>
 #include <Utility/WithStrand.hpp>
 
-namespace CNCOnlineForwarder::TCPProxy 
+namespace CNCOnlineForwarder::TCPProxy
 {
-    class TCPProxy : public std::enable_shared_from_this<TCPProxy> 
+    // Accepts the connections of the players and relays each of them to the server with a TCPConnection,
+    // like peerchat (the chat and lobby server, IRC on TCP 6667).
+    // With RelayMode::peerchat, they are relayed by PeerchatConnections sharing a LobbyCache instead.
+    // On Linux, several acceptors can listen on the same port with SO_REUSEPORT, each one on its own strand,
+    // so a reconnect storm is not accepted by a single thread.
+    // On Linux, the process must ignore SIGPIPE before relaying with splice(), which cannot suppress it per call.
+    class TCPProxy : public std::enable_shared_from_this<TCPProxy>
     {
     public:
         using Strand = IOManager::StrandType;
         using EndPoint = boost::asio::ip::tcp::endpoint;
         using Acceptor = Utility::WithStrand<boost::asio::ip::tcp::acceptor>;
         using Socket = Utility::WithStrand<boost::asio::ip::tcp::socket>;
+        using Timer = Utility::WithStrand<boost::asio::steady_timer>;
         using AddressV4 = boost::asio::ip::address_v4;
+
+        struct Options
+        {
+            EndPoint localEndPoint;
+            std::string serverHost;
+            std::uint16_t serverPort = 0;
+            RelayMode mode = RelayMode::automatic;
+            // Only used with RelayMode::peerchat
+            Peerchat::PeerchatConnection::Options peerchat;
+            // The kernel spreads the connections between them. Only 1 without SO_REUSEPORT.
+            std::size_t acceptors = 1;
+        };
+
     private:
         struct PrivateConstructor {};
 
+        // A listening socket and its accept loop. The connections it accepts are set up on its strand.
+        struct Shard
+        {
+            Strand strand;
+            Acceptor acceptor;
+            // Delays the accept loop after an error, like running out of file descriptors,
+            // since the pending connection would wake it up again immediately
+            Timer retryTimer;
+            std::chrono::steady_clock::duration retryDelay;
+
+            explicit Shard(Strand const& shardStrand) :
+                strand{ shardStrand },
+                acceptor{ strand },
+                retryTimer{ strand },
+                retryDelay{}
+            {}
+        };
+
     public:
         static constexpr auto description = "TCPProxy";
+        // Connections already waiting in the backlog are accepted without waiting again
+        static constexpr auto maxAcceptsPerWakeUp = 64;
+        // Doubled after each consecutive error
+        static constexpr auto minRetryDelay = std::chrono::milliseconds{ 10 };
+        static constexpr auto maxRetryDelay = std::chrono::seconds{ 1 };
     private:
+        IOManager::ObjectMaker m_objectMaker;
         Strand m_strand;
-        Acceptor m_acceptor;
+        // Not moved, the acceptors refer to their strands
+        std::vector<std::unique_ptr<Shard>> m_shards;
+        std::string m_serverHostName;
+        std::uint16_t m_serverPort;
+        RelayMode m_mode;
+        // Shared by the connections of RelayMode::peerchat
+        std::shared_ptr<Peerchat::LobbyCache> m_lobbyCache;
+        std::shared_ptr<Peerchat::PeerchatConnection::SecretKeys const> m_secretKeys;
+        Diagnostics::Counter& m_connections;
+        Diagnostics::Histogram& m_acceptsPerWakeUp;
+        Diagnostics::Counter& m_acceptErrors;
 
     public:
         static std::shared_ptr<TCPProxy> create
         (
             IOManager::ObjectMaker const& objectMaker,
-            std::uint16_t const localPort,
-            std::string_view const serverHostName,
-            std::uint16_t const serverPort
+            Options const& options
         );
 
         TCPProxy
         (
             PrivateConstructor,
             IOManager::ObjectMaker const& objectMaker,
-            std::uint16_t const localPort,
-            std::string_view const serverHostName,
-            std::uint16_t const serverPort
+            Options const& options
         );
 
+        std::uint16_t getLocalPort() const;
+
     private:
-        void prepareForNextConnection();
+        void prepareForNextConnection(Shard& shard);
+
+        void acceptPending(Shard& shard);
+
+        void retryLater(Shard& shard);
+
+        void connect(Socket::Type&& socket);
+
+        void relay(Socket::Type&& socket, EndPoint const& serverEndPoint);
 
     };
-}
\ No newline at end of file
+}
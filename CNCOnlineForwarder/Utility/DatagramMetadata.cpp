@@ -0,0 +1,128 @@
+#include "DatagramMetadata.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <linux/net_tstamp.h>
+#endif
+
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Utility
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<DatagramMetadata>(level, std::forward<Arguments>(arguments)...);
+        }
+    }
+
+#ifdef __linux__
+    bool enableDatagramMetadata(boost::asio::ip::udp::socket& socket)
+    {
+        auto const handle = socket.native_handle();
+        auto const enabled = int{ 1 };
+        auto success = true;
+        if (::setsockopt(handle, SOL_SOCKET, SO_TIMESTAMPNS, &enabled, sizeof(enabled)) != 0)
+        {
+            logLine(LogLevel::warning, "Cannot enable SO_TIMESTAMPNS: ", std::strerror(errno));
+            success = false;
+        }
+        if (::setsockopt(handle, SOL_SOCKET, SO_RXQ_OVFL, &enabled, sizeof(enabled)) != 0)
+        {
+            logLine(LogLevel::warning, "Cannot enable SO_RXQ_OVFL: ", std::strerror(errno));
+            success = false;
+        }
+        return success;
+    }
+
+    std::size_t receiveWithMetadata
+    (
+        boost::asio::ip::udp::socket& socket,
+        boost::asio::mutable_buffer const& buffer,
+        boost::asio::ip::udp::endpoint& from,
+        DatagramMetadata& metadata,
+        ErrorCode& code
+    )
+    {
+        // Room for one timespec and one drop counter
+        alignas(::cmsghdr) auto control = std::array<char, CMSG_SPACE(sizeof(::timespec)) + CMSG_SPACE(sizeof(std::uint32_t))>{};
+        auto vector = ::iovec{ buffer.data(), buffer.size() };
+        auto message = ::msghdr{};
+        message.msg_name = from.data();
+        message.msg_namelen = static_cast<::socklen_t>(from.capacity());
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+
+        auto const result = ::recvmsg(socket.native_handle(), &message, MSG_DONTWAIT);
+        metadata.stampUserspace();
+        if (result < 0)
+        {
+            code = ErrorCode{ errno, boost::asio::error::get_system_category() };
+            return 0;
+        }
+        code = {};
+        from.resize(message.msg_namelen);
+
+        metadata.kernelTimestamp.reset();
+        for (auto header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+        {
+            if (header->cmsg_level != SOL_SOCKET)
+            {
+                continue;
+            }
+
+            if (header->cmsg_type == SCM_TIMESTAMPNS)
+            {
+                auto timestamp = ::timespec{};
+                std::memcpy(&timestamp, CMSG_DATA(header), sizeof(timestamp));
+                auto const sinceEpoch =
+                    std::chrono::seconds{ timestamp.tv_sec } + std::chrono::nanoseconds{ timestamp.tv_nsec };
+                metadata.kernelTimestamp = DatagramMetadata::SystemClock::time_point
+                {
+                    std::chrono::duration_cast<DatagramMetadata::SystemClock::duration>(sinceEpoch)
+                };
+            }
+            else if (header->cmsg_type == SO_RXQ_OVFL)
+            {
+                auto dropped = std::uint32_t{};
+                std::memcpy(&dropped, CMSG_DATA(header), sizeof(dropped));
+                metadata.droppedByKernel = dropped;
+            }
+        }
+
+        return static_cast<std::size_t>(result);
+    }
+#else
+    bool enableDatagramMetadata(boost::asio::ip::udp::socket&)
+    {
+        return false;
+    }
+
+    std::size_t receiveWithMetadata
+    (
+        boost::asio::ip::udp::socket& socket,
+        boost::asio::mutable_buffer const& buffer,
+        boost::asio::ip::udp::endpoint& from,
+        DatagramMetadata& metadata,
+        ErrorCode& code
+    )
+    {
+        socket.non_blocking(true, code);
+        if (code.failed())
+        {
+            return 0;
+        }
+        auto const result = socket.receive_from(buffer, from, 0, code);
+        metadata.stampUserspace();
+        return result;
+    }
+#endif
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Utility
+{
+    // Information about a received datagram, beside its content and source
+    struct DatagramMetadata
+    {
+        using SystemClock = std::chrono::system_clock;
+        using SteadyClock = std::chrono::steady_clock;
+
+        static constexpr auto description = "DatagramMetadata";
+
+        // When the kernel received the datagram (SO_TIMESTAMPNS),
+        // if kernel timestamps are supported by the platform
+        std::optional<SystemClock::time_point> kernelTimestamp;
+        // When the datagram was read from the socket, comparable with kernelTimestamp
+        SystemClock::time_point userspaceTimestamp;
+        // When the datagram was read from the socket, for measuring processing time
+        SteadyClock::time_point receivedAt;
+        // Total datagrams dropped by the socket so far (SO_RXQ_OVFL),
+        // if supported by the platform
+        std::optional<std::uint32_t> droppedByKernel;
+
+        // Returns: how long the datagram stayed in the socket receive queue
+        std::optional<std::chrono::nanoseconds> getQueueingDelay() const noexcept
+        {
+            if (!kernelTimestamp.has_value())
+            {
+                return std::nullopt;
+            }
+            return userspaceTimestamp - kernelTimestamp.value();
+        }
+
+        void stampUserspace() noexcept
+        {
+            userspaceTimestamp = SystemClock::now();
+            receivedAt = SteadyClock::now();
+        }
+    };
+
+    // Asks the kernel to attach receive timestamps and drop counts to datagrams.
+    // Returns: false if not supported on this platform or by this socket
+    bool enableDatagramMetadata(boost::asio::ip::udp::socket& socket);
+
+    // Non-blocking receive which also fills the metadata of the datagram.
+    // Sets code to would_block if there is nothing to receive.
+    std::size_t receiveWithMetadata
+    (
+        boost::asio::ip::udp::socket& socket,
+        boost::asio::mutable_buffer const& buffer,
+        boost::asio::ip::udp::endpoint& from,
+        DatagramMetadata& metadata,
+        boost::system::error_code& code
+    );
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
+#include <Diagnostics/EventLoopMonitor.hpp>
+#include <Utility/WeakRefHandler.hpp>
+
+namespace CNCOnlineForwarder::Utility
+{
+    // Same as boost::asio::defer, but also keeps track of
+    // how long the handler waits before being executed.
+    // Type is used to describe the handler, it can be omitted for WeakRefHandlers.
+    template<typename Type = void, typename Executor, typename Handler>
+    void defer(Executor const& executor, Handler&& handler)
+    {
+        using HandlerValue = std::decay_t<Handler>;
+        using IsWeak = IsWeakRefHandler<HandlerValue>;
+        // The queued handler is charged to the event loop, not to the caller
+        auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::handlerState };
+        if constexpr (std::is_void_v<Type>)
+        {
+            static_assert(IsWeak::value, "Type must be specified if handler is not a WeakRefHandler");
+            using Scheduled = Diagnostics::ScheduledHandler<HandlerValue, false>;
+            auto& statistics = Diagnostics::getHandlerStatistics<typename IsWeak::TargetType>();
+            boost::asio::defer(executor, Scheduled{ statistics, std::forward<Handler>(handler) });
+        }
+        else
+        {
+            // WeakRefHandlers measure their own execution time
+            using Scheduled = Diagnostics::ScheduledHandler<HandlerValue, !IsWeak::value>;
+            auto& statistics = Diagnostics::getHandlerStatistics<Type>();
+            boost::asio::defer(executor, Scheduled{ statistics, std::forward<Handler>(handler) });
+        }
+    }
+}
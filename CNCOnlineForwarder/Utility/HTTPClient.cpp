@@ -0,0 +1,572 @@
+#include "HTTPClient.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+#include <Utility/Defer.hpp>
+#include <Utility/ResolverCache.hpp>
+#include <Utility/WeakRefHandler.hpp>
+#include <Utility/WithStrand.hpp>
+
+using TCP = boost::asio::ip::tcp;
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace Http = boost::beast::http;
+
+namespace CNCOnlineForwarder::Utility
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<HTTPClient>(level, std::forward<Arguments>(arguments)...);
+        }
+    }
+
+    // A connection to a host of the pool.
+    // Its responses are read all the time, even while it is idle, so it is closed
+    // as soon as the server closes its side, instead of failing the next request.
+    // Shares the strand of the client.
+    class HTTPClient::Connection : public std::enable_shared_from_this<Connection>
+    {
+    public:
+        enum class State
+        {
+            connecting,
+            open,
+            closed,
+        };
+
+        using Parser = Http::response_parser<Http::string_body>;
+
+    private:
+        std::weak_ptr<HTTPClient> m_client;
+        std::string m_poolKey;
+        Options m_options;
+        IOManager::StrandType m_strand;
+        TCP::socket m_socket;
+        WithStrand<boost::asio::steady_timer> m_timer;
+        // Incremented when the timer is set again, so the expiration of a previous timeout is ignored
+        std::uint64_t m_timeout;
+        boost::beast::flat_buffer m_buffer; // (Must persist between reads)
+        std::optional<Parser> m_parser;
+        // Requests sent or being sent, answered in the same order
+        std::deque<std::shared_ptr<Exchange>> m_exchanges;
+        std::size_t m_written;
+        bool m_isWriting;
+        std::size_t m_answered;
+        State m_state;
+
+    public:
+        static constexpr auto description = "HTTPClient::Connection";
+        static constexpr auto allocationTag = Diagnostics::AllocationTag::http;
+
+        Connection
+        (
+            std::weak_ptr<HTTPClient> client,
+            std::string const& poolKey,
+            Options const& options,
+            IOManager::StrandType const& strand
+        ) :
+            m_client{ std::move(client) },
+            m_poolKey{ poolKey },
+            m_options{ options },
+            m_strand{ strand },
+            m_socket{ m_strand },
+            m_timer{ m_strand },
+            m_timeout{ 0 },
+            m_buffer{},
+            m_parser{},
+            m_exchanges{},
+            m_written{ 0 },
+            m_isWriting{ false },
+            m_answered{ 0 },
+            m_state{ State::connecting }
+        {}
+
+        std::string const& getPoolKey() const noexcept { return m_poolKey; }
+
+        State getState() const noexcept { return m_state; }
+
+        std::size_t getLoad() const noexcept { return m_exchanges.size(); }
+
+        bool hasAnswered() const noexcept { return m_answered > 0; }
+
+        // Pipelining is only tried on the connections the server already kept alive once
+        bool canPipeline() const noexcept
+        {
+            return (m_state == State::open) && hasAnswered() && (m_exchanges.size() < m_options.maxPipelineDepth);
+        }
+
+        void start(std::vector<TCP::endpoint> const& endPoints)
+        {
+            if (m_state != State::connecting)
+            {
+                return;
+            }
+
+            setTimeout(m_options.connectTimeout);
+            boost::asio::async_connect
+            (
+                m_socket,
+                endPoints,
+                [self = shared_from_this()](ErrorCode const& code, TCP::endpoint const& endPoint)
+                {
+                    self->onConnect(code, endPoint);
+                }
+            );
+        }
+
+        void send(std::shared_ptr<Exchange> const& exchange)
+        {
+            if (m_exchanges.empty())
+            {
+                setTimeout(m_options.responseTimeout);
+            }
+            m_exchanges.push_back(exchange);
+            writeNext();
+        }
+
+        void close(ErrorCode const& code)
+        {
+            if (m_state == State::closed)
+            {
+                return;
+            }
+            m_state = State::closed;
+
+            auto ignored = ErrorCode{};
+            m_socket.shutdown(TCP::socket::shutdown_both, ignored);
+            m_socket.close(ignored);
+            m_timer->cancel();
+
+            auto unanswered = std::move(m_exchanges);
+            m_exchanges.clear();
+            if (auto const client = m_client.lock())
+            {
+                client->onConnectionClosed(shared_from_this(), code, std::move(unanswered));
+            }
+        }
+
+    private:
+        void setTimeout(std::chrono::steady_clock::duration const timeout)
+        {
+            auto const current = ++m_timeout;
+            auto const onExpired = [weak = weak_from_this(), current](ErrorCode const& code)
+            {
+                auto const self = weak.lock();
+                if ((code == boost::asio::error::operation_aborted) || !self || (self->m_timeout != current))
+                {
+                    return;
+                }
+                self->close(boost::asio::error::timed_out);
+            };
+            m_timer.asyncWait(timeout, boost::asio::bind_executor(m_strand, onExpired));
+        }
+
+        void onConnect(ErrorCode const& code, TCP::endpoint const& endPoint)
+        {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::http };
+
+            if (code.failed())
+            {
+                logLine(LogLevel::warning, "Connect to ", m_poolKey, " failed: ", code);
+                return close(code);
+            }
+
+            if (m_state != State::connecting)
+            {
+                return;
+            }
+
+            logLine(LogLevel::debug, "Connected to ", m_poolKey, " on ", endPoint);
+            m_state = State::open;
+            setTimeout(m_exchanges.empty() ? m_options.idleTimeout : m_options.responseTimeout);
+            readNext();
+            if (auto const client = m_client.lock())
+            {
+                client->dispatch(m_poolKey);
+            }
+        }
+
+        void writeNext()
+        {
+            if ((m_state != State::open) || m_isWriting || (m_written == m_exchanges.size()))
+            {
+                return;
+            }
+
+            m_isWriting = true;
+            auto const exchange = m_exchanges[m_written];
+            Http::async_write
+            (
+                m_socket,
+                exchange->request,
+                [self = shared_from_this(), exchange](ErrorCode const& code, std::size_t const /* bytesTransferred */)
+                {
+                    self->onWrite(code);
+                }
+            );
+        }
+
+        void onWrite(ErrorCode const& code)
+        {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::http };
+
+            m_isWriting = false;
+            if (code.failed())
+            {
+                logLine(LogLevel::debug, "Write to ", m_poolKey, " failed: ", code);
+                return close(code);
+            }
+
+            ++m_written;
+            writeNext();
+        }
+
+        void readNext()
+        {
+            if (m_state != State::open)
+            {
+                return;
+            }
+
+            m_parser.emplace();
+            m_parser->body_limit(m_options.maxResponseSize);
+            Http::async_read
+            (
+                m_socket,
+                m_buffer,
+                *m_parser,
+                [self = shared_from_this()](ErrorCode const& code, std::size_t const /* bytesTransferred */)
+                {
+                    self->onRead(code);
+                }
+            );
+        }
+
+        void onRead(ErrorCode const& code)
+        {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::http };
+
+            if (code.failed())
+            {
+                // Usually the server closing an idle connection
+                auto const level = m_exchanges.empty() ? LogLevel::debug : LogLevel::warning;
+                logLine(level, "Connection to ", m_poolKey, " lost: ", code);
+                return close(code);
+            }
+
+            if (m_exchanges.empty() || (m_written == 0))
+            {
+                logLine(LogLevel::warning, "Unexpected response from ", m_poolKey, ", closing connection");
+                return close(Http::error::unexpected_body);
+            }
+
+            auto const exchange = std::move(m_exchanges.front());
+            m_exchanges.pop_front();
+            --m_written;
+            ++m_answered;
+            auto const response = std::make_shared<Response const>(m_parser->release());
+            auto const keepAlive = response->keep_alive();
+            setTimeout(m_exchanges.empty() ? m_options.idleTimeout : m_options.responseTimeout);
+
+            auto const client = m_client.lock();
+            if (client)
+            {
+                client->onResponse(exchange, {}, response);
+            }
+
+            if (!keepAlive)
+            {
+                // The requests pipelined after this one will not be answered
+                return close(Http::error::end_of_stream);
+            }
+
+            readNext();
+            if (client && m_exchanges.empty())
+            {
+                client->dispatch(m_poolKey);
+            }
+        }
+    };
+
+    std::shared_ptr<HTTPClient> HTTPClient::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        Options const& options
+    )
+    {
+        auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::http };
+        return std::make_shared<HTTPClient>(PrivateConstructor{}, objectMaker, options);
+    }
+
+    HTTPClient::HTTPClient
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        Options const& options
+    ) :
+        m_objectMaker{ objectMaker },
+        m_strand{ objectMaker.makeStrand() },
+        m_options{ options },
+        m_pools{},
+        m_exchanges{},
+        m_requests{ Diagnostics::MetricsRegistry::get().counter("http.requests") },
+        m_coalesced{ Diagnostics::MetricsRegistry::get().counter("http.coalesced") },
+        m_connections{ Diagnostics::MetricsRegistry::get().counter("http.connections") },
+        m_reused{ Diagnostics::MetricsRegistry::get().counter("http.reused") },
+        m_pipelined{ Diagnostics::MetricsRegistry::get().counter("http.pipelined") },
+        m_retries{ Diagnostics::MetricsRegistry::get().counter("http.retries") },
+        m_failures{ Diagnostics::MetricsRegistry::get().counter("http.failures") }
+    {
+        m_options.maxConnectionsPerHost = std::max<std::size_t>(m_options.maxConnectionsPerHost, 1);
+        m_options.maxPipelineDepth = std::max<std::size_t>(m_options.maxPipelineDepth, 1);
+    }
+
+    void HTTPClient::asyncGet(Get get, Handler handler)
+    {
+        auto action = [get = std::move(get), handler = std::move(handler)](HTTPClient& self) mutable
+        {
+            self.startGet(get, std::move(handler));
+        };
+        Utility::defer(m_strand, makeWeakHandler(this, std::move(action)));
+    }
+
+    std::string HTTPClient::getPoolKey(std::string_view const host, std::uint16_t const port)
+    {
+        auto key = std::string{ host };
+        key += ':';
+        key += std::to_string(port);
+        return key;
+    }
+
+    void HTTPClient::startGet(Get const& get, Handler&& handler)
+    {
+        m_requests.add();
+
+        auto poolKey = getPoolKey(get.host, get.port);
+        auto key = poolKey + get.target;
+        for (auto const& [name, value] : get.fields)
+        {
+            key += '\n';
+            key += name;
+            key += ": ";
+            key += value;
+        }
+
+        if (auto const existing = m_exchanges.find(key); existing != m_exchanges.end())
+        {
+            m_coalesced.add();
+            existing->second->handlers.push_back(std::move(handler));
+            return;
+        }
+
+        auto const exchange = std::make_shared<Exchange>();
+        exchange->key = key;
+        exchange->poolKey = poolKey;
+        exchange->handlers.push_back(std::move(handler));
+
+        auto& request = exchange->request;
+        request.version(11);
+        request.method(Http::verb::get);
+        request.target(get.target);
+        request.set(Http::field::host, (get.port == 80) ? get.host : poolKey);
+        request.set(Http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+        for (auto const& [name, value] : get.fields)
+        {
+            request.set(name, value);
+        }
+        request.keep_alive(true);
+
+        logLine(LogLevel::debug, "GET ", poolKey, get.target);
+        m_exchanges.emplace(std::move(key), exchange);
+
+        auto& pool = m_pools[poolKey];
+        if (pool.host.empty())
+        {
+            pool.host = get.host;
+            pool.port = get.port;
+        }
+        pool.queue.push_back(exchange);
+        dispatch(poolKey);
+    }
+
+    void HTTPClient::dispatch(std::string const& poolKey)
+    {
+        auto const iterator = m_pools.find(poolKey);
+        if (iterator == m_pools.end())
+        {
+            return;
+        }
+        auto& pool = iterator->second;
+
+        // Idle connections first
+        for (auto const& connection : pool.connections)
+        {
+            if (pool.queue.empty())
+            {
+                return;
+            }
+            if ((connection->getState() == Connection::State::open) && (connection->getLoad() == 0))
+            {
+                if (connection->hasAnswered())
+                {
+                    m_reused.add();
+                }
+                connection->send(pool.queue.front());
+                pool.queue.pop_front();
+            }
+        }
+
+        // Then new connections, each of them will take a queued request once connected
+        auto connecting = static_cast<std::size_t>(std::count_if
+        (
+            pool.connections.begin(),
+            pool.connections.end(),
+            [](auto const& connection) { return connection->getState() == Connection::State::connecting; }
+        ));
+        while ((pool.queue.size() > connecting) && (pool.connections.size() < m_options.maxConnectionsPerHost))
+        {
+            connect(pool, poolKey);
+            ++connecting;
+        }
+
+        // Finally pipelining on the least busy connections
+        while (pool.queue.size() > connecting)
+        {
+            auto best = std::shared_ptr<Connection>{};
+            for (auto const& connection : pool.connections)
+            {
+                if (connection->canPipeline() && (!best || (connection->getLoad() < best->getLoad())))
+                {
+                    best = connection;
+                }
+            }
+            if (!best)
+            {
+                // Sent when a connection becomes idle
+                return;
+            }
+            m_pipelined.add();
+            best->send(pool.queue.front());
+            pool.queue.pop_front();
+        }
+    }
+
+    void HTTPClient::connect(Pool& pool, std::string const& poolKey)
+    {
+        m_connections.add();
+        auto const connection = std::make_shared<Connection>(weak_from_this(), poolKey, m_options, m_strand);
+        pool.connections.push_back(connection);
+
+        auto const onResolved = [connection, port = pool.port](ErrorCode const& code, ResolverCache::Addresses const& addresses)
+        {
+            if (code.failed())
+            {
+                logLine(LogLevel::warning, "Cannot resolve hostname: ", code);
+                return connection->close(code);
+            }
+
+            auto endPoints = std::vector<TCP::endpoint>{};
+            for (auto const& address : addresses)
+            {
+                endPoints.emplace_back(address, port);
+            }
+            connection->start(endPoints);
+        };
+        // Usually already known by the resolver cache
+        ResolverCache::get().asyncResolve
+        (
+            m_objectMaker,
+            pool.host,
+            [strand = m_strand, onResolved](ErrorCode const& code, ResolverCache::Addresses const& addresses)
+            {
+                Utility::defer<HTTPClient>(strand, [onResolved, code, addresses]
+                {
+                    onResolved(code, addresses);
+                });
+            }
+        );
+    }
+
+    bool HTTPClient::retryOrFail(std::shared_ptr<Exchange> const& exchange, ErrorCode const& code)
+    {
+        if (exchange->retries < m_options.maxRetries)
+        {
+            ++exchange->retries;
+            m_retries.add();
+            return true;
+        }
+
+        onResponse(exchange, code, nullptr);
+        return false;
+    }
+
+    void HTTPClient::onResponse(std::shared_ptr<Exchange> const& exchange, ErrorCode const& code, ResponsePointer const& response)
+    {
+        if (auto const iterator = m_exchanges.find(exchange->key); (iterator != m_exchanges.end()) && (iterator->second == exchange))
+        {
+            m_exchanges.erase(iterator);
+        }
+
+        if (code.failed())
+        {
+            m_failures.add();
+            logLine(LogLevel::warning, "GET ", exchange->key, " failed: ", code);
+        }
+
+        for (auto const& handler : exchange->handlers)
+        {
+            handler(code, response);
+        }
+    }
+
+    void HTTPClient::onConnectionClosed
+    (
+        std::shared_ptr<Connection> const& connection,
+        ErrorCode const& code,
+        std::deque<std::shared_ptr<Exchange>> unanswered
+    )
+    {
+        auto const poolKey = connection->getPoolKey();
+        auto const iterator = m_pools.find(poolKey);
+        if (iterator == m_pools.end())
+        {
+            return;
+        }
+        auto& pool = iterator->second;
+        auto& connections = pool.connections;
+        connections.erase(std::remove(connections.begin(), connections.end(), connection), connections.end());
+
+        // Sent again before the requests queued after them
+        for (auto exchange = unanswered.rbegin(); exchange != unanswered.rend(); ++exchange)
+        {
+            if (retryOrFail(*exchange, code))
+            {
+                pool.queue.push_front(*exchange);
+            }
+        }
+
+        // Without any connection left, the queued requests were waiting for the failed one
+        if (!connection->hasAnswered() && connections.empty())
+        {
+            auto queue = std::move(pool.queue);
+            pool.queue.clear();
+            for (auto const& exchange : queue)
+            {
+                if (retryOrFail(exchange, code))
+                {
+                    pool.queue.push_back(exchange);
+                }
+            }
+        }
+
+        if (connections.empty() && pool.queue.empty())
+        {
+            m_pools.erase(iterator);
+            return;
+        }
+        dispatch(poolKey);
+    }
+}
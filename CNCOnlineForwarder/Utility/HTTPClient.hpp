@@ -0,0 +1,137 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
+#include <Diagnostics/Metrics.hpp>
+
+namespace CNCOnlineForwarder::Utility
+{
+    // HTTP/1.1 client for upstream servers which are called over and over.
+    // Connections are kept alive in a pool per host and port. When all of them are busy,
+    // requests are pipelined on the connections the server already kept alive once.
+    // Identical GETs in flight at the same time share a single request.
+    // GETs are idempotent, so the requests lost with a connection (usually closed by the server
+    // while it was idle) are sent again, up to maxRetries times.
+    // Safe to use from any thread.
+    class HTTPClient : public std::enable_shared_from_this<HTTPClient>
+    {
+    public:
+        using ErrorCode = boost::system::error_code;
+        using Response = boost::beast::http::response<boost::beast::http::string_body>;
+        using ResponsePointer = std::shared_ptr<Response const>;
+        // Called on the strand of the client, never before asyncGet returns.
+        // The response is null if the code is failed; HTTP error statuses are not failures.
+        using Handler = std::function<void(ErrorCode const&, ResponsePointer const&)>;
+
+        struct Options
+        {
+            std::chrono::steady_clock::duration connectTimeout = std::chrono::seconds{ 10 };
+            // From sending a request to the end of its response
+            std::chrono::steady_clock::duration responseTimeout = std::chrono::seconds{ 30 };
+            // Connections without requests are closed after this
+            std::chrono::steady_clock::duration idleTimeout = std::chrono::seconds{ 30 };
+            std::size_t maxConnectionsPerHost = 4;
+            // Requests sent on a connection before their responses, 1 disables pipelining
+            std::size_t maxPipelineDepth = 4;
+            // Times a request is sent again after its connection failed
+            std::size_t maxRetries = 2;
+            std::uint64_t maxResponseSize = 8 * 1024 * 1024;
+        };
+
+        struct Get
+        {
+            std::string host;
+            std::uint16_t port = 80;
+            std::string target = "/";
+            // Additional header fields, like If-None-Match
+            std::vector<std::pair<std::string, std::string>> fields;
+        };
+
+    private:
+        struct PrivateConstructor {};
+        class Connection;
+
+        using Request = boost::beast::http::request<boost::beast::http::empty_body>;
+
+        // A request, and everyone waiting for its response
+        struct Exchange
+        {
+            std::string key;
+            std::string poolKey;
+            Request request;
+            std::size_t retries = 0;
+            std::vector<Handler> handlers;
+        };
+
+        struct Pool
+        {
+            std::string host;
+            std::uint16_t port = 0;
+            std::vector<std::shared_ptr<Connection>> connections;
+            // Requests not given to a connection yet
+            std::deque<std::shared_ptr<Exchange>> queue;
+        };
+
+        IOManager::ObjectMaker m_objectMaker;
+        IOManager::StrandType m_strand;
+        Options m_options;
+        // By host and port
+        std::unordered_map<std::string, Pool> m_pools;
+        // Requests not answered yet, by host, port, target and fields
+        std::unordered_map<std::string, std::shared_ptr<Exchange>> m_exchanges;
+        Diagnostics::Counter& m_requests;
+        Diagnostics::Counter& m_coalesced;
+        Diagnostics::Counter& m_connections;
+        Diagnostics::Counter& m_reused;
+        Diagnostics::Counter& m_pipelined;
+        Diagnostics::Counter& m_retries;
+        Diagnostics::Counter& m_failures;
+
+    public:
+        static constexpr auto description = "HTTPClient";
+        static constexpr auto allocationTag = Diagnostics::AllocationTag::http;
+
+        static std::shared_ptr<HTTPClient> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            Options const& options
+        );
+
+        HTTPClient
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            Options const& options
+        );
+
+        HTTPClient(HTTPClient const&) = delete;
+        HTTPClient& operator=(HTTPClient const&) = delete;
+
+        // If the client is destroyed, the requests not answered yet are abandoned,
+        // and its busy connections are closed by their timeouts.
+        void asyncGet(Get get, Handler handler);
+
+    private:
+        static std::string getPoolKey(std::string_view const host, std::uint16_t const port);
+
+        void startGet(Get const& get, Handler&& handler);
+
+        // Gives the queued requests of the pool to its connections, opening new ones if needed
+        void dispatch(std::string const& poolKey);
+
+        void connect(Pool& pool, std::string const& poolKey);
+
+        // Sends the exchange again if it can be retried, otherwise fails it
+        bool retryOrFail(std::shared_ptr<Exchange> const& exchange, ErrorCode const& code);
+
+        void onResponse(std::shared_ptr<Exchange> const& exchange, ErrorCode const& code, ResponsePointer const& response);
+
+        // Removes the connection from its pool, its unanswered requests are sent again or failed
+        void onConnectionClosed
+        (
+            std::shared_ptr<Connection> const& connection,
+            ErrorCode const& code,
+            std::deque<std::shared_ptr<Exchange>> unanswered
+        );
+    };
+}
@@ -0,0 +1,186 @@
+#pragma once
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Utility
+{
+    // Minimal streaming JSON writer, takes care of commas and string escaping
+    class JsonWriter
+    {
+    private:
+        std::ostream& m_out;
+        // One entry for each open object / array: whether it already has an element
+        std::vector<bool> m_hasElement;
+        bool m_afterKey;
+
+    public:
+        explicit JsonWriter(std::ostream& out) :
+            m_out{ out },
+            m_hasElement{},
+            m_afterKey{ false }
+        {}
+
+        JsonWriter& beginObject()
+        {
+            prepareValue();
+            m_out << '{';
+            m_hasElement.push_back(false);
+            return *this;
+        }
+
+        JsonWriter& endObject()
+        {
+            m_hasElement.pop_back();
+            m_out << '}';
+            return *this;
+        }
+
+        JsonWriter& beginArray()
+        {
+            prepareValue();
+            m_out << '[';
+            m_hasElement.push_back(false);
+            return *this;
+        }
+
+        JsonWriter& endArray()
+        {
+            m_hasElement.pop_back();
+            m_out << ']';
+            return *this;
+        }
+
+        JsonWriter& key(std::string_view const name)
+        {
+            prepareValue();
+            writeString(name);
+            m_out << ':';
+            m_afterKey = true;
+            return *this;
+        }
+
+        JsonWriter& value(std::string_view const text)
+        {
+            prepareValue();
+            writeString(text);
+            return *this;
+        }
+
+        JsonWriter& value(char const* text)
+        {
+            return value(std::string_view{ text });
+        }
+
+        JsonWriter& value(bool const boolean)
+        {
+            prepareValue();
+            m_out << (boolean ? "true" : "false");
+            return *this;
+        }
+
+        JsonWriter& null()
+        {
+            prepareValue();
+            m_out << "null";
+            return *this;
+        }
+
+        template<typename Number>
+        std::enable_if_t<std::is_arithmetic_v<Number>, JsonWriter&> value(Number const number)
+        {
+            prepareValue();
+            if constexpr (std::is_floating_point_v<Number>)
+            {
+                if (!std::isfinite(number))
+                {
+                    m_out << "null";
+                    return *this;
+                }
+                m_out << number;
+            }
+            else if constexpr (sizeof(Number) == 1)
+            {
+                // Don't print int8_t / uint8_t as characters
+                m_out << static_cast<int>(number);
+            }
+            else
+            {
+                m_out << number;
+            }
+            return *this;
+        }
+
+        // Writes any value printable with operator<< as a string
+        template<typename T>
+        JsonWriter& printed(T const& printable)
+        {
+            auto stream = std::ostringstream{};
+            stream << printable;
+            return value(stream.str());
+        }
+
+        template<typename T>
+        JsonWriter& member(std::string_view const name, T const& memberValue)
+        {
+            key(name);
+            return value(memberValue);
+        }
+
+    private:
+        void prepareValue()
+        {
+            if (m_afterKey)
+            {
+                m_afterKey = false;
+                return;
+            }
+
+            if (!m_hasElement.empty())
+            {
+                if (m_hasElement.back())
+                {
+                    m_out << ',';
+                }
+                m_hasElement.back() = true;
+            }
+        }
+
+        void writeString(std::string_view const text)
+        {
+            static constexpr auto hexDigits = std::string_view{ "0123456789abcdef" };
+            m_out << '"';
+            for (auto const character : text)
+            {
+                switch (character)
+                {
+                case '"':
+                    m_out << "\\\"";
+                    break;
+                case '\\':
+                    m_out << "\\\\";
+                    break;
+                case '\n':
+                    m_out << "\\n";
+                    break;
+                case '\r':
+                    m_out << "\\r";
+                    break;
+                case '\t':
+                    m_out << "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(character) < 0x20)
+                    {
+                        auto const code = static_cast<unsigned char>(character);
+                        m_out << "\\u00" << hexDigits[code >> 4] << hexDigits[code & 0xF];
+                    }
+                    else
+                    {
+                        m_out << character;
+                    }
+                    break;
+                }
+            }
+            m_out << '"';
+        }
+    };
+}
@@ -0,0 +1,283 @@
+#include "NetworkImpairment.hpp"
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Utility
+{
+    namespace
+    {
+        // Flows idle for longer than this are forgotten
+        constexpr auto flowIdleTimeout = std::chrono::minutes{ 2 };
+        constexpr auto decisionsBetweenPrunes = std::size_t{ 4096 };
+        // Minimum extra delay of reordered datagrams, when there is little or no jitter
+        constexpr auto minimumReorderDelay = std::chrono::milliseconds{ 1 };
+
+        // splitmix64
+        std::uint64_t nextRandom(std::uint64_t& state) noexcept
+        {
+            auto z = (state += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+
+        // Uniformly distributed in [0, 1)
+        double nextUniform(std::uint64_t& state) noexcept
+        {
+            return static_cast<double>(nextRandom(state) >> 11) * 0x1.0p-53;
+        }
+
+        bool happens(std::uint64_t& state, double const probability) noexcept
+        {
+            return (probability > 0) && (nextUniform(state) < probability);
+        }
+
+        double parseNumber(std::string_view const text)
+        {
+            auto const copy = std::string{ text };
+            auto end = static_cast<char*>(nullptr);
+            auto const value = std::strtod(copy.c_str(), &end);
+            if (copy.empty() || (end != copy.c_str() + copy.size()) || !std::isfinite(value) || (value < 0))
+            {
+                throw std::invalid_argument{ "NetworkImpairment: invalid number " + copy };
+            }
+            return value;
+        }
+
+        NetworkImpairment::Duration parseDuration(std::string_view text)
+        {
+            auto unit = 1e6;
+            if (text.size() >= 2 && (text.substr(text.size() - 2) == "us"))
+            {
+                unit = 1e3;
+                text.remove_suffix(2);
+            }
+            else if (text.size() >= 2 && (text.substr(text.size() - 2) == "ms"))
+            {
+                text.remove_suffix(2);
+            }
+            return NetworkImpairment::Duration{ static_cast<std::int64_t>(parseNumber(text) * unit) };
+        }
+
+        double parseProbability(std::string_view text)
+        {
+            auto scale = 1.0;
+            if (!text.empty() && (text.back() == '%'))
+            {
+                scale = 0.01;
+                text.remove_suffix(1);
+            }
+            auto const probability = parseNumber(text) * scale;
+            if (probability > 1)
+            {
+                throw std::invalid_argument{ "NetworkImpairment: probability above 1: " + std::string{ text } };
+            }
+            return probability;
+        }
+
+        NetworkImpairment::EndPoint parseEndPoint(std::string_view const text)
+        {
+            auto const colon = text.find(':');
+            auto code = boost::system::error_code{};
+            auto const address = boost::asio::ip::make_address_v4(text.substr(0, colon), code);
+            if (code.failed())
+            {
+                throw std::invalid_argument{ "NetworkImpairment: invalid address " + std::string{ text } };
+            }
+
+            auto port = 0.0;
+            if (colon != std::string_view::npos)
+            {
+                port = parseNumber(text.substr(colon + 1));
+                if (port > std::numeric_limits<std::uint16_t>::max())
+                {
+                    throw std::invalid_argument{ "NetworkImpairment: invalid port " + std::string{ text } };
+                }
+            }
+            return NetworkImpairment::EndPoint{ address, static_cast<std::uint16_t>(port) };
+        }
+    }
+
+    std::size_t NetworkImpairment::FlowKey::Hash::operator()(FlowKey const& key) const noexcept
+    {
+        auto seed = std::size_t{ key.localPort };
+        boost::hash_combine(seed, key.to.address().to_v4().to_uint());
+        boost::hash_combine(seed, key.to.port());
+        return seed;
+    }
+
+    NetworkImpairment& NetworkImpairment::get()
+    {
+        static auto impairment = NetworkImpairment{};
+        return impairment;
+    }
+
+    NetworkImpairment::NetworkImpairment() :
+        m_enabled{ false },
+        m_mutex{},
+        m_rules{},
+        m_seed{ 1 },
+        m_flows{},
+        m_decisionsSincePrune{ 0 },
+        m_impaired{ Diagnostics::MetricsRegistry::get().counter("impairment.impaired") },
+        m_dropped{ Diagnostics::MetricsRegistry::get().counter("impairment.dropped") },
+        m_duplicated{ Diagnostics::MetricsRegistry::get().counter("impairment.duplicated") },
+        m_reordered{ Diagnostics::MetricsRegistry::get().counter("impairment.reordered") }
+    {}
+
+    NetworkImpairment::Rule NetworkImpairment::parseRule(std::string_view specification)
+    {
+        auto rule = Rule{};
+        while (!specification.empty())
+        {
+            auto const comma = specification.find(',');
+            auto const item = specification.substr(0, comma);
+            specification = (comma == std::string_view::npos) ? std::string_view{} : specification.substr(comma + 1);
+
+            auto const equal = item.find('=');
+            if (equal == std::string_view::npos)
+            {
+                throw std::invalid_argument{ "NetworkImpairment: expected key=value, got " + std::string{ item } };
+            }
+            auto const key = item.substr(0, equal);
+            auto const value = item.substr(equal + 1);
+            if (key == "to")
+            {
+                rule.to = parseEndPoint(value);
+            }
+            else if (key == "latency")
+            {
+                rule.latency = parseDuration(value);
+            }
+            else if (key == "jitter")
+            {
+                rule.jitter = parseDuration(value);
+            }
+            else if (key == "loss")
+            {
+                rule.loss = parseProbability(value);
+            }
+            else if (key == "reorder")
+            {
+                rule.reorder = parseProbability(value);
+            }
+            else if (key == "duplicate")
+            {
+                rule.duplicate = parseProbability(value);
+            }
+            else
+            {
+                throw std::invalid_argument{ "NetworkImpairment: unknown key " + std::string{ key } };
+            }
+        }
+        return rule;
+    }
+
+    void NetworkImpairment::setRules(std::vector<Rule> rules, std::uint64_t const seed)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        m_enabled.store(!rules.empty(), std::memory_order_relaxed);
+        m_rules = std::move(rules);
+        m_seed = seed;
+        m_flows.clear();
+    }
+
+    NetworkImpairment::Decision NetworkImpairment::decide
+    (
+        std::uint16_t const localPort,
+        EndPoint const& to,
+        TimePoint const now
+    )
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        auto const rule = findRule(to);
+        if (rule == nullptr)
+        {
+            return Decision{ 1, {} };
+        }
+
+        if (++m_decisionsSincePrune >= decisionsBetweenPrunes)
+        {
+            pruneIdleFlows(now);
+        }
+
+        auto const key = FlowKey{ localPort, to };
+        auto [flowIterator, isNew] = m_flows.try_emplace(key);
+        auto& flow = flowIterator->second;
+        if (isNew)
+        {
+            flow.random = m_seed ^ FlowKey::Hash{}(key);
+            flow.lastDeparture = now;
+        }
+        flow.lastUsed = now;
+        m_impaired.add();
+
+        auto& random = flow.random;
+        if (happens(random, rule->loss))
+        {
+            m_dropped.add();
+            return Decision{ 0, {} };
+        }
+
+        auto delay = rule->latency;
+        if (rule->jitter.count() > 0)
+        {
+            auto const offset = (nextUniform(random) * 2 - 1) * static_cast<double>(rule->jitter.count());
+            delay = std::max(Duration{ 0 }, delay + Duration{ static_cast<Duration::rep>(offset) });
+        }
+
+        auto departure = now + delay;
+        if (happens(random, rule->reorder))
+        {
+            // Doesn't hold back the datagrams after it
+            m_reordered.add();
+            departure += std::max<Duration>(rule->jitter * 2, minimumReorderDelay);
+        }
+        else
+        {
+            departure = std::max(departure, flow.lastDeparture);
+            flow.lastDeparture = departure;
+        }
+
+        auto decision = Decision{ 1, { departure - now, departure - now } };
+        if (happens(random, rule->duplicate))
+        {
+            m_duplicated.add();
+            decision.copies = 2;
+        }
+        return decision;
+    }
+
+    NetworkImpairment::Rule const* NetworkImpairment::findRule(EndPoint const& to) const noexcept
+    {
+        for (auto const& rule : m_rules)
+        {
+            if (!rule.to.has_value())
+            {
+                return &rule;
+            }
+
+            auto const& filter = rule.to.value();
+            if ((filter.address() == to.address()) && ((filter.port() == 0) || (filter.port() == to.port())))
+            {
+                return &rule;
+            }
+        }
+        return nullptr;
+    }
+
+    void NetworkImpairment::pruneIdleFlows(TimePoint const now)
+    {
+        m_decisionsSincePrune = 0;
+        for (auto flow = m_flows.begin(); flow != m_flows.end();)
+        {
+            if ((now - flow->second.lastUsed) > flowIdleTimeout)
+            {
+                flow = m_flows.erase(flow);
+            }
+            else
+            {
+                ++flow;
+            }
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <precompiled.hpp>
+#include <Diagnostics/Metrics.hpp>
+
+namespace CNCOnlineForwarder::Utility
+{
+    // Degrades the datagrams sent by the UDP sockets of the forwarder, like a bad link would,
+    // to see how the relay and the NatNeg handshake behave under real-world conditions.
+    // Meant for benchmarks against the local NatNeg server emulator or in the simulator, disabled by default.
+    // Every flow (local port, destination) has its own random sequence derived from the seed,
+    // so a given flow is impaired the same way from one run to the next.
+    class NetworkImpairment
+    {
+    public:
+        using Duration = std::chrono::nanoseconds;
+        // Since an arbitrary epoch, the virtual one in the simulation
+        using TimePoint = std::chrono::nanoseconds;
+        using EndPoint = boost::asio::ip::udp::endpoint;
+
+        struct Rule
+        {
+            // Only datagrams sent to this address (and port, unless 0) are impaired.
+            // If not set, every datagram is.
+            std::optional<EndPoint> to;
+            Duration latency{ 0 };
+            // Added to the latency, uniformly distributed in [-jitter, jitter].
+            // Unless reordered, datagrams of a flow still leave in order.
+            Duration jitter{ 0 };
+            double loss = 0;
+            // Held back long enough to be overtaken by the next datagrams of the flow
+            double reorder = 0;
+            double duplicate = 0;
+        };
+
+        struct Decision
+        {
+            // 0 if the datagram is lost, 2 if it is duplicated
+            std::size_t copies;
+            // After which each copy must be sent
+            std::array<Duration, 2> delays;
+        };
+
+    private:
+        struct FlowKey
+        {
+            std::uint16_t localPort;
+            EndPoint to;
+
+            bool operator==(FlowKey const&) const = default;
+
+            struct Hash
+            {
+                std::size_t operator()(FlowKey const& key) const noexcept;
+            };
+        };
+
+        struct Flow
+        {
+            std::uint64_t random;
+            TimePoint lastDeparture;
+            TimePoint lastUsed;
+        };
+
+        std::atomic<bool> m_enabled;
+        std::mutex m_mutex;
+        std::vector<Rule> m_rules;
+        std::uint64_t m_seed;
+        std::unordered_map<FlowKey, Flow, FlowKey::Hash> m_flows;
+        std::size_t m_decisionsSincePrune;
+        Diagnostics::Counter& m_impaired;
+        Diagnostics::Counter& m_dropped;
+        Diagnostics::Counter& m_duplicated;
+        Diagnostics::Counter& m_reordered;
+
+    public:
+        static constexpr auto description = "NetworkImpairment";
+
+        static NetworkImpairment& get();
+
+        // Parses a comma separated list of key=value, for example
+        //      to=127.0.0.1:27902,latency=40ms,jitter=10ms,loss=2%,reorder=1%,duplicate=0.5%
+        // Durations are in milliseconds unless suffixed with us or ms, probabilities are fractions unless suffixed with %.
+        // Throws: std::invalid_argument if the specification is malformed.
+        static Rule parseRule(std::string_view const specification);
+
+        // The first matching rule applies to a datagram, an empty list disables the impairment.
+        // Should be called before the sockets start sending.
+        void setRules(std::vector<Rule> rules, std::uint64_t const seed = 1);
+
+        bool isEnabled() const noexcept
+        {
+            return m_enabled.load(std::memory_order_relaxed);
+        }
+
+        Decision decide(std::uint16_t const localPort, EndPoint const& to, TimePoint const now);
+
+    private:
+        NetworkImpairment();
+
+        Rule const* findRule(EndPoint const& to) const noexcept;
+
+        void pruneIdleFlows(TimePoint const now);
+    };
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+namespace CNCOnlineForwarder::Utility
+{
+    // Parses command line options and query parameters.
+    // Returns: nullopt unless the whole text is a number between minimum and maximum
+    template<typename Number>
+    std::optional<Number> parseNumber
+    (
+        std::string_view const text,
+        Number const minimum = std::numeric_limits<Number>::lowest(),
+        Number const maximum = std::numeric_limits<Number>::max()
+    )
+    {
+        auto number = Number{};
+        if constexpr (std::is_floating_point_v<Number>)
+        {
+            // std::from_chars for floating point is missing from some of the standard libraries we build with
+            auto const copy = std::string{ text };
+            auto end = static_cast<char*>(nullptr);
+            errno = 0;
+            number = static_cast<Number>(std::strtod(copy.c_str(), &end));
+            if (copy.empty() || (errno != 0) || (end != (copy.c_str() + copy.size())))
+            {
+                return std::nullopt;
+            }
+        }
+        else
+        {
+            auto const end = text.data() + text.size();
+            auto const [last, error] = std::from_chars(text.data(), end, number);
+            if ((error != std::errc{}) || (last != end))
+            {
+                return std::nullopt;
+            }
+        }
+        // Also rejects NaN
+        if (!((number >= minimum) && (number <= maximum)))
+        {
+            return std::nullopt;
+        }
+        return number;
+    }
+
+    // Port 0 is rejected: it would let the system choose one
+    inline std::optional<std::uint16_t> parsePort(std::string_view const text)
+    {
+        return parseNumber<std::uint16_t>(text, 1);
+    }
+}
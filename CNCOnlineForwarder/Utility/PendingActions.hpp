@@ -1,5 +1,6 @@
 #pragma once
 #include <precompiled.hpp>
+#include <Diagnostics/Tracing.hpp>
 
 namespace CNCOnlineForwarder::Utility
 {
@@ -7,8 +8,15 @@ namespace CNCOnlineForwarder::Utility
     class PendingActions
     {
     private:
+        struct PendingAction
+        {
+            typename FutureData::ActionType action;
+            // Time spent waiting for the data to become ready
+            Diagnostics::PendingSpan span;
+        };
+
         FutureData m_data;
-        std::optional<std::vector<typename FutureData::ActionType>> m_pendingActions;
+        std::optional<std::vector<PendingAction>> m_pendingActions;
 
     public:
         PendingActions(FutureData data) :
@@ -21,6 +29,11 @@ namespace CNCOnlineForwarder::Utility
             return &m_data;
         }
 
+        bool hasPendingActions() const noexcept
+        {
+            return m_pendingActions.has_value() && !m_pendingActions->empty();
+        }
+
         void trySetReady()
         {
             setReadyIf(m_pendingActions.has_value() && m_data.isReady());
@@ -35,9 +48,11 @@ namespace CNCOnlineForwarder::Utility
 
             auto actions = std::move(m_pendingActions.value());
             m_pendingActions.reset();
-            for (auto& action : actions)
+            for (auto& pending : actions)
             {
-                m_data.apply(std::move(action));
+                pending.span.finish("pending", FutureData::description);
+                auto const trace = Diagnostics::TraceContext::Scope{ pending.span.getTarget() };
+                m_data.apply(std::move(pending.action));
             }
         }
 
@@ -46,7 +61,7 @@ namespace CNCOnlineForwarder::Utility
         {
             if (m_pendingActions.has_value())
             {
-                m_pendingActions->emplace_back(std::forward<Action>(action));
+                m_pendingActions->push_back({ std::forward<Action>(action), {} });
                 return;
             }
 
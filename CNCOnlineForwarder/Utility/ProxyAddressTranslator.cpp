@@ -1,10 +1,7 @@
 #include "ProxyAddressTranslator.hpp"
 #include <precompiled.hpp>
 #include <Logging/Logging.hpp>
-#include <Utility/SimpleHTTPClient.hpp>
-#include <Utility/WeakRefHandler.hpp>
 
-using ErrorCode = boost::system::error_code;
 using LogLevel = CNCOnlineForwarder::Logging::Level;
 
 namespace CNCOnlineForwarder::Utility
@@ -17,41 +14,72 @@ namespace CNCOnlineForwarder::Utility
 
     std::shared_ptr<ProxyAddressTranslator> ProxyAddressTranslator::create
     (
-        IOManager::ObjectMaker const& objectMaker
+        IOManager::ObjectMaker const& objectMaker,
+        std::optional<AddressV4> const& fixedPublicAddress
     )
     {
-        auto const self = std::make_shared<ProxyAddressTranslator>
-        (
-            PrivateConstructor{},
-            objectMaker
-        );
-        periodicallySetPublicAddress(self);
+        if (!fixedPublicAddress.has_value())
+        {
+            return create(objectMaker, PublicAddressDiscovery::getDefaultSources());
+        }
+
+        auto const self = std::make_shared<ProxyAddressTranslator>(PrivateConstructor{});
+        log(LogLevel::info, "Using fixed public address");
+        self->setPublicAddress(fixedPublicAddress.value());
         return self;
     }
 
-    ProxyAddressTranslator::ProxyAddressTranslator
+    std::shared_ptr<ProxyAddressTranslator> ProxyAddressTranslator::create
     (
-        PrivateConstructor,
-        IOManager::ObjectMaker const& objectMaker
-    ) :
-        m_objectMaker{ objectMaker },
-        m_publicAddress{}
+        IOManager::ObjectMaker const& objectMaker,
+        std::vector<PublicAddressDiscovery::Source> sources
+    )
     {
+        auto const self = std::make_shared<ProxyAddressTranslator>(PrivateConstructor{});
+        self->m_discovery = PublicAddressDiscovery::create(objectMaker, std::move(sources), self);
+        return self;
+    }
+
+    ProxyAddressTranslator::ProxyAddressTranslator(PrivateConstructor) :
+        m_publicAddress{ AddressV4{}.to_uint() },
+        m_writerMutex{},
+        m_discovery{},
+        m_changes{ Diagnostics::MetricsRegistry::get().counter("publicAddress.changes") }
+    {
+        static_assert(std::atomic<AddressV4::uint_type>::is_always_lock_free);
     }
 
     ProxyAddressTranslator::AddressV4 ProxyAddressTranslator::getUntranslated() const
     {
-        auto const lock = std::scoped_lock{ m_mutex };
-        return m_publicAddress;
+        return AddressV4{ m_publicAddress.load(std::memory_order_relaxed) };
+    }
+
+    bool ProxyAddressTranslator::isReady() const
+    {
+        return !getUntranslated().is_unspecified();
     }
 
     void ProxyAddressTranslator::setPublicAddress(AddressV4 const& newPublicAddress)
     {
+        auto previous = AddressV4{};
+        {
+            auto const lock = std::scoped_lock{ m_writerMutex };
+            previous = AddressV4{ m_publicAddress.load(std::memory_order_relaxed) };
+            if (previous == newPublicAddress)
+            {
+                return;
+            }
+            m_publicAddress.store(newPublicAddress.to_uint(), std::memory_order_relaxed);
+        }
+
+        if (previous.is_unspecified())
         {
-            auto const lock = std::scoped_lock{ m_mutex };
-            m_publicAddress = newPublicAddress;
+            log(LogLevel::info, "Public address set to ", newPublicAddress);
+            return;
         }
-        log(LogLevel::info, "Public address updated to ", newPublicAddress);
+        // Connects are translated when they are relayed, so live sessions use the new address from now on
+        m_changes.add();
+        log(LogLevel::warning, "Public address changed from ", previous, " to ", newPublicAddress);
     }
 
     ProxyAddressTranslator::UDPEndPoint ProxyAddressTranslator::localToPublic
@@ -63,55 +91,4 @@ namespace CNCOnlineForwarder::Utility
         publicEndPoint.address(getUntranslated());
         return publicEndPoint;
     }
-
-    void ProxyAddressTranslator::periodicallySetPublicAddress
-    (
-        std::weak_ptr<ProxyAddressTranslator> const& ref
-    )
-    {
-        auto const self = ref.lock();
-        if (!self)
-        {
-            log(LogLevel::info, "ProxyAddressTranslator expired, not updating anymore");
-            return;
-        }
-
-        log(LogLevel::info, "Will update public address now.");
-
-        auto const action = [](ProxyAddressTranslator& self, std::string newIP)
-        {
-            auto ip = std::optional<AddressV4>{};
-            try 
-            {
-                boost::algorithm::trim(newIP);
-                log(LogLevel::info, "Retrieved public IP address: ", newIP);
-                ip = AddressV4::from_string(newIP);
-            }
-            catch (std::exception const& exception) 
-            {
-                log(LogLevel::error, "Failed to parse IP address ", newIP, ": ", exception.what());
-                return;
-            }
-            self.setPublicAddress(ip.value());
-        };
-        Utility::asyncHttpGet
-        (
-            self->m_objectMaker,
-            "api.ipify.org",
-            "/",
-            Utility::makeWeakHandler(self, action)
-        );
-
-        using Timer = boost::asio::steady_timer;
-        auto const timer = std::make_shared<Timer>(self->m_objectMaker.make<Timer>());
-        timer->expires_after(std::chrono::minutes{ 1 });
-        timer->async_wait([ref, timer](ErrorCode const& code)
-        {
-            if (code.failed())
-            {
-                throw std::system_error{ code, "ProxyAddressTranslator: async wait failed" };
-            }
-            periodicallySetPublicAddress(ref);
-        });
-    }
-}
\ No newline at end of file
+}
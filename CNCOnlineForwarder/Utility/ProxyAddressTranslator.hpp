@@ -1,6 +1,8 @@
 #pragma once
 #include <precompiled.hpp>
 #include <IOManager.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Utility/PublicAddressDiscovery.hpp>
 
 namespace CNCOnlineForwarder::Utility
 {
@@ -12,35 +14,42 @@ namespace CNCOnlineForwarder::Utility
     private:
         struct PrivateConstructor {};
     private:
-        IOManager::ObjectMaker m_objectMaker;
-        std::mutex mutable m_mutex;
-        AddressV4 m_publicAddress;
+        // Read on every relayed connect, from any thread, and replaced at most once a minute.
+        // The whole state is one IPv4 address, so readers only load an integer
+        // and never wait for the writer, and nothing has to be reclaimed.
+        std::atomic<AddressV4::uint_type> m_publicAddress;
+        std::mutex m_writerMutex;
+        std::shared_ptr<PublicAddressDiscovery> m_discovery;
+        Diagnostics::Counter& m_changes;
     public:
 
         static constexpr auto description = "ProxyAddressTranslator";
 
+        // If `fixedPublicAddress` is set, it's used as is, otherwise
+        // the public address is discovered with the default sources
         static std::shared_ptr<ProxyAddressTranslator> create
         (
-            IOManager::ObjectMaker const& objectMaker
+            IOManager::ObjectMaker const& objectMaker,
+            std::optional<AddressV4> const& fixedPublicAddress = std::nullopt
         );
 
-        ProxyAddressTranslator
+        // The public address is discovered with `sources`, tried in order
+        static std::shared_ptr<ProxyAddressTranslator> create
         (
-            PrivateConstructor,
-            IOManager::ObjectMaker const& objectMaker
+            IOManager::ObjectMaker const& objectMaker,
+            std::vector<PublicAddressDiscovery::Source> sources
         );
 
+        explicit ProxyAddressTranslator(PrivateConstructor);
+
         AddressV4 getUntranslated() const;
 
+        // False until the public address is known, connects must not be rewritten before
+        bool isReady() const;
+
         void setPublicAddress(AddressV4 const& newPublicAddress);
 
         UDPEndPoint localToPublic(UDPEndPoint const& endPoint) const;
-
-    private:
-        static void periodicallySetPublicAddress
-        (
-            std::weak_ptr<ProxyAddressTranslator> const& ref
-        );
     };
 }
 
@@ -0,0 +1,492 @@
+#include "PublicAddressDiscovery.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+#include <Utility/Defer.hpp>
+#include <Utility/ProxyAddressTranslator.hpp>
+#include <Utility/ResolverCache.hpp>
+#include <Utility/SimpleWriteHandler.hpp>
+#include <Utility/WeakRefHandler.hpp>
+#include <charconv>
+#include <random>
+#ifdef __linux__
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#endif
+
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Utility
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<PublicAddressDiscovery>(level, std::forward<Arguments>(arguments)...);
+        }
+
+        using Source = PublicAddressDiscovery::Source;
+        using AddressV4 = PublicAddressDiscovery::AddressV4;
+
+        constexpr auto defaultStunHost = "stun.l.google.com";
+        constexpr auto defaultStunPort = std::uint16_t{ 19302 };
+        constexpr auto defaultHttpHost = "api.ipify.org";
+        constexpr auto defaultHttpPort = std::uint16_t{ 80 };
+
+        // Parses HOST[:PORT] into source, keeping the defaults of what is omitted
+        void parseHostAndPort(std::string_view const value, Source& source)
+        {
+            auto const colon = value.find(':');
+            if (colon != 0)
+            {
+                auto const host = value.substr(0, colon);
+                source.host = host.empty() ? source.host : std::string{ host };
+            }
+            if (colon == std::string_view::npos)
+            {
+                return;
+            }
+
+            auto const port = value.substr(colon + 1);
+            auto parsed = unsigned{};
+            auto const [end, error] = std::from_chars(port.data(), port.data() + port.size(), parsed);
+            if ((error != std::errc{}) || (end != (port.data() + port.size())) || (parsed == 0) || (parsed > 65535))
+            {
+                throw std::invalid_argument{ "Invalid port in public address source: " + std::string{ value } };
+            }
+            source.port = static_cast<std::uint16_t>(parsed);
+        }
+
+        HTTPClient::Options getHttpOptions()
+        {
+            auto options = HTTPClient::Options{};
+            options.connectTimeout = PublicAddressDiscovery::attemptTimeout;
+            options.responseTimeout = PublicAddressDiscovery::attemptTimeout;
+            // Kept until the next round, unless the server closes it first
+            options.idleTimeout = PublicAddressDiscovery::refreshInterval + PublicAddressDiscovery::attemptTimeout;
+            options.maxConnectionsPerHost = 1;
+            options.maxRetries = 1;
+            return options;
+        }
+
+        // Addresses of private networks and other special purpose ranges are never the public address
+        bool isPubliclyRoutable(AddressV4 const& address) noexcept
+        {
+            auto const value = address.to_uint();
+            auto const isIn = [value](std::uint32_t const network, int const prefixLength)
+            {
+                auto const mask = ~std::uint32_t{ 0 } << (32 - prefixLength);
+                return (value & mask) == network;
+            };
+            return !isIn(0x00000000, 8)     // 0.0.0.0/8
+                && !isIn(0x0A000000, 8)     // 10.0.0.0/8
+                && !isIn(0x64400000, 10)    // 100.64.0.0/10, carrier-grade NAT
+                && !isIn(0x7F000000, 8)     // 127.0.0.0/8
+                && !isIn(0xA9FE0000, 16)    // 169.254.0.0/16
+                && !isIn(0xAC100000, 12)    // 172.16.0.0/12
+                && !isIn(0xC0000000, 24)    // 192.0.0.0/24
+                && !isIn(0xC0A80000, 16)    // 192.168.0.0/16
+                && !isIn(0xC6120000, 15)    // 198.18.0.0/15
+                && !isIn(0xE0000000, 3);    // multicast and reserved
+        }
+    }
+
+    PublicAddressDiscovery::Source PublicAddressDiscovery::parseSource(std::string_view const specification)
+    {
+        auto const colon = specification.find(':');
+        auto const kind = specification.substr(0, colon);
+        auto const value = (colon == std::string_view::npos) ? std::string_view{} : specification.substr(colon + 1);
+
+        auto source = Source{};
+        if (kind == "static")
+        {
+            auto code = ErrorCode{};
+            source.kind = Source::Kind::fixed;
+            source.address = boost::asio::ip::make_address_v4(value, code);
+            if (code.failed())
+            {
+                throw std::invalid_argument{ "Invalid static public address: " + std::string{ value } };
+            }
+        }
+        else if ((kind == "interface") && value.empty())
+        {
+            source.kind = Source::Kind::interface;
+        }
+        else if (kind == "stun")
+        {
+            source.kind = Source::Kind::stun;
+            source.host = defaultStunHost;
+            source.port = defaultStunPort;
+            parseHostAndPort(value, source);
+        }
+        else if (kind == "http")
+        {
+            auto const slash = value.find('/');
+            source.kind = Source::Kind::http;
+            source.host = defaultHttpHost;
+            source.port = defaultHttpPort;
+            source.target = (slash == std::string_view::npos) ? "/" : std::string{ value.substr(slash) };
+            parseHostAndPort(value.substr(0, slash), source);
+        }
+        else
+        {
+            throw std::invalid_argument{ "Unknown public address source: " + std::string{ specification } };
+        }
+        return source;
+    }
+
+    std::vector<PublicAddressDiscovery::Source> PublicAddressDiscovery::getDefaultSources()
+    {
+        return { parseSource("interface"), parseSource("stun"), parseSource("http") };
+    }
+
+    std::string PublicAddressDiscovery::describe(Source const& source)
+    {
+        auto text = std::ostringstream{};
+        switch (source.kind)
+        {
+        case Source::Kind::fixed:
+            text << "static:" << source.address;
+            break;
+        case Source::Kind::interface:
+            text << "interface";
+            break;
+        case Source::Kind::stun:
+            text << "stun:" << source.host << ':' << source.port;
+            break;
+        case Source::Kind::http:
+            text << "http:" << source.host << ':' << source.port << source.target;
+            break;
+        }
+        return text.str();
+    }
+
+    std::shared_ptr<PublicAddressDiscovery> PublicAddressDiscovery::create
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        std::vector<Source> sources,
+        std::weak_ptr<ProxyAddressTranslator> const& translator
+    )
+    {
+        auto const self = std::make_shared<PublicAddressDiscovery>
+        (
+            PrivateConstructor{},
+            objectMaker,
+            std::move(sources),
+            translator
+        );
+
+        auto const action = [](PublicAddressDiscovery& self)
+        {
+            auto sources = std::ostringstream{};
+            for (auto const& source : self.m_sources)
+            {
+                sources << ' ' << describe(source);
+            }
+            logLine(LogLevel::info, "Discovering the public address with:", sources.str());
+            self.startRound();
+        };
+        Utility::defer(self->m_strand, makeWeakHandler(self, action));
+
+        return self;
+    }
+
+    PublicAddressDiscovery::PublicAddressDiscovery
+    (
+        PrivateConstructor,
+        IOManager::ObjectMaker const& objectMaker,
+        std::vector<Source> sources,
+        std::weak_ptr<ProxyAddressTranslator> const& translator
+    ) :
+        m_objectMaker{ objectMaker },
+        m_strand{ objectMaker.makeStrand() },
+        m_sources{ std::move(sources) },
+        m_translator{ translator },
+        m_attemptTimer{ m_strand },
+        m_roundTimer{ m_strand },
+        m_nextSource{ 0 },
+        m_attempt{ 0 },
+        m_stunSocket{},
+        m_stunBuffer{},
+        m_stunFrom{},
+        m_stunTransaction{},
+        m_stunAttempt{ 0 },
+        m_httpClient{ HTTPClient::create(objectMaker, getHttpOptions()) },
+        m_failures{ Diagnostics::MetricsRegistry::get().counter("publicAddress.failures") }
+    {}
+
+    void PublicAddressDiscovery::startRound()
+    {
+        m_nextSource = 0;
+        tryNextSource();
+    }
+
+    void PublicAddressDiscovery::scheduleRound(std::chrono::steady_clock::duration const delay)
+    {
+        auto const onExpired = [](PublicAddressDiscovery& self, ErrorCode const& code)
+        {
+            if (code == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+            self.startRound();
+        };
+        m_roundTimer.asyncWait(delay, boost::asio::bind_executor(m_strand, makeWeakHandler(this, onExpired)));
+    }
+
+    void PublicAddressDiscovery::tryNextSource()
+    {
+        if (m_nextSource == m_sources.size())
+        {
+            m_failures.add();
+            auto const translator = m_translator.lock();
+            auto const isKnown = translator && translator->isReady();
+            logLine
+            (
+                isKnown ? LogLevel::warning : LogLevel::error,
+                "No source found the public address, ",
+                isKnown ? "keeping the previous one" : "sessions cannot be accepted yet"
+            );
+            scheduleRound(isKnown ? std::chrono::steady_clock::duration{ refreshInterval } : std::chrono::steady_clock::duration{ retryInterval });
+            return;
+        }
+
+        auto const& source = m_sources[m_nextSource];
+        ++m_nextSource;
+        auto const attempt = ++m_attempt;
+        auto const onTimeout = [attempt](PublicAddressDiscovery& self, ErrorCode const& code)
+        {
+            if (code == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+            logLine(LogLevel::warning, "No answer from ", describe(self.m_sources[self.m_nextSource - 1]));
+            self.finishAttempt(attempt, std::nullopt);
+        };
+        m_attemptTimer.asyncWait(attemptTimeout, boost::asio::bind_executor(m_strand, makeWeakHandler(this, onTimeout)));
+
+        switch (source.kind)
+        {
+        case Source::Kind::fixed:
+            finishAttempt(attempt, source.address);
+            break;
+        case Source::Kind::interface:
+            discoverOnInterfaces(attempt);
+            break;
+        case Source::Kind::stun:
+            discoverWithStun(attempt, source);
+            break;
+        case Source::Kind::http:
+            discoverWithHttp(attempt, source);
+            break;
+        }
+    }
+
+    void PublicAddressDiscovery::finishAttempt(std::uint64_t const attempt, std::optional<AddressV4> const& address)
+    {
+        if (attempt != m_attempt)
+        {
+            return;
+        }
+        // Late answers of this attempt will be ignored
+        ++m_attempt;
+        m_attemptTimer->cancel();
+
+        auto const& source = m_sources[m_nextSource - 1];
+        if (!address.has_value() || address->is_unspecified())
+        {
+            logLine(LogLevel::info, describe(source), " did not find the public address");
+            tryNextSource();
+            return;
+        }
+
+        auto const translator = m_translator.lock();
+        if (!translator)
+        {
+            logLine(LogLevel::info, "ProxyAddressTranslator expired, not updating anymore");
+            return;
+        }
+        logLine(LogLevel::info, "Public address ", address.value(), " found by ", describe(source));
+        translator->setPublicAddress(address.value());
+        scheduleRound(refreshInterval);
+    }
+
+    void PublicAddressDiscovery::discoverOnInterfaces(std::uint64_t const attempt)
+    {
+#ifdef __linux__
+        auto* interfaces = static_cast<ifaddrs*>(nullptr);
+        if (getifaddrs(&interfaces) != 0)
+        {
+            logLine(LogLevel::error, "Cannot enumerate network interfaces: ", std::strerror(errno));
+            finishAttempt(attempt, std::nullopt);
+            return;
+        }
+
+        auto found = std::optional<AddressV4>{};
+        for (auto const* i = interfaces; i != nullptr; i = i->ifa_next)
+        {
+            if ((i->ifa_addr == nullptr)
+                || (i->ifa_addr->sa_family != AF_INET)
+                || ((i->ifa_flags & IFF_UP) == 0)
+                || ((i->ifa_flags & IFF_LOOPBACK) != 0))
+            {
+                continue;
+            }
+            auto const& internet = *reinterpret_cast<sockaddr_in const*>(i->ifa_addr);
+            auto const address = AddressV4{ boost::endian::big_to_native(internet.sin_addr.s_addr) };
+            if (isPubliclyRoutable(address))
+            {
+                found = address;
+                break;
+            }
+        }
+        freeifaddrs(interfaces);
+        finishAttempt(attempt, found);
+#else
+        logLine(LogLevel::info, "Enumerating network interfaces is not supported on this platform");
+        finishAttempt(attempt, std::nullopt);
+#endif
+    }
+
+    void PublicAddressDiscovery::discoverWithStun(std::uint64_t const attempt, Source const& source)
+    {
+        if (!m_stunSocket)
+        {
+            m_stunSocket = std::make_unique<Socket>(m_strand, EndPoint{ boost::asio::ip::udp::v4(), 0 });
+            prepareForNextStunResponse();
+        }
+
+        auto const onResolved = [attempt, port = source.port]
+        (
+            PublicAddressDiscovery& self,
+            ErrorCode const& code,
+            ResolverCache::Addresses const& addresses
+        )
+        {
+            if (attempt != self.m_attempt)
+            {
+                return;
+            }
+            auto const address = std::find_if(addresses.begin(), addresses.end(), [](auto const& address)
+            {
+                return address.is_v4();
+            });
+            if (code.failed() || (address == addresses.end()))
+            {
+                logLine(LogLevel::warning, "Cannot resolve STUN server: ", code);
+                self.finishAttempt(attempt, std::nullopt);
+                return;
+            }
+
+            auto random = std::random_device{};
+            for (auto& byte : self.m_stunTransaction)
+            {
+                byte = static_cast<std::uint8_t>(random());
+            }
+            self.m_stunAttempt = attempt;
+            auto writeHandler = makeWriteHandler<PublicAddressDiscovery>(Stun::makeBindingRequest(self.m_stunTransaction));
+            self.m_stunSocket->asyncSendTo
+            (
+                writeHandler.getData(),
+                EndPoint{ *address, port },
+                std::move(writeHandler)
+            );
+        };
+        ResolverCache::get().asyncResolve
+        (
+            m_objectMaker,
+            source.host,
+            [strand = m_strand, handler = makeWeakHandler(this, onResolved)]
+            (
+                ErrorCode const& code,
+                ResolverCache::Addresses const& addresses
+            )
+            {
+                Utility::defer<PublicAddressDiscovery>(strand, [handler, code, addresses]() mutable
+                {
+                    handler(code, addresses);
+                });
+            }
+        );
+    }
+
+    void PublicAddressDiscovery::prepareForNextStunResponse()
+    {
+        auto const onReceived = [](PublicAddressDiscovery& self, ErrorCode const& code, std::size_t const bytesReceived)
+        {
+            if (code == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+
+            if (code.failed())
+            {
+                logLine(LogLevel::error, "STUN receive failed: ", code);
+            }
+            else
+            {
+                auto const data = std::string_view{ self.m_stunBuffer.data(), bytesReceived };
+                auto const mapped = Stun::parseBindingResponse(data, self.m_stunTransaction);
+                if (mapped.has_value())
+                {
+                    self.finishAttempt(self.m_stunAttempt, mapped->address().to_v4());
+                }
+                else
+                {
+                    logLine(LogLevel::warning, "Unexpected datagram from ", self.m_stunFrom, ", discarded");
+                }
+            }
+            self.prepareForNextStunResponse();
+        };
+        m_stunSocket->asyncReceiveFrom
+        (
+            boost::asio::buffer(m_stunBuffer),
+            m_stunFrom,
+            makeWeakHandler(this, onReceived)
+        );
+    }
+
+    void PublicAddressDiscovery::discoverWithHttp(std::uint64_t const attempt, Source const& source)
+    {
+        auto const onGet = [attempt](PublicAddressDiscovery& self, ErrorCode const& code, HTTPClient::ResponsePointer const& response)
+        {
+            if (code.failed())
+            {
+                self.finishAttempt(attempt, std::nullopt);
+                return;
+            }
+
+            if (response->result() != boost::beast::http::status::ok)
+            {
+                logLine(LogLevel::error, "Unexpected HTTP status ", response->result_int());
+                self.finishAttempt(attempt, std::nullopt);
+                return;
+            }
+
+            auto body = boost::algorithm::trim_copy(response->body());
+            auto parseError = ErrorCode{};
+            auto const address = boost::asio::ip::make_address_v4(body, parseError);
+            if (parseError.failed())
+            {
+                logLine(LogLevel::error, "Failed to parse IP address ", body, ": ", parseError);
+                self.finishAttempt(attempt, std::nullopt);
+                return;
+            }
+            self.finishAttempt(attempt, address);
+        };
+        // Answered on the strand of the client
+        m_httpClient->asyncGet
+        (
+            HTTPClient::Get{ source.host, source.port, source.target, {} },
+            [strand = m_strand, handler = makeWeakHandler(this, onGet)](ErrorCode const& code, HTTPClient::ResponsePointer const& response)
+            {
+                Utility::defer<PublicAddressDiscovery>(strand, [handler, code, response]() mutable
+                {
+                    handler(code, response);
+                });
+            }
+        );
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <Diagnostics/Metrics.hpp>
+#include <Utility/HTTPClient.hpp>
+#include <Utility/StunMessage.hpp>
+#include <Utility/WithStrand.hpp>
+
+namespace CNCOnlineForwarder::Utility
+{
+    class ProxyAddressTranslator;
+
+    // Finds out the public address of the forwarder, which is written in the connects sent to the players.
+    // Sources are tried in order until one of them answers, then again every refreshInterval,
+    // so a change of the public address is noticed. Until the first answer, every source is retried
+    // every retryInterval.
+    class PublicAddressDiscovery : public std::enable_shared_from_this<PublicAddressDiscovery>
+    {
+    public:
+        using AddressV4 = boost::asio::ip::address_v4;
+        using EndPoint = boost::asio::ip::udp::endpoint;
+        using Socket = WithStrand<boost::asio::ip::udp::socket>;
+        using Timer = WithStrand<boost::asio::steady_timer>;
+
+        struct Source
+        {
+            enum class Kind
+            {
+                // A configured address
+                fixed,
+                // The first publicly routable address of the network interfaces, if the forwarder is not behind a NAT
+                interface,
+                // The mapped address of a STUN binding request
+                stun,
+                // The body of an HTTP GET, like api.ipify.org
+                http,
+            };
+
+            Kind kind = Kind::fixed;
+            AddressV4 address;
+            std::string host;
+            std::uint16_t port = 0;
+            std::string target;
+        };
+
+        static constexpr auto attemptTimeout = std::chrono::seconds{ 5 };
+        static constexpr auto retryInterval = std::chrono::seconds{ 10 };
+        static constexpr auto refreshInterval = std::chrono::minutes{ 1 };
+
+    private:
+        struct PrivateConstructor {};
+
+        IOManager::ObjectMaker m_objectMaker;
+        IOManager::StrandType m_strand;
+        std::vector<Source> m_sources;
+        std::weak_ptr<ProxyAddressTranslator> m_translator;
+        Timer m_attemptTimer;
+        Timer m_roundTimer;
+        std::size_t m_nextSource;
+        // Answers of timed out attempts are ignored
+        std::uint64_t m_attempt;
+        std::unique_ptr<Socket> m_stunSocket;
+        std::array<char, 512> m_stunBuffer;
+        EndPoint m_stunFrom;
+        Stun::TransactionID m_stunTransaction;
+        std::uint64_t m_stunAttempt;
+        std::shared_ptr<HTTPClient> m_httpClient;
+        Diagnostics::Counter& m_failures;
+
+    public:
+        static constexpr auto description = "PublicAddressDiscovery";
+
+        // Parses one of
+        //      static:IPV4
+        //      interface
+        //      stun[:HOST[:PORT]]                  (default stun.l.google.com:19302)
+        //      http[:HOST[:PORT][/TARGET]]         (default api.ipify.org:80/)
+        // Throws: std::invalid_argument if the specification is malformed.
+        static Source parseSource(std::string_view const specification);
+
+        // interface, then STUN, then HTTP
+        static std::vector<Source> getDefaultSources();
+
+        // Starts the discovery, the results are given to translator
+        static std::shared_ptr<PublicAddressDiscovery> create
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            std::vector<Source> sources,
+            std::weak_ptr<ProxyAddressTranslator> const& translator
+        );
+
+        PublicAddressDiscovery
+        (
+            PrivateConstructor,
+            IOManager::ObjectMaker const& objectMaker,
+            std::vector<Source> sources,
+            std::weak_ptr<ProxyAddressTranslator> const& translator
+        );
+
+        PublicAddressDiscovery(PublicAddressDiscovery const&) = delete;
+        PublicAddressDiscovery& operator=(PublicAddressDiscovery const&) = delete;
+
+        static std::string describe(Source const& source);
+
+    private:
+        void startRound();
+
+        void scheduleRound(std::chrono::steady_clock::duration const delay);
+
+        void tryNextSource();
+
+        void finishAttempt(std::uint64_t const attempt, std::optional<AddressV4> const& address);
+
+        void discoverOnInterfaces(std::uint64_t const attempt);
+
+        void discoverWithStun(std::uint64_t const attempt, Source const& source);
+
+        void prepareForNextStunResponse();
+
+        void discoverWithHttp(std::uint64_t const attempt, Source const& source);
+    };
+}
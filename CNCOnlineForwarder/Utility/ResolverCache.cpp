@@ -0,0 +1,281 @@
+#include "ResolverCache.hpp"
+#include <precompiled.hpp>
+#include <Logging/Logging.hpp>
+#include <Utility/WithStrand.hpp>
+
+using ErrorCode = boost::system::error_code;
+using LogLevel = CNCOnlineForwarder::Logging::Level;
+
+namespace CNCOnlineForwarder::Utility
+{
+    namespace
+    {
+        template<typename... Arguments>
+        void logLine(LogLevel const level, Arguments&&... arguments)
+        {
+            return Logging::logLine<ResolverCache>(level, std::forward<Arguments>(arguments)...);
+        }
+    }
+
+    // A resolution of a host, and the timer of its next refresh.
+    // Kept alive by its pending operations only, so it never outlives the IOManager.
+    class ResolverCache::Lookup : public std::enable_shared_from_this<Lookup>
+    {
+    private:
+        IOManager::StrandType m_strand;
+        WithStrand<boost::asio::ip::udp::resolver> m_resolver;
+        WithStrand<boost::asio::steady_timer> m_timer;
+        std::string m_host;
+
+    public:
+        Lookup(IOManager::ObjectMaker const& objectMaker, std::string const& host) :
+            m_strand{ objectMaker.makeStrand() },
+            m_resolver{ m_strand },
+            m_timer{ m_strand },
+            m_host{ host }
+        {}
+
+        std::string const& getHost() const noexcept { return m_host; }
+
+        void resolve()
+        {
+            // Only the addresses are cached, the port is chosen by the users of the cache
+            m_resolver.asyncResolve
+            (
+                m_host,
+                "0",
+                [self = shared_from_this()](ErrorCode const& code, boost::asio::ip::udp::resolver::results_type const& results)
+                {
+                    auto addresses = Addresses{};
+                    if (!code.failed())
+                    {
+                        for (auto const& result : results)
+                        {
+                            auto const address = result.endpoint().address();
+                            if (std::find(addresses.begin(), addresses.end(), address) == addresses.end())
+                            {
+                                addresses.push_back(address);
+                            }
+                        }
+                    }
+                    ResolverCache::get().finishResolving(self, code, std::move(addresses));
+                }
+            );
+        }
+
+        void refreshAfter(std::chrono::steady_clock::duration const delay)
+        {
+            m_timer.asyncWait(delay, [self = shared_from_this()](ErrorCode const& code)
+            {
+                if (code == boost::asio::error::operation_aborted)
+                {
+                    return;
+                }
+                ResolverCache::get().refresh(self);
+            });
+        }
+    };
+
+    ResolverCache& ResolverCache::get()
+    {
+        static auto cache = ResolverCache{};
+        return cache;
+    }
+
+    ResolverCache::ResolverCache() :
+        m_mutex{},
+        m_entries{},
+        m_hits{ Diagnostics::MetricsRegistry::get().counter("resolver.hits") },
+        m_misses{ Diagnostics::MetricsRegistry::get().counter("resolver.misses") },
+        m_coalesced{ Diagnostics::MetricsRegistry::get().counter("resolver.coalesced") },
+        m_negativeHits{ Diagnostics::MetricsRegistry::get().counter("resolver.negativeHits") },
+        m_refreshes{ Diagnostics::MetricsRegistry::get().counter("resolver.refreshes") },
+        m_failures{ Diagnostics::MetricsRegistry::get().counter("resolver.failures") }
+    {}
+
+    ResolverCache::TimePoint ResolverCache::now() noexcept
+    {
+#ifdef CNCONLINEFORWARDER_SIMULATION
+        return Simulation::VirtualNetwork::get().now();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch();
+#endif
+    }
+
+    std::optional<ResolverCache::Addresses> ResolverCache::tryGet(std::string const& host)
+    {
+        auto const lock = std::scoped_lock{ m_mutex };
+        auto const entry = m_entries.find(host);
+        if ((entry == m_entries.end()) || entry->second.addresses.empty() || (now() >= entry->second.expiresAt))
+        {
+            return std::nullopt;
+        }
+        m_hits.add();
+        return entry->second.addresses;
+    }
+
+    void ResolverCache::asyncResolve
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        std::string const& host,
+        Handler handler
+    )
+    {
+        auto lookup = std::shared_ptr<Lookup>{};
+        auto isCached = false;
+        auto code = ErrorCode{};
+        auto addresses = Addresses{};
+        {
+            auto const lock = std::scoped_lock{ m_mutex };
+            auto& entry = m_entries[host];
+            auto const currentTime = now();
+            isCached = (currentTime < entry.expiresAt);
+            if (isCached)
+            {
+                if (entry.addresses.empty())
+                {
+                    m_negativeHits.add();
+                    code = entry.error;
+                }
+                else
+                {
+                    m_hits.add();
+                    addresses = entry.addresses;
+                    // Hosts not kept resolved are refreshed by their users
+                    if (!entry.isKeptResolved && !entry.isResolving && ((entry.expiresAt - currentTime) < refreshAhead))
+                    {
+                        m_refreshes.add();
+                        lookup = startResolving(objectMaker, host, entry);
+                    }
+                }
+            }
+            else
+            {
+                entry.waiters.push_back(std::move(handler));
+                if (entry.isResolving)
+                {
+                    m_coalesced.add();
+                    return;
+                }
+                m_misses.add();
+                lookup = startResolving(objectMaker, host, entry);
+            }
+        }
+
+        if (lookup)
+        {
+            lookup->resolve();
+        }
+        if (isCached)
+        {
+            handler(code, addresses);
+        }
+    }
+
+    void ResolverCache::keepResolved(IOManager::ObjectMaker const& objectMaker, std::string const& host)
+    {
+        auto lookup = std::shared_ptr<Lookup>{};
+        {
+            auto const lock = std::scoped_lock{ m_mutex };
+            auto& entry = m_entries[host];
+            entry.isKeptResolved = true;
+            if (entry.isResolving)
+            {
+                // The refresh will be scheduled when it completes
+                return;
+            }
+            lookup = startResolving(objectMaker, host, entry);
+        }
+        logLine(LogLevel::info, "Keeping ", host, " resolved");
+        lookup->resolve();
+    }
+
+    std::shared_ptr<ResolverCache::Lookup> ResolverCache::startResolving
+    (
+        IOManager::ObjectMaker const& objectMaker,
+        std::string const& host,
+        Entry& entry
+    )
+    {
+        // A new lookup every time, the previous one might belong to an IOManager which is gone
+        auto const lookup = std::make_shared<Lookup>(objectMaker, host);
+        entry.isResolving = true;
+        entry.lookup = lookup;
+        return lookup;
+    }
+
+    void ResolverCache::refresh(std::shared_ptr<Lookup> const& lookup)
+    {
+        {
+            auto const lock = std::scoped_lock{ m_mutex };
+            auto& entry = m_entries[lookup->getHost()];
+            // Superseded by a more recent lookup
+            if (entry.isResolving || (entry.lookup.lock() != lookup))
+            {
+                return;
+            }
+            entry.isResolving = true;
+            m_refreshes.add();
+        }
+        lookup->resolve();
+    }
+
+    void ResolverCache::finishResolving
+    (
+        std::shared_ptr<Lookup> const& lookup,
+        ErrorCode const& code,
+        Addresses addresses
+    )
+    {
+        auto waiters = std::vector<Handler>{};
+        auto resultCode = ErrorCode{};
+        auto resultAddresses = Addresses{};
+        {
+            auto const lock = std::scoped_lock{ m_mutex };
+            auto& entry = m_entries[lookup->getHost()];
+            auto const currentTime = now();
+            entry.isResolving = false;
+            if (!code.failed() && !addresses.empty())
+            {
+                entry.addresses = std::move(addresses);
+                entry.error = {};
+                entry.expiresAt = currentTime + timeToLive;
+            }
+            else
+            {
+                m_failures.add();
+                entry.error = code.failed() ? code : ErrorCode{ boost::asio::error::host_not_found };
+                logLine(LogLevel::warning, "Cannot resolve ", lookup->getHost(), ": ", entry.error);
+                // Previous addresses are still better than nothing until they expire
+                if (entry.addresses.empty() || (currentTime >= entry.expiresAt))
+                {
+                    entry.addresses.clear();
+                    entry.expiresAt = currentTime + negativeTimeToLive;
+                }
+            }
+
+            if (entry.addresses.empty())
+            {
+                resultCode = entry.error;
+            }
+            else
+            {
+                resultAddresses = entry.addresses;
+            }
+            waiters.swap(entry.waiters);
+
+            if (entry.isKeptResolved && (entry.lookup.lock() == lookup))
+            {
+                auto const delay = entry.error.failed()
+                    ? std::chrono::steady_clock::duration{ negativeTimeToLive }
+                    : std::chrono::steady_clock::duration{ timeToLive - refreshAhead };
+                lookup->refreshAfter(delay);
+            }
+        }
+
+        for (auto const& waiter : waiters)
+        {
+            waiter(resultCode, resultAddresses);
+        }
+    }
+}
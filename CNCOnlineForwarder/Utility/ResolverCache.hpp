@@ -0,0 +1,99 @@
+#pragma once
+#include <precompiled.hpp>
+#include <IOManager.hpp>
+#include <Diagnostics/Metrics.hpp>
+
+namespace CNCOnlineForwarder::Utility
+{
+    // Process-wide cache of the addresses of upstream servers (NatNeg server, HTTP hosts),
+    // so their DNS resolution is not on the path of every new session.
+    // Concurrent lookups of the same host share a single resolution, failures are remembered
+    // for a short time, and the hosts given to keepResolved are resolved again before they expire.
+    // Safe to use from any thread.
+    class ResolverCache
+    {
+    public:
+        using Address = boost::asio::ip::address;
+        using Addresses = std::vector<Address>;
+        using ErrorCode = boost::system::error_code;
+        // Since an arbitrary epoch, the virtual one in the simulation
+        using TimePoint = std::chrono::nanoseconds;
+        // Not called on the strand of the caller, and might be called before asyncResolve returns.
+        // Addresses are empty if the code is failed.
+        using Handler = std::function<void(ErrorCode const&, Addresses const&)>;
+
+        // getaddrinfo does not tell the TTL of the records, so every host is kept for the same time
+        static constexpr auto timeToLive = std::chrono::minutes{ 5 };
+        static constexpr auto negativeTimeToLive = std::chrono::seconds{ 10 };
+        // Hosts still in use are resolved again when they expire in less than this
+        static constexpr auto refreshAhead = std::chrono::minutes{ 1 };
+
+    private:
+        class Lookup;
+
+        struct Entry
+        {
+            // Empty if the host could not be resolved yet
+            Addresses addresses;
+            // Of the last resolution
+            ErrorCode error;
+            // Of the addresses, or of the error if there are no addresses
+            TimePoint expiresAt{};
+            bool isResolving = false;
+            bool isKeptResolved = false;
+            std::vector<Handler> waiters;
+            std::weak_ptr<Lookup> lookup;
+        };
+
+        std::mutex m_mutex;
+        std::unordered_map<std::string, Entry> m_entries;
+        Diagnostics::Counter& m_hits;
+        Diagnostics::Counter& m_misses;
+        Diagnostics::Counter& m_coalesced;
+        Diagnostics::Counter& m_negativeHits;
+        Diagnostics::Counter& m_refreshes;
+        Diagnostics::Counter& m_failures;
+
+    public:
+        static constexpr auto description = "ResolverCache";
+
+        static ResolverCache& get();
+
+        // Never waits for the DNS.
+        // Returns: the addresses of the host, if they are known and not expired.
+        std::optional<Addresses> tryGet(std::string const& host);
+
+        void asyncResolve
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            std::string const& host,
+            Handler handler
+        );
+
+        // Resolves the host now, then again before each expiration, until the IOManager is stopped.
+        // Failed refreshes are retried after negativeTimeToLive, meanwhile the previous addresses are still used.
+        void keepResolved(IOManager::ObjectMaker const& objectMaker, std::string const& host);
+
+    private:
+        ResolverCache();
+
+        static TimePoint now() noexcept;
+
+        // Must be called with m_mutex held, the returned lookup must be started after releasing it
+        std::shared_ptr<Lookup> startResolving
+        (
+            IOManager::ObjectMaker const& objectMaker,
+            std::string const& host,
+            Entry& entry
+        );
+
+        void refresh(std::shared_ptr<Lookup> const& lookup);
+
+        void finishResolving
+        (
+            std::shared_ptr<Lookup> const& lookup,
+            ErrorCode const& code,
+            Addresses addresses
+        );
+    };
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <precompiled.hpp>
+#include <Diagnostics/Tracing.hpp>
 #include <Logging/Logging.hpp>
 
 namespace CNCOnlineForwarder::Utility
@@ -9,11 +10,13 @@ namespace CNCOnlineForwarder::Utility
     {
     private:
         std::unique_ptr<std::string> m_data;
+        Diagnostics::PendingSpan m_span;
 
     public:
         template<typename String>
         SimpleWriteHandler(String&& data) :
-            m_data{ std::make_unique<std::string>(std::forward<String>(data)) }
+            m_data{ std::make_unique<std::string>(std::forward<String>(data)) },
+            m_span{}
         {
         }
 
@@ -30,6 +33,7 @@ namespace CNCOnlineForwarder::Utility
         {
             using namespace Logging;
 
+            m_span.finish("send", Type::description);
             if (code.failed())
             {
                 logLine<Type>(Level::error, "Async write failed: ", code);
@@ -0,0 +1,136 @@
+#pragma once
+#include <precompiled.hpp>
+
+namespace CNCOnlineForwarder::Utility::Stun
+{
+    // The subset of RFC 5389 needed to learn the public address of a UDP socket:
+    // binding requests without attributes, and the (XOR-)MAPPED-ADDRESS of their responses.
+    using TransactionID = std::array<std::uint8_t, 12>;
+    using EndPoint = boost::asio::ip::udp::endpoint;
+
+    inline constexpr auto headerSize = std::size_t{ 20 };
+    inline constexpr auto magicCookie = std::uint32_t{ 0x2112A442 };
+    inline constexpr auto bindingRequest = std::uint16_t{ 0x0001 };
+    inline constexpr auto bindingResponse = std::uint16_t{ 0x0101 };
+    inline constexpr auto mappedAddress = std::uint16_t{ 0x0001 };
+    inline constexpr auto xorMappedAddress = std::uint16_t{ 0x0020 };
+    inline constexpr auto familyIPv4 = std::uint8_t{ 0x01 };
+
+    namespace Details
+    {
+        inline std::uint16_t read16(std::string_view const data, std::size_t const offset)
+        {
+            return static_cast<std::uint16_t>((std::uint8_t(data[offset]) << 8) | std::uint8_t(data[offset + 1]));
+        }
+
+        inline std::uint32_t read32(std::string_view const data, std::size_t const offset)
+        {
+            return (std::uint32_t{ read16(data, offset) } << 16) | read16(data, offset + 2);
+        }
+
+        inline void append16(std::string& data, std::uint16_t const value)
+        {
+            data.push_back(static_cast<char>(value >> 8));
+            data.push_back(static_cast<char>(value & 0xFF));
+        }
+
+        inline void append32(std::string& data, std::uint32_t const value)
+        {
+            append16(data, static_cast<std::uint16_t>(value >> 16));
+            append16(data, static_cast<std::uint16_t>(value & 0xFFFF));
+        }
+
+        inline std::string makeHeader(std::uint16_t const type, std::uint16_t const length, TransactionID const& id)
+        {
+            auto message = std::string{};
+            append16(message, type);
+            append16(message, length);
+            append32(message, magicCookie);
+            message.append(reinterpret_cast<char const*>(id.data()), id.size());
+            return message;
+        }
+
+        inline bool hasHeader(std::string_view const data, std::uint16_t const type)
+        {
+            return (data.size() >= headerSize)
+                && (read16(data, 0) == type)
+                && (read32(data, 4) == magicCookie)
+                && ((headerSize + read16(data, 2)) <= data.size());
+        }
+    }
+
+    inline std::string makeBindingRequest(TransactionID const& id)
+    {
+        return Details::makeHeader(bindingRequest, 0, id);
+    }
+
+    // Returns: the transaction ID, if data is a binding request
+    inline std::optional<TransactionID> parseBindingRequest(std::string_view const data)
+    {
+        if (!Details::hasHeader(data, bindingRequest))
+        {
+            return std::nullopt;
+        }
+        auto id = TransactionID{};
+        std::memcpy(id.data(), data.data() + 8, id.size());
+        return id;
+    }
+
+    // Only IPv4 mapped addresses are supported
+    inline std::string makeBindingResponse(TransactionID const& id, EndPoint const& mapped)
+    {
+        auto message = Details::makeHeader(bindingResponse, 12, id);
+        Details::append16(message, xorMappedAddress);
+        Details::append16(message, 8);
+        message.push_back(0);
+        message.push_back(static_cast<char>(familyIPv4));
+        Details::append16(message, static_cast<std::uint16_t>(mapped.port() ^ (magicCookie >> 16)));
+        Details::append32(message, mapped.address().to_v4().to_uint() ^ magicCookie);
+        return message;
+    }
+
+    // Returns: the IPv4 mapped address, if data is the response of the transaction `id`
+    inline std::optional<EndPoint> parseBindingResponse(std::string_view const data, TransactionID const& id)
+    {
+        using Details::read16;
+        using Details::read32;
+
+        if (!Details::hasHeader(data, bindingResponse) || (std::memcmp(data.data() + 8, id.data(), id.size()) != 0))
+        {
+            return std::nullopt;
+        }
+
+        auto result = std::optional<EndPoint>{};
+        auto const end = headerSize + read16(data, 2);
+        auto offset = headerSize;
+        while ((offset + 4) <= end)
+        {
+            auto const type = read16(data, offset);
+            auto const length = std::size_t{ read16(data, offset + 2) };
+            auto const value = offset + 4;
+            if ((value + length) > end)
+            {
+                return std::nullopt;
+            }
+
+            if (((type == xorMappedAddress) || (type == mappedAddress)) && (length >= 8) && (std::uint8_t(data[value + 1]) == familyIPv4))
+            {
+                auto port = read16(data, value + 2);
+                auto address = read32(data, value + 4);
+                if (type == xorMappedAddress)
+                {
+                    port = static_cast<std::uint16_t>(port ^ (magicCookie >> 16));
+                    address ^= magicCookie;
+                }
+                result = EndPoint{ boost::asio::ip::address_v4{ address }, port };
+                // Preferred by RFC 5389, because some NATs rewrite addresses found in payloads
+                if (type == xorMappedAddress)
+                {
+                    return result;
+                }
+            }
+            offset = value + ((length + 3) & ~std::size_t{ 3 });
+        }
+        return result;
+    }
+}
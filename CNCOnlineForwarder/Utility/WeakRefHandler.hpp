@@ -1,5 +1,8 @@
 #pragma once
 #include <precompiled.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
+#include <Diagnostics/EventLoopMonitor.hpp>
+#include <Diagnostics/Tracing.hpp>
 #include <Logging/Logging.hpp>
 
 namespace CNCOnlineForwarder::Utility
@@ -30,7 +33,33 @@ namespace CNCOnlineForwarder::Utility
                 return;
             }
 
-            std::invoke(m_handler, *self, std::forward<Arguments>(arguments)...);
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::getAllocationTag<Type>() };
+            auto& statistics = Diagnostics::getHandlerStatistics<Type>();
+            auto scope = Diagnostics::EventLoopMonitor::HandlerScope{ statistics };
+            if constexpr (requires { self->getTraceTarget(); })
+            {
+                auto const trace = Diagnostics::TraceContext::Scope{ self->getTraceTarget(), "handler", Type::description };
+                std::invoke(m_handler, *self, std::forward<Arguments>(arguments)...);
+            }
+            else
+            {
+                std::invoke(m_handler, *self, std::forward<Arguments>(arguments)...);
+            }
+            if (auto const elapsed = scope.finish(); elapsed.has_value())
+            {
+                auto session = std::ostringstream{};
+                if constexpr (requires { self->describeSession(session); })
+                {
+                    self->describeSession(session);
+                }
+                Diagnostics::EventLoopMonitor::reportSlowHandler(statistics, elapsed.value(), session.str());
+            }
+        }
+
+        // Allow keeping the referenced object alive outside of the handler
+        std::shared_ptr<Type> lock() const noexcept
+        {
+            return m_ref.lock();
         }
 
         // Allow accessing handler members
@@ -55,6 +84,15 @@ namespace CNCOnlineForwarder::Utility
         };
     }
 
+    template<typename T>
+    struct IsWeakRefHandler : std::false_type {};
+
+    template<typename Type, typename Handler>
+    struct IsWeakRefHandler<WeakRefHandler<Type, Handler>> : std::true_type
+    {
+        using TargetType = Type;
+    };
+
     template<typename T, typename Handler>
     auto makeWeakHandler
     (
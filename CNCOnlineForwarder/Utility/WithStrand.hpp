@@ -1,16 +1,50 @@
 #pragma once
 #include <precompiled.hpp>
 #include <IOManager.hpp>
+#include <Diagnostics/AllocationTracker.hpp>
+#include <Utility/DatagramMetadata.hpp>
+#include <Utility/NetworkImpairment.hpp>
+#ifdef CNCONLINEFORWARDER_SIMULATION
+#include <Simulation/VirtualIO.hpp>
+#endif
 
 namespace CNCOnlineForwarder::Utility {
     namespace Details
     {
+        // The object actually held by WithStrand<T>
+        template<typename T>
+        struct Implementation
+        {
+            using Type = T;
+        };
+
+#ifdef CNCONLINEFORWARDER_SIMULATION
+        // Sockets, timers and resolvers are replaced by fakes on the virtual network and clock
+        template<>
+        struct Implementation<boost::asio::ip::udp::socket>
+        {
+            using Type = Simulation::VirtualSocket;
+        };
+
+        template<>
+        struct Implementation<boost::asio::steady_timer>
+        {
+            using Type = Simulation::VirtualTimer;
+        };
+
+        template<typename Protocol>
+        struct Implementation<boost::asio::ip::basic_resolver<Protocol>>
+        {
+            using Type = Simulation::VirtualResolver<Protocol>;
+        };
+#endif
+
         template<typename T>
         class WithStrandBase
         {
         protected:
             IOManager::StrandType& m_strand;
-            T m_object;
+            typename Implementation<T>::Type m_object;
         public:
             template<typename... Args>
             WithStrandBase(IOManager::StrandType& strand, Args&&... args) :
@@ -18,9 +52,142 @@ namespace CNCOnlineForwarder::Utility {
                 m_object{ m_strand.get_inner_executor(), std::forward<Args>(args)... }
             {}
 
-            T* operator->() noexcept { return &m_object; }
+            auto* operator->() noexcept { return &m_object; }
 
-            T const* operator->() const noexcept { return &m_object; }
+            auto const* operator->() const noexcept { return &m_object; }
+        };
+
+        // Waits until the socket is readable, then receives the datagram
+        // together with its metadata.
+        // Handler must be a WeakRefHandler referencing the owner of the socket.
+        template<typename Handler>
+        class ReceiveWithMetadata
+        {
+        private:
+            using Socket = boost::asio::ip::udp::socket;
+
+            IOManager::StrandType m_strand;
+            Socket* m_socket;
+            boost::asio::mutable_buffer m_buffer;
+            Socket::endpoint_type* m_from;
+            DatagramMetadata* m_metadata;
+            Handler m_handler;
+
+        public:
+            template<typename InputHandler>
+            ReceiveWithMetadata
+            (
+                IOManager::StrandType const& strand,
+                Socket& socket,
+                boost::asio::mutable_buffer const& buffer,
+                Socket::endpoint_type& from,
+                DatagramMetadata& metadata,
+                InputHandler&& handler
+            ) :
+                m_strand{ strand },
+                m_socket{ &socket },
+                m_buffer{ buffer },
+                m_from{ &from },
+                m_metadata{ &metadata },
+                m_handler{ std::forward<InputHandler>(handler) }
+            {}
+
+            void start()
+            {
+                auto& socket = *m_socket;
+                auto const strand = m_strand;
+                auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::handlerState };
+                socket.async_wait(Socket::wait_read, boost::asio::bind_executor(strand, std::move(*this)));
+            }
+
+            void operator()(boost::system::error_code code)
+            {
+                auto bytesReceived = std::size_t{ 0 };
+                if (!code.failed())
+                {
+                    // The socket belongs to the owner, keep it alive while using the socket
+                    auto const owner = m_handler.lock();
+                    if (!owner)
+                    {
+                        code = boost::asio::error::operation_aborted;
+                    }
+                    else
+                    {
+                        bytesReceived = receiveWithMetadata(*m_socket, m_buffer, *m_from, *m_metadata, code);
+                        if (code == boost::asio::error::would_block)
+                        {
+                            // Spurious wake up, wait again
+                            return start();
+                        }
+                    }
+                }
+                m_handler(code, bytesReceived);
+            }
+        };
+
+        // Datagrams delayed by NetworkImpairment, which might be sent after the socket is gone
+        class ImpairedSends : public std::enable_shared_from_this<ImpairedSends>
+        {
+        private:
+            using Socket = Implementation<boost::asio::ip::udp::socket>::Type;
+            using Timer = Implementation<boost::asio::steady_timer>::Type;
+            using Data = std::shared_ptr<std::string const>;
+
+            IOManager::StrandType m_strand;
+            std::mutex m_mutex;
+            Socket* m_socket;
+
+        public:
+            ImpairedSends(IOManager::StrandType const& strand, Socket& socket) :
+                m_strand{ strand },
+                m_mutex{},
+                m_socket{ &socket }
+            {}
+
+            static NetworkImpairment::TimePoint now() noexcept
+            {
+#ifdef CNCONLINEFORWARDER_SIMULATION
+                return Simulation::VirtualNetwork::get().now();
+#else
+                return std::chrono::steady_clock::now().time_since_epoch();
+#endif
+            }
+
+            // Called when the socket is destroyed, the datagrams still delayed are discarded
+            void detach() noexcept
+            {
+                auto const lock = std::scoped_lock{ m_mutex };
+                m_socket = nullptr;
+            }
+
+            void send(Data const& data, boost::asio::ip::udp::endpoint const& to, NetworkImpairment::Duration const delay)
+            {
+                if (delay.count() == 0)
+                {
+                    return sendNow(data, to);
+                }
+
+                auto const timer = std::make_shared<Timer>(m_strand.get_inner_executor());
+                timer->expires_from_now(delay);
+                auto const onExpired = [self = shared_from_this(), timer, data, to](boost::system::error_code const& code)
+                {
+                    if (!code.failed())
+                    {
+                        self->sendNow(data, to);
+                    }
+                };
+                timer->async_wait(boost::asio::bind_executor(m_strand, onExpired));
+            }
+
+        private:
+            void sendNow(Data const& data, boost::asio::ip::udp::endpoint const& to)
+            {
+                auto const lock = std::scoped_lock{ m_mutex };
+                if (m_socket != nullptr)
+                {
+                    m_socket->async_send_to(boost::asio::buffer(*data), to, [data](boost::system::error_code const&, std::size_t) {});
+                }
+            }
         };
     }
 
@@ -39,9 +206,30 @@ namespace CNCOnlineForwarder::Utility {
     class WithStrand<boost::asio::ip::udp::socket> :
         public Details::WithStrandBase<boost::asio::ip::udp::socket>
     {
+    private:
+        // Only created if NetworkImpairment is enabled
+        std::shared_ptr<Details::ImpairedSends> m_impairedSends;
+
     public:
         using Details::WithStrandBase<boost::asio::ip::udp::socket>::WithStrandBase;
 
+        ~WithStrand()
+        {
+            if (m_impairedSends)
+            {
+                m_impairedSends->detach();
+            }
+        }
+
+        bool enableDatagramMetadata()
+        {
+#ifdef CNCONLINEFORWARDER_SIMULATION
+            return false;
+#else
+            return Utility::enableDatagramMetadata(m_object);
+#endif
+        }
+
         template<typename MutableBufferSequence, typename EndPoint, typename ReadHandler>
         auto asyncReceiveFrom
         (
@@ -50,6 +238,7 @@ namespace CNCOnlineForwarder::Utility {
             ReadHandler&& handler
         )
         {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::handlerState };
             return m_object.async_receive_from
             (
                 buffers,
@@ -58,6 +247,35 @@ namespace CNCOnlineForwarder::Utility {
             );
         }
 
+        // Like asyncReceiveFrom, but also retrieves kernel timestamps and drop counts.
+        // ReadHandler must be a WeakRefHandler referencing the owner of this socket.
+        template<typename ReadHandler>
+        void asyncReceiveFrom
+        (
+            boost::asio::mutable_buffer const& buffer,
+            boost::asio::ip::udp::endpoint& from,
+            DatagramMetadata& metadata,
+            ReadHandler&& handler
+        )
+        {
+#if defined(__linux__) && !defined(CNCONLINEFORWARDER_SIMULATION)
+            using Operation = Details::ReceiveWithMetadata<std::decay_t<ReadHandler>>;
+            Operation{ m_strand, m_object, buffer, from, metadata, std::forward<ReadHandler>(handler) }.start();
+#else
+            // Kernel metadata is not available, only record userspace timestamps
+            auto stamp = [&metadata, handler = std::forward<ReadHandler>(handler)]
+            (
+                boost::system::error_code const& code, 
+                std::size_t const bytesReceived
+            ) mutable
+            {
+                metadata.stampUserspace();
+                handler(code, bytesReceived);
+            };
+            asyncReceiveFrom(buffer, from, std::move(stamp));
+#endif
+        }
+
         template<typename ConstBufferSequence, typename EndPoint, typename WriteHandler>
         auto asyncSendTo
         (
@@ -66,6 +284,12 @@ namespace CNCOnlineForwarder::Utility {
             WriteHandler&& handler
         )
         {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::handlerState };
+            if (NetworkImpairment::get().isEnabled())
+            {
+                return impairedSendTo(buffers, to, std::forward<WriteHandler>(handler));
+            }
+
             return m_object.async_send_to
             (
                 buffers,
@@ -73,6 +297,40 @@ namespace CNCOnlineForwarder::Utility {
                 boost::asio::bind_executor(m_strand, std::forward<WriteHandler>(handler))
             );
         }
+
+    private:
+        template<typename ConstBufferSequence, typename WriteHandler>
+        void impairedSendTo
+        (
+            ConstBufferSequence const& buffers,
+            boost::asio::ip::udp::endpoint const& to,
+            WriteHandler&& handler
+        )
+        {
+            auto const size = boost::asio::buffer_size(buffers);
+            auto const now = Details::ImpairedSends::now();
+            auto const decision = NetworkImpairment::get().decide(m_object.local_endpoint().port(), to, now);
+            if (decision.copies > 0)
+            {
+                if (!m_impairedSends)
+                {
+                    m_impairedSends = std::make_shared<Details::ImpairedSends>(m_strand, m_object);
+                }
+
+                auto data = std::make_shared<std::string>(size, '\0');
+                boost::asio::buffer_copy(boost::asio::buffer(*data), buffers);
+                for (auto i = std::size_t{ 0 }; i < decision.copies; ++i)
+                {
+                    m_impairedSends->send(data, to, decision.delays[i]);
+                }
+            }
+
+            // Like a real link, losses are not visible to the sender
+            boost::asio::post(m_strand, [handler = std::forward<WriteHandler>(handler), size]() mutable
+            {
+                handler(boost::system::error_code{}, size);
+            });
+        }
     };
 
     template<>
@@ -83,9 +341,10 @@ namespace CNCOnlineForwarder::Utility {
         using Details::WithStrandBase<boost::asio::steady_timer>::WithStrandBase;
 
         template<typename WaitHandler>
-        auto asyncWait(std::chrono::minutes const timeout, WaitHandler&& waitHandler)
+        auto asyncWait(std::chrono::steady_clock::duration const timeout, WaitHandler&& waitHandler)
         {
             m_object.expires_from_now(timeout);
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::handlerState };
             m_object.async_wait(std::forward<WaitHandler>(waitHandler));
         }
     };
@@ -105,6 +364,7 @@ namespace CNCOnlineForwarder::Utility {
             ResolveHandler&& resolveHandler
         )
         {
+            auto const allocationScope = Diagnostics::AllocationScope{ Diagnostics::AllocationTag::handlerState };
             this->m_object.async_resolve
             (
                 host,